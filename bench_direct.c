@@ -0,0 +1,69 @@
+/* A benchmark of reading Skippy forms through an AST against reading
+them directly into lvals, as --direct does. Only reading is timed, not
+evaluation. Build it beside variables.c with
+
+  cc -std=c99 -O2 bench_direct.c mpc.c -ledit -lm -lpthread */
+#define SKIPPY_NO_MAIN
+#include "variables.c"
+#include <time.h>
+
+#define BENCH_FORMS 20000
+#define BENCH_RUNS 5
+
+/* One form of nested q-expressions, numbers and symbols */
+static const char* bench_form =
+  "(def {tree} {1 {2.5 -3 {sym {x y z} 42}} {head tail} (+ 1 2) {{{deep}}}})\n";
+
+/* A function that reads every form in the input and frees it */
+double bench_read(mpc_parser_t* expr, const char* input, int direct) {
+  clock_t start = clock();
+  mpc_input_t* in = mpc_input_new_string("bench", input);
+  if (!direct) { mpc_input_flags(in, MPC_INPUT_AST_ARENA); }
+
+  mpc_result_t r;
+  int forms = 0;
+  while (mpc_parse_next(in, expr, &r)) {
+    lval_del(lval_read_output(r.output, direct));
+    forms++;
+  }
+  if (r.error) {
+    mpc_err_print(r.error);
+    mpc_err_delete(r.error);
+  }
+  mpc_input_delete(in);
+
+  if (forms != BENCH_FORMS) { printf("Error: read %i forms\n", forms); }
+  return (double)(clock() - start) / CLOCKS_PER_SEC;
+}
+
+int main(void) {
+  size_t n = strlen(bench_form);
+  char* input = malloc(n * BENCH_FORMS + 1);
+  for (int i = 0; i < BENCH_FORMS; i++) { memcpy(input + n * i, bench_form, n); }
+  input[n * BENCH_FORMS] = '\0';
+
+  /* The best of several runs in each mode */
+  double best[2] = { 0, 0 };
+  for (int direct = 0; direct < 2; direct++) {
+    mpc_parser_t* Number = mpc_new("number");
+    mpc_parser_t* Symbol = mpc_new("symbol");
+    mpc_parser_t* Sexpr = mpc_new("sexpr");
+    mpc_parser_t* Qexpr = mpc_new("qexpr");
+    mpc_parser_t* Expr = mpc_new("expr");
+    mpc_parser_t* Skippy = mpc_new("skippy");
+    lread_define(direct, Number, Symbol, Sexpr, Qexpr, Expr, Skippy);
+
+    for (int j = 0; j < BENCH_RUNS; j++) {
+      double t = bench_read(Expr, input, direct);
+      if (j == 0 || t < best[direct]) { best[direct] = t; }
+    }
+
+    mpc_cleanup(6, Number, Symbol, Sexpr, Qexpr, Expr, Skippy);
+  }
+
+  printf("%i forms, %.2f MB: ast %.3f s, direct %.3f s (%.2fx)\n",
+    BENCH_FORMS, n * BENCH_FORMS / 1e6, best[0], best[1], best[0] / best[1]);
+
+  free(input);
+  return 0;
+}
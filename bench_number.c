@@ -0,0 +1,54 @@
+/* A benchmark of reading 10 million number literals, as a numeric data
+file would have them, with lval_read_num_str against plain strtod.
+Build it beside variables.c with
+
+  cc -std=c99 -O2 bench_number.c mpc.c -ledit -lm -lpthread */
+#define SKIPPY_NO_MAIN
+#include "variables.c"
+#include <time.h>
+
+#define BENCH_LITERALS 10000000
+#define BENCH_DISTINCT 1000
+
+/* A function to read a literal as strtod does */
+lval* bench_strtod(char* s) {
+  errno = 0;
+  double x = strtod(s, NULL);
+  return errno != ERANGE ?
+    lval_num(x) : lval_err("invalid number");
+}
+
+/* A function that reads every literal with the given reader and
+returns the time taken. The sum keeps the reads from being dropped */
+double bench_read(lval* (*read)(char*), char** literals, double* sum) {
+  clock_t start = clock();
+  for (long i = 0; i < BENCH_LITERALS; i++) {
+    lval* v = read(literals[i % BENCH_DISTINCT]);
+    *sum += v->num;
+    lval_del(v);
+  }
+  return (double)(clock() - start) / CLOCKS_PER_SEC;
+}
+
+int main(void) {
+  /* Integers and numbers with two places, some negative */
+  char* literals[BENCH_DISTINCT];
+  srand(7);
+  for (int i = 0; i < BENCH_DISTINCT; i++) {
+    char b[64];
+    int n = sprintf(b, "%s%i", rand() % 4 ? "" : "-", rand() % 100000);
+    if (rand() % 2) { sprintf(b + n, ".%02i", rand() % 100); }
+    literals[i] = malloc(strlen(b) + 1);
+    strcpy(literals[i], b);
+  }
+
+  double sum = 0;
+  double slow = bench_read(bench_strtod, literals, &sum);
+  double fast = bench_read(lval_read_num_str, literals, &sum);
+
+  printf("%i literals: strtod %.3f s, lval_read_num_str %.3f s (%.2fx) [%g]\n",
+    BENCH_LITERALS, slow, fast, slow / fast, sum);
+
+  for (int i = 0; i < BENCH_DISTINCT; i++) { free(literals[i]); }
+  return 0;
+}
@@ -1,5 +1,11 @@
 #include "mpc.h"
 
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
 /*
 ** State Type
 */
@@ -20,6 +26,178 @@ static mpc_state_t mpc_state_new(void) {
   return s;
 }
 
+/*
+** Character Sets
+*/
+
+/*
+** Sets of characters are stored as 256-bit
+** tables so that testing membership is a
+** single load and mask. Because `strchr` also
+** finds the terminating null, sets built from
+** strings always contain '\0' as before.
+*/
+
+enum {
+  MPC_SET_SIZE = 32
+};
+
+#define MPC_SET_HAS(s, c) ((s)[(unsigned char)(c) >> 3] & (1 << ((unsigned char)(c) & 7)))
+#define MPC_SET_ADD(s, c) ((s)[(unsigned char)(c) >> 3] |= (unsigned char)(1 << ((unsigned char)(c) & 7)))
+
+static void mpc_set_from_string(unsigned char *s, const char *x) {
+  memset(s, 0, MPC_SET_SIZE);
+  MPC_SET_ADD(s, '\0');
+  while (*x) { MPC_SET_ADD(s, *x); x++; }
+}
+
+static void mpc_set_invert(unsigned char *s) {
+  int j;
+  for (j = 0; j < MPC_SET_SIZE; j++) { s[j] = (unsigned char)~s[j]; }
+}
+
+/*
+** Runs of characters from a set are found many
+** bytes at a time when compiling for SSE2 or
+** AVX2. With SSE2 each block of 16 bytes is
+** compared against every range of consecutive
+** characters in the set, so this is only done
+** for sets of a few ranges. With AVX2 a set of
+** ASCII characters is instead looked up by the
+** low and high half of each byte, 32 bytes at a
+** time. The bytes left over at the end of the
+** input are tested one at a time.
+*/
+
+enum {
+  MPC_CLASS_RANGES = 16
+};
+
+typedef struct {
+  int ranges;
+  int ascii;
+  unsigned char set[MPC_SET_SIZE];
+  unsigned char lo[MPC_CLASS_RANGES];
+  unsigned char width[MPC_CLASS_RANGES];
+  unsigned char nibbles[16];
+} mpc_class_t;
+
+static mpc_class_t *mpc_class_new(const unsigned char *s) {
+  
+  int j, n = 0;
+  mpc_class_t *c = calloc(1, sizeof(mpc_class_t));
+  
+  memcpy(c->set, s, MPC_SET_SIZE);
+  c->ascii = 1;
+  
+  for (j = 0; j < 256; j++) {
+    if (!MPC_SET_HAS(s, j)) { continue; }
+    if (j < 128) {
+      c->nibbles[j & 15] |= (unsigned char)(1 << (j >> 4));
+    } else {
+      c->ascii = 0;
+    }
+    if (n > 0 && n <= MPC_CLASS_RANGES && c->lo[n-1] + c->width[n-1] + 1 == j) {
+      c->width[n-1]++;
+      continue;
+    }
+    if (n < MPC_CLASS_RANGES) { c->lo[n] = (unsigned char)j; }
+    n++;
+  }
+  
+  c->ranges = n <= MPC_CLASS_RANGES ? n : -1;
+  return c;
+}
+
+#if defined(__SSE2__)
+
+static long mpc_class_span_sse2(const mpc_class_t *c, const char *x, long n) {
+  
+  int j;
+  long k;
+  unsigned int m;
+  __m128i v, d, in, lo[MPC_CLASS_RANGES], width[MPC_CLASS_RANGES];
+  
+  for (j = 0; j < c->ranges; j++) {
+    lo[j] = _mm_set1_epi8((char)c->lo[j]);
+    width[j] = _mm_set1_epi8((char)c->width[j]);
+  }
+  
+  /* A byte is in a range if it is at most `width` above its `lo` */
+  for (k = 0; k + 16 <= n; k += 16) {
+    v = _mm_loadu_si128((const __m128i*)(x + k));
+    in = _mm_setzero_si128();
+    for (j = 0; j < c->ranges; j++) {
+      d = _mm_sub_epi8(v, lo[j]);
+      in = _mm_or_si128(in, _mm_cmpeq_epi8(_mm_min_epu8(d, width[j]), d));
+    }
+    m = (unsigned int)_mm_movemask_epi8(in) ^ 0xFFFF;
+    if (m) {
+      while (!(m & 1)) { m >>= 1; k++; }
+      return k;
+    }
+  }
+  
+  return k;
+}
+
+#endif
+
+#if defined(__AVX2__)
+
+static long mpc_class_span_avx2(const mpc_class_t *c, const char *x, long n) {
+  
+  long k;
+  unsigned int m;
+  __m256i v, h;
+  const __m256i low = _mm256_set1_epi8(0x0F);
+  const __m256i nibbles = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)c->nibbles));
+  const __m256i bits = _mm256_setr_epi8(
+    1, 2, 4, 8, 16, 32, 64, (char)128, 0, 0, 0, 0, 0, 0, 0, 0,
+    1, 2, 4, 8, 16, 32, 64, (char)128, 0, 0, 0, 0, 0, 0, 0, 0);
+  
+  /*
+  ** Bit `h` of `nibbles[l]` is set if the character
+  ** `0xhl` is in the set. Bytes of 0x80 and above
+  ** find no bit and so are never in it.
+  */
+  
+  for (k = 0; k + 32 <= n; k += 32) {
+    v = _mm256_loadu_si256((const __m256i*)(x + k));
+    h = _mm256_and_si256(_mm256_srli_epi16(v, 4), low);
+    v = _mm256_and_si256(
+      _mm256_shuffle_epi8(nibbles, _mm256_and_si256(v, low)),
+      _mm256_shuffle_epi8(bits, h));
+    m = (unsigned int)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, _mm256_setzero_si256()));
+    if (m) {
+      while (!(m & 1)) { m >>= 1; k++; }
+      return k;
+    }
+  }
+  
+  return k;
+}
+
+#endif
+
+static long mpc_class_span(const mpc_class_t *c, const char *x, long n, int vector) {
+  
+  long k = -1;
+  
+  if (n == 0 || !MPC_SET_HAS(c->set, x[0])) { return 0; }
+  
+#if defined(__AVX2__)
+  if (vector && k < 0 && c->ascii) { k = mpc_class_span_avx2(c, x, n); }
+#endif
+#if defined(__SSE2__)
+  if (vector && k < 0 && c->ranges >= 0) { k = mpc_class_span_sse2(c, x, n); }
+#endif
+  
+  if (k < 0) { k = 0; }
+  while (k < n && MPC_SET_HAS(c->set, x[k])) { k++; }
+  return k;
+}
+
 /*
 ** Input Type
 */
@@ -66,20 +244,83 @@ enum {
 };
 
 enum {
-  MPC_INPUT_MEM_NUM = 512
+  MPC_INPUT_LINES_MIN = 32
 };
 
-typedef struct {
-  char mem[64];
+/*
+** Memory for intermediate values is taken from a
+** per input arena. Each block has a header giving
+** its size, which is rounded up to a multiple of
+** the header size. Freed blocks go onto a free
+** list per size so short lived values, such as
+** result arrays, reuse the same memory, and the
+** most recent block can be grown in place. The
+** whole arena is released in one go once a parse
+** has finished and its outputs have been exported.
+**
+** Blocks which don't fit, or which are too large
+** for the free lists, fall back to `malloc`.
+*/
+
+enum {
+  MPC_INPUT_ARENA_SIZE = 32768,
+  MPC_INPUT_ARENA_CLASSES = 64
+};
+
+typedef union {
+  size_t size;
+  void *ptr;
+  long l;
+  double d;
 } mpc_mem_t;
 
+struct mpc_ast_arena_t;
+
+/*
+** A profile attached to an input records, for
+** each named parser, how often it was run and
+** succeeded or failed, the bytes it consumed,
+** the rewinds made while it was the innermost
+** named parser running and the time spent in
+** it, including time spent in its children.
+**
+** Entries are found through an open addressing
+** table keyed on the parser. `stack` holds the
+** entries of the named parsers now running.
+*/
+
 typedef struct {
+  const mpc_parser_t *p;
+  char *name;
+  long calls;
+  long successes;
+  long failures;
+  long bytes;
+  long rewinds;
+  int active;
+  clock_t start;
+  clock_t time;
+} mpc_profile_entry_t;
+
+struct mpc_profile_t {
+  int num;
+  int slots;
+  int *table;
+  mpc_profile_entry_t *entries;
+  int stack_num;
+  int stack_slots;
+  int *stack;
+};
+
+struct mpc_input_t {
 
   int type;
+  int flags;
   char *filename;  
-  mpc_state_t state;
+  long pos;
   
   char *string;
+  long length;
   char *buffer;
   FILE *file;
   
@@ -87,18 +328,104 @@ typedef struct {
   int backtrack;
   int marks_slots;
   int marks_num;
-  mpc_state_t *marks;
+  long *marks;
+  
+  int lines_slots;
+  int lines_num;
+  long *lines;
+  long lines_end;
+  mpc_state_t origin;
+  long reach;
+  
+  long limit_depth;
+  long limit_length;
+  long limit_steps;
+  long depth;
+  long steps;
+  const char *limited;
+  
+  int deferred;
+  long furthest_pos;
+  int furthest_slots;
+  int furthest_num;
+  const char **furthest_expected;
+  const char *furthest_failure;
+  char furthest_recieved;
+  
+  int spans;
   
   char *lasts;
   char last;
   
-  size_t mem_index;
-  char mem_full[MPC_INPUT_MEM_NUM];
-  mpc_mem_t mem[MPC_INPUT_MEM_NUM];
+  long allocs;
+  char *arena;
+  char *arena_last;
+  size_t arena_size;
+  size_t arena_used;
+  void *arena_free[MPC_INPUT_ARENA_CLASSES];
+  
+  struct mpc_ast_arena_t *ast_arena;
+  
+  mpc_profile_t *profile;
+  
+};
+
+/*
+** The fields every kind of input starts with the
+** same: marks, the line index, limits, deferred
+** errors, spans, the arena, flags and profiling.
+*/
+
+static void mpc_input_init(mpc_input_t *i) {
+  
+  i->suppress = 0;
+  i->backtrack = 1;
+  i->marks_num = 0;
+  i->marks_slots = MPC_INPUT_MARKS_MIN;
+  i->marks = malloc(sizeof(long) * i->marks_slots);
+  i->lasts = malloc(sizeof(char) * i->marks_slots);
+  i->last = '\0';
+  
+  i->lines_num = 1;
+  i->lines_slots = MPC_INPUT_LINES_MIN;
+  i->lines = malloc(sizeof(long) * i->lines_slots);
+  i->lines[0] = 0;
+  i->lines_end = 0;
+  i->origin = mpc_state_new();
+  i->reach = 0;
+  
+  i->limit_depth = 0;
+  i->limit_length = 0;
+  i->limit_steps = 0;
+  i->depth = 0;
+  i->steps = 0;
+  i->limited = NULL;
   
-} mpc_input_t;
+  i->deferred = 0;
+  i->furthest_pos = -1;
+  i->furthest_slots = 0;
+  i->furthest_num = 0;
+  i->furthest_expected = NULL;
+  i->furthest_failure = NULL;
+  i->furthest_recieved = '\0';
+  
+  i->spans = 0;
+  
+  i->allocs = 0;
+  i->arena = NULL;
+  i->arena_last = NULL;
+  i->arena_size = MPC_INPUT_ARENA_SIZE;
+  i->arena_used = 0;
+  memset(i->arena_free, 0, sizeof(i->arena_free));
+  
+  i->flags = MPC_INPUT_DEFAULT;
+  i->ast_arena = NULL;
+  
+  i->profile = NULL;
+  
+}
 
-static mpc_input_t *mpc_input_new_string(const char *filename, const char *string) {
+mpc_input_t *mpc_input_new_string(const char *filename, const char *string) {
 
   mpc_input_t *i = malloc(sizeof(mpc_input_t));
   
@@ -106,28 +433,20 @@ static mpc_input_t *mpc_input_new_string(const char *filename, const char *strin
   strcpy(i->filename, filename);
   i->type = MPC_INPUT_STRING;
   
-  i->state = mpc_state_new();
+  i->pos = 0;
   
   i->string = malloc(strlen(string) + 1);
   strcpy(i->string, string);
+  i->length = strlen(i->string);
   i->buffer = NULL;
   i->file = NULL;
   
-  i->suppress = 0;
-  i->backtrack = 1;
-  i->marks_num = 0;
-  i->marks_slots = MPC_INPUT_MARKS_MIN;
-  i->marks = malloc(sizeof(mpc_state_t) * i->marks_slots);
-  i->lasts = malloc(sizeof(char) * i->marks_slots);
-  i->last = '\0';
-  
-  i->mem_index = 0;
-  memset(i->mem_full, 0, sizeof(char) * MPC_INPUT_MEM_NUM);
+  mpc_input_init(i);
   
   return i;
 }
 
-static mpc_input_t *mpc_input_new_nstring(const char *filename, const char *string, size_t length) {
+mpc_input_t *mpc_input_new_nstring(const char *filename, const char *string, size_t length) {
 
   mpc_input_t *i = malloc(sizeof(mpc_input_t));
   
@@ -135,30 +454,22 @@ static mpc_input_t *mpc_input_new_nstring(const char *filename, const char *stri
   strcpy(i->filename, filename);
   i->type = MPC_INPUT_STRING;
   
-  i->state = mpc_state_new();
+  i->pos = 0;
   
   i->string = malloc(length + 1);
   strncpy(i->string, string, length);
   i->string[length] = '\0';
+  i->length = strlen(i->string);
   i->buffer = NULL;
   i->file = NULL;
   
-  i->suppress = 0;
-  i->backtrack = 1;
-  i->marks_num = 0;
-  i->marks_slots = MPC_INPUT_MARKS_MIN;
-  i->marks = malloc(sizeof(mpc_state_t) * i->marks_slots);
-  i->lasts = malloc(sizeof(char) * i->marks_slots);
-  i->last = '\0';
-  
-  i->mem_index = 0;
-  memset(i->mem_full, 0, sizeof(char) * MPC_INPUT_MEM_NUM);
+  mpc_input_init(i);
   
   return i;
 
 }
 
-static mpc_input_t *mpc_input_new_pipe(const char *filename, FILE *pipe) {
+mpc_input_t *mpc_input_new_pipe(const char *filename, FILE *pipe) {
 
   mpc_input_t *i = malloc(sizeof(mpc_input_t));
   
@@ -166,55 +477,39 @@ static mpc_input_t *mpc_input_new_pipe(const char *filename, FILE *pipe) {
   strcpy(i->filename, filename);
   
   i->type = MPC_INPUT_PIPE;
-  i->state = mpc_state_new();
+  i->pos = 0;
   
   i->string = NULL;
+  i->length = 0;
   i->buffer = NULL;
   i->file = pipe;
   
-  i->suppress = 0;
-  i->backtrack = 1;
-  i->marks_num = 0;
-  i->marks_slots = MPC_INPUT_MARKS_MIN;
-  i->marks = malloc(sizeof(mpc_state_t) * i->marks_slots);
-  i->lasts = malloc(sizeof(char) * i->marks_slots);
-  i->last = '\0';
-  
-  i->mem_index = 0;
-  memset(i->mem_full, 0, sizeof(char) * MPC_INPUT_MEM_NUM);
+  mpc_input_init(i);
   
   return i;
   
 }
 
-static mpc_input_t *mpc_input_new_file(const char *filename, FILE *file) {
+mpc_input_t *mpc_input_new_file(const char *filename, FILE *file) {
   
   mpc_input_t *i = malloc(sizeof(mpc_input_t));
   
   i->filename = malloc(strlen(filename) + 1);
   strcpy(i->filename, filename);
   i->type = MPC_INPUT_FILE;
-  i->state = mpc_state_new();
+  i->pos = 0;
   
   i->string = NULL;
+  i->length = 0;
   i->buffer = NULL;
   i->file = file;
   
-  i->suppress = 0;
-  i->backtrack = 1;
-  i->marks_num = 0;
-  i->marks_slots = MPC_INPUT_MARKS_MIN;
-  i->marks = malloc(sizeof(mpc_state_t) * i->marks_slots);
-  i->lasts = malloc(sizeof(char) * i->marks_slots);
-  i->last = '\0';
-  
-  i->mem_index = 0;
-  memset(i->mem_full, 0, sizeof(char) * MPC_INPUT_MEM_NUM);
+  mpc_input_init(i);
   
   return i;
 }
 
-static void mpc_input_delete(mpc_input_t *i) {
+void mpc_input_delete(mpc_input_t *i) {
   
   free(i->filename);
   
@@ -223,33 +518,50 @@ static void mpc_input_delete(mpc_input_t *i) {
   
   free(i->marks);
   free(i->lasts);
+  free(i->lines);
+  free(i->furthest_expected);
+  free(i->arena);
+  mpc_ast_arena_delete((mpc_ast_t*)i->ast_arena);
   free(i);
 }
 
 static int mpc_mem_ptr(mpc_input_t *i, void *p) {
   return
-    (char*)p >= (char*)(i->mem) &&
-    (char*)p <  (char*)(i->mem) + (MPC_INPUT_MEM_NUM * sizeof(mpc_mem_t));
+    (char*)p >= i->arena &&
+    (char*)p <  i->arena + i->arena_used;
+}
+
+static size_t mpc_mem_round(size_t n) {
+  size_t h = sizeof(mpc_mem_t);
+  return n < h ? h : ((n + h - 1) / h) * h;
+}
+
+static size_t mpc_mem_size(void *p) {
+  return ((mpc_mem_t*)p)[-1].size;
 }
 
 static void *mpc_malloc(mpc_input_t *i, size_t n) {
-  size_t j;
-  char *p;
   
-  if (n > sizeof(mpc_mem_t)) { return malloc(n); }
+  size_t c = mpc_mem_round(n), k = c / sizeof(mpc_mem_t);
+  mpc_mem_t *h;
+  void *p;
   
-  j = i->mem_index;
-  do {
-    if (!i->mem_full[i->mem_index]) {
-      p = (void*)(i->mem + i->mem_index);
-      i->mem_full[i->mem_index] = 1;
-      i->mem_index = (i->mem_index+1) % MPC_INPUT_MEM_NUM;
-      return p;
-    }
-    i->mem_index = (i->mem_index+1) % MPC_INPUT_MEM_NUM;
-  } while (j != i->mem_index);
+  i->allocs++;
+  
+  if (k < MPC_INPUT_ARENA_CLASSES && i->arena_free[k]) {
+    p = i->arena_free[k];
+    i->arena_free[k] = *(void**)p;
+    return p;
+  }
   
-  return malloc(n);
+  if (i->arena_used + sizeof(mpc_mem_t) + c > i->arena_size) { return malloc(n); }
+  if (!i->arena) { i->arena = malloc(i->arena_size); }
+  
+  h = (mpc_mem_t*)(i->arena + i->arena_used);
+  h->size = c;
+  i->arena_used += sizeof(mpc_mem_t) + c;
+  i->arena_last = (char*)(h + 1);
+  return h + 1;
 }
 
 static void *mpc_calloc(mpc_input_t *i, size_t n, size_t m) {
@@ -259,37 +571,64 @@ static void *mpc_calloc(mpc_input_t *i, size_t n, size_t m) {
 }
 
 static void mpc_free(mpc_input_t *i, void *p) {
-  size_t j;
+  
+  size_t c, k;
+  
   if (!mpc_mem_ptr(i, p)) { free(p); return; }
-  j = ((size_t)(((char*)p) - ((char*)i->mem))) / sizeof(mpc_mem_t);
-  i->mem_full[j] = 0;
+  
+  c = mpc_mem_size(p);
+  k = c / sizeof(mpc_mem_t);
+  
+  if (p == i->arena_last) {
+    i->arena_used -= sizeof(mpc_mem_t) + c;
+    i->arena_last = NULL;
+  } else if (k < MPC_INPUT_ARENA_CLASSES) {
+    *(void**)p = i->arena_free[k];
+    i->arena_free[k] = p;
+  }
 }
 
 static void *mpc_realloc(mpc_input_t *i, void *p, size_t n) {
   
+  size_t c, d;
   char *q = NULL;
   
-  if (!mpc_mem_ptr(i, p)) { return realloc(p, n); }
+  if (!mpc_mem_ptr(i, p)) { i->allocs++; return realloc(p, n); }
   
-  if (n > sizeof(mpc_mem_t)) {
-    q = malloc(n);
-    memcpy(q, p, sizeof(mpc_mem_t));
-    mpc_free(i, p);
-    return q;
+  c = mpc_mem_size(p);
+  d = mpc_mem_round(n);
+  if (d <= c) { return p; }
+  
+  if (p == i->arena_last && i->arena_used + (d - c) <= i->arena_size) {
+    ((mpc_mem_t*)p)[-1].size = d;
+    i->arena_used += d - c;
+    return p;
   }
   
-  return p;
+  q = mpc_malloc(i, n);
+  memcpy(q, p, c);
+  mpc_free(i, p);
+  return q;
 }
 
 static void *mpc_export(mpc_input_t *i, void *p) {
   char *q = NULL;
   if (!mpc_mem_ptr(i, p)) { return p; }
-  q = malloc(sizeof(mpc_mem_t));
-  memcpy(q, p, sizeof(mpc_mem_t));
+  q = malloc(mpc_mem_size(p));
+  memcpy(q, p, mpc_mem_size(p));
   mpc_free(i, p);
   return q; 
 }
 
+static void mpc_mem_reset(mpc_input_t *i) {
+  i->arena_used = 0;
+  i->arena_last = NULL;
+  memset(i->arena_free, 0, sizeof(i->arena_free));
+}
+
+static void mpc_input_deferred_disable(mpc_input_t *i) { i->deferred--; }
+static void mpc_input_deferred_enable(mpc_input_t *i) { i->deferred++; }
+
 static void mpc_input_backtrack_disable(mpc_input_t *i) { i->backtrack--; }
 static void mpc_input_backtrack_enable(mpc_input_t *i) { i->backtrack++; }
 
@@ -304,11 +643,11 @@ static void mpc_input_mark(mpc_input_t *i) {
   
   if (i->marks_num > i->marks_slots) {
     i->marks_slots = i->marks_num + i->marks_num / 2;
-    i->marks = realloc(i->marks, sizeof(mpc_state_t) * i->marks_slots);
+    i->marks = realloc(i->marks, sizeof(long) * i->marks_slots);
     i->lasts = realloc(i->lasts, sizeof(char) * i->marks_slots);
   }
 
-  i->marks[i->marks_num-1] = i->state;
+  i->marks[i->marks_num-1] = i->pos;
   i->lasts[i->marks_num-1] = i->last;
   
   if (i->type == MPC_INPUT_PIPE && i->marks_num == 1) {
@@ -328,7 +667,7 @@ static void mpc_input_unmark(mpc_input_t *i) {
     i->marks_slots = 
       i->marks_num > MPC_INPUT_MARKS_MIN ?
       i->marks_num : MPC_INPUT_MARKS_MIN;
-    i->marks = realloc(i->marks, sizeof(mpc_state_t) * i->marks_slots);
+    i->marks = realloc(i->marks, sizeof(long) * i->marks_slots);
     i->lasts = realloc(i->lasts, sizeof(char) * i->marks_slots);      
   }
   
@@ -343,28 +682,43 @@ static void mpc_input_rewind(mpc_input_t *i) {
   
   if (i->backtrack < 1) { return; }
   
-  i->state = i->marks[i->marks_num-1];
+  if (i->profile && i->profile->stack_num > 0) {
+    i->profile->entries[i->profile->stack[i->profile->stack_num-1]].rewinds++;
+  }
+  
+  i->pos = i->marks[i->marks_num-1];
   i->last  = i->lasts[i->marks_num-1];
   
   if (i->type == MPC_INPUT_FILE) {
-    fseek(i->file, i->state.pos, SEEK_SET);
+    fseek(i->file, i->pos, SEEK_SET);
   }
   
   mpc_input_unmark(i);
 }
 
 static int mpc_input_buffer_in_range(mpc_input_t *i) {
-  return i->state.pos < (long)(strlen(i->buffer) + i->marks[0].pos);
+  return i->pos < (long)(strlen(i->buffer) + i->marks[0]);
 }
 
 static char mpc_input_buffer_get(mpc_input_t *i) {
-  return i->buffer[i->state.pos - i->marks[0].pos];
+  return i->buffer[i->pos - i->marks[0]];
+}
+
+/*
+** For strings `reach` is one past the furthest
+** character looked at, which is what decides how
+** much of a parse an edit to the text can change.
+*/
+
+static void mpc_input_reach(mpc_input_t *i, long pos) {
+  if (pos >= i->reach) { i->reach = pos + 1; }
 }
 
 static int mpc_input_terminated(mpc_input_t *i) {
-  if (i->type == MPC_INPUT_STRING && i->state.pos == (long)strlen(i->string)) { return 1; }
+  if (i->type == MPC_INPUT_STRING && i->pos == i->length) { return 1; }
   if (i->type == MPC_INPUT_FILE && feof(i->file)) { return 1; }
-  if (i->type == MPC_INPUT_PIPE && feof(i->file)) { return 1; }
+  if (i->type == MPC_INPUT_PIPE && feof(i->file)
+  &&  !(i->buffer && mpc_input_buffer_in_range(i))) { return 1; }
   return 0;
 }
 
@@ -374,7 +728,7 @@ static char mpc_input_getc(mpc_input_t *i) {
   
   switch (i->type) {
     
-    case MPC_INPUT_STRING: return i->string[i->state.pos];
+    case MPC_INPUT_STRING: mpc_input_reach(i, i->pos); return i->string[i->pos];
     case MPC_INPUT_FILE: c = fgetc(i->file); return c;
     case MPC_INPUT_PIPE:
     
@@ -397,7 +751,7 @@ static char mpc_input_peekc(mpc_input_t *i) {
   char c = '\0';
   
   switch (i->type) {
-    case MPC_INPUT_STRING: return i->string[i->state.pos];
+    case MPC_INPUT_STRING: mpc_input_reach(i, i->pos); return i->string[i->pos];
     case MPC_INPUT_FILE: 
       
       c = fgetc(i->file);
@@ -449,6 +803,18 @@ static int mpc_input_failure(mpc_input_t *i, char c) {
   return 0;
 }
 
+static void mpc_input_line_add(mpc_input_t *i, long pos) {
+  
+  i->lines_num++;
+  
+  if (i->lines_num > i->lines_slots) {
+    i->lines_slots = i->lines_num + i->lines_num / 2;
+    i->lines = realloc(i->lines, sizeof(long) * i->lines_slots);
+  }
+  
+  i->lines[i->lines_num-1] = pos;
+}
+
 static int mpc_input_success(mpc_input_t *i, char c, char **o) {
   
   if (i->type == MPC_INPUT_PIPE
@@ -459,15 +825,15 @@ static int mpc_input_success(mpc_input_t *i, char c, char **o) {
   }
   
   i->last = c;
-  i->state.pos++;
-  i->state.col++;
+  i->pos++;
   
-  if (c == '\n') {
-    i->state.col = 0;
-    i->state.row++;
+  if (c == '\n' && i->type != MPC_INPUT_STRING
+  &&  i->pos > i->lines[i->lines_num-1]) {
+    mpc_input_line_add(i, i->pos);
   }
   
-  if (o) {
+  if (o && i->spans) { (*o) = NULL; }
+  else if (o) {
     (*o) = mpc_malloc(i, 2);
     (*o)[0] = c;
     (*o)[1] = '\0';
@@ -494,16 +860,10 @@ static int mpc_input_range(mpc_input_t *i, char c, char d, char **o) {
   return x >= c && x <= d ? mpc_input_success(i, x, o) : mpc_input_failure(i, x);  
 }
 
-static int mpc_input_oneof(mpc_input_t *i, const char *c, char **o) {
-  char x = mpc_input_getc(i);
-  if (mpc_input_terminated(i)) { return 0; }
-  return strchr(c, x) != 0 ? mpc_input_success(i, x, o) : mpc_input_failure(i, x);  
-}
-
-static int mpc_input_noneof(mpc_input_t *i, const char *c, char **o) {
+static int mpc_input_set(mpc_input_t *i, const unsigned char *s, char **o) {
   char x = mpc_input_getc(i);
   if (mpc_input_terminated(i)) { return 0; }
-  return strchr(c, x) == 0 ? mpc_input_success(i, x, o) : mpc_input_failure(i, x);  
+  return MPC_SET_HAS(s, x) ? mpc_input_success(i, x, o) : mpc_input_failure(i, x);
 }
 
 static int mpc_input_satisfy(mpc_input_t *i, int(*cond)(char), char **o) {
@@ -526,6 +886,8 @@ static int mpc_input_string(mpc_input_t *i, const char *c, char **o) {
   }
   mpc_input_unmark(i);
   
+  if (i->spans) { *o = NULL; return 1; }
+  
   *o = mpc_malloc(i, strlen(c) + 1);
   strcpy(*o, c);
   return 1;
@@ -536,9 +898,146 @@ static int mpc_input_anchor(mpc_input_t* i, int(*f)(char,char), char **o) {
   return f(i->last, mpc_input_peekc(i));
 }
 
+/*
+** Spans switch off output for everything run
+** inside them. Only the starting offset is kept
+** and on success the matched text is copied out
+** in one go, from the string, by seeking back in
+** the file, or from the pipe buffer, which stays
+** alive because the start of the span is marked.
+*/
+
+static char *mpc_input_slice(mpc_input_t *i, long start) {
+  
+  size_t n = i->pos - start;
+  char *o = mpc_malloc(i, n + 1);
+  
+  switch (i->type) {
+    case MPC_INPUT_STRING: memcpy(o, i->string + start, n); break;
+    case MPC_INPUT_FILE:
+      fseek(i->file, start, SEEK_SET);
+      n = fread(o, 1, n, i->file);
+      break;
+    case MPC_INPUT_PIPE: memcpy(o, i->buffer + (start - i->marks[0]), n); break;
+    default: n = 0; break;
+  }
+  
+  o[n] = '\0';
+  return o;
+}
+
+static int mpc_input_span_begin(mpc_input_t *i) {
+  int backtrack = i->backtrack;
+  i->spans++;
+  i->backtrack = 1;
+  mpc_input_mark(i);
+  return backtrack;
+}
+
+static char *mpc_input_span_end(mpc_input_t *i, int success, int backtrack) {
+  
+  char *o = NULL;
+  
+  if (success) {
+    o = mpc_input_slice(i, i->marks[i->marks_num-1]);
+    mpc_input_unmark(i);
+  } else {
+    mpc_input_rewind(i);
+  }
+  
+  i->backtrack = backtrack;
+  i->spans--;
+  return o;
+}
+
+/*
+** Consumes the longest run of characters in a
+** set, succeeding if it is at least `n` long.
+** Strings are scanned in place, many bytes at a
+** time where possible, otherwise the run is read
+** one character at a time as a span so
+** the text can be copied out after.
+*/
+
+static int mpc_input_scan(mpc_input_t *i, const mpc_class_t *c, long n, char **o) {
+  
+  int backtrack;
+  long k, start = i->pos;
+  
+  if (i->type == MPC_INPUT_STRING) {
+    k = start + mpc_class_span(c, i->string + start, i->length - start, !(i->flags & MPC_INPUT_NO_VECTOR));
+    mpc_input_reach(i, k);
+    if (k - start < n) { return 0; }
+    if (k > start) { i->last = i->string[k-1]; }
+    i->pos = k;
+    if (o) { *o = mpc_input_slice(i, start); }
+    return 1;
+  }
+  
+  if (!o) {
+    while (mpc_input_set(i, c->set, NULL));
+    return i->pos - start >= n;
+  }
+  
+  backtrack = mpc_input_span_begin(i);
+  while (mpc_input_set(i, c->set, NULL));
+  k = i->pos - start;
+  *o = mpc_input_span_end(i, k >= n, backtrack);
+  return k >= n;
+}
+
+/*
+** Only the byte offset is tracked while parsing.
+** Rows and columns are worked out on demand from
+** an index of line starts, which is only needed
+** when an error or state value is produced. They
+** are given relative to the input's `origin` so
+** that part of a larger text can be parsed alone.
+**
+** For strings the index is built lazily by
+** scanning up to the requested offset. Files and
+** pipes can't be rescanned cheaply, so newlines
+** are recorded as they are first consumed.
+*/
+
+static void mpc_input_lines_scan(mpc_input_t *i, long pos) {
+  const char *s, *e;
+  if (pos <= i->lines_end) { return; }
+  s = i->string + i->lines_end;
+  e = i->string + pos;
+  while ((s = memchr(s, '\n', e - s))) {
+    s++;
+    mpc_input_line_add(i, s - i->string);
+  }
+  i->lines_end = pos;
+}
+
+static mpc_state_t mpc_input_state_at(mpc_input_t *i, long pos) {
+  
+  mpc_state_t s;
+  int lo, hi, mid;
+  
+  if (i->type == MPC_INPUT_STRING) { mpc_input_lines_scan(i, pos); }
+  
+  lo = 0; hi = i->lines_num-1;
+  while (lo < hi) {
+    mid = lo + (hi - lo + 1) / 2;
+    if (i->lines[mid] <= pos) { lo = mid; } else { hi = mid-1; }
+  }
+  
+  s.pos = i->origin.pos + pos;
+  s.row = i->origin.row + lo;
+  s.col = (lo ? 0 : i->origin.col) + pos - i->lines[lo];
+  return s;
+}
+
+static mpc_state_t mpc_input_state(mpc_input_t *i) {
+  return mpc_input_state_at(i, i->pos);
+}
+
 static mpc_state_t *mpc_input_state_copy(mpc_input_t *i) {
   mpc_state_t *r = mpc_malloc(i, sizeof(mpc_state_t));
-  memcpy(r, &i->state, sizeof(mpc_state_t));
+  *r = mpc_input_state(i);
   return r;
 }
 
@@ -575,14 +1074,13 @@ static void mpc_err_string_cat(char *buffer, int *pos, int *max, char const *fmt
   va_end(va);
 }
 
-static char char_unescape_buffer[4];
-
-static const char *mpc_err_char_unescape(char c) {
+/* Quoted characters go into the caller's `buf` so errors can be built on any thread */
+static const char *mpc_err_char_unescape(char c, char *buf) {
   
-  char_unescape_buffer[0] = '\'';
-  char_unescape_buffer[1] = ' ';
-  char_unescape_buffer[2] = '\'';
-  char_unescape_buffer[3] = '\0';
+  buf[0] = '\'';
+  buf[1] = ' ';
+  buf[2] = '\'';
+  buf[3] = '\0';
   
   switch (c) {
     case '\a': return "bell";
@@ -595,8 +1093,8 @@ static const char *mpc_err_char_unescape(char c) {
     case '\t': return "tab";
     case ' ' : return "space";
     default:
-      char_unescape_buffer[1] = c;
-      return char_unescape_buffer;
+      buf[1] = c;
+      return buf;
   }
   
 }
@@ -606,6 +1104,7 @@ char *mpc_err_string(mpc_err_t *x) {
   int i;  
   int pos = 0; 
   int max = 1023;
+  char quoted[4];
   char *buffer = calloc(1, 1024);
   
   if (x->failure) {
@@ -631,19 +1130,74 @@ char *mpc_err_string(mpc_err_t *x) {
   }
   
   mpc_err_string_cat(buffer, &pos, &max, " at ");
-  mpc_err_string_cat(buffer, &pos, &max, mpc_err_char_unescape(x->recieved));
+  mpc_err_string_cat(buffer, &pos, &max, "%s", mpc_err_char_unescape(x->recieved, quoted));
   mpc_err_string_cat(buffer, &pos, &max, "\n");
   
   return realloc(buffer, strlen(buffer) + 1);
 }
 
+/*
+** When errors are deferred nothing is allocated
+** on failure. Instead the input remembers the
+** furthest position any parser failed at along
+** with the messages expected there. These are
+** owned by the parsers so only pointers need to
+** be kept. A real error is only built from them
+** if the whole parse fails.
+**
+** Expected messages recorded this way lose the
+** "one or more of" style prefixes added by the
+** repetition parsers.
+*/
+
+static int mpc_err_defer(mpc_input_t *i) {
+  
+  if (i->pos < i->furthest_pos) { return 0; }
+  
+  if (i->pos > i->furthest_pos) {
+    i->furthest_pos = i->pos;
+    i->furthest_num = 0;
+    i->furthest_failure = NULL;
+    i->furthest_recieved = mpc_input_peekc(i);
+  }
+  
+  return 1;
+}
+
+static void mpc_err_defer_expected(mpc_input_t *i, const char *expected) {
+  
+  int j;
+  
+  if (!mpc_err_defer(i)) { return; }
+  
+  for (j = 0; j < i->furthest_num; j++) {
+    if (i->furthest_expected[j] == expected
+    ||  strcmp(i->furthest_expected[j], expected) == 0) { return; }
+  }
+  
+  i->furthest_num++;
+  
+  if (i->furthest_num > i->furthest_slots) {
+    i->furthest_slots = i->furthest_num + i->furthest_num / 2;
+    i->furthest_expected = realloc(i->furthest_expected, sizeof(char*) * i->furthest_slots);
+  }
+  
+  i->furthest_expected[i->furthest_num-1] = expected;
+}
+
+static void mpc_err_defer_failure(mpc_input_t *i, const char *failure) {
+  if (!mpc_err_defer(i)) { return; }
+  if (i->furthest_failure == NULL) { i->furthest_failure = failure; }
+}
+
 static mpc_err_t *mpc_err_new(mpc_input_t *i, const char *expected) {
   mpc_err_t *x;
   if (i->suppress) { return NULL; }
+  if (i->deferred) { mpc_err_defer_expected(i, expected); return NULL; }
   x = mpc_malloc(i, sizeof(mpc_err_t));
   x->filename = mpc_malloc(i, strlen(i->filename) + 1);
   strcpy(x->filename, i->filename);
-  x->state = i->state;
+  x->state = mpc_input_state(i);
   x->expected_num = 1;
   x->expected = mpc_malloc(i, sizeof(char*));
   x->expected[0] = mpc_malloc(i, strlen(expected) + 1);
@@ -656,10 +1210,11 @@ static mpc_err_t *mpc_err_new(mpc_input_t *i, const char *expected) {
 static mpc_err_t *mpc_err_fail(mpc_input_t *i, const char *failure) {
   mpc_err_t *x;
   if (i->suppress) { return NULL; }
+  if (i->deferred) { mpc_err_defer_failure(i, failure); return NULL; }
   x = mpc_malloc(i, sizeof(mpc_err_t));
   x->filename = mpc_malloc(i, strlen(i->filename) + 1);
   strcpy(x->filename, i->filename);
-  x->state = i->state;
+  x->state = mpc_input_state(i);
   x->expected_num = 0;
   x->expected = NULL;
   x->failure = mpc_malloc(i, strlen(failure) + 1);
@@ -682,13 +1237,46 @@ static mpc_err_t *mpc_err_file(const char *filename, const char *failure) {
   return x;
 }
 
-static void mpc_err_delete_internal(mpc_input_t *i, mpc_err_t *x) {
+static mpc_err_t *mpc_err_furthest(mpc_input_t *i) {
+  
   int j;
-  if (x == NULL) { return; }
-  for (j = 0; j < x->expected_num; j++) { mpc_free(i, x->expected[j]); }
-  mpc_free(i, x->expected);
-  mpc_free(i, x->filename);
-  mpc_free(i, x->failure);
+  mpc_err_t *x;
+  
+  if (i->furthest_pos < 0) { return NULL; }
+  
+  x = mpc_malloc(i, sizeof(mpc_err_t));
+  x->filename = mpc_malloc(i, strlen(i->filename) + 1);
+  strcpy(x->filename, i->filename);
+  x->state = mpc_input_state_at(i, i->furthest_pos);
+  x->expected_num = 0;
+  x->expected = NULL;
+  x->failure = NULL;
+  x->recieved = i->furthest_recieved;
+  
+  if (i->furthest_failure) {
+    x->failure = mpc_malloc(i, strlen(i->furthest_failure) + 1);
+    strcpy(x->failure, i->furthest_failure);
+    x->recieved = ' ';
+    return x;
+  }
+  
+  x->expected_num = i->furthest_num;
+  x->expected = mpc_malloc(i, sizeof(char*) * i->furthest_num);
+  for (j = 0; j < i->furthest_num; j++) {
+    x->expected[j] = mpc_malloc(i, strlen(i->furthest_expected[j]) + 1);
+    strcpy(x->expected[j], i->furthest_expected[j]);
+  }
+  
+  return x;
+}
+
+static void mpc_err_delete_internal(mpc_input_t *i, mpc_err_t *x) {
+  int j;
+  if (x == NULL) { return; }
+  for (j = 0; j < x->expected_num; j++) { mpc_free(i, x->expected[j]); }
+  mpc_free(i, x->expected);
+  mpc_free(i, x->filename);
+  mpc_free(i, x->failure);
   mpc_free(i, x);
 }
 
@@ -722,15 +1310,16 @@ static void mpc_err_add_expected(mpc_input_t *i, mpc_err_t *x, char *expected) {
 
 static mpc_err_t *mpc_err_or(mpc_input_t *i, mpc_err_t** x, int n) {
   
-  int j, k, fst;
+  int j, k, fst, num;
   mpc_err_t *e;
   
-  fst = -1;
+  fst = -1; num = 0;
   for (j = 0; j < n; j++) {
-    if (x[j] != NULL) { fst = j; }
+    if (x[j] != NULL) { fst = j; num++; }
   }
   
   if (fst == -1) { return NULL; }
+  if (num == 1) { return x[fst]; }
   
   e = mpc_malloc(i, sizeof(mpc_err_t));
   e->state = mpc_state_invalid();
@@ -885,7 +1474,12 @@ enum {
   MPC_TYPE_AND        = 24,
 
   MPC_TYPE_CHECK      = 25,
-  MPC_TYPE_CHECK_WITH = 26
+  MPC_TYPE_CHECK_WITH = 26,
+  
+  MPC_TYPE_DEFERRED   = 27,
+  MPC_TYPE_REGEX      = 28,
+  MPC_TYPE_SPAN       = 29,
+  MPC_TYPE_SCAN       = 30
 };
 
 typedef struct { char *m; } mpc_pdata_fail_t;
@@ -895,7 +1489,8 @@ typedef struct { int(*f)(char,char); } mpc_pdata_anchor_t;
 typedef struct { char x; } mpc_pdata_single_t;
 typedef struct { char x; char y; } mpc_pdata_range_t;
 typedef struct { int(*f)(char); } mpc_pdata_satisfy_t;
-typedef struct { char *x; } mpc_pdata_string_t;
+typedef struct { char *x; char *m; } mpc_pdata_string_t;
+typedef struct { char *x; unsigned char s[MPC_SET_SIZE]; } mpc_pdata_set_t;
 typedef struct { mpc_parser_t *x; mpc_apply_t f; } mpc_pdata_apply_t;
 typedef struct { mpc_parser_t *x; mpc_apply_to_t f; void *d; } mpc_pdata_apply_to_t;
 typedef struct { mpc_parser_t *x; mpc_check_t f; char *e; } mpc_pdata_check_t;
@@ -903,8 +1498,10 @@ typedef struct { mpc_parser_t *x; mpc_check_with_t f; void *d; char *e; } mpc_pd
 typedef struct { mpc_parser_t *x; } mpc_pdata_predict_t;
 typedef struct { mpc_parser_t *x; mpc_dtor_t dx; mpc_ctor_t lf; } mpc_pdata_not_t;
 typedef struct { int n; mpc_fold_t f; mpc_parser_t *x; mpc_dtor_t dx; } mpc_pdata_repeat_t;
-typedef struct { int n; mpc_parser_t **xs; } mpc_pdata_or_t;
+typedef struct { int n; mpc_parser_t **xs; unsigned char *jump; } mpc_pdata_or_t;
 typedef struct { int n; mpc_fold_t f; mpc_parser_t **xs; mpc_dtor_t *dxs;  } mpc_pdata_and_t;
+typedef struct { mpc_parser_t *x; struct mpc_dfa_t *d; } mpc_pdata_regex_t;
+typedef struct { int n; char *m; unsigned char s[MPC_SET_SIZE]; mpc_class_t *c; } mpc_pdata_scan_t;
 
 typedef union {
   mpc_pdata_fail_t fail;
@@ -915,6 +1512,7 @@ typedef union {
   mpc_pdata_range_t range;
   mpc_pdata_satisfy_t satisfy;
   mpc_pdata_string_t string;
+  mpc_pdata_set_t set;
   mpc_pdata_apply_t apply;
   mpc_pdata_apply_to_t apply_to;
   mpc_pdata_check_t check;
@@ -924,6 +1522,8 @@ typedef union {
   mpc_pdata_repeat_t repeat;
   mpc_pdata_and_t and;
   mpc_pdata_or_t or;
+  mpc_pdata_regex_t regex;
+  mpc_pdata_scan_t scan;
 } mpc_pdata_t;
 
 struct mpc_parser_t {
@@ -931,8 +1531,179 @@ struct mpc_parser_t {
   mpc_pdata_t data;
   char type;
   char retained;
+  int rule;
+};
+
+/*
+** A DFA has one row of 256 transitions for each
+** state. State zero is dead and state one is the
+** start. A regex anchored with `^` or `$` only
+** matches at the start or end of the input.
+**
+** Running one returns 1 on a match and 0 on
+** failure. Files and pipes may contain null
+** characters, which the DFA leaves out, so if
+** one is found -1 is returned and the caller
+** must use the parser tree instead.
+**
+** A state that moves to itself on a class of
+** characters, such as the inside of a string or
+** comment, skips a run of them in one go. This
+** is left out when the regex ends with `$` as
+** then accepting also depends on the next byte.
+*/
+
+enum {
+  MPC_DFA_SOI = 1,
+  MPC_DFA_EOI = 2
 };
 
+typedef struct mpc_dfa_t {
+  int flags;
+  int states;
+  unsigned char *accept;
+  unsigned char *trans;
+  mpc_class_t **loops;
+  char **expect;
+} mpc_dfa_t;
+
+static size_t mpc_dfa_expect_len(const char *x) {
+  const char *m = x;
+  while (*m) { m += strlen(m) + 1; }
+  return m - x + 1;
+}
+
+static int mpc_input_dfa_accept(mpc_dfa_t *d, int s, char next) {
+  return d->accept[s] && (!(d->flags & MPC_DFA_EOI) || next == '\0');
+}
+
+/*
+** Where a match stops the tree would have tried
+** each way on from there and failed, so the same
+** errors are given. If these aren't known for the
+** state the match is run again through the tree.
+**
+** Merging them one by one into the errors so far
+** is the same as merging a single error with all
+** of them, which only needs copying if the errors
+** so far are at the same place. If they are all
+** behind, their error is reused for the new one.
+*/
+
+static void mpc_input_dfa_expect(mpc_input_t *i, const char *m, mpc_err_t **e) {
+  
+  mpc_err_t *x;
+  long pos = i->origin.pos + i->pos;
+  
+  if (*m == '\0' || (*e && (*e)->state.pos > pos)) { return; }
+  
+  if (i->deferred) {
+    for (; *m; m += strlen(m) + 1) { mpc_err_new(i, m); }
+    return;
+  }
+  
+  if (*e && (*e)->state.pos < pos && !(*e)->failure && (*e)->expected_num) {
+    x = *e;
+    while (x->expected_num > 1) { mpc_free(i, x->expected[--x->expected_num]); }
+    x->expected[0] = mpc_realloc(i, x->expected[0], strlen(m) + 1);
+    strcpy(x->expected[0], m);
+    x->state = mpc_input_state(i);
+    x->recieved = mpc_input_peekc(i);
+    *e = NULL;
+  } else {
+    x = mpc_err_new(i, m);
+  }
+  for (m += strlen(m) + 1; *m; m += strlen(m) + 1) {
+    if (!mpc_err_contains_expected(i, x, (char*)m)) { mpc_err_add_expected(i, x, (char*)m); }
+  }
+  
+  if (*e && (*e)->state.pos == pos) { *e = mpc_err_merge(i, *e, x); return; }
+  if (*e) { mpc_err_delete_internal(i, *e); }
+  *e = x;
+}
+
+static int mpc_input_dfa(mpc_input_t *i, mpc_dfa_t *d, char **o, mpc_err_t **e) {
+  
+  int s = 1, t = 1, nulls = 0, backtrack = i->backtrack;
+  long k, best = -1, start = i->pos;
+  char c;
+  mpc_class_t **loops = i->flags & MPC_INPUT_NO_VECTOR ? NULL : d->loops;
+  
+  if ((d->flags & MPC_DFA_SOI) && i->last != '\0') { return 0; }
+  
+  /* Strings can be scanned in place */
+  if (i->type == MPC_INPUT_STRING) {
+    
+    k = start;
+    if (mpc_input_dfa_accept(d, s, i->string[k])) { best = k; }
+    while (k < i->length && (s = d->trans[s * 256 + (unsigned char)i->string[k]])) {
+      t = s;
+      k++;
+      if (loops && loops[s]) { k += mpc_class_span(loops[s], i->string + k, i->length - k, 1); }
+      if (mpc_input_dfa_accept(d, s, i->string[k])) { best = k; }
+    }
+    mpc_input_reach(i, k);
+    
+    if (best < 0) { return 0; }
+    
+    if (!i->suppress) {
+      if (!d->expect[t]) { return -1; }
+      i->pos = k;
+      mpc_input_dfa_expect(i, d->expect[t], e);
+    }
+    
+    if (best > start) { i->last = i->string[best-1]; }
+    i->pos = best;
+    if (o) { *o = mpc_input_slice(i, start); }
+    return 1;
+  }
+  
+  /*
+  ** Otherwise keep a mark at the start and another
+  ** at the last accepting position to return to.
+  */
+  
+  i->backtrack = 1;
+  mpc_input_mark(i);
+  
+  while (1) {
+    c = mpc_input_peekc(i);
+    if (c == '\0' && !mpc_input_terminated(i)) { nulls = 1; break; }
+    if (mpc_input_dfa_accept(d, s, c)) {
+      if (best >= 0) { mpc_input_unmark(i); }
+      mpc_input_mark(i);
+      best = i->pos;
+    }
+    if (c == '\0') { break; }
+    if (!(s = d->trans[s * 256 + (unsigned char)c])) { break; }
+    t = s;
+    if (!mpc_input_any(i, NULL)) { nulls = 1; break; }
+  }
+  
+  /* A pipe can't be read again past its first mark */
+  if (best >= 0 && !nulls && !i->suppress) {
+    if (d->expect[t]) {
+      mpc_input_dfa_expect(i, d->expect[t], e);
+    } else if (i->type != MPC_INPUT_PIPE || i->marks_num > 2) {
+      nulls = 1;
+    }
+  }
+  
+  if (best >= 0 && !nulls) {
+    mpc_input_rewind(i);
+    if (o) { *o = mpc_input_slice(i, start); }
+    mpc_input_unmark(i);
+  } else {
+    if (best >= 0) { mpc_input_unmark(i); }
+    mpc_input_rewind(i);
+  }
+  
+  i->backtrack = backtrack;
+  
+  if (nulls) { return -1; }
+  return best >= 0;
+}
+
 static mpc_val_t *mpcf_input_nth_free(mpc_input_t *i, int n, mpc_val_t **xs, int x) {
   int j;
   for (j = 0; j < n; j++) { if (j != x) { mpc_free(i, xs[j]); } }
@@ -953,6 +1724,188 @@ static mpc_val_t *mpcf_input_strfold(mpc_input_t *i, int n, mpc_val_t **xs) {
   return xs[0];
 }
 
+/*
+** With `MPC_INPUT_AST_ARENA` set the built in AST
+** functions allocate nodes, tags, contents and
+** child arrays from a region owned by the parse
+** rather than with `malloc`. Nodes thrown away
+** while backtracking are left in the region.
+**
+** The region header starts with a spare node,
+** and once the parse succeeds the root is copied
+** into it. This means the root returned to the
+** user is also the region, and the whole tree
+** can be freed with `mpc_ast_arena_delete`.
+**
+** A parser which never builds an AST node has no
+** region, and its output is returned unchanged.
+** Otherwise the output must be the AST so built.
+*/
+
+enum {
+  MPC_AST_ARENA_CHUNK = 4096
+};
+
+typedef struct mpc_ast_chunk_t {
+  struct mpc_ast_chunk_t *next;
+  size_t used;
+  size_t size;
+  mpc_mem_t data[1];
+} mpc_ast_chunk_t;
+
+typedef struct mpc_ast_arena_t {
+  mpc_ast_t root;
+  mpc_ast_chunk_t *chunks;
+  char empty[1];
+} mpc_ast_arena_t;
+
+static mpc_ast_arena_t *mpc_ast_arena_get(mpc_input_t *i) {
+  if (!i->ast_arena) {
+    i->ast_arena = malloc(sizeof(mpc_ast_arena_t));
+    i->ast_arena->chunks = NULL;
+    i->ast_arena->empty[0] = '\0';
+  }
+  return i->ast_arena;
+}
+
+static void *mpc_ast_region_alloc(mpc_ast_arena_t *r, size_t n) {
+  
+  mpc_ast_chunk_t *c = r->chunks;
+  size_t size;
+  
+  n = mpc_mem_round(n);
+  
+  if (!c || c->used + n > c->size) {
+    size = c ? c->size * 2 : MPC_AST_ARENA_CHUNK;
+    size = size > n ? size : n;
+    c = malloc(sizeof(mpc_ast_chunk_t) + size);
+    c->next = r->chunks;
+    c->used = 0;
+    c->size = size;
+    r->chunks = c;
+  }
+  
+  c->used += n;
+  return (char*)c->data + (c->used - n);
+}
+
+static void *mpc_ast_arena_alloc(mpc_input_t *i, size_t n) {
+  return mpc_ast_region_alloc(mpc_ast_arena_get(i), n);
+}
+
+static char *mpc_ast_arena_str(mpc_input_t *i, const char *prefix, size_t m, const char *s) {
+  size_t n = strlen(s);
+  char *x;
+  if (m + n == 0) { return mpc_ast_arena_get(i)->empty; }
+  x = mpc_ast_arena_alloc(i, m + n + 1);
+  memcpy(x, prefix, m);
+  memcpy(x + m, s, n + 1);
+  return x;
+}
+
+static mpc_ast_t *mpc_ast_arena_new(mpc_input_t *i, const char *tag, const char *contents) {
+  mpc_ast_t *a = mpc_ast_arena_alloc(i, sizeof(mpc_ast_t));
+  a->tag = mpc_ast_arena_str(i, "", 0, tag);
+  a->contents = mpc_ast_arena_str(i, "", 0, contents);
+  a->state = mpc_state_new();
+  a->children_num = 0;
+  a->children = NULL;
+  a->rule = 0;
+  a->primary = 0;
+  a->view = NULL;
+  a->view_len = 0;
+  return a;
+}
+
+static mpc_ast_t *mpc_ast_arena_finish(mpc_input_t *i, mpc_ast_t *a) {
+  mpc_ast_arena_t *r = i->ast_arena;
+  i->ast_arena = NULL;
+  if (r == NULL) { return a; }
+  if (a == NULL) { mpc_ast_arena_delete((mpc_ast_t*)r); return NULL; }
+  r->root = *a;
+  return &r->root;
+}
+
+static mpc_val_t *mpcf_input_fold_ast(mpc_input_t *i, int n, mpc_val_t **xs) {
+  
+  int j, k, m = 0;
+  mpc_ast_t **as = (mpc_ast_t**)xs;
+  mpc_ast_t *r, *c;
+  
+  if (n == 0) { return NULL; }
+  if (n == 1) { return xs[0]; }
+  if (n == 2 && xs[1] == NULL) { return xs[0]; }
+  if (n == 2 && xs[0] == NULL) { return xs[1]; }
+  
+  for (j = 0; j < n; j++) {
+    if (as[j] == NULL) { continue; }
+    m += as[j]->children_num ? as[j]->children_num : 1;
+  }
+  
+  r = mpc_ast_arena_new(i, ">", "");
+  r->children = mpc_ast_arena_alloc(i, sizeof(mpc_ast_t*) * m);
+  
+  for (j = 0; j < n; j++) {
+    
+    if (as[j] == NULL) { continue; }
+    
+    if (as[j]->children_num == 0) {
+      r->children[r->children_num++] = as[j];
+    } else if (as[j]->children_num == 1) {
+      c = as[j]->children[0];
+      c->tag = mpc_ast_arena_str(i, as[j]->tag, strlen(as[j]->tag)-1, c->tag);
+      if (as[j]->rule) { c->rule = as[j]->rule; }
+      if (!c->primary) { c->primary = as[j]->primary; }
+      r->children[r->children_num++] = c;
+    } else {
+      for (k = 0; k < as[j]->children_num; k++) {
+        r->children[r->children_num++] = as[j]->children[k];
+      }
+    }
+  
+  }
+  
+  if (r->children_num) {
+    r->state = r->children[0]->state;
+  }
+  
+  return r;
+}
+
+static mpc_val_t *mpcf_input_add_root_ast(mpc_input_t *i, mpc_ast_t *a) {
+  mpc_ast_t *r;
+  if (a == NULL || a->children_num <= 1) { return a; }
+  r = mpc_ast_arena_new(i, ">", "");
+  r->children = mpc_ast_arena_alloc(i, sizeof(mpc_ast_t*));
+  r->children[r->children_num++] = a;
+  return r;
+}
+
+static mpc_val_t *mpcf_input_tag_ast(mpc_input_t *i, mpc_ast_t *a, const char *t) {
+  a->tag = mpc_ast_arena_str(i, "", 0, t);
+  return a;
+}
+
+static mpc_val_t *mpcf_input_add_tag_ast(mpc_input_t *i, mpc_ast_t *a, const char *t) {
+  size_t n = strlen(t);
+  char *x;
+  if (a == NULL) { return a; }
+  x = mpc_ast_arena_alloc(i, n + 1 + strlen(a->tag) + 1);
+  memcpy(x, t, n);
+  x[n] = '|';
+  strcpy(x + n + 1, a->tag);
+  a->tag = x;
+  return a;
+}
+
+static mpc_val_t *mpcf_input_add_rule_ast(mpc_input_t *i, mpc_ast_t *a, mpc_parser_t *p) {
+  a = mpcf_input_add_tag_ast(i, a, p->name);
+  if (a == NULL) { return a; }
+  a->rule = p->rule;
+  if (!a->primary) { a->primary = p->rule; }
+  return a;
+}
+
 static mpc_val_t *mpcf_input_state_ast(mpc_input_t *i, int n, mpc_val_t **xs) {
   mpc_state_t *s = ((mpc_state_t**)xs)[0];
   mpc_ast_t *a = ((mpc_ast_t**)xs)[1];
@@ -962,6 +1915,45 @@ static mpc_val_t *mpcf_input_state_ast(mpc_input_t *i, int n, mpc_val_t **xs) {
   return a;
 }
 
+/*
+** With `MPC_INPUT_AST_VIEWS` set, leaves matched
+** from a string input do not copy their contents.
+** Instead `view` points at the text in the input's
+** own copy of the string, and inner nodes have no
+** contents at all. Either is only copied out when
+** `mpc_ast_contents` is called, so the input must
+** outlive the tree. Inputs read from files or pipes,
+** or built in an arena, still copy their contents.
+*/
+
+static mpc_ast_t *mpc_ast_view_new(const char *tag, const char *view, long n) {
+  mpc_ast_t *a = malloc(sizeof(mpc_ast_t));
+  a->tag = malloc(strlen(tag) + 1);
+  strcpy(a->tag, tag);
+  a->contents = NULL;
+  a->state = mpc_state_new();
+  a->children_num = 0;
+  a->children = NULL;
+  a->rule = 0;
+  a->primary = 0;
+  a->view = view;
+  a->view_len = n;
+  return a;
+}
+
+static const char *mpc_input_view(mpc_input_t *i, const char *c, long n) {
+  if (i->type != MPC_INPUT_STRING || n > i->pos) { return NULL; }
+  if (memcmp(i->string + i->pos - n, c, n) != 0) { return NULL; }
+  return i->string + i->pos - n;
+}
+
+static mpc_val_t *mpc_ast_fold(int n, mpc_val_t **xs, int views);
+
+static mpc_val_t *mpcf_input_add_root_view_ast(mpc_ast_t *a) {
+  if (a == NULL || a->children_num <= 1) { return a; }
+  return mpc_ast_add_child(mpc_ast_view_new(">", NULL, 0), a);
+}
+
 static mpc_val_t *mpc_parse_fold(mpc_input_t *i, mpc_fold_t f, int n, mpc_val_t **xs) {
   int j;
   if (f == mpcf_null)      { return mpcf_null(n, xs); }
@@ -973,6 +1965,8 @@ static mpc_val_t *mpc_parse_fold(mpc_input_t *i, mpc_fold_t f, int n, mpc_val_t
   if (f == mpcf_trd_free)  { return mpcf_input_trd_free(i, n, xs); }
   if (f == mpcf_strfold)   { return mpcf_input_strfold(i, n, xs); }
   if (f == mpcf_state_ast) { return mpcf_input_state_ast(i, n, xs); }
+  if (f == mpcf_fold_ast && (i->flags & MPC_INPUT_AST_ARENA)) { return mpcf_input_fold_ast(i, n, xs); }
+  if (f == mpcf_fold_ast && (i->flags & MPC_INPUT_AST_VIEWS)) { return mpc_ast_fold(n, xs, 1); }
   for (j = 0; j < n; j++) { xs[j] = mpc_export(i, xs[j]); }
   return f(j, xs);
 }
@@ -983,7 +1977,17 @@ static mpc_val_t *mpcf_input_free(mpc_input_t *i, mpc_val_t *x) {
 }
 
 static mpc_val_t *mpcf_input_str_ast(mpc_input_t *i, mpc_val_t *c) {
-  mpc_ast_t *a = mpc_ast_new("", c);
+  mpc_ast_t *a;
+  const char *v;
+  long n;
+  if (i->flags & MPC_INPUT_AST_ARENA) {
+    a = mpc_ast_arena_new(i, "", c);
+  } else if ((i->flags & MPC_INPUT_AST_VIEWS)
+         && (v = mpc_input_view(i, c, n = strlen(c)))) {
+    a = mpc_ast_view_new("", v, n);
+  } else {
+    a = mpc_ast_new("", c);
+  }
   mpc_free(i, c);
   return a;
 }
@@ -991,15 +1995,26 @@ static mpc_val_t *mpcf_input_str_ast(mpc_input_t *i, mpc_val_t *c) {
 static mpc_val_t *mpc_parse_apply(mpc_input_t *i, mpc_apply_t f, mpc_val_t *x) {
   if (f == mpcf_free)     { return mpcf_input_free(i, x); }
   if (f == mpcf_str_ast)  { return mpcf_input_str_ast(i, x); }
+  if (i->flags & MPC_INPUT_AST_ARENA) {
+    if (f == (mpc_apply_t)mpc_ast_add_root) { return mpcf_input_add_root_ast(i, x); }
+  } else if (i->flags & MPC_INPUT_AST_VIEWS) {
+    if (f == (mpc_apply_t)mpc_ast_add_root) { return mpcf_input_add_root_view_ast(x); }
+  }
   return f(mpc_export(i, x));
 }
 
 static mpc_val_t *mpc_parse_apply_to(mpc_input_t *i, mpc_apply_to_t f, mpc_val_t *x, mpc_val_t *d) {
+  if (i->flags & MPC_INPUT_AST_ARENA) {
+    if (f == (mpc_apply_to_t)mpc_ast_tag)     { return mpcf_input_tag_ast(i, x, d); }
+    if (f == (mpc_apply_to_t)mpc_ast_add_tag) { return mpcf_input_add_tag_ast(i, x, d); }
+    if (f == (mpc_apply_to_t)mpc_ast_add_rule) { return mpcf_input_add_rule_ast(i, x, d); }
+  }
   return f(mpc_export(i, x), d);
 }
 
 static void mpc_parse_dtor(mpc_input_t *i, mpc_dtor_t d, mpc_val_t *x) {
   if (d == free) { mpc_free(i, x); return; }
+  if (d == (mpc_dtor_t)mpc_ast_delete && (i->flags & MPC_INPUT_AST_ARENA)) { return; }
   d(mpc_export(i, x));
 }
 
@@ -1013,12 +2028,109 @@ enum {
   if (x) { MPC_SUCCESS(r->output); } \
   else { MPC_FAILURE(NULL); }
 
-static int mpc_parse_run(mpc_input_t *i, mpc_parser_t *p, mpc_result_t *r, mpc_err_t **e) {
+static int mpc_parse_run(mpc_input_t *i, const mpc_parser_t *p, mpc_result_t *r, mpc_err_t **e);
+
+/*
+** Inside a span no outputs are kept, so repeats
+** and sequences run without a results array and
+** never call their fold or destructors.
+*/
+
+static int mpc_parse_span(mpc_input_t *i, const mpc_parser_t *p, mpc_result_t *r, mpc_err_t **e) {
+  
+  int j = 0;
+  
+  switch (p->type) {
+    
+    case MPC_TYPE_MANY:
+    case MPC_TYPE_MANY1:
+      while (mpc_parse_run(i, p->data.repeat.x, r, e)) { j++; }
+      if (j == 0 && p->type == MPC_TYPE_MANY1) {
+        MPC_FAILURE(mpc_err_many1(i, r->error));
+      }
+      *e = mpc_err_merge(i, *e, r->error);
+      MPC_SUCCESS(NULL);
+    
+    case MPC_TYPE_COUNT:
+      mpc_input_mark(i);
+      while (j < p->data.repeat.n && mpc_parse_run(i, p->data.repeat.x, r, e)) { j++; }
+      if (j == p->data.repeat.n) {
+        mpc_input_unmark(i);
+        MPC_SUCCESS(NULL);
+      }
+      mpc_input_rewind(i);
+      MPC_FAILURE(mpc_err_count(i, r->error, p->data.repeat.n));
+    
+    case MPC_TYPE_AND:
+      mpc_input_mark(i);
+      for (j = 0; j < p->data.and.n; j++) {
+        if (!mpc_parse_run(i, p->data.and.xs[j], r, e)) {
+          mpc_input_rewind(i);
+          MPC_FAILURE(r->error);
+        }
+      }
+      mpc_input_unmark(i);
+      MPC_SUCCESS(NULL);
+    
+    default: return 0;
+  }
+  
+}
+
+/*
+** A string made by joining single characters
+** reports a failure at the character that did
+** not match, as the sequence it replaced did,
+** using a table of their quoted forms.
+*/
+
+static int mpc_parse_chars(mpc_input_t *i, const mpc_parser_t *p, mpc_result_t *r) {
+  
+  const char *x = p->data.string.x;
+  
+  if (!p->data.string.m) {
+    MPC_PRIMITIVE(mpc_input_string(i, x, (char**)&r->output));
+  }
+  
+  mpc_input_mark(i);
+  for (; *x; x++) {
+    if (!mpc_input_char(i, *x, NULL)) {
+      r->error = mpc_err_new(i, p->data.string.m + (x - p->data.string.x) * 4);
+      mpc_input_rewind(i);
+      return 0;
+    }
+  }
+  mpc_input_unmark(i);
+  
+  x = p->data.string.x;
+  r->output = i->spans ? NULL : strcpy(mpc_malloc(i, strlen(x) + 1), x);
+  return 1;
+}
+
+/*
+** A scan stands for a `many` of one character
+** class folded into a string, and gives the
+** same error where the run stops.
+*/
+
+static int mpc_parse_scan(mpc_input_t *i, const mpc_parser_t *p, mpc_result_t *r, mpc_err_t **e) {
+  
+  if (!mpc_input_scan(i, p->data.scan.c, p->data.scan.n, i->spans ? NULL : (char**)&r->output)) {
+    MPC_FAILURE(mpc_err_many1(i, mpc_err_new(i, p->data.scan.m)));
+  }
+  
+  *e = mpc_err_merge(i, *e, mpc_err_new(i, p->data.scan.m));
+  MPC_SUCCESS(i->spans ? NULL : r->output);
+}
+
+static int mpc_parse_node(mpc_input_t *i, const mpc_parser_t *p, mpc_result_t *r, mpc_err_t **e) {
   
   int j = 0, k = 0;
+  long pos;
   mpc_result_t results_stk[MPC_PARSE_STACK_MIN];
   mpc_result_t *results;
   int results_slots = MPC_PARSE_STACK_MIN;
+  mpc_err_t *x = NULL;
   
   switch (p->type) {
       
@@ -1027,10 +2139,11 @@ static int mpc_parse_run(mpc_input_t *i, mpc_parser_t *p, mpc_result_t *r, mpc_e
     case MPC_TYPE_ANY:     MPC_PRIMITIVE(mpc_input_any(i, (char**)&r->output));
     case MPC_TYPE_SINGLE:  MPC_PRIMITIVE(mpc_input_char(i, p->data.single.x, (char**)&r->output));
     case MPC_TYPE_RANGE:   MPC_PRIMITIVE(mpc_input_range(i, p->data.range.x, p->data.range.y, (char**)&r->output));
-    case MPC_TYPE_ONEOF:   MPC_PRIMITIVE(mpc_input_oneof(i, p->data.string.x, (char**)&r->output));
-    case MPC_TYPE_NONEOF:  MPC_PRIMITIVE(mpc_input_noneof(i, p->data.string.x, (char**)&r->output));
+    case MPC_TYPE_ONEOF:   MPC_PRIMITIVE(mpc_input_set(i, p->data.set.s, (char**)&r->output));
+    case MPC_TYPE_NONEOF:  MPC_PRIMITIVE(mpc_input_set(i, p->data.set.s, (char**)&r->output));
     case MPC_TYPE_SATISFY: MPC_PRIMITIVE(mpc_input_satisfy(i, p->data.satisfy.f, (char**)&r->output));
-    case MPC_TYPE_STRING:  MPC_PRIMITIVE(mpc_input_string(i, p->data.string.x, (char**)&r->output));
+    case MPC_TYPE_STRING:  return mpc_parse_chars(i, p, r);
+    case MPC_TYPE_SCAN:    return mpc_parse_scan(i, p, r, e);
     case MPC_TYPE_ANCHOR:  MPC_PRIMITIVE(mpc_input_anchor(i, p->data.anchor.f, (char**)&r->output));
     
     /* Other parsers */
@@ -1038,29 +2151,29 @@ static int mpc_parse_run(mpc_input_t *i, mpc_parser_t *p, mpc_result_t *r, mpc_e
     case MPC_TYPE_UNDEFINED: MPC_FAILURE(mpc_err_fail(i, "Parser Undefined!"));
     case MPC_TYPE_PASS:      MPC_SUCCESS(NULL);
     case MPC_TYPE_FAIL:      MPC_FAILURE(mpc_err_fail(i, p->data.fail.m));
-    case MPC_TYPE_LIFT:      MPC_SUCCESS(p->data.lift.lf());
-    case MPC_TYPE_LIFT_VAL:  MPC_SUCCESS(p->data.lift.x);
-    case MPC_TYPE_STATE:     MPC_SUCCESS(mpc_input_state_copy(i));
+    case MPC_TYPE_LIFT:      MPC_SUCCESS(i->spans ? NULL : p->data.lift.lf());
+    case MPC_TYPE_LIFT_VAL:  MPC_SUCCESS(i->spans ? NULL : p->data.lift.x);
+    case MPC_TYPE_STATE:     MPC_SUCCESS(i->spans ? NULL : mpc_input_state_copy(i));
     
     /* Application Parsers */
     
     case MPC_TYPE_APPLY:
       if (mpc_parse_run(i, p->data.apply.x, r, e)) {
-        MPC_SUCCESS(mpc_parse_apply(i, p->data.apply.f, r->output));
+        MPC_SUCCESS(i->spans ? NULL : mpc_parse_apply(i, p->data.apply.f, r->output));
       } else {
         MPC_FAILURE(r->output);
       }
     
     case MPC_TYPE_APPLY_TO:
       if (mpc_parse_run(i, p->data.apply_to.x, r, e)) {
-        MPC_SUCCESS(mpc_parse_apply_to(i, p->data.apply_to.f, r->output, p->data.apply_to.d));
+        MPC_SUCCESS(i->spans ? NULL : mpc_parse_apply_to(i, p->data.apply_to.f, r->output, p->data.apply_to.d));
       } else {
         MPC_FAILURE(r->error);
       }
 
     case MPC_TYPE_CHECK:
       if (mpc_parse_run(i, p->data.check.x, r, e)) {
-        if (p->data.check.f(&r->output)) {
+        if (i->spans || p->data.check.f(&r->output)) {
           MPC_SUCCESS(r->output);
         } else {
           MPC_FAILURE(mpc_err_fail(i, p->data.check.e));
@@ -1071,7 +2184,7 @@ static int mpc_parse_run(mpc_input_t *i, mpc_parser_t *p, mpc_result_t *r, mpc_e
 
     case MPC_TYPE_CHECK_WITH:
       if (mpc_parse_run(i, p->data.check_with.x, r, e)) {
-        if (p->data.check_with.f(&r->output, p->data.check_with.d)) {
+        if (i->spans || p->data.check_with.f(&r->output, p->data.check_with.d)) {
           MPC_SUCCESS(r->output);
         } else {
           MPC_FAILURE(mpc_err_fail(i, p->data.check_with.e));
@@ -1100,6 +2213,33 @@ static int mpc_parse_run(mpc_input_t *i, mpc_parser_t *p, mpc_result_t *r, mpc_e
         MPC_FAILURE(r->error);
       }
     
+    case MPC_TYPE_REGEX:
+      r->output = NULL;
+      j = mpc_input_dfa(i, p->data.regex.d, i->spans ? NULL : (char**)&r->output, e);
+      if (j == 1) { MPC_SUCCESS(r->output); }
+      if (j == 0 && i->suppress) { MPC_FAILURE(NULL); }
+      return mpc_parse_run(i, p->data.regex.x, r, e);
+    
+    case MPC_TYPE_DEFERRED:
+      mpc_input_deferred_enable(i);
+      if (mpc_parse_run(i, p->data.predict.x, r, e)) {
+        mpc_input_deferred_disable(i);
+        MPC_SUCCESS(r->output);
+      } else {
+        mpc_input_deferred_disable(i);
+        MPC_FAILURE(r->error);
+      }
+    
+    case MPC_TYPE_SPAN:
+      if (i->spans) { return mpc_parse_run(i, p->data.predict.x, r, e); }
+      j = mpc_input_span_begin(i);
+      if (mpc_parse_run(i, p->data.predict.x, r, e)) {
+        MPC_SUCCESS(mpc_input_span_end(i, 1, j));
+      } else {
+        mpc_input_span_end(i, 0, j);
+        MPC_FAILURE(r->error);
+      }
+    
     /* Optional Parsers */
     
     /* TODO: Update Not Error Message */
@@ -1110,26 +2250,30 @@ static int mpc_parse_run(mpc_input_t *i, mpc_parser_t *p, mpc_result_t *r, mpc_e
       if (mpc_parse_run(i, p->data.not.x, r, e)) {
         mpc_input_rewind(i);
         mpc_input_suppress_disable(i);
-        mpc_parse_dtor(i, p->data.not.dx, r->output);
+        if (!i->spans) { mpc_parse_dtor(i, p->data.not.dx, r->output); }
         MPC_FAILURE(mpc_err_new(i, "opposite"));
       } else {
         mpc_input_unmark(i);
         mpc_input_suppress_disable(i);
-        MPC_SUCCESS(p->data.not.lf());
+        if (i->limited) { MPC_FAILURE(r->error); }
+        MPC_SUCCESS(i->spans ? NULL : p->data.not.lf());
       }
     
     case MPC_TYPE_MAYBE:
       if (mpc_parse_run(i, p->data.not.x, r, e)) {
         MPC_SUCCESS(r->output);
       } else {
+        if (i->limited) { MPC_FAILURE(r->error); }
         *e = mpc_err_merge(i, *e, r->error);
-        MPC_SUCCESS(p->data.not.lf());
+        MPC_SUCCESS(i->spans ? NULL : p->data.not.lf());
       }
     
     /* Repeat Parsers */
     
     case MPC_TYPE_MANY:
       
+      if (i->spans) { return mpc_parse_span(i, p, r, e); }
+      
       results = results_stk;
       
       while (mpc_parse_run(i, p->data.repeat.x, &results[j], e)) {
@@ -1151,6 +2295,8 @@ static int mpc_parse_run(mpc_input_t *i, mpc_parser_t *p, mpc_result_t *r, mpc_e
     
     case MPC_TYPE_MANY1:
       
+      if (i->spans) { return mpc_parse_span(i, p, r, e); }
+      
       results = results_stk;
       
       while (mpc_parse_run(i, p->data.repeat.x, &results[j], e)) {
@@ -1178,20 +2324,25 @@ static int mpc_parse_run(mpc_input_t *i, mpc_parser_t *p, mpc_result_t *r, mpc_e
     
     case MPC_TYPE_COUNT:
       
+      if (i->spans) { return mpc_parse_span(i, p, r, e); }
+      
       results = p->data.repeat.n > MPC_PARSE_STACK_MIN
         ? mpc_malloc(i, sizeof(mpc_result_t) * p->data.repeat.n)
         : results_stk;
       
+      mpc_input_mark(i);
       while (mpc_parse_run(i, p->data.repeat.x, &results[j], e)) {
         j++;
         if (j == p->data.repeat.n) { break; }
       }
       
       if (j == p->data.repeat.n) {
+        mpc_input_unmark(i);
         MPC_SUCCESS(
           mpc_parse_fold(i, p->data.repeat.f, j, (mpc_val_t**)results);
           if (p->data.repeat.n > MPC_PARSE_STACK_MIN) { mpc_free(i, results); });
       } else {
+        mpc_input_rewind(i);
         for (k = 0; k < j; k++) {
           mpc_parse_dtor(i, p->data.repeat.dx, results[k].output);
         }
@@ -1206,26 +2357,51 @@ static int mpc_parse_run(mpc_input_t *i, mpc_parser_t *p, mpc_result_t *r, mpc_e
       
       if (p->data.or.n == 0) { MPC_SUCCESS(NULL); }
       
-      results = p->data.or.n > MPC_PARSE_STACK_MIN
-        ? mpc_malloc(i, sizeof(mpc_result_t) * p->data.or.n)
-        : results_stk;
+      /*
+      ** If only one alternative can start with the
+      ** next character run just that one. Should it
+      ** fail the others are still run in order to
+      ** collect their errors, but none can succeed.
+      **
+      ** Without backtracking a failed alternative
+      ** may leave the input moved on. Run in order
+      ** those before it would have failed where it
+      ** started, so only those after it are run.
+      */
       
-      for (j = 0; j < p->data.or.n; j++) {
-        if (mpc_parse_run(i, p->data.or.xs[j], &results[j], e)) {
-          MPC_SUCCESS(results[j].output;
-            if (p->data.or.n > MPC_PARSE_STACK_MIN) { mpc_free(i, results); });
+      k = p->data.or.jump && !(i->flags & MPC_INPUT_NO_DISPATCH)
+        ? p->data.or.jump[(unsigned char)mpc_input_peekc(i)] : 0;
+      
+      if (k) {
+        pos = i->pos;
+        if (mpc_parse_run(i, p->data.or.xs[k-1], r, e)) { MPC_SUCCESS(r->output); }
+        if (i->suppress) { MPC_FAILURE(NULL); }
+        x = r->error;
+        if (i->pos != pos) {
+          *e = mpc_err_merge(i, *e, x);
+          j = k;
+          k = 0;
+        }
+      }
+      
+      for (; j < p->data.or.n; j++) {
+        if (j == k-1) {
+          *e = mpc_err_merge(i, *e, x);
+        } else if (mpc_parse_run(i, p->data.or.xs[j], r, e)) {
+          MPC_SUCCESS(r->output);
         } else {
-          *e = mpc_err_merge(i, *e, results[j].error);
+          *e = mpc_err_merge(i, *e, r->error);
         } 
       }
       
-      MPC_FAILURE(NULL;
-        if (p->data.or.n > MPC_PARSE_STACK_MIN) { mpc_free(i, results); });
+      MPC_FAILURE(NULL);
     
     case MPC_TYPE_AND:
       
       if (p->data.and.n == 0) { MPC_SUCCESS(NULL); }
       
+      if (i->spans) { return mpc_parse_span(i, p, r, e); }
+      
       results = p->data.or.n > MPC_PARSE_STACK_MIN
         ? mpc_malloc(i, sizeof(mpc_result_t) * p->data.or.n)
         : results_stk;
@@ -1261,21 +2437,234 @@ static int mpc_parse_run(mpc_input_t *i, mpc_parser_t *p, mpc_result_t *r, mpc_e
 #undef MPC_FAILURE
 #undef MPC_PRIMITIVE
 
-int mpc_parse_input(mpc_input_t *i, mpc_parser_t *p, mpc_result_t *r) {
+/*
+** Named parsers are run through the profile when
+** one is attached. Time is only taken when the
+** outermost call of a parser returns so that
+** recursive rules are not counted twice.
+*/
+
+static int mpc_profile_find(mpc_profile_t *f, const mpc_parser_t *p) {
+  
+  int j, *t;
+  unsigned long h = ((unsigned long)(size_t)p >> 4) * 2654435761UL;
+  mpc_profile_entry_t *y;
+  
+  t = &f->table[h & (unsigned long)(f->slots-1)];
+  while (*t && f->entries[*t-1].p != p) {
+    t = t == &f->table[f->slots-1] ? f->table : t+1;
+  }
+  
+  if (*t) { return *t-1; }
+  
+  y = &f->entries[f->num];
+  memset(y, 0, sizeof(mpc_profile_entry_t));
+  y->p = p;
+  y->name = malloc(strlen(p->name) + 1);
+  strcpy(y->name, p->name);
+  *t = ++f->num;
+  
+  if (f->num * 2 >= f->slots) {
+    f->slots *= 2;
+    f->entries = realloc(f->entries, sizeof(mpc_profile_entry_t) * f->slots / 2);
+    f->table = realloc(f->table, sizeof(int) * f->slots);
+    memset(f->table, 0, sizeof(int) * f->slots);
+    for (j = 0; j < f->num; j++) {
+      h = ((unsigned long)(size_t)f->entries[j].p >> 4) * 2654435761UL;
+      t = &f->table[h & (unsigned long)(f->slots-1)];
+      while (*t) { t = t == &f->table[f->slots-1] ? f->table : t+1; }
+      *t = j+1;
+    }
+  }
+  
+  return f->num-1;
+}
+
+static int mpc_parse_profiled(mpc_input_t *i, const mpc_parser_t *p, mpc_result_t *r, mpc_err_t **e) {
+  
+  int x;
+  long pos = i->pos;
+  mpc_profile_t *f = i->profile;
+  mpc_profile_entry_t *y;
+  int k = mpc_profile_find(f, p);
+  
+  if (f->entries[k].active++ == 0) { f->entries[k].start = clock(); }
+  
+  if (f->stack_num == f->stack_slots) {
+    f->stack_slots *= 2;
+    f->stack = realloc(f->stack, sizeof(int) * f->stack_slots);
+  }
+  f->stack[f->stack_num++] = k;
+  
+  x = mpc_parse_node(i, p, r, e);
+  
+  f->stack_num--;
+  
+  /* Entries may have moved while the parser ran */
+  y = &f->entries[k];
+  y->calls++;
+  if (x) { y->successes++; y->bytes += i->pos - pos; } else { y->failures++; }
+  if (--y->active == 0) { y->time += clock() - y->start; }
+  
+  return x;
+}
+
+/*
+** Limits guard against hostile input. They are
+** checked each time a parser starts, and once
+** one is hit every parser fails, including ones
+** such as `mpc_maybe` which would normally turn
+** a failure into a success, so the whole parse
+** unwinds and reports which limit was hit.
+** Repeats have no destructor for what they have
+** matched so end as usual, and the next parser
+** to start fails instead.
+**
+** Depth counts parsers running inside one
+** another, so each level of nesting in the
+** input uses several. Length is checked against
+** the position so a single token may run past
+** it before the next parser starts.
+*/
+
+static int mpc_parse_limit(mpc_input_t *i, long depth) {
+  if (i->limited) { return 0; }
+  if (i->limit_steps && ++i->steps > i->limit_steps) {
+    i->limited = "Parse took more steps than the limit!";
+  } else if (i->limit_depth && depth > i->limit_depth) {
+    i->limited = "Input nests deeper than the limit!";
+  } else if (i->limit_length && i->pos > i->limit_length) {
+    i->limited = "Input is longer than the limit!";
+  }
+  return i->limited == NULL;
+}
+
+static int mpc_parse_limited(mpc_input_t *i, const mpc_parser_t *p, mpc_result_t *r, mpc_err_t **e) {
+  
   int x;
+  
+  if (!mpc_parse_limit(i, i->depth + 1)) {
+    r->error = NULL;
+    return 0;
+  }
+  
+  i->depth++;
+  x = i->profile && p->name ? mpc_parse_profiled(i, p, r, e) : mpc_parse_node(i, p, r, e);
+  i->depth--;
+  
+  return x;
+}
+
+static int mpc_parse_run(mpc_input_t *i, const mpc_parser_t *p, mpc_result_t *r, mpc_err_t **e) {
+  if (i->limit_depth || i->limit_length || i->limit_steps) { return mpc_parse_limited(i, p, r, e); }
+  if (i->profile && p->name) { return mpc_parse_profiled(i, p, r, e); }
+  return mpc_parse_node(i, p, r, e);
+}
+
+static mpc_err_t *mpc_parse_begin(mpc_input_t *i) {
   mpc_err_t *e = mpc_err_fail(i, "Unknown Error");
   e->state = mpc_state_invalid();
-  x = mpc_parse_run(i, p, r, &e);
+  i->furthest_pos = -1;
+  i->depth = 0;
+  i->steps = 0;
+  i->limited = NULL;
+  return e;
+}
+
+static int mpc_parse_end(mpc_input_t *i, int x, mpc_err_t *e, mpc_result_t *r) {
   if (x) {
     mpc_err_delete_internal(i, e);
     r->output = mpc_export(i, r->output);
+    if (i->flags & MPC_INPUT_AST_ARENA) { r->output = mpc_ast_arena_finish(i, r->output); }
+  } else if (i->limited) {
+    mpc_ast_arena_delete((mpc_ast_t*)i->ast_arena);
+    i->ast_arena = NULL;
+    mpc_err_delete_internal(i, e);
+    mpc_err_delete_internal(i, r->error);
+    r->error = mpc_err_export(i, mpc_err_fail(i, i->limited));
   } else {
+    mpc_ast_arena_delete((mpc_ast_t*)i->ast_arena);
+    i->ast_arena = NULL;
+    e = mpc_err_merge(i, e, mpc_err_furthest(i));
     r->error = mpc_err_export(i, mpc_err_merge(i, e, r->error));
   }
+  mpc_mem_reset(i);
   return x;
 }
 
-int mpc_parse(const char *filename, const char *string, mpc_parser_t *p, mpc_result_t *r) {
+int mpc_parse_input(mpc_input_t *i, const mpc_parser_t *p, mpc_result_t *r) {
+  mpc_err_t *e = mpc_parse_begin(i);
+  int x = mpc_parse_run(i, p, r, &e);
+  return mpc_parse_end(i, x, e, r);
+}
+
+/*
+** Rather than parsing a whole input in one go
+** `mpc_parse_next` can be called repeatedly on
+** the same input to read one item at a time.
+**
+** Leading whitespace is skipped before each
+** item and position information carries over
+** so errors still report the correct row and
+** column.
+**
+** Because nothing is marked between items a
+** pipe only ever buffers the item currently
+** being parsed, so memory use is proportional
+** to the largest item rather than the input.
+**
+** Once the input is exhausted zero is returned
+** with `r->error` set to `NULL`. Parsing cannot
+** resume after an item fails to parse.
+*/
+
+static char mpc_input_skip_space(mpc_input_t *i) {
+  char c;
+  while (1) {
+    c = mpc_input_peekc(i);
+    if (c == '\0' || !isspace((unsigned char)c)) { return c; }
+    mpc_input_any(i, NULL);
+  }
+}
+
+int mpc_parse_next(mpc_input_t *i, const mpc_parser_t *p, mpc_result_t *r) {
+
+  char c = mpc_input_skip_space(i);
+
+  if (c == '\0' && mpc_input_terminated(i)) {
+    r->error = NULL;
+    return 0;
+  }
+
+  return mpc_parse_input(i, p, r);
+}
+
+void mpc_input_flags(mpc_input_t *i, int flags) {
+  i->flags = flags;
+}
+
+long mpc_input_allocs(mpc_input_t *i) {
+  return i->allocs;
+}
+
+void mpc_input_origin(mpc_input_t *i, mpc_state_t s) {
+  i->origin = s;
+}
+
+void mpc_input_limits(mpc_input_t *i, long depth, long length, long steps) {
+  i->limit_depth = depth;
+  i->limit_length = length;
+  i->limit_steps = steps;
+}
+
+void mpc_input_arena(mpc_input_t *i, size_t size) {
+  free(i->arena);
+  i->arena = NULL;
+  i->arena_size = size;
+  mpc_mem_reset(i);
+}
+
+int mpc_parse(const char *filename, const char *string, const mpc_parser_t *p, mpc_result_t *r) {
   int x;
   mpc_input_t *i = mpc_input_new_string(filename, string);
   x = mpc_parse_input(i, p, r);
@@ -1283,7 +2672,7 @@ int mpc_parse(const char *filename, const char *string, mpc_parser_t *p, mpc_res
   return x;
 }
 
-int mpc_nparse(const char *filename, const char *string, size_t length, mpc_parser_t *p, mpc_result_t *r) {
+int mpc_nparse(const char *filename, const char *string, size_t length, const mpc_parser_t *p, mpc_result_t *r) {
   int x;
   mpc_input_t *i = mpc_input_new_nstring(filename, string, length);
   x = mpc_parse_input(i, p, r);
@@ -1291,7 +2680,7 @@ int mpc_nparse(const char *filename, const char *string, size_t length, mpc_pars
   return x;
 }
 
-int mpc_parse_file(const char *filename, FILE *file, mpc_parser_t *p, mpc_result_t *r) {
+int mpc_parse_file(const char *filename, FILE *file, const mpc_parser_t *p, mpc_result_t *r) {
   int x;
   mpc_input_t *i = mpc_input_new_file(filename, file);
   x = mpc_parse_input(i, p, r);
@@ -1299,7 +2688,7 @@ int mpc_parse_file(const char *filename, FILE *file, mpc_parser_t *p, mpc_result
   return x;
 }
 
-int mpc_parse_pipe(const char *filename, FILE *pipe, mpc_parser_t *p, mpc_result_t *r) {
+int mpc_parse_pipe(const char *filename, FILE *pipe, const mpc_parser_t *p, mpc_result_t *r) {
   int x;
   mpc_input_t *i = mpc_input_new_pipe(filename, pipe);
   x = mpc_parse_input(i, p, r);
@@ -1307,7 +2696,7 @@ int mpc_parse_pipe(const char *filename, FILE *pipe, mpc_parser_t *p, mpc_result
   return x;
 }
 
-int mpc_parse_contents(const char *filename, mpc_parser_t *p, mpc_result_t *r) {
+int mpc_parse_contents(const char *filename, const mpc_parser_t *p, mpc_result_t *r) {
   
   FILE *f = fopen(filename, "rb");
   int res;
@@ -1323,6 +2712,532 @@ int mpc_parse_contents(const char *filename, mpc_parser_t *p, mpc_result_t *r) {
   return res;
 }
 
+/*
+** Compiled Parsers
+**
+** `mpc_compile` lays a parser graph out as one
+** array of instructions which refer to their
+** children by index. `mpc_program_run` runs it
+** with a stack of frames rather than recursing.
+** Each frame is one call of `mpc_parse_run`
+** turned inside out: it is entered with `ret`
+** set to -1 and resumed with `ret` set to the
+** result of the child it ran.
+**
+** Outputs are kept on a separate value stack
+** addressed by index so that it may be grown.
+** Sequences and repeats reserve their slots on
+** top of it while they run.
+**
+** A program points into the parser it was built
+** from. That parser must outlive the program and
+** should not be changed once it is compiled.
+*/
+
+typedef struct {
+  char type;
+  int n;
+  int x;
+  mpc_parser_t *p;
+} mpc_insn_t;
+
+struct mpc_program_t {
+  int num;
+  mpc_insn_t *insns;
+  int *kids;
+};
+
+typedef struct {
+  int insn;
+  int out;
+  int base;
+  int j;
+  int k;
+  long pos;
+  mpc_err_t *x;
+} mpc_frame_t;
+
+enum {
+  MPC_PROGRAM_STACK_MIN = 64
+};
+
+static int mpc_compile_children(mpc_parser_t *p, mpc_parser_t ***xs) {
+  switch (p->type) {
+    case MPC_TYPE_EXPECT:     *xs = &p->data.expect.x; return 1;
+    case MPC_TYPE_APPLY:      *xs = &p->data.apply.x; return 1;
+    case MPC_TYPE_APPLY_TO:   *xs = &p->data.apply_to.x; return 1;
+    case MPC_TYPE_CHECK:      *xs = &p->data.check.x; return 1;
+    case MPC_TYPE_CHECK_WITH: *xs = &p->data.check_with.x; return 1;
+    case MPC_TYPE_PREDICT:
+    case MPC_TYPE_DEFERRED:
+    case MPC_TYPE_SPAN:       *xs = &p->data.predict.x; return 1;
+    case MPC_TYPE_REGEX:      *xs = &p->data.regex.x; return 1;
+    case MPC_TYPE_NOT:
+    case MPC_TYPE_MAYBE:      *xs = &p->data.not.x; return 1;
+    case MPC_TYPE_MANY:
+    case MPC_TYPE_MANY1:
+    case MPC_TYPE_COUNT:      *xs = &p->data.repeat.x; return 1;
+    case MPC_TYPE_OR:         *xs = p->data.or.xs; return p->data.or.n;
+    case MPC_TYPE_AND:        *xs = p->data.and.xs; return p->data.and.n;
+    default:                  *xs = NULL; return 0;
+  }
+}
+
+/*
+** Parsers are numbered in the order they are
+** first reached. A hash table from parser to
+** number (plus one, so zero is empty) is used
+** to find those already seen.
+*/
+
+static int *mpc_compile_slot(int *table, int slots, mpc_parser_t **nodes, mpc_parser_t *p) {
+  unsigned long h = ((unsigned long)(size_t)p >> 4) * 2654435761UL;
+  int *t = &table[h & (unsigned long)(slots-1)];
+  while (*t && nodes[*t-1] != p) {
+    t = t == &table[slots-1] ? table : t+1;
+  }
+  return t;
+}
+
+mpc_program_t *mpc_compile(mpc_parser_t *p) {
+  
+  int j, k, n, *t;
+  int num = 1, slots = 64, kids_num = 0;
+  int *table = calloc(slots, sizeof(int));
+  mpc_parser_t **nodes = malloc(sizeof(mpc_parser_t*) * slots);
+  mpc_parser_t **xs;
+  mpc_program_t *c;
+  
+  nodes[0] = p;
+  *mpc_compile_slot(table, slots, nodes, p) = 1;
+  
+  for (j = 0; j < num; j++) {
+    
+    n = mpc_compile_children(nodes[j], &xs);
+    if (nodes[j]->type == MPC_TYPE_OR || nodes[j]->type == MPC_TYPE_AND) { kids_num += n; }
+    
+    for (k = 0; k < n; k++) {
+      
+      t = mpc_compile_slot(table, slots, nodes, xs[k]);
+      if (*t) { continue; }
+      
+      nodes[num] = xs[k];
+      *t = ++num;
+      
+      if (num * 2 > slots) {
+        slots *= 2;
+        nodes = realloc(nodes, sizeof(mpc_parser_t*) * slots);
+        free(table);
+        table = calloc(slots, sizeof(int));
+        for (n = 0; n < num; n++) {
+          *mpc_compile_slot(table, slots, nodes, nodes[n]) = n+1;
+        }
+        n = mpc_compile_children(nodes[j], &xs);
+      }
+    }
+  }
+  
+  c = malloc(sizeof(mpc_program_t));
+  c->num = num;
+  c->insns = malloc(sizeof(mpc_insn_t) * num);
+  c->kids = malloc(sizeof(int) * (kids_num ? kids_num : 1));
+  kids_num = 0;
+  
+  for (j = 0; j < num; j++) {
+    
+    n = mpc_compile_children(nodes[j], &xs);
+    c->insns[j].type = nodes[j]->type;
+    c->insns[j].p = nodes[j];
+    c->insns[j].n = nodes[j]->type == MPC_TYPE_COUNT ? nodes[j]->data.repeat.n : n;
+    c->insns[j].x = 0;
+    
+    if (nodes[j]->type == MPC_TYPE_OR || nodes[j]->type == MPC_TYPE_AND) {
+      c->insns[j].x = kids_num;
+      for (k = 0; k < n; k++) {
+        c->kids[kids_num++] = *mpc_compile_slot(table, slots, nodes, xs[k]) - 1;
+      }
+    } else if (n) {
+      c->insns[j].x = *mpc_compile_slot(table, slots, nodes, xs[0]) - 1;
+    }
+  }
+  
+  free(table);
+  free(nodes);
+  
+  return c;
+}
+
+void mpc_program_delete(mpc_program_t *c) {
+  free(c->insns);
+  free(c->kids);
+  free(c);
+}
+
+#define MPC_RUN_SUCCESS(x) { vs[f->out].output = (x); ret = 1; num--; continue; }
+#define MPC_RUN_FAILURE(x) { vs[f->out].error = (x); ret = 0; num--; continue; }
+#define MPC_RUN_RETURN() { num--; continue; }
+#define MPC_RUN_PRIMITIVE(x) \
+  if (x) { ret = 1; num--; continue; } \
+  else { MPC_RUN_FAILURE(NULL); }
+
+#define MPC_RUN_CALL(c_, o_) { \
+  call = (c_); out = (o_); \
+  if (num == slots) { \
+    slots += slots / 2; \
+    fs = realloc(fs, sizeof(mpc_frame_t) * slots); \
+  } \
+  fs[num].insn = call; fs[num].out = out; fs[num].j = 0; \
+  num++; ret = -1; continue; }
+
+#define MPC_RUN_RESERVE(m) { \
+  vnum = (m); \
+  if (vnum > vslots) { \
+    vslots = vnum + vnum / 2; \
+    vs = realloc(vs, sizeof(mpc_result_t) * vslots); \
+  } }
+
+static int mpc_program_run(mpc_input_t *i, const mpc_program_t *c, mpc_result_t *r, mpc_err_t **e) {
+  
+  int j, call, out, ret = -1, num = 1, vnum = 1;
+  int limits = i->limit_depth || i->limit_length || i->limit_steps;
+  int slots = MPC_PROGRAM_STACK_MIN, vslots = MPC_PROGRAM_STACK_MIN;
+  mpc_frame_t *fs = malloc(sizeof(mpc_frame_t) * slots), *f;
+  mpc_result_t *vs = malloc(sizeof(mpc_result_t) * vslots);
+  mpc_insn_t *in;
+  mpc_parser_t *p;
+  
+  fs[0].insn = 0;
+  fs[0].out = 0;
+  fs[0].j = 0;
+  
+  while (num) {
+    
+    f = &fs[num-1];
+    in = &c->insns[f->insn];
+    p = in->p;
+    
+    /* Frames start with `ret` negative */
+    if (limits && ret < 0 && !mpc_parse_limit(i, num)) { MPC_RUN_FAILURE(NULL); }
+    
+    switch (in->type) {
+      
+      /* Basic Parsers */
+      
+      case MPC_TYPE_ANY:     MPC_RUN_PRIMITIVE(mpc_input_any(i, (char**)&vs[f->out].output));
+      case MPC_TYPE_SINGLE:  MPC_RUN_PRIMITIVE(mpc_input_char(i, p->data.single.x, (char**)&vs[f->out].output));
+      case MPC_TYPE_RANGE:   MPC_RUN_PRIMITIVE(mpc_input_range(i, p->data.range.x, p->data.range.y, (char**)&vs[f->out].output));
+      case MPC_TYPE_ONEOF:   MPC_RUN_PRIMITIVE(mpc_input_set(i, p->data.set.s, (char**)&vs[f->out].output));
+      case MPC_TYPE_NONEOF:  MPC_RUN_PRIMITIVE(mpc_input_set(i, p->data.set.s, (char**)&vs[f->out].output));
+      case MPC_TYPE_SATISFY: MPC_RUN_PRIMITIVE(mpc_input_satisfy(i, p->data.satisfy.f, (char**)&vs[f->out].output));
+      case MPC_TYPE_STRING:  ret = mpc_parse_chars(i, p, &vs[f->out]); MPC_RUN_RETURN();
+      case MPC_TYPE_SCAN:    ret = mpc_parse_scan(i, p, &vs[f->out], e); MPC_RUN_RETURN();
+      case MPC_TYPE_ANCHOR:  MPC_RUN_PRIMITIVE(mpc_input_anchor(i, p->data.anchor.f, (char**)&vs[f->out].output));
+      
+      /* Other parsers */
+      
+      case MPC_TYPE_UNDEFINED: MPC_RUN_FAILURE(mpc_err_fail(i, "Parser Undefined!"));
+      case MPC_TYPE_PASS:      MPC_RUN_SUCCESS(NULL);
+      case MPC_TYPE_FAIL:      MPC_RUN_FAILURE(mpc_err_fail(i, p->data.fail.m));
+      case MPC_TYPE_LIFT:      MPC_RUN_SUCCESS(i->spans ? NULL : p->data.lift.lf());
+      case MPC_TYPE_LIFT_VAL:  MPC_RUN_SUCCESS(i->spans ? NULL : p->data.lift.x);
+      case MPC_TYPE_STATE:     MPC_RUN_SUCCESS(i->spans ? NULL : mpc_input_state_copy(i));
+      
+      /* Application Parsers */
+      
+      case MPC_TYPE_APPLY:
+        if (ret < 0) { MPC_RUN_CALL(in->x, f->out); }
+        if (!ret) { MPC_RUN_RETURN(); }
+        MPC_RUN_SUCCESS(i->spans ? NULL : mpc_parse_apply(i, p->data.apply.f, vs[f->out].output));
+      
+      case MPC_TYPE_APPLY_TO:
+        if (ret < 0) { MPC_RUN_CALL(in->x, f->out); }
+        if (!ret) { MPC_RUN_RETURN(); }
+        MPC_RUN_SUCCESS(i->spans ? NULL : mpc_parse_apply_to(i, p->data.apply_to.f, vs[f->out].output, p->data.apply_to.d));
+      
+      case MPC_TYPE_CHECK:
+        if (ret < 0) { MPC_RUN_CALL(in->x, f->out); }
+        if (!ret || i->spans || p->data.check.f(&vs[f->out].output)) { MPC_RUN_RETURN(); }
+        MPC_RUN_FAILURE(mpc_err_fail(i, p->data.check.e));
+      
+      case MPC_TYPE_CHECK_WITH:
+        if (ret < 0) { MPC_RUN_CALL(in->x, f->out); }
+        if (!ret || i->spans || p->data.check_with.f(&vs[f->out].output, p->data.check_with.d)) { MPC_RUN_RETURN(); }
+        MPC_RUN_FAILURE(mpc_err_fail(i, p->data.check_with.e));
+      
+      case MPC_TYPE_EXPECT:
+        if (ret < 0) {
+          mpc_input_suppress_enable(i);
+          MPC_RUN_CALL(in->x, f->out);
+        }
+        mpc_input_suppress_disable(i);
+        if (ret) { MPC_RUN_RETURN(); }
+        MPC_RUN_FAILURE(mpc_err_new(i, p->data.expect.m));
+      
+      case MPC_TYPE_PREDICT:
+        if (ret < 0) {
+          mpc_input_backtrack_disable(i);
+          MPC_RUN_CALL(in->x, f->out);
+        }
+        mpc_input_backtrack_enable(i);
+        MPC_RUN_RETURN();
+      
+      case MPC_TYPE_REGEX:
+        if (ret >= 0) { MPC_RUN_RETURN(); }
+        vs[f->out].output = NULL;
+        j = mpc_input_dfa(i, p->data.regex.d, i->spans ? NULL : (char**)&vs[f->out].output, e);
+        if (j == 1) { ret = 1; MPC_RUN_RETURN(); }
+        if (j == 0 && i->suppress) { MPC_RUN_FAILURE(NULL); }
+        MPC_RUN_CALL(in->x, f->out);
+      
+      case MPC_TYPE_DEFERRED:
+        if (ret < 0) {
+          mpc_input_deferred_enable(i);
+          MPC_RUN_CALL(in->x, f->out);
+        }
+        mpc_input_deferred_disable(i);
+        MPC_RUN_RETURN();
+      
+      case MPC_TYPE_SPAN:
+        if (ret < 0) {
+          f->j = i->spans > 0;
+          if (!f->j) { f->k = mpc_input_span_begin(i); }
+          MPC_RUN_CALL(in->x, f->out);
+        }
+        if (f->j) { MPC_RUN_RETURN(); }
+        if (ret) { MPC_RUN_SUCCESS(mpc_input_span_end(i, 1, f->k)); }
+        mpc_input_span_end(i, 0, f->k);
+        MPC_RUN_RETURN();
+      
+      /* Optional Parsers */
+      
+      case MPC_TYPE_NOT:
+        if (ret < 0) {
+          mpc_input_mark(i);
+          mpc_input_suppress_enable(i);
+          MPC_RUN_CALL(in->x, f->out);
+        }
+        if (ret) {
+          mpc_input_rewind(i);
+          mpc_input_suppress_disable(i);
+          if (!i->spans) { mpc_parse_dtor(i, p->data.not.dx, vs[f->out].output); }
+          MPC_RUN_FAILURE(mpc_err_new(i, "opposite"));
+        }
+        mpc_input_unmark(i);
+        mpc_input_suppress_disable(i);
+        if (i->limited) { MPC_RUN_RETURN(); }
+        MPC_RUN_SUCCESS(i->spans ? NULL : p->data.not.lf());
+      
+      case MPC_TYPE_MAYBE:
+        if (ret < 0) { MPC_RUN_CALL(in->x, f->out); }
+        if (ret || i->limited) { MPC_RUN_RETURN(); }
+        *e = mpc_err_merge(i, *e, vs[f->out].error);
+        MPC_RUN_SUCCESS(i->spans ? NULL : p->data.not.lf());
+      
+      /* Repeat Parsers */
+      
+      case MPC_TYPE_MANY:
+      case MPC_TYPE_MANY1:
+        
+        if (i->spans) {
+          if (ret < 0) { MPC_RUN_CALL(in->x, f->out); }
+          if (ret) { f->j++; MPC_RUN_CALL(in->x, f->out); }
+          if (f->j == 0 && in->type == MPC_TYPE_MANY1) {
+            MPC_RUN_FAILURE(mpc_err_many1(i, vs[f->out].error));
+          }
+          *e = mpc_err_merge(i, *e, vs[f->out].error);
+          MPC_RUN_SUCCESS(NULL);
+        }
+        
+        if (ret < 0) { f->base = vnum; }
+        if (ret > 0) { f->j++; }
+        if (ret != 0) {
+          MPC_RUN_RESERVE(f->base + f->j + 1);
+          MPC_RUN_CALL(in->x, f->base + f->j);
+        }
+        
+        vnum = f->base;
+        if (f->j == 0 && in->type == MPC_TYPE_MANY1) {
+          MPC_RUN_FAILURE(mpc_err_many1(i, vs[f->base].error));
+        }
+        *e = mpc_err_merge(i, *e, vs[f->base + f->j].error);
+        MPC_RUN_SUCCESS(mpc_parse_fold(i, p->data.repeat.f, f->j, (mpc_val_t**)(vs + f->base)));
+      
+      case MPC_TYPE_COUNT:
+        
+        if (i->spans) {
+          if (ret < 0) {
+            mpc_input_mark(i);
+            if (f->j < in->n) { MPC_RUN_CALL(in->x, f->out); }
+          } else if (ret && ++f->j < in->n) {
+            MPC_RUN_CALL(in->x, f->out);
+          }
+          if (f->j == in->n) {
+            mpc_input_unmark(i);
+            MPC_RUN_SUCCESS(NULL);
+          }
+          mpc_input_rewind(i);
+          MPC_RUN_FAILURE(mpc_err_count(i, vs[f->out].error, in->n));
+        }
+        
+        if (ret < 0) {
+          f->base = vnum;
+          mpc_input_mark(i);
+        } else if (ret && ++f->j == in->n) {
+          mpc_input_unmark(i);
+          vnum = f->base;
+          MPC_RUN_SUCCESS(mpc_parse_fold(i, p->data.repeat.f, f->j, (mpc_val_t**)(vs + f->base)));
+        }
+        
+        if (ret != 0) {
+          MPC_RUN_RESERVE(f->base + f->j + 1);
+          MPC_RUN_CALL(in->x, f->base + f->j);
+        }
+        
+        mpc_input_rewind(i);
+        for (j = 0; j < f->j; j++) {
+          mpc_parse_dtor(i, p->data.repeat.dx, vs[f->base + j].output);
+        }
+        vnum = f->base;
+        MPC_RUN_FAILURE(mpc_err_count(i, vs[f->base + f->j].error, in->n));
+      
+      /* Combinatory Parsers */
+      
+      case MPC_TYPE_OR:
+        
+        if (ret < 0) {
+          if (in->n == 0) { MPC_RUN_SUCCESS(NULL); }
+          f->k = p->data.or.jump && !(i->flags & MPC_INPUT_NO_DISPATCH)
+            ? p->data.or.jump[(unsigned char)mpc_input_peekc(i)] : 0;
+          if (f->k) {
+            f->j = -1;
+            f->pos = i->pos;
+            MPC_RUN_CALL(c->kids[in->x + f->k - 1], f->out);
+          }
+        } else if (ret) {
+          MPC_RUN_RETURN();
+        } else if (f->j < 0) {
+          if (i->suppress) { MPC_RUN_FAILURE(NULL); }
+          f->x = vs[f->out].error;
+          f->j = 0;
+          if (i->pos != f->pos) {
+            *e = mpc_err_merge(i, *e, f->x);
+            f->j = f->k;
+            f->k = 0;
+          }
+        } else {
+          *e = mpc_err_merge(i, *e, vs[f->out].error);
+          f->j++;
+        }
+        
+        while (f->j < in->n && f->j == f->k - 1) {
+          *e = mpc_err_merge(i, *e, f->x);
+          f->j++;
+        }
+        
+        if (f->j < in->n) { MPC_RUN_CALL(c->kids[in->x + f->j], f->out); }
+        MPC_RUN_FAILURE(NULL);
+      
+      case MPC_TYPE_AND:
+        
+        if (ret < 0) {
+          if (in->n == 0) { MPC_RUN_SUCCESS(NULL); }
+          f->base = vnum;
+          mpc_input_mark(i);
+          if (!i->spans) { MPC_RUN_RESERVE(vnum + in->n); }
+        } else if (!ret) {
+          mpc_input_rewind(i);
+          if (i->spans) { MPC_RUN_RETURN(); }
+          for (j = 0; j < f->j; j++) {
+            mpc_parse_dtor(i, p->data.and.dxs[j], vs[f->base + j].output);
+          }
+          vnum = f->base;
+          MPC_RUN_FAILURE(vs[f->base + f->j].error);
+        } else if (++f->j == in->n) {
+          mpc_input_unmark(i);
+          if (i->spans) { MPC_RUN_SUCCESS(NULL); }
+          vnum = f->base;
+          MPC_RUN_SUCCESS(mpc_parse_fold(i, p->data.and.f, f->j, (mpc_val_t**)(vs + f->base)));
+        }
+        
+        MPC_RUN_CALL(c->kids[in->x + f->j], i->spans ? f->out : f->base + f->j);
+      
+      /* End */
+      
+      default:
+        
+        MPC_RUN_FAILURE(mpc_err_fail(i, "Unknown Parser Type Id!"));
+    }
+    
+  }
+  
+  *r = vs[0];
+  free(fs);
+  free(vs);
+  return ret;
+}
+
+#undef MPC_RUN_SUCCESS
+#undef MPC_RUN_FAILURE
+#undef MPC_RUN_RETURN
+#undef MPC_RUN_PRIMITIVE
+#undef MPC_RUN_CALL
+#undef MPC_RUN_RESERVE
+
+/*
+** Most inputs parse, and building the errors of
+** every failed alternative is then wasted work.
+** So a program first runs with its errors
+** deferred. Only if that fails is the input
+** rewound and run again to build the same error
+** `mpc_parse_input` would. Pipes can't be rewound
+** once read and are always run once.
+*/
+
+int mpc_parse_input_compiled(mpc_input_t *i, const mpc_program_t *c, mpc_result_t *r) {
+  
+  int x;
+  mpc_err_t *e = mpc_parse_begin(i);
+  
+  if (i->profile) {
+    x = mpc_parse_run(i, c->insns[0].p, r, &e);
+    return mpc_parse_end(i, x, e, r);
+  }
+  
+  if (i->type == MPC_INPUT_PIPE) {
+    x = mpc_program_run(i, c, r, &e);
+    return mpc_parse_end(i, x, e, r);
+  }
+  
+  mpc_input_mark(i);
+  mpc_input_deferred_enable(i);
+  x = mpc_program_run(i, c, r, &e);
+  mpc_input_deferred_disable(i);
+  
+  if (x || i->limited) {
+    mpc_input_unmark(i);
+    return mpc_parse_end(i, x, e, r);
+  }
+  
+  mpc_input_rewind(i);
+  mpc_err_delete_internal(i, e);
+  mpc_err_delete_internal(i, r->error);
+  mpc_ast_arena_delete((mpc_ast_t*)i->ast_arena);
+  i->ast_arena = NULL;
+  mpc_mem_reset(i);
+  
+  e = mpc_parse_begin(i);
+  x = mpc_program_run(i, c, r, &e);
+  return mpc_parse_end(i, x, e, r);
+}
+
+int mpc_parse_compiled(const char *filename, const char *string, const mpc_program_t *c, mpc_result_t *r) {
+  int x;
+  mpc_input_t *i = mpc_input_new_string(filename, string);
+  x = mpc_parse_input_compiled(i, c, r);
+  mpc_input_delete(i);
+  return x;
+}
+
 /*
 ** Building a Parser
 */
@@ -1336,6 +3251,7 @@ static void mpc_undefine_or(mpc_parser_t *p) {
     mpc_undefine_unretained(p->data.or.xs[i], 0);
   }
   free(p->data.or.xs);
+  free(p->data.or.jump);
   
 }
 
@@ -1350,6 +3266,60 @@ static void mpc_undefine_and(mpc_parser_t *p) {
   
 }
 
+static void mpc_dfa_loops(mpc_dfa_t *d) {
+  
+  int j, c, n;
+  unsigned char s[MPC_SET_SIZE];
+  
+  d->loops = NULL;
+  if (d->flags & MPC_DFA_EOI) { return; }
+  
+  d->loops = calloc(d->states, sizeof(mpc_class_t*));
+  for (j = 2; j < d->states; j++) {
+    memset(s, 0, MPC_SET_SIZE);
+    for (c = 0, n = 0; c < 256; c++) {
+      if (d->trans[j * 256 + c] == j) { MPC_SET_ADD(s, c); n++; }
+    }
+    if (n) { d->loops[j] = mpc_class_new(s); }
+  }
+}
+
+static void mpc_dfa_delete(mpc_dfa_t *d) {
+  int j;
+  if (d->loops) {
+    for (j = 0; j < d->states; j++) { free(d->loops[j]); }
+    free(d->loops);
+  }
+  for (j = 0; j < d->states; j++) { free(d->expect[j]); }
+  free(d->expect);
+  free(d->accept);
+  free(d->trans);
+  free(d);
+}
+
+static mpc_dfa_t *mpc_dfa_copy(mpc_dfa_t *a) {
+  int j;
+  size_t n;
+  mpc_dfa_t *d = malloc(sizeof(mpc_dfa_t));
+  d->flags = a->flags;
+  d->states = a->states;
+  d->accept = malloc(d->states);
+  memcpy(d->accept, a->accept, d->states);
+  d->trans = malloc(d->states * 256);
+  memcpy(d->trans, a->trans, d->states * 256);
+  d->expect = malloc(sizeof(char*) * d->states);
+  for (j = 0; j < d->states; j++) {
+    d->expect[j] = NULL;
+    if (a->expect[j]) {
+      n = mpc_dfa_expect_len(a->expect[j]);
+      d->expect[j] = malloc(n);
+      memcpy(d->expect[j], a->expect[j], n);
+    }
+  }
+  mpc_dfa_loops(d);
+  return d;
+}
+
 static void mpc_undefine_unretained(mpc_parser_t *p, int force) {
   
   if (p->retained && !force) { return; }
@@ -1360,13 +3330,29 @@ static void mpc_undefine_unretained(mpc_parser_t *p, int force) {
     
     case MPC_TYPE_ONEOF: 
     case MPC_TYPE_NONEOF:
+      free(p->data.set.x); 
+      break;
+    
     case MPC_TYPE_STRING:
       free(p->data.string.x); 
+      free(p->data.string.m);
+      break;
+    
+    case MPC_TYPE_SCAN:
+      free(p->data.scan.m);
+      free(p->data.scan.c);
       break;
     
     case MPC_TYPE_APPLY:    mpc_undefine_unretained(p->data.apply.x, 0);    break;
     case MPC_TYPE_APPLY_TO: mpc_undefine_unretained(p->data.apply_to.x, 0); break;
     case MPC_TYPE_PREDICT:  mpc_undefine_unretained(p->data.predict.x, 0);  break;
+    case MPC_TYPE_DEFERRED: mpc_undefine_unretained(p->data.predict.x, 0);  break;
+    case MPC_TYPE_SPAN:     mpc_undefine_unretained(p->data.predict.x, 0);  break;
+    
+    case MPC_TYPE_REGEX:
+      mpc_undefine_unretained(p->data.regex.x, 0);
+      mpc_dfa_delete(p->data.regex.d);
+      break;
     
     case MPC_TYPE_MAYBE:
     case MPC_TYPE_NOT:
@@ -1467,14 +3453,35 @@ mpc_parser_t *mpc_copy(mpc_parser_t *a) {
     
     case MPC_TYPE_ONEOF: 
     case MPC_TYPE_NONEOF:
+      p->data.set.x = malloc(strlen(a->data.set.x)+1);
+      strcpy(p->data.set.x, a->data.set.x);
+      break;
+    
     case MPC_TYPE_STRING:
       p->data.string.x = malloc(strlen(a->data.string.x)+1);
       strcpy(p->data.string.x, a->data.string.x);
+      if (a->data.string.m) {
+        p->data.string.m = malloc(strlen(a->data.string.x) * 4);
+        memcpy(p->data.string.m, a->data.string.m, strlen(a->data.string.x) * 4);
+      }
+      break;
+    
+    case MPC_TYPE_SCAN:
+      p->data.scan.m = malloc(strlen(a->data.scan.m)+1);
+      strcpy(p->data.scan.m, a->data.scan.m);
+      p->data.scan.c = mpc_class_new(a->data.scan.s);
       break;
     
     case MPC_TYPE_APPLY:    p->data.apply.x    = mpc_copy(a->data.apply.x);    break;
     case MPC_TYPE_APPLY_TO: p->data.apply_to.x = mpc_copy(a->data.apply_to.x); break;
     case MPC_TYPE_PREDICT:  p->data.predict.x  = mpc_copy(a->data.predict.x);  break;
+    case MPC_TYPE_DEFERRED: p->data.predict.x  = mpc_copy(a->data.predict.x);  break;
+    case MPC_TYPE_SPAN:     p->data.predict.x  = mpc_copy(a->data.predict.x);  break;
+    
+    case MPC_TYPE_REGEX:
+      p->data.regex.x = mpc_copy(a->data.regex.x);
+      p->data.regex.d = mpc_dfa_copy(a->data.regex.d);
+      break;
     
     case MPC_TYPE_MAYBE:
     case MPC_TYPE_NOT:
@@ -1498,6 +3505,11 @@ mpc_parser_t *mpc_copy(mpc_parser_t *a) {
       for (i = 0; i < a->data.or.n; i++) {
         p->data.or.xs[i] = mpc_copy(a->data.or.xs[i]);
       }
+      p->data.or.jump = NULL;
+      if (a->data.or.jump) {
+        p->data.or.jump = malloc(256);
+        memcpy(p->data.or.jump, a->data.or.jump, 256);
+      }
     break;
     case MPC_TYPE_AND:
       p->data.and.xs = malloc(a->data.and.n * sizeof(mpc_parser_t*));
@@ -1719,16 +3731,19 @@ mpc_parser_t *mpc_range(char s, char e) {
 mpc_parser_t *mpc_oneof(const char *s) {
   mpc_parser_t *p = mpc_undefined();
   p->type = MPC_TYPE_ONEOF;
-  p->data.string.x = malloc(strlen(s) + 1);
-  strcpy(p->data.string.x, s);
+  p->data.set.x = malloc(strlen(s) + 1);
+  strcpy(p->data.set.x, s);
+  mpc_set_from_string(p->data.set.s, s);
   return mpc_expectf(p, "one of '%s'", s);
 }
 
 mpc_parser_t *mpc_noneof(const char *s) {
   mpc_parser_t *p = mpc_undefined();
   p->type = MPC_TYPE_NONEOF;
-  p->data.string.x = malloc(strlen(s) + 1);
-  strcpy(p->data.string.x, s);
+  p->data.set.x = malloc(strlen(s) + 1);
+  strcpy(p->data.set.x, s);
+  mpc_set_from_string(p->data.set.s, s);
+  mpc_set_invert(p->data.set.s);
   return mpc_expectf(p, "none of '%s'", s);
 
 }
@@ -1829,6 +3844,20 @@ mpc_parser_t *mpc_predictive(mpc_parser_t *a) {
   return p;
 }
 
+mpc_parser_t *mpc_deferred(mpc_parser_t *a) {
+  mpc_parser_t *p = mpc_undefined();
+  p->type = MPC_TYPE_DEFERRED;
+  p->data.predict.x = a;
+  return p;
+}
+
+mpc_parser_t *mpc_span(mpc_parser_t *a) {
+  mpc_parser_t *p = mpc_undefined();
+  p->type = MPC_TYPE_SPAN;
+  p->data.predict.x = a;
+  return p;
+}
+
 mpc_parser_t *mpc_not_lift(mpc_parser_t *a, mpc_dtor_t da, mpc_ctor_t lf) {
   mpc_parser_t *p = mpc_undefined();
   p->type = MPC_TYPE_NOT;
@@ -1890,6 +3919,7 @@ mpc_parser_t *mpc_or(int n, ...) {
   p->type = MPC_TYPE_OR;
   p->data.or.n = n;
   p->data.or.xs = malloc(sizeof(mpc_parser_t*) * n);
+  p->data.or.jump = NULL;
   
   va_start(va, n);  
   for (i = 0; i < n; i++) {
@@ -1949,7 +3979,7 @@ static int mpc_boundary_anchor(char prev, char next) {
 mpc_parser_t *mpc_boundary(void) { return mpc_expect(mpc_anchor(mpc_boundary_anchor), "boundary"); }
 
 mpc_parser_t *mpc_whitespace(void) { return mpc_expect(mpc_oneof(" \f\n\r\t\v"), "whitespace"); }
-mpc_parser_t *mpc_whitespaces(void) { return mpc_expect(mpc_many(mpcf_strfold, mpc_whitespace()), "spaces"); }
+mpc_parser_t *mpc_whitespaces(void) { return mpc_expect(mpc_span(mpc_many(mpcf_strfold, mpc_whitespace())), "spaces"); }
 mpc_parser_t *mpc_blank(void) { return mpc_expect(mpc_apply(mpc_whitespaces(), mpcf_free), "whitespace"); }
 
 mpc_parser_t *mpc_newline(void) { return mpc_expect(mpc_char('\n'), "newline"); }
@@ -1959,9 +3989,9 @@ mpc_parser_t *mpc_escape(void) { return mpc_and(2, mpcf_strfold, mpc_char('\\'),
 mpc_parser_t *mpc_digit(void) { return mpc_expect(mpc_oneof("0123456789"), "digit"); }
 mpc_parser_t *mpc_hexdigit(void) { return mpc_expect(mpc_oneof("0123456789ABCDEFabcdef"), "hex digit"); }
 mpc_parser_t *mpc_octdigit(void) { return mpc_expect(mpc_oneof("01234567"), "oct digit"); }
-mpc_parser_t *mpc_digits(void) { return mpc_expect(mpc_many1(mpcf_strfold, mpc_digit()), "digits"); }
-mpc_parser_t *mpc_hexdigits(void) { return mpc_expect(mpc_many1(mpcf_strfold, mpc_hexdigit()), "hex digits"); }
-mpc_parser_t *mpc_octdigits(void) { return mpc_expect(mpc_many1(mpcf_strfold, mpc_octdigit()), "oct digits"); }
+mpc_parser_t *mpc_digits(void) { return mpc_expect(mpc_span(mpc_many1(mpcf_strfold, mpc_digit())), "digits"); }
+mpc_parser_t *mpc_hexdigits(void) { return mpc_expect(mpc_span(mpc_many1(mpcf_strfold, mpc_hexdigit())), "hex digits"); }
+mpc_parser_t *mpc_octdigits(void) { return mpc_expect(mpc_span(mpc_many1(mpcf_strfold, mpc_octdigit())), "oct digits"); }
 
 mpc_parser_t *mpc_lower(void) { return mpc_expect(mpc_oneof("abcdefghijklmnopqrstuvwxyz"), "lowercase letter"); }
 mpc_parser_t *mpc_upper(void) { return mpc_expect(mpc_oneof("ABCDEFGHIJKLMNOPQRSTUVWXYZ"), "uppercase letter"); }
@@ -1988,7 +4018,7 @@ mpc_parser_t *mpc_real(void) {
   p32 = mpc_digits();
   p3 = mpc_maybe_lift(mpc_and(3, mpcf_strfold, p30, p31, p32, free, free), mpcf_ctor_str);
   
-  return mpc_expect(mpc_and(4, mpcf_strfold, p0, p1, p2, p3, free, free, free), "real");
+  return mpc_expect(mpc_span(mpc_and(4, mpcf_strfold, p0, p1, p2, p3, free, free, free)), "real");
 
 }
 
@@ -2002,19 +4032,19 @@ mpc_parser_t *mpc_char_lit(void) {
 
 mpc_parser_t *mpc_string_lit(void) {
   mpc_parser_t *strchar = mpc_or(2, mpc_escape(), mpc_noneof("\""));
-  return mpc_expect(mpc_between(mpc_many(mpcf_strfold, strchar), free, "\"", "\""), "string");
+  return mpc_expect(mpc_between(mpc_span(mpc_many(mpcf_strfold, strchar)), free, "\"", "\""), "string");
 }
 
 mpc_parser_t *mpc_regex_lit(void) {  
   mpc_parser_t *regexchar = mpc_or(2, mpc_escape(), mpc_noneof("/"));
-  return mpc_expect(mpc_between(mpc_many(mpcf_strfold, regexchar), free, "/", "/"), "regex");
+  return mpc_expect(mpc_between(mpc_span(mpc_many(mpcf_strfold, regexchar)), free, "/", "/"), "regex");
 }
 
 mpc_parser_t *mpc_ident(void) {
   mpc_parser_t *p0, *p1; 
   p0 = mpc_or(2, mpc_alpha(), mpc_underscore());
   p1 = mpc_many(mpcf_strfold, mpc_alphanum()); 
-  return mpc_and(2, mpcf_strfold, p0, p1, free);
+  return mpc_span(mpc_and(2, mpcf_strfold, p0, p1, free));
 }
 
 /*
@@ -2200,32 +4230,42 @@ static const char *mpc_re_range_escape_char(char c) {
   }
 }
 
+static char *mpc_re_range_cat(char *range, size_t *len, size_t *max, const char *x, size_t n) {
+  if (*len + n + 1 > *max) {
+    *max = (*len + n + 1) * 2;
+    range = realloc(range, *max);
+  }
+  memcpy(range + *len, x, n);
+  *len += n;
+  range[*len] = '\0';
+  return range;
+}
+
 static mpc_val_t *mpcf_re_range(mpc_val_t *x) {
   
   mpc_parser_t *out;
-  size_t i, j;
+  size_t i, j, len = 0, max = 64;
   size_t start, end;
+  char c;
   const char *tmp = NULL;
   const char *s = x;
+  size_t slen = strlen(s);
   int comp = s[0] == '^' ? 1 : 0;
-  char *range = calloc(1,1);
+  char *range = calloc(1, max);
   
   if (s[0] == '\0') { free(range); free(x); return mpc_fail("Invalid Regex Range Expression"); } 
   if (s[0] == '^' && 
       s[1] == '\0') { free(range); free(x); return mpc_fail("Invalid Regex Range Expression"); }
   
-  for (i = comp; i < strlen(s); i++){
+  for (i = comp; i < slen; i++){
     
     /* Regex Range Escape */
     if (s[i] == '\\') {
       tmp = mpc_re_range_escape_char(s[i+1]);
       if (tmp != NULL) {
-        range = realloc(range, strlen(range) + strlen(tmp) + 1);
-        strcat(range, tmp);
+        range = mpc_re_range_cat(range, &len, &max, tmp, strlen(tmp));
       } else {
-        range = realloc(range, strlen(range) + 1 + 1);
-        range[strlen(range) + 1] = '\0';
-        range[strlen(range) + 0] = s[i+1];      
+        range = mpc_re_range_cat(range, &len, &max, s + i + 1, 1);
       }
       i++;
     }
@@ -2233,24 +4273,20 @@ static mpc_val_t *mpcf_re_range(mpc_val_t *x) {
     /* Regex Range...Range */
     else if (s[i] == '-') {
       if (s[i+1] == '\0' || i == 0) {
-          range = realloc(range, strlen(range) + strlen("-") + 1);
-          strcat(range, "-");
+        range = mpc_re_range_cat(range, &len, &max, "-", 1);
       } else {
         start = s[i-1]+1;
         end = s[i+1]-1;
         for (j = start; j <= end; j++) {
-          range = realloc(range, strlen(range) + 1 + 1 + 1);
-          range[strlen(range) + 1] = '\0';
-          range[strlen(range) + 0] = (char)j;
+          c = (char)j;
+          range = mpc_re_range_cat(range, &len, &max, &c, 1);
         }        
       }
     }
     
     /* Regex Range Normal */
     else {
-      range = realloc(range, strlen(range) + 1 + 1);
-      range[strlen(range) + 1] = '\0';
-      range[strlen(range) + 0] = s[i];
+      range = mpc_re_range_cat(range, &len, &max, s + i, 1);
     }
   
   }
@@ -2263,7 +4299,427 @@ static mpc_val_t *mpcf_re_range(mpc_val_t *x) {
   return out;
 }
 
+/*
+** Once built, a regex which never needs to
+** backtrack is also compiled into a DFA that
+** can be run in a tight loop.
+**
+** The DFA is built from the parser tree using
+** the Glushkov construction - every character
+** class becomes a position and we work out
+** which positions can follow which. If each
+** position (and the start) can only move to one
+** other position on any character, the positions
+** are already the states of a DFA.
+**
+** This restriction is also what makes the
+** greedy, ordered behaviour of the combinators
+** the same as taking the longest match. For the
+** same reason an alternative which can match
+** nothing must come last and repetition of
+** something which can match nothing is refused.
+**
+** Anything else, such as anchors other than a
+** leading `^` or trailing `$`, word boundaries
+** or negative escapes, keeps the parser tree.
+** The tree is also kept alongside the DFA so
+** that a failure can be run again through it
+** to produce exactly the same error message.
+** A match gives the errors the tree would have
+** where it stops, and is run again through the
+** tree too where these can't be known ahead.
+*/
+
+enum {
+  MPC_DFA_POSITIONS_MAX = 254
+};
+
+typedef struct {
+  int num;
+  unsigned char (*chars)[MPC_SET_SIZE];
+  unsigned char (*follow)[MPC_SET_SIZE];
+  unsigned char (*order)[MPC_DFA_POSITIONS_MAX];
+  int *orders;
+  int *inexact;
+  const char **msgs;
+  const char *m;
+  int opaque;
+  int caught;
+} mpc_dfa_build_t;
+
+typedef struct {
+  int nullable;
+  unsigned char first[MPC_SET_SIZE];
+  unsigned char last[MPC_SET_SIZE];
+  unsigned char wrap[MPC_SET_SIZE];
+  unsigned char escape[MPC_SET_SIZE];
+} mpc_dfa_frag_t;
+
+static void mpc_set_add_parser(unsigned char *s, mpc_parser_t *p) {
+  int j;
+  char c;
+  switch (p->type) {
+    case MPC_TYPE_SINGLE: MPC_SET_ADD(s, p->data.single.x); break;
+    case MPC_TYPE_RANGE:
+      for (j = 0; j < 256; j++) {
+        c = (char)j;
+        if (c >= p->data.range.x && c <= p->data.range.y) { MPC_SET_ADD(s, c); }
+      }
+      break;
+    case MPC_TYPE_ONEOF:
+    case MPC_TYPE_NONEOF:
+      for (j = 0; j < MPC_SET_SIZE; j++) { s[j] |= p->data.set.s[j]; }
+      break;
+    case MPC_TYPE_ANY: memset(s, 0xFF, MPC_SET_SIZE); break;
+    default: break;
+  }
+}
+
+static void mpc_set_union(unsigned char *s, const unsigned char *t) {
+  int j;
+  for (j = 0; j < MPC_SET_SIZE; j++) { s[j] |= t[j]; }
+}
+
+static void mpc_dfa_frag_empty(mpc_dfa_frag_t *f) {
+  f->nullable = 1;
+  memset(f->first, 0, MPC_SET_SIZE);
+  memset(f->last, 0, MPC_SET_SIZE);
+  memset(f->wrap, 0, MPC_SET_SIZE);
+  memset(f->escape, 0, MPC_SET_SIZE);
+}
+
+static int mpc_dfa_position(mpc_dfa_build_t *b, const char *m, mpc_dfa_frag_t *f) {
+  int j = b->num++;
+  memset(b->chars[j], 0, MPC_SET_SIZE);
+  memset(b->follow[j], 0, MPC_SET_SIZE);
+  b->orders[j] = 0;
+  b->inexact[j] = 0;
+  b->msgs[j] = b->opaque ? NULL : m;
+  mpc_dfa_frag_empty(f);
+  f->nullable = 0;
+  MPC_SET_ADD(f->first, j);
+  MPC_SET_ADD(f->last, j);
+  MPC_SET_ADD(f->escape, j);
+  return j;
+}
+
+/*
+** Positions which can follow another are kept in
+** the order the tree would try them, so that the
+** errors where a match stops can be given in the
+** same order. A position is inexact if trying one
+** of these gives an error which depends on more
+** than where the match stopped.
+*/
+
+static void mpc_dfa_follow(mpc_dfa_build_t *b, int j, const mpc_dfa_frag_t *g, int escapes) {
+  int k;
+  for (k = 0; k < b->num; k++) {
+    if (!MPC_SET_HAS(g->first, k)) { continue; }
+    if (!b->msgs[k] || MPC_SET_HAS(g->wrap, k) || (escapes && MPC_SET_HAS(g->escape, k))) { b->inexact[j] = 1; }
+    if (MPC_SET_HAS(b->follow[j], k)) { continue; }
+    MPC_SET_ADD(b->follow[j], k);
+    b->order[j][b->orders[j]++] = (unsigned char)k;
+  }
+}
+
+static void mpc_dfa_frag_seq(mpc_dfa_build_t *b, mpc_dfa_frag_t *f, mpc_dfa_frag_t *g) {
+  int j;
+  for (j = 0; j < b->num; j++) {
+    if (MPC_SET_HAS(f->last, j)) { mpc_dfa_follow(b, j, g, !b->caught); }
+  }
+  if (f->nullable) {
+    mpc_set_union(f->first, g->first);
+    mpc_set_union(f->wrap, g->wrap);
+    mpc_set_union(f->escape, g->escape);
+  }
+  if (!g->nullable) { memset(f->last, 0, MPC_SET_SIZE); }
+  mpc_set_union(f->last, g->last);
+  f->nullable = f->nullable && g->nullable;
+}
+
+static void mpc_dfa_frag_loop(mpc_dfa_build_t *b, mpc_dfa_frag_t *f) {
+  int j;
+  for (j = 0; j < b->num; j++) {
+    if (MPC_SET_HAS(f->last, j)) { mpc_dfa_follow(b, j, f, 0); }
+  }
+}
+
+/*
+** A failure which leaves a `many1` or `count`
+** is wrapped in a new message, and one leaving
+** the inside of a `many1` also depends on how
+** many times it has already matched.
+*/
+
+static void mpc_dfa_frag_wrap(mpc_dfa_frag_t *f) {
+  mpc_set_union(f->wrap, f->escape);
+  memset(f->escape, 0, MPC_SET_SIZE);
+}
+
+static int mpc_dfa_build(mpc_dfa_build_t *b, mpc_parser_t *p, mpc_dfa_frag_t *f) {
+  
+  int j, k, r, caught = b->caught;
+  mpc_dfa_frag_t g;
+  mpc_parser_t *x;
+  
+  mpc_dfa_frag_empty(f);
+  
+  switch (p->type) {
+    
+    case MPC_TYPE_EXPECT:
+      for (x = p->data.expect.x; x->type == MPC_TYPE_EXPECT; x = x->data.expect.x);
+      if (x->type == MPC_TYPE_ANY || x->type == MPC_TYPE_SINGLE || x->type == MPC_TYPE_RANGE
+      ||  x->type == MPC_TYPE_ONEOF || x->type == MPC_TYPE_NONEOF) {
+        b->m = p->data.expect.m;
+        return mpc_dfa_build(b, x, f);
+      }
+      b->opaque++;
+      r = mpc_dfa_build(b, x, f);
+      b->opaque--;
+      return r;
+    
+    case MPC_TYPE_SPAN: return mpc_dfa_build(b, p->data.predict.x, f);
+    
+    case MPC_TYPE_ANY:
+    case MPC_TYPE_SINGLE:
+    case MPC_TYPE_RANGE:
+    case MPC_TYPE_ONEOF:
+    case MPC_TYPE_NONEOF:
+      if (b->num == MPC_DFA_POSITIONS_MAX) { return 0; }
+      j = mpc_dfa_position(b, b->m, f);
+      b->m = NULL;
+      mpc_set_add_parser(b->chars[j], p);
+      b->chars[j][0] &= (unsigned char)~1;
+      return 1;
+    
+    case MPC_TYPE_LIFT: return p->data.lift.lf == mpcf_ctor_str;
+    
+    case MPC_TYPE_STRING:
+      for (j = 0; p->data.string.x[j]; j++) {
+        if (b->num == MPC_DFA_POSITIONS_MAX) { return 0; }
+        k = mpc_dfa_position(b, p->data.string.m ? p->data.string.m + j * 4 : NULL, &g);
+        MPC_SET_ADD(b->chars[k], p->data.string.x[j]);
+        mpc_dfa_frag_seq(b, f, &g);
+      }
+      return 1;
+    
+    case MPC_TYPE_SCAN:
+      if (b->num == MPC_DFA_POSITIONS_MAX) { return 0; }
+      j = mpc_dfa_position(b, p->data.scan.m, f);
+      memcpy(b->chars[j], p->data.scan.s, MPC_SET_SIZE);
+      b->chars[j][0] &= (unsigned char)~1;
+      mpc_dfa_frag_loop(b, f);
+      if (p->data.scan.n) { mpc_dfa_frag_wrap(f); }
+      memset(f->escape, 0, MPC_SET_SIZE);
+      f->nullable = !p->data.scan.n;
+      return 1;
+    
+    case MPC_TYPE_AND:
+      if (p->data.and.f != mpcf_strfold) { return 0; }
+      for (j = 0; j < p->data.and.n; j++) {
+        if (!mpc_dfa_build(b, p->data.and.xs[j], &g)) { return 0; }
+        mpc_dfa_frag_seq(b, f, &g);
+      }
+      return 1;
+    
+    case MPC_TYPE_OR:
+      f->nullable = 0;
+      for (j = 0; j < p->data.or.n; j++) {
+        if (!mpc_dfa_build(b, p->data.or.xs[j], &g)) { return 0; }
+        if (g.nullable && j != p->data.or.n-1) { return 0; }
+        mpc_set_union(f->first, g.first);
+        mpc_set_union(f->last, g.last);
+        mpc_set_union(f->wrap, g.wrap);
+        mpc_set_union(f->escape, g.escape);
+        f->nullable = g.nullable;
+      }
+      return 1;
+    
+    case MPC_TYPE_MAYBE:
+      if (p->data.not.lf != mpcf_ctor_str) { return 0; }
+      b->caught = 1;
+      r = mpc_dfa_build(b, p->data.not.x, f);
+      b->caught = caught;
+      memset(f->escape, 0, MPC_SET_SIZE);
+      f->nullable = 1;
+      return r;
+    
+    case MPC_TYPE_MANY:
+    case MPC_TYPE_MANY1:
+      if (p->data.repeat.f != mpcf_strfold) { return 0; }
+      b->caught = p->type == MPC_TYPE_MANY;
+      r = mpc_dfa_build(b, p->data.repeat.x, f);
+      b->caught = caught;
+      if (!r || f->nullable) { return 0; }
+      mpc_dfa_frag_loop(b, f);
+      if (p->type == MPC_TYPE_MANY1) { mpc_dfa_frag_wrap(f); }
+      memset(f->escape, 0, MPC_SET_SIZE);
+      f->nullable = p->type == MPC_TYPE_MANY;
+      return 1;
+    
+    case MPC_TYPE_COUNT:
+      if (p->data.repeat.f != mpcf_strfold) { return 0; }
+      b->caught = 0;
+      for (j = 0; j < p->data.repeat.n; j++) {
+        if (!mpc_dfa_build(b, p->data.repeat.x, &g)) { b->caught = caught; return 0; }
+        mpc_dfa_frag_seq(b, f, &g);
+      }
+      b->caught = caught;
+      mpc_dfa_frag_wrap(f);
+      return 1;
+    
+    default: return 0;
+  }
+  
+}
+
+static int mpc_dfa_is_anchor(mpc_parser_t *p, int(*f)(char,char)) {
+  mpc_parser_t *a;
+  if (p->type != MPC_TYPE_AND
+  ||  p->data.and.n != 2
+  ||  p->data.and.f != mpcf_snd
+  ||  p->data.and.xs[1]->type != MPC_TYPE_LIFT
+  ||  p->data.and.xs[1]->data.lift.lf != mpcf_ctor_str) { return 0; }
+  a = p->data.and.xs[0];
+  while (a->type == MPC_TYPE_EXPECT) { a = a->data.expect.x; }
+  return a->type == MPC_TYPE_ANCHOR && a->data.anchor.f == f;
+}
+
+static int mpc_dfa_transitions(mpc_dfa_t *d, mpc_dfa_build_t *b, int from, const unsigned char *to) {
+  int j, c;
+  unsigned char *row = d->trans + from * 256;
+  for (j = 0; j < b->num; j++) {
+    if (!MPC_SET_HAS(to, j)) { continue; }
+    for (c = 0; c < 256; c++) {
+      if (!MPC_SET_HAS(b->chars[j], c)) { continue; }
+      if (row[c]) { return 0; }
+      row[c] = (unsigned char)(j + 2);
+    }
+  }
+  return 1;
+}
+
+/*
+** The errors where a match stops are kept for each
+** state as the messages one after another, ending
+** with an empty one, or as NULL if inexact.
+*/
+
+static char *mpc_dfa_expect_new(mpc_dfa_build_t *b, int j) {
+  
+  int k;
+  size_t n = 1;
+  char *x;
+  
+  if (b->inexact[j]) { return NULL; }
+  for (k = 0; k < b->orders[j]; k++) { n += strlen(b->msgs[b->order[j][k]]) + 1; }
+  
+  x = malloc(n);
+  for (k = 0, n = 0; k < b->orders[j]; k++) {
+    strcpy(x + n, b->msgs[b->order[j][k]]);
+    n += strlen(x + n) + 1;
+  }
+  x[n] = '\0';
+  return x;
+}
+
+static mpc_dfa_t *mpc_dfa_new(mpc_parser_t *p) {
+  
+  int j, n, start, end, ok;
+  mpc_parser_t **xs;
+  mpc_dfa_frag_t f, g;
+  mpc_dfa_build_t b;
+  mpc_dfa_t *d;
+  
+  if (p->type == MPC_TYPE_AND && p->data.and.f == mpcf_strfold) {
+    xs = p->data.and.xs; n = p->data.and.n;
+  } else {
+    xs = &p; n = 1;
+  }
+  
+  d = calloc(1, sizeof(mpc_dfa_t));
+  start = 0; end = n;
+  if (end > start && mpc_dfa_is_anchor(xs[start], mpc_soi_anchor)) { d->flags |= MPC_DFA_SOI; start++; }
+  if (end > start && mpc_dfa_is_anchor(xs[end-1], mpc_eoi_anchor)) { d->flags |= MPC_DFA_EOI; end--; }
+  
+  b.num = 0;
+  b.chars = malloc(sizeof(*b.chars) * MPC_DFA_POSITIONS_MAX);
+  b.follow = malloc(sizeof(*b.follow) * (MPC_DFA_POSITIONS_MAX + 1));
+  b.order = malloc(sizeof(*b.order) * (MPC_DFA_POSITIONS_MAX + 1));
+  b.orders = malloc(sizeof(int) * (MPC_DFA_POSITIONS_MAX + 1));
+  b.inexact = malloc(sizeof(int) * (MPC_DFA_POSITIONS_MAX + 1));
+  b.msgs = malloc(sizeof(char*) * MPC_DFA_POSITIONS_MAX);
+  b.m = NULL;
+  b.opaque = 0;
+  b.caught = 1;
+  
+  ok = 1;
+  mpc_dfa_frag_empty(&f);
+  for (j = start; j < end && ok; j++) {
+    ok = mpc_dfa_build(&b, xs[j], &g);
+    if (ok) { mpc_dfa_frag_seq(&b, &f, &g); }
+  }
+  
+  if (ok) {
+    d->states = b.num + 2;
+    d->accept = calloc(d->states, 1);
+    d->trans = calloc(d->states * 256, 1);
+    d->accept[1] = (unsigned char)f.nullable;
+    for (j = 0; j < b.num; j++) {
+      d->accept[j+2] = MPC_SET_HAS(f.last, j) ? 1 : 0;
+    }
+    ok = mpc_dfa_transitions(d, &b, 1, f.first);
+    for (j = 0; j < b.num && ok; j++) {
+      ok = mpc_dfa_transitions(d, &b, j+2, b.follow[j]);
+    }
+  }
+  
+  if (ok) {
+    memset(b.follow[b.num], 0, MPC_SET_SIZE);
+    b.orders[b.num] = 0;
+    b.inexact[b.num] = 0;
+    mpc_dfa_follow(&b, b.num, &f, 0);
+    d->expect = malloc(sizeof(char*) * d->states);
+    d->expect[0] = NULL;
+    d->expect[1] = mpc_dfa_expect_new(&b, b.num);
+    for (j = 0; j < b.num; j++) { d->expect[j+2] = mpc_dfa_expect_new(&b, j); }
+  }
+  
+  free(b.chars);
+  free(b.follow);
+  free(b.order);
+  free(b.orders);
+  free(b.inexact);
+  free(b.msgs);
+  
+  if (!ok) {
+    free(d->accept);
+    free(d->trans);
+    free(d);
+    return NULL;
+  }
+  
+  mpc_dfa_loops(d);
+  return d;
+}
+
+static mpc_parser_t *mpc_re_dfa(mpc_parser_t *a) {
+  mpc_parser_t *p;
+  mpc_dfa_t *d = mpc_dfa_new(a);
+  if (d == NULL) { return mpc_span(a); }
+  p = mpc_undefined();
+  p->type = MPC_TYPE_REGEX;
+  p->data.regex.x = mpc_span(a);
+  p->data.regex.d = d;
+  return p;
+}
+
 mpc_parser_t *mpc_re(const char *re) {
+  return mpc_re_mode(re, MPC_RE_DEFAULT);
+}
+
+mpc_parser_t *mpc_re_mode(const char *re, int mode) {
   
   char *err_msg;
   mpc_parser_t *err_out;
@@ -2326,7 +4782,7 @@ mpc_parser_t *mpc_re(const char *re) {
   
   mpc_optimise(r.output);
   
-  return r.output;
+  return (mode & MPC_RE_NODFA) ? mpc_span(r.output) : mpc_re_dfa(r.output);
   
 }
 
@@ -2643,7 +5099,7 @@ static void mpc_print_unretained(mpc_parser_t *p, int force) {
   
   if (p->type == MPC_TYPE_ONEOF) {
     s = mpcf_escape_new(
-      p->data.string.x,
+      p->data.set.x,
       mpc_escape_input_c,
       mpc_escape_output_c);
     printf("[%s]", s);
@@ -2652,7 +5108,7 @@ static void mpc_print_unretained(mpc_parser_t *p, int force) {
   
   if (p->type == MPC_TYPE_NONEOF) {
     s = mpcf_escape_new(
-      p->data.string.x,
+      p->data.set.x,
       mpc_escape_input_c,
       mpc_escape_output_c);
     printf("[^%s]", s);
@@ -2668,9 +5124,16 @@ static void mpc_print_unretained(mpc_parser_t *p, int force) {
     free(s);
   }
   
+  if (p->type == MPC_TYPE_SCAN) {
+    printf("%s%s", p->data.scan.m, p->data.scan.n ? "+" : "*");
+  }
+  
   if (p->type == MPC_TYPE_APPLY)    { mpc_print_unretained(p->data.apply.x, 0); }
   if (p->type == MPC_TYPE_APPLY_TO) { mpc_print_unretained(p->data.apply_to.x, 0); }
   if (p->type == MPC_TYPE_PREDICT)  { mpc_print_unretained(p->data.predict.x, 0); }
+  if (p->type == MPC_TYPE_DEFERRED) { mpc_print_unretained(p->data.predict.x, 0); }
+  if (p->type == MPC_TYPE_REGEX)    { mpc_print_unretained(p->data.regex.x, 0); }
+  if (p->type == MPC_TYPE_SPAN)     { mpc_print_unretained(p->data.predict.x, 0); }
 
   if (p->type == MPC_TYPE_NOT)   { mpc_print_unretained(p->data.not.x, 0); printf("!"); }
   if (p->type == MPC_TYPE_MAYBE) { mpc_print_unretained(p->data.not.x, 0); printf("?"); }
@@ -2802,6 +5265,21 @@ void mpc_ast_delete(mpc_ast_t *a) {
   
 }
 
+void mpc_ast_arena_delete(mpc_ast_t *a) {
+  
+  mpc_ast_arena_t *r = (mpc_ast_arena_t*)a;
+  mpc_ast_chunk_t *c, *n;
+  
+  if (r == NULL) { return; }
+  
+  for (c = r->chunks; c; c = n) {
+    n = c->next;
+    free(c);
+  }
+  
+  free(r);
+}
+
 static void mpc_ast_delete_no_children(mpc_ast_t *a) {
   free(a->children);
   free(a->tag);
@@ -2823,6 +5301,10 @@ mpc_ast_t *mpc_ast_new(const char *tag, const char *contents) {
   
   a->children_num = 0;
   a->children = NULL;
+  a->rule = 0;
+  a->primary = 0;
+  a->view = NULL;
+  a->view_len = 0;
   return a;
   
 }
@@ -2858,12 +5340,30 @@ mpc_ast_t *mpc_ast_add_root(mpc_ast_t *a) {
   return r;
 }
 
+static const char *mpc_ast_text(mpc_ast_t *a, long *n) {
+  if (a->contents) { *n = strlen(a->contents); return a->contents; }
+  *n = a->view_len;
+  return a->view ? a->view : "";
+}
+
+const char *mpc_ast_contents(mpc_ast_t *a) {
+  if (a->contents) { return a->contents; }
+  if (a->view == NULL) { return ""; }
+  a->contents = malloc(a->view_len + 1);
+  memcpy(a->contents, a->view, a->view_len);
+  a->contents[a->view_len] = '\0';
+  return a->contents;
+}
+
 int mpc_ast_eq(mpc_ast_t *a, mpc_ast_t *b) {
   
   int i;
+  long an, bn;
+  const char *at = mpc_ast_text(a, &an);
+  const char *bt = mpc_ast_text(b, &bn);
 
   if (strcmp(a->tag, b->tag) != 0) { return 0; }
-  if (strcmp(a->contents, b->contents) != 0) { return 0; }
+  if (an != bn || memcmp(at, bt, an) != 0) { return 0; }
   if (a->children_num != b->children_num) { return 0; }
   
   for (i = 0; i < a->children_num; i++) {
@@ -2889,6 +5389,14 @@ mpc_ast_t *mpc_ast_add_tag(mpc_ast_t *a, const char *t) {
   return a;
 }
 
+mpc_ast_t *mpc_ast_add_rule(mpc_ast_t *a, mpc_parser_t *p) {
+  if (a == NULL) { return a; }
+  mpc_ast_add_tag(a, p->name);
+  a->rule = p->rule;
+  if (!a->primary) { a->primary = p->rule; }
+  return a;
+}
+
 mpc_ast_t *mpc_ast_add_root_tag(mpc_ast_t *a, const char *t) {
   if (a == NULL) { return a; }
   a->tag = realloc(a->tag, (strlen(t)-1) + strlen(a->tag) + 1);
@@ -2912,6 +5420,8 @@ mpc_ast_t *mpc_ast_state(mpc_ast_t *a, mpc_state_t s) {
 static void mpc_ast_print_depth(mpc_ast_t *a, int d, FILE *fp) {
   
   int i;
+  long n;
+  const char *t;
   
   if (a == NULL) {
     fprintf(fp, "NULL\n");
@@ -2920,11 +5430,13 @@ static void mpc_ast_print_depth(mpc_ast_t *a, int d, FILE *fp) {
   
   for (i = 0; i < d; i++) { fprintf(fp, "  "); }
   
-  if (strlen(a->contents)) {
-    fprintf(fp, "%s:%lu:%lu '%s'\n", a->tag, 
+  t = mpc_ast_text(a, &n);
+  
+  if (n) {
+    fprintf(fp, "%s:%lu:%lu '%.*s'\n", a->tag, 
       (long unsigned int)(a->state.row+1),
       (long unsigned int)(a->state.col+1),
-      a->contents);
+      (int)n, t);
   } else {
     fprintf(fp, "%s \n", a->tag);
   }
@@ -3111,7 +5623,79 @@ void mpc_ast_traverse_free(mpc_ast_trav_t **trav) {
   }
 }
 
-mpc_val_t *mpcf_fold_ast(int n, mpc_val_t **xs) {
+void mpc_ast_iter_init(mpc_ast_iter_t *it) {
+  it->order = mpc_ast_trav_order_pre;
+  it->num = 0;
+  it->slots = 32;
+  it->stack = malloc(sizeof(mpc_ast_iter_frame_t) * it->slots);
+}
+
+void mpc_ast_iter_free(mpc_ast_iter_t *it) {
+  free(it->stack);
+  it->stack = NULL;
+  it->num = 0;
+  it->slots = 0;
+}
+
+static void mpc_ast_iter_push(mpc_ast_iter_t *it, mpc_ast_t *a) {
+  if (it->num == it->slots) {
+    it->slots = it->slots ? it->slots * 2 : 32;
+    it->stack = realloc(it->stack, sizeof(mpc_ast_iter_frame_t) * it->slots);
+  }
+  it->stack[it->num].node = a;
+  it->stack[it->num].child = -1;
+  it->num++;
+}
+
+void mpc_ast_iter_start(mpc_ast_iter_t *it, mpc_ast_t *ast, mpc_ast_trav_order_t order) {
+  it->order = order;
+  it->num = 0;
+  if (ast) { mpc_ast_iter_push(it, ast); }
+}
+
+/*
+** A frame's child is -1 until its node has been
+** reached and after that the index of the next
+** child to descend into. Pre order returns a node
+** on reaching it and post order on leaving it.
+*/
+
+mpc_ast_t *mpc_ast_iter_next(mpc_ast_iter_t *it) {
+  
+  mpc_ast_iter_frame_t *f;
+  
+  while (it->num > 0) {
+    
+    f = &it->stack[it->num-1];
+    
+    if (f->child < 0) {
+      f->child = 0;
+      if (it->order == mpc_ast_trav_order_pre) { return f->node; }
+    }
+    
+    if (f->child < f->node->children_num) {
+      mpc_ast_iter_push(it, f->node->children[f->child++]);
+      continue;
+    }
+    
+    it->num--;
+    if (it->order == mpc_ast_trav_order_post) { return f->node; }
+  }
+  
+  return NULL;
+}
+
+/*
+** The number of ancestors of the node last
+** returned by `mpc_ast_iter_next`, so zero for
+** the root.
+*/
+
+int mpc_ast_iter_depth(mpc_ast_iter_t *it) {
+  return it->order == mpc_ast_trav_order_pre ? it->num - 1 : it->num;
+}
+
+static mpc_val_t *mpc_ast_fold(int n, mpc_val_t **xs, int views) {
   
   int i, j;
   mpc_ast_t** as = (mpc_ast_t**)xs;
@@ -3122,7 +5706,7 @@ mpc_val_t *mpcf_fold_ast(int n, mpc_val_t **xs) {
   if (n == 2 && xs[1] == NULL) { return xs[0]; }
   if (n == 2 && xs[0] == NULL) { return xs[1]; }
   
-  r = mpc_ast_new(">", "");
+  r = views ? mpc_ast_view_new(">", NULL, 0) : mpc_ast_new(">", "");
   
   for (i = 0; i < n; i++) {
     
@@ -3131,6 +5715,8 @@ mpc_val_t *mpcf_fold_ast(int n, mpc_val_t **xs) {
     if        (as[i] && as[i]->children_num == 0) {
       mpc_ast_add_child(r, as[i]);
     } else if (as[i] && as[i]->children_num == 1) {
+      if (as[i]->rule) { as[i]->children[0]->rule = as[i]->rule; }
+      if (!as[i]->children[0]->primary) { as[i]->children[0]->primary = as[i]->primary; }
       mpc_ast_add_child(r, mpc_ast_add_root_tag(as[i]->children[0], as[i]->tag));
       mpc_ast_delete_no_children(as[i]);
     } else if (as[i] && as[i]->children_num >= 2) {
@@ -3149,6 +5735,10 @@ mpc_val_t *mpcf_fold_ast(int n, mpc_val_t **xs) {
   return r;
 }
 
+mpc_val_t *mpcf_fold_ast(int n, mpc_val_t **xs) {
+  return mpc_ast_fold(n, xs, 0);
+}
+
 mpc_val_t *mpcf_str_ast(mpc_val_t *c) {
   mpc_ast_t *a = mpc_ast_new("", c);
   free(c);
@@ -3196,6 +5786,7 @@ mpc_parser_t *mpca_or(int n, ...) {
   p->type = MPC_TYPE_OR;
   p->data.or.n = n;
   p->data.or.xs = malloc(sizeof(mpc_parser_t*) * n);
+  p->data.or.jump = NULL;
   
   va_start(va, n);  
   for (i = 0; i < n; i++) {
@@ -3283,6 +5874,7 @@ typedef struct {
   int parsers_num;
   mpc_parser_t **parsers;
   int flags;
+  const mpca_action_t *actions;
 } mpca_grammar_st_t;
 
 static mpc_val_t *mpcaf_grammar_or(int n, mpc_val_t **xs) {
@@ -3320,25 +5912,25 @@ static mpc_val_t *mpcaf_grammar_repeat(int n, mpc_val_t **xs) {
 static mpc_val_t *mpcaf_grammar_string(mpc_val_t *x, void *s) {
   mpca_grammar_st_t *st = s;
   char *y = mpcf_unescape(x);
-  mpc_parser_t *p = (st->flags & MPCA_LANG_WHITESPACE_SENSITIVE) ? mpc_string(y) : mpc_tok(mpc_string(y));
+  mpc_parser_t *p = mpca_tag(mpc_apply(mpc_string(y), mpcf_str_ast), "string");
   free(y);
-  return mpca_state(mpca_tag(mpc_apply(p, mpcf_str_ast), "string"));
+  return mpca_state((st->flags & MPCA_LANG_WHITESPACE_SENSITIVE) ? p : mpc_tok(p));
 }
 
 static mpc_val_t *mpcaf_grammar_char(mpc_val_t *x, void *s) {
   mpca_grammar_st_t *st = s;
   char *y = mpcf_unescape(x);
-  mpc_parser_t *p = (st->flags & MPCA_LANG_WHITESPACE_SENSITIVE) ? mpc_char(y[0]) : mpc_tok(mpc_char(y[0]));
+  mpc_parser_t *p = mpca_tag(mpc_apply(mpc_char(y[0]), mpcf_str_ast), "char");
   free(y);
-  return mpca_state(mpca_tag(mpc_apply(p, mpcf_str_ast), "char"));
+  return mpca_state((st->flags & MPCA_LANG_WHITESPACE_SENSITIVE) ? p : mpc_tok(p));
 }
 
 static mpc_val_t *mpcaf_grammar_regex(mpc_val_t *x, void *s) {
   mpca_grammar_st_t *st = s;
   char *y = mpcf_unescape_regex(x);
-  mpc_parser_t *p = (st->flags & MPCA_LANG_WHITESPACE_SENSITIVE) ? mpc_re(y) : mpc_tok(mpc_re(y));
+  mpc_parser_t *p = mpca_tag(mpc_apply(mpc_re(y), mpcf_str_ast), "regex");
   free(y);
-  return mpca_state(mpca_tag(mpc_apply(p, mpcf_str_ast), "regex"));
+  return mpca_state((st->flags & MPCA_LANG_WHITESPACE_SENSITIVE) ? p : mpc_tok(p));
 }
 
 /* Should this just use `isdigit` instead? */
@@ -3365,6 +5957,7 @@ static mpc_parser_t *mpca_grammar_find_parser(char *x, mpca_grammar_st_t *st) {
       if (st->parsers[st->parsers_num-1] == NULL) {
         return mpc_failf("No Parser in position %i! Only supplied %i Parsers!", i, st->parsers_num);
       }
+      st->parsers[st->parsers_num-1]->rule = st->parsers_num;
     }
     
     return st->parsers[st->parsers_num-1];
@@ -3389,6 +5982,7 @@ static mpc_parser_t *mpca_grammar_find_parser(char *x, mpca_grammar_st_t *st) {
       st->parsers[st->parsers_num-1] = p;
       
       if (p == NULL || p->name == NULL) { return mpc_failf("Unknown Parser '%s'!", x); }
+      p->rule = st->parsers_num;
       if (p->name && strcmp(p->name, x) == 0) { return p; }
       
     }
@@ -3404,7 +5998,7 @@ static mpc_val_t *mpcaf_grammar_id(mpc_val_t *x, void *s) {
   free(x);
 
   if (p->name) {
-    return mpca_state(mpca_root(mpca_add_tag(p, p->name)));
+    return mpca_state(mpca_root(mpc_apply_to(p, (mpc_apply_to_t)mpc_ast_add_rule, p)));
   } else {
     return mpca_state(mpca_root(p));
   }
@@ -3473,6 +6067,8 @@ mpc_parser_t *mpca_grammar_st(const char *grammar, mpca_grammar_st_t *st) {
   
   mpc_optimise(r.output);
   
+  if (st->flags & MPCA_LANG_DEFERRED_ERRORS) { r.output = mpc_deferred(r.output); }
+  
   return (st->flags & MPCA_LANG_PREDICTIVE) ? mpc_predictive(r.output) : r.output;
   
 }
@@ -3487,6 +6083,7 @@ mpc_parser_t *mpca_grammar(int flags, const char *grammar, ...) {
   st.parsers_num = 0;
   st.parsers = NULL;
   st.flags = flags;
+  st.actions = NULL;
   
   res = mpca_grammar_st(grammar, &st);  
   free(st.parsers);
@@ -3494,45 +6091,274 @@ mpc_parser_t *mpca_grammar(int flags, const char *grammar, ...) {
   return res;
 }
 
+/*
+** A rule may name an action with `@`, as in
+** `number @int : /[0-9]+/ ;`. The body of such a
+** rule is rewritten so that instead of AST nodes
+** it builds a flat list of values: the matched
+** text of each literal, and the value of each rule
+** referred to. The list is then given to the
+** action's fold (or the single value to its apply)
+** and the result is the value of the rule.
+*/
+
 typedef struct {
-  char *ident;
-  char *name;
-  mpc_parser_t *grammar;
-} mpca_stmt_t;
+  int num;
+  mpc_val_t **vals;
+  mpc_parser_t **rules;
+} mpca_vals_t;
 
-static mpc_val_t *mpca_stmt_afold(int n, mpc_val_t **xs) {
-  mpca_stmt_t *stmt = malloc(sizeof(mpca_stmt_t));
-  stmt->ident = ((char**)xs)[0];
-  stmt->name = ((char**)xs)[1];
-  stmt->grammar = ((mpc_parser_t**)xs)[3];
-  (void) n;
-  free(((char**)xs)[2]);
-  free(((char**)xs)[4]);
-  
-  return stmt;
+static void mpca_rule_dtor(mpc_parser_t *p, mpc_val_t *x);
+
+static void mpcaf_vals_delete(mpc_val_t *x) {
+  int j;
+  mpca_vals_t *v = x;
+  if (v == NULL) { return; }
+  for (j = 0; j < v->num; j++) {
+    if (v->rules[j]) { mpca_rule_dtor(v->rules[j], v->vals[j]); }
+    else { free(v->vals[j]); }
+  }
+  free(v->vals);
+  free(v->rules);
+  free(v);
 }
 
-static mpc_val_t *mpca_stmt_fold(int n, mpc_val_t **xs) {
+static mpc_val_t *mpca_vals_one(mpc_val_t *x, mpc_parser_t *r) {
+  mpca_vals_t *v = malloc(sizeof(mpca_vals_t));
+  v->num = 1;
+  v->vals = malloc(sizeof(mpc_val_t*));
+  v->rules = malloc(sizeof(mpc_parser_t*));
+  v->vals[0] = x;
+  v->rules[0] = r;
+  return v;
+}
+
+static mpc_val_t *mpcaf_vals_str(mpc_val_t *x) {
+  return mpca_vals_one(x, NULL);
+}
+
+static mpc_val_t *mpcaf_vals_rule(mpc_val_t *x, void *r) {
+  return mpca_vals_one(x, r);
+}
+
+static mpc_val_t *mpcaf_vals_fold(int n, mpc_val_t **xs) {
   
-  int i;
-  mpca_stmt_t **stmts = malloc(sizeof(mpca_stmt_t*) * (n+1));
+  int j, m = 0;
+  mpca_vals_t *r = NULL, *v;
   
-  for (i = 0; i < n; i++) {
-    stmts[i] = xs[i];
+  for (j = 0; j < n; j++) {
+    v = xs[j];
+    if (v == NULL) { continue; }
+    if (r == NULL) { r = v; continue; }
+    m = r->num + v->num;
+    r->vals = realloc(r->vals, sizeof(mpc_val_t*) * m);
+    r->rules = realloc(r->rules, sizeof(mpc_parser_t*) * m);
+    memcpy(r->vals + r->num, v->vals, sizeof(mpc_val_t*) * v->num);
+    memcpy(r->rules + r->num, v->rules, sizeof(mpc_parser_t*) * v->num);
+    r->num = m;
+    free(v->vals);
+    free(v->rules);
+    free(v);
   }
-  stmts[n] = NULL;  
   
-  return stmts;
+  return r;
 }
 
-static void mpca_stmt_list_delete(mpc_val_t *x) {
-
-  mpca_stmt_t **stmts = x;
+static mpc_val_t *mpcaf_action(mpc_val_t *x, void *d) {
+  
+  int j;
+  mpc_val_t *y;
+  mpca_vals_t *v = x;
+  const mpca_action_t *a = d;
+  
+  if (a->fold) {
+    y = a->fold(v ? v->num : 0, v ? v->vals : NULL);
+  } else {
+    for (j = 1; v && j < v->num; j++) {
+      if (v->rules[j]) { mpca_rule_dtor(v->rules[j], v->vals[j]); }
+      else { free(v->vals[j]); }
+    }
+    y = a->apply(v && v->num ? v->vals[0] : NULL);
+  }
+  
+  if (v) {
+    free(v->vals);
+    free(v->rules);
+    free(v);
+  }
+  
+  return y;
+}
+
+static void mpca_rule_dtor(mpc_parser_t *p, mpc_val_t *x) {
+  const mpca_action_t *a;
+  if (x == NULL) { return; }
+  if (p->type == MPC_TYPE_APPLY_TO && p->data.apply_to.f == mpcaf_action) {
+    a = p->data.apply_to.d;
+    if (a->dtor) { a->dtor(x); } else { free(x); }
+  } else {
+    mpc_ast_delete(x);
+  }
+}
+
+static void mpca_values_unretained(mpc_parser_t *p) {
+  
+  int i;
+  mpc_parser_t *t;
+  
+  if (p->retained) { return; }
+  
+  while (1) {
+    
+    /* Remove `state` */
+    if (p->type == MPC_TYPE_AND && p->data.and.f == mpcf_state_ast) {
+      t = p->data.and.xs[1];
+      mpc_delete(p->data.and.xs[0]);
+      free(p->data.and.xs); free(p->data.and.dxs); free(p->name);
+      memcpy(p, t, sizeof(mpc_parser_t));
+      free(t);
+      continue;
+    }
+    
+    /* Remove `tag` */
+    if (p->type == MPC_TYPE_APPLY_TO
+    &&  p->data.apply_to.f == (mpc_apply_to_t)mpc_ast_tag) {
+      t = p->data.apply_to.x;
+      free(p->name);
+      memcpy(p, t, sizeof(mpc_parser_t));
+      free(t);
+      continue;
+    }
+    
+    /* Remove `root` of a rule reference */
+    if (p->type == MPC_TYPE_APPLY
+    &&  p->data.apply.f == (mpc_apply_t)mpc_ast_add_root
+    && !p->data.apply.x->retained) {
+      t = p->data.apply.x;
+      free(p->name);
+      memcpy(p, t, sizeof(mpc_parser_t));
+      free(t);
+      continue;
+    }
+    
+    break;
+  }
+  
+  /* Replace AST callbacks with value list ones */
+  
+  if (p->type == MPC_TYPE_APPLY && p->data.apply.f == mpcf_str_ast) {
+    p->data.apply.f = mpcaf_vals_str;
+  }
+  
+  if (p->type == MPC_TYPE_APPLY_TO
+  &&  p->data.apply_to.f == (mpc_apply_to_t)mpc_ast_add_rule) {
+    p->data.apply_to.f = mpcaf_vals_rule;
+  }
+  
+  if (p->type == MPC_TYPE_APPLY
+  &&  p->data.apply.f == (mpc_apply_t)mpc_ast_add_root) {
+    t = p->data.apply.x;
+    p->type = MPC_TYPE_APPLY_TO;
+    p->data.apply_to.x = t;
+    p->data.apply_to.f = mpcaf_vals_rule;
+    p->data.apply_to.d = t;
+  }
+  
+  if (p->type == MPC_TYPE_AND && p->data.and.f == mpcf_fold_ast) {
+    p->data.and.f = mpcaf_vals_fold;
+    for (i = 0; i < p->data.and.n-1; i++) { p->data.and.dxs[i] = mpcaf_vals_delete; }
+  }
+  
+  if ((p->type == MPC_TYPE_MANY || p->type == MPC_TYPE_MANY1 || p->type == MPC_TYPE_COUNT)
+  &&  p->data.repeat.f == mpcf_fold_ast) {
+    p->data.repeat.f = mpcaf_vals_fold;
+    p->data.repeat.dx = mpcaf_vals_delete;
+  }
+  
+  if (p->type == MPC_TYPE_NOT && p->data.not.dx == (mpc_dtor_t)mpc_ast_delete) {
+    p->data.not.dx = mpcaf_vals_delete;
+  }
+  
+  /* Rewrite Subexpressions */
+  
+  if (p->type == MPC_TYPE_EXPECT)     { mpca_values_unretained(p->data.expect.x); }
+  if (p->type == MPC_TYPE_APPLY)      { mpca_values_unretained(p->data.apply.x); }
+  if (p->type == MPC_TYPE_APPLY_TO)   { mpca_values_unretained(p->data.apply_to.x); }
+  if (p->type == MPC_TYPE_PREDICT)    { mpca_values_unretained(p->data.predict.x); }
+  if (p->type == MPC_TYPE_DEFERRED)   { mpca_values_unretained(p->data.predict.x); }
+  if (p->type == MPC_TYPE_NOT)        { mpca_values_unretained(p->data.not.x); }
+  if (p->type == MPC_TYPE_MAYBE)      { mpca_values_unretained(p->data.not.x); }
+  if (p->type == MPC_TYPE_MANY)       { mpca_values_unretained(p->data.repeat.x); }
+  if (p->type == MPC_TYPE_MANY1)      { mpca_values_unretained(p->data.repeat.x); }
+  if (p->type == MPC_TYPE_COUNT)      { mpca_values_unretained(p->data.repeat.x); }
+  
+  if (p->type == MPC_TYPE_OR) {
+    for (i = 0; i < p->data.or.n; i++) { mpca_values_unretained(p->data.or.xs[i]); }
+  }
+  
+  if (p->type == MPC_TYPE_AND) {
+    for (i = 0; i < p->data.and.n; i++) { mpca_values_unretained(p->data.and.xs[i]); }
+  }
+  
+}
+
+static mpc_parser_t *mpca_stmt_action(mpc_parser_t *p, const char *name, mpca_grammar_st_t *st) {
+  
+  const mpca_action_t *a;
+  
+  for (a = st->actions; a && a->name; a++) {
+    if (strcmp(a->name, name) == 0) {
+      mpca_values_unretained(p);
+      return mpc_apply_to(p, mpcaf_action, (void*)a);
+    }
+  }
+  
+  mpc_soft_delete(p);
+  return mpc_failf("Unknown Action '%s'!", name);
+}
+
+typedef struct {
+  char *ident;
+  char *name;
+  char *action;
+  mpc_parser_t *grammar;
+} mpca_stmt_t;
+
+static mpc_val_t *mpca_stmt_afold(int n, mpc_val_t **xs) {
+  mpca_stmt_t *stmt = malloc(sizeof(mpca_stmt_t));
+  stmt->ident = ((char**)xs)[0];
+  stmt->name = ((char**)xs)[1];
+  stmt->action = ((char**)xs)[2];
+  stmt->grammar = ((mpc_parser_t**)xs)[4];
+  (void) n;
+  free(((char**)xs)[3]);
+  free(((char**)xs)[5]);
+  
+  return stmt;
+}
+
+static mpc_val_t *mpca_stmt_fold(int n, mpc_val_t **xs) {
+  
+  int i;
+  mpca_stmt_t **stmts = malloc(sizeof(mpca_stmt_t*) * (n+1));
+  
+  for (i = 0; i < n; i++) {
+    stmts[i] = xs[i];
+  }
+  stmts[n] = NULL;  
+  
+  return stmts;
+}
+
+static void mpca_stmt_list_delete(mpc_val_t *x) {
+
+  mpca_stmt_t **stmts = x;
 
   while(*stmts) {
     mpca_stmt_t *stmt = *stmts; 
     free(stmt->ident);
     free(stmt->name);
+    free(stmt->action);
     mpc_soft_delete(stmt->grammar);
     free(stmt);  
     stmts++;
@@ -3541,6 +6367,8 @@ static void mpca_stmt_list_delete(mpc_val_t *x) {
 
 }
 
+static void mpc_optimise_first(mpc_parser_t *p, int force);
+
 static mpc_val_t *mpca_stmt_list_apply_to(mpc_val_t *x, void *s) {
 
   mpca_grammar_st_t *st = s;
@@ -3552,13 +6380,24 @@ static mpc_val_t *mpca_stmt_list_apply_to(mpc_val_t *x, void *s) {
     stmt = *stmts;
     left = mpca_grammar_find_parser(stmt->ident, st);
     if (st->flags & MPCA_LANG_PREDICTIVE) { stmt->grammar = mpc_predictive(stmt->grammar); }
+    if (st->flags & MPCA_LANG_DEFERRED_ERRORS) { stmt->grammar = mpc_deferred(stmt->grammar); }
     if (stmt->name) { stmt->grammar = mpc_expect(stmt->grammar, stmt->name); }
     mpc_optimise(stmt->grammar);
+    if (stmt->action && st->actions) { stmt->grammar = mpca_stmt_action(stmt->grammar, stmt->action, st); }
     mpc_define(left, stmt->grammar);
+    stmt->grammar = left;
+    stmts++;
+  }
+  
+  /* Rebuild jump tables now later rules are defined */
+  
+  for (stmts = x; *stmts; stmts++) {
+    stmt = *stmts;
+    mpc_optimise_first(stmt->grammar, 1);
     free(stmt->ident);
     free(stmt->name);
+    free(stmt->action);
     free(stmt);
-    stmts++;
   }
   
   free(x);
@@ -3584,9 +6423,11 @@ static mpc_err_t *mpca_lang_st(mpc_input_t *i, mpca_grammar_st_t *st) {
     mpca_stmt_list_apply_to, st
   ));
   
-  mpc_define(Stmt, mpc_and(5, mpca_stmt_afold,
-    mpc_tok(mpc_ident()), mpc_maybe(mpc_tok(mpc_string_lit())), mpc_sym(":"), Grammar, mpc_sym(";"),
-    free, free, free, mpc_soft_delete
+  mpc_define(Stmt, mpc_and(6, mpca_stmt_afold,
+    mpc_tok(mpc_ident()), mpc_maybe(mpc_tok(mpc_string_lit())),
+    mpc_maybe(mpc_and(2, mpcf_snd_free, mpc_sym("@"), mpc_tok(mpc_ident()), free)),
+    mpc_sym(":"), Grammar, mpc_sym(";"),
+    free, free, free, free, mpc_soft_delete
   ));
   
   mpc_define(Grammar, mpc_and(2, mpcaf_grammar_or,
@@ -3647,6 +6488,7 @@ mpc_err_t *mpca_lang_file(int flags, FILE *f, ...) {
   st.parsers_num = 0;
   st.parsers = NULL;
   st.flags = flags;
+  st.actions = NULL;
   
   i = mpc_input_new_file("<mpca_lang_file>", f);
   err = mpca_lang_st(i, &st);
@@ -3669,6 +6511,7 @@ mpc_err_t *mpca_lang_pipe(int flags, FILE *p, ...) {
   st.parsers_num = 0;
   st.parsers = NULL;
   st.flags = flags;
+  st.actions = NULL;
   
   i = mpc_input_new_pipe("<mpca_lang_pipe>", p);
   err = mpca_lang_st(i, &st);
@@ -3692,6 +6535,7 @@ mpc_err_t *mpca_lang(int flags, const char *language, ...) {
   st.parsers_num = 0;
   st.parsers = NULL;
   st.flags = flags;
+  st.actions = NULL;
   
   i = mpc_input_new_string("<mpca_lang>", language);
   err = mpca_lang_st(i, &st);
@@ -3702,6 +6546,30 @@ mpc_err_t *mpca_lang(int flags, const char *language, ...) {
   return err;
 }
 
+mpc_err_t *mpca_lang_actions(int flags, const mpca_action_t *actions, const char *language, ...) {
+  
+  mpca_grammar_st_t st;
+  mpc_input_t *i;
+  mpc_err_t *err;
+  
+  va_list va;  
+  va_start(va, language);
+  
+  st.va = &va;
+  st.parsers_num = 0;
+  st.parsers = NULL;
+  st.flags = flags;
+  st.actions = actions;
+  
+  i = mpc_input_new_string("<mpca_lang_actions>", language);
+  err = mpca_lang_st(i, &st);
+  mpc_input_delete(i);
+  
+  free(st.parsers);
+  va_end(va);
+  return err;
+}
+
 mpc_err_t *mpca_lang_contents(int flags, const char *filename, ...) {
   
   mpca_grammar_st_t st;
@@ -3723,6 +6591,7 @@ mpc_err_t *mpca_lang_contents(int flags, const char *filename, ...) {
   st.parsers_num = 0;
   st.parsers = NULL;
   st.flags = flags;
+  st.actions = NULL;
   
   i = mpc_input_new_file(filename, f);
   err = mpca_lang_st(i, &st);
@@ -3736,84 +6605,1541 @@ mpc_err_t *mpca_lang_contents(int flags, const char *filename, ...) {
   return err;
 }
 
-static int mpc_nodecount_unretained(mpc_parser_t* p, int force) {
+/*
+** Grammar Caching
+**
+** `mpca_lang_save` writes the parsers built by
+** `mpca_lang` out as a flat blob which
+** `mpca_lang_load` turns back into the same
+** parsers without parsing the grammar or any of
+** its regular expressions again.
+**
+** Unretained parsers form a tree so each is
+** written in place, children after parents.
+** Retained parsers are written as the index of
+** the rule they belong to. Integers are written
+** as four bytes, least significant first, and
+** strings as their length followed by their
+** characters, with a length of -1 for `NULL`.
+**
+** Functions are written as an index into a table
+** of those the library uses to build grammars,
+** and tags and actions by name. A parser using
+** any other function or value cannot be saved.
+*/
 
-  int i, total;
+enum {
+  MPCA_SAVE_VERSION = 2,
+  MPCA_SAVE_RULE = 0xFF
+};
 
-  if (p->retained && !force) { return 0; }
+typedef void(*mpca_save_fn_t)(void);
 
-  if (p->type == MPC_TYPE_EXPECT) { return 1 + mpc_nodecount_unretained(p->data.expect.x, 0); }
+/* What each function is called as, so loading never puts one where a
+** different kind of function is expected. `NULL` is of any kind. */
+enum {
+  MPCA_FN_ANY, MPCA_FN_FOLD, MPCA_FN_APPLY, MPCA_FN_APPLY_TO, MPCA_FN_DTOR,
+  MPCA_FN_CTOR, MPCA_FN_ANCHOR, MPCA_FN_SATISFY, MPCA_FN_CHECK,
+  MPCA_FN_CHECK_WITH
+};
 
-  if (p->type == MPC_TYPE_APPLY)    { return 1 + mpc_nodecount_unretained(p->data.apply.x, 0); }
-  if (p->type == MPC_TYPE_APPLY_TO) { return 1 + mpc_nodecount_unretained(p->data.apply_to.x, 0); }
-  if (p->type == MPC_TYPE_PREDICT)  { return 1 + mpc_nodecount_unretained(p->data.predict.x, 0); }
+typedef struct {
+  mpca_save_fn_t f;
+  int kind;
+} mpca_save_fn_entry_t;
+
+/* New functions go at the end so saved data stays valid */
+static const mpca_save_fn_entry_t mpca_save_fns[] = {
+  { NULL,                                     MPCA_FN_ANY },
+  { (mpca_save_fn_t)mpcf_null,                MPCA_FN_FOLD },
+  { (mpca_save_fn_t)mpcf_fst,                 MPCA_FN_FOLD },
+  { (mpca_save_fn_t)mpcf_snd,                 MPCA_FN_FOLD },
+  { (mpca_save_fn_t)mpcf_trd,                 MPCA_FN_FOLD },
+  { (mpca_save_fn_t)mpcf_fst_free,            MPCA_FN_FOLD },
+  { (mpca_save_fn_t)mpcf_snd_free,            MPCA_FN_FOLD },
+  { (mpca_save_fn_t)mpcf_trd_free,            MPCA_FN_FOLD },
+  { (mpca_save_fn_t)mpcf_strfold,             MPCA_FN_FOLD },
+  { (mpca_save_fn_t)mpcf_maths,               MPCA_FN_FOLD },
+  { (mpca_save_fn_t)mpcf_fold_ast,            MPCA_FN_FOLD },
+  { (mpca_save_fn_t)mpcf_state_ast,           MPCA_FN_FOLD },
+  { (mpca_save_fn_t)mpcf_re_or,               MPCA_FN_FOLD },
+  { (mpca_save_fn_t)mpcf_re_and,              MPCA_FN_FOLD },
+  { (mpca_save_fn_t)mpcf_re_repeat,           MPCA_FN_FOLD },
+  { (mpca_save_fn_t)mpcaf_vals_fold,          MPCA_FN_FOLD },
+  { (mpca_save_fn_t)mpcf_free,                MPCA_FN_APPLY },
+  { (mpca_save_fn_t)mpcf_int,                 MPCA_FN_APPLY },
+  { (mpca_save_fn_t)mpcf_hex,                 MPCA_FN_APPLY },
+  { (mpca_save_fn_t)mpcf_oct,                 MPCA_FN_APPLY },
+  { (mpca_save_fn_t)mpcf_float,               MPCA_FN_APPLY },
+  { (mpca_save_fn_t)mpcf_strtriml,            MPCA_FN_APPLY },
+  { (mpca_save_fn_t)mpcf_strtrimr,            MPCA_FN_APPLY },
+  { (mpca_save_fn_t)mpcf_strtrim,             MPCA_FN_APPLY },
+  { (mpca_save_fn_t)mpcf_escape,              MPCA_FN_APPLY },
+  { (mpca_save_fn_t)mpcf_unescape,            MPCA_FN_APPLY },
+  { (mpca_save_fn_t)mpcf_escape_regex,        MPCA_FN_APPLY },
+  { (mpca_save_fn_t)mpcf_unescape_regex,      MPCA_FN_APPLY },
+  { (mpca_save_fn_t)mpcf_escape_string_raw,   MPCA_FN_APPLY },
+  { (mpca_save_fn_t)mpcf_unescape_string_raw, MPCA_FN_APPLY },
+  { (mpca_save_fn_t)mpcf_escape_char_raw,     MPCA_FN_APPLY },
+  { (mpca_save_fn_t)mpcf_unescape_char_raw,   MPCA_FN_APPLY },
+  { (mpca_save_fn_t)mpcf_str_ast,             MPCA_FN_APPLY },
+  { (mpca_save_fn_t)mpcf_re_escape,           MPCA_FN_APPLY },
+  { (mpca_save_fn_t)mpcf_re_range,            MPCA_FN_APPLY },
+  { (mpca_save_fn_t)mpcaf_vals_str,           MPCA_FN_APPLY },
+  { (mpca_save_fn_t)mpc_ast_add_root,         MPCA_FN_APPLY },
+  { (mpca_save_fn_t)mpc_ast_tag,              MPCA_FN_APPLY_TO },
+  { (mpca_save_fn_t)mpc_ast_add_tag,          MPCA_FN_APPLY_TO },
+  { (mpca_save_fn_t)mpc_ast_add_rule,         MPCA_FN_APPLY_TO },
+  { (mpca_save_fn_t)mpcaf_vals_rule,          MPCA_FN_APPLY_TO },
+  { (mpca_save_fn_t)mpcaf_action,             MPCA_FN_APPLY_TO },
+  { (mpca_save_fn_t)free,                     MPCA_FN_DTOR },
+  { (mpca_save_fn_t)mpcf_dtor_null,           MPCA_FN_DTOR },
+  { (mpca_save_fn_t)mpc_ast_delete,           MPCA_FN_DTOR },
+  { (mpca_save_fn_t)mpc_soft_delete,          MPCA_FN_DTOR },
+  { (mpca_save_fn_t)mpcaf_vals_delete,        MPCA_FN_DTOR },
+  { (mpca_save_fn_t)mpcf_ctor_null,           MPCA_FN_CTOR },
+  { (mpca_save_fn_t)mpcf_ctor_str,            MPCA_FN_CTOR },
+  { (mpca_save_fn_t)mpc_soi_anchor,           MPCA_FN_ANCHOR },
+  { (mpca_save_fn_t)mpc_eoi_anchor,           MPCA_FN_ANCHOR },
+  { (mpca_save_fn_t)mpc_boundary_anchor,      MPCA_FN_ANCHOR }
+};
 
-  if (p->type == MPC_TYPE_CHECK)    { return 1 + mpc_nodecount_unretained(p->data.check.x, 0); }
-  if (p->type == MPC_TYPE_CHECK_WITH) { return 1 + mpc_nodecount_unretained(p->data.check_with.x, 0); }
+static const char *mpca_save_tags[] = { "string", "char", "regex" };
 
-  if (p->type == MPC_TYPE_NOT)   { return 1 + mpc_nodecount_unretained(p->data.not.x, 0); }
-  if (p->type == MPC_TYPE_MAYBE) { return 1 + mpc_nodecount_unretained(p->data.not.x, 0); }
+enum {
+  MPCA_SAVE_FNS = sizeof(mpca_save_fns) / sizeof(mpca_save_fn_entry_t),
+  MPCA_SAVE_TAGS = sizeof(mpca_save_tags) / sizeof(const char*)
+};
 
-  if (p->type == MPC_TYPE_MANY)  { return 1 + mpc_nodecount_unretained(p->data.repeat.x, 0); }
-  if (p->type == MPC_TYPE_MANY1) { return 1 + mpc_nodecount_unretained(p->data.repeat.x, 0); }
-  if (p->type == MPC_TYPE_COUNT) { return 1 + mpc_nodecount_unretained(p->data.repeat.x, 0); }
+typedef struct {
+  char *data;
+  size_t size;
+  size_t slots;
+  int rules_num;
+  mpc_parser_t **rules;
+  const char *error;
+} mpca_save_t;
+
+static void mpca_save_bytes(mpca_save_t *s, const void *x, size_t n) {
+  while (s->size + n > s->slots) {
+    s->slots *= 2;
+    s->data = realloc(s->data, s->slots);
+  }
+  memcpy(s->data + s->size, x, n);
+  s->size += n;
+}
 
-  if (p->type == MPC_TYPE_OR) { 
-    total = 1;
-    for(i = 0; i < p->data.or.n; i++) {
-      total += mpc_nodecount_unretained(p->data.or.xs[i], 0);
-    }
-    return total;
+static void mpca_save_byte(mpca_save_t *s, int x) {
+  unsigned char c = (unsigned char)x;
+  mpca_save_bytes(s, &c, 1);
+}
+
+static void mpca_save_int(mpca_save_t *s, long x) {
+  unsigned long u = (unsigned long)x;
+  unsigned char b[4];
+  b[0] = (unsigned char)(u & 0xFF);
+  b[1] = (unsigned char)((u >> 8) & 0xFF);
+  b[2] = (unsigned char)((u >> 16) & 0xFF);
+  b[3] = (unsigned char)((u >> 24) & 0xFF);
+  mpca_save_bytes(s, b, 4);
+}
+
+static void mpca_save_str(mpca_save_t *s, const char *x) {
+  if (x == NULL) { mpca_save_int(s, -1); return; }
+  mpca_save_int(s, (long)strlen(x));
+  mpca_save_bytes(s, x, strlen(x));
+}
+
+static void mpca_save_fn(mpca_save_t *s, mpca_save_fn_t f, int kind) {
+  int k;
+  for (k = 0; k < MPCA_SAVE_FNS; k++) {
+    if (mpca_save_fns[k].f == f && (f == NULL || mpca_save_fns[k].kind == kind)) { mpca_save_byte(s, k); return; }
   }
+  s->error = "Cannot save a parser using an unknown function!";
+  mpca_save_byte(s, 0);
+}
+
+static void mpca_save_rule(mpca_save_t *s, mpc_parser_t *p) {
+  int k;
+  for (k = 0; k < s->rules_num; k++) {
+    if (s->rules[k] == p) { mpca_save_int(s, k); return; }
+  }
+  s->error = "Cannot save a parser using a rule which was not given!";
+  mpca_save_int(s, 0);
+}
+
+static void mpca_save_data(mpca_save_t *s, mpc_apply_to_t f, void *d) {
   
-  if (p->type == MPC_TYPE_AND) {
-    total = 1;
-    for(i = 0; i < p->data.and.n; i++) {
-      total += mpc_nodecount_unretained(p->data.and.xs[i], 0);
+  int k;
+  
+  if (f == (mpc_apply_to_t)mpc_ast_tag || f == (mpc_apply_to_t)mpc_ast_add_tag) {
+    for (k = 0; k < MPCA_SAVE_TAGS; k++) {
+      if (strcmp(d, mpca_save_tags[k]) == 0) { mpca_save_byte(s, k); return; }
     }
-    return total;
+    s->error = "Cannot save a parser using an unknown tag!";
+    mpca_save_byte(s, 0);
+    return;
+  }
+  
+  if (f == (mpc_apply_to_t)mpc_ast_add_rule || f == mpcaf_vals_rule) {
+    mpca_save_rule(s, d);
+    return;
+  }
+  
+  if (f == mpcaf_action) {
+    mpca_save_str(s, ((const mpca_action_t*)d)->name);
+    return;
   }
-
-  return 1;
   
+  if (d != NULL) { s->error = "Cannot save a parser using unknown data!"; }
 }
 
-void mpc_stats(mpc_parser_t* p) {
-  printf("Stats\n");
-  printf("=====\n");
-  printf("Node Count: %i\n", mpc_nodecount_unretained(p, 1));
+static void mpca_save_node(mpca_save_t *s, mpc_parser_t *p, int force) {
+  
+  int k;
+  
+  if (p->retained && !force) {
+    mpca_save_byte(s, MPCA_SAVE_RULE);
+    mpca_save_rule(s, p);
+    return;
+  }
+  
+  mpca_save_byte(s, p->type);
+  mpca_save_str(s, p->name);
+  mpca_save_int(s, p->rule);
+  
+  switch (p->type) {
+    
+    case MPC_TYPE_UNDEFINED:
+    case MPC_TYPE_PASS:
+    case MPC_TYPE_ANY:
+    case MPC_TYPE_STATE:
+      break;
+    
+    case MPC_TYPE_FAIL: mpca_save_str(s, p->data.fail.m); break;
+    
+    case MPC_TYPE_LIFT: mpca_save_fn(s, (mpca_save_fn_t)p->data.lift.lf, MPCA_FN_CTOR); break;
+    case MPC_TYPE_LIFT_VAL:
+      if (p->data.lift.x != NULL) { s->error = "Cannot save a parser lifting a value!"; }
+      break;
+    
+    case MPC_TYPE_EXPECT:
+      mpca_save_str(s, p->data.expect.m);
+      mpca_save_node(s, p->data.expect.x, 0);
+      break;
+    
+    case MPC_TYPE_ANCHOR:  mpca_save_fn(s, (mpca_save_fn_t)p->data.anchor.f, MPCA_FN_ANCHOR); break;
+    case MPC_TYPE_SATISFY: mpca_save_fn(s, (mpca_save_fn_t)p->data.satisfy.f, MPCA_FN_SATISFY); break;
+    case MPC_TYPE_SINGLE:  mpca_save_byte(s, p->data.single.x); break;
+    
+    case MPC_TYPE_RANGE:
+      mpca_save_byte(s, p->data.range.x);
+      mpca_save_byte(s, p->data.range.y);
+      break;
+    
+    case MPC_TYPE_ONEOF:
+    case MPC_TYPE_NONEOF:
+      mpca_save_str(s, p->data.set.x);
+      mpca_save_bytes(s, p->data.set.s, MPC_SET_SIZE);
+      break;
+    
+    case MPC_TYPE_STRING:
+      mpca_save_str(s, p->data.string.x);
+      mpca_save_byte(s, p->data.string.m != NULL);
+      if (p->data.string.m) { mpca_save_bytes(s, p->data.string.m, strlen(p->data.string.x) * 4); }
+      break;
+    
+    case MPC_TYPE_SCAN:
+      mpca_save_int(s, p->data.scan.n);
+      mpca_save_str(s, p->data.scan.m);
+      mpca_save_bytes(s, p->data.scan.s, MPC_SET_SIZE);
+      break;
+    
+    case MPC_TYPE_APPLY:
+      mpca_save_fn(s, (mpca_save_fn_t)p->data.apply.f, MPCA_FN_APPLY);
+      mpca_save_node(s, p->data.apply.x, 0);
+      break;
+    
+    case MPC_TYPE_APPLY_TO:
+      mpca_save_fn(s, (mpca_save_fn_t)p->data.apply_to.f, MPCA_FN_APPLY_TO);
+      mpca_save_data(s, p->data.apply_to.f, p->data.apply_to.d);
+      mpca_save_node(s, p->data.apply_to.x, 0);
+      break;
+    
+    case MPC_TYPE_CHECK:
+      mpca_save_fn(s, (mpca_save_fn_t)p->data.check.f, MPCA_FN_CHECK);
+      mpca_save_str(s, p->data.check.e);
+      mpca_save_node(s, p->data.check.x, 0);
+      break;
+    
+    case MPC_TYPE_CHECK_WITH:
+      if (p->data.check_with.d != NULL) { s->error = "Cannot save a parser using unknown data!"; }
+      mpca_save_fn(s, (mpca_save_fn_t)p->data.check_with.f, MPCA_FN_CHECK_WITH);
+      mpca_save_str(s, p->data.check_with.e);
+      mpca_save_node(s, p->data.check_with.x, 0);
+      break;
+    
+    case MPC_TYPE_PREDICT:
+    case MPC_TYPE_DEFERRED:
+    case MPC_TYPE_SPAN:
+      mpca_save_node(s, p->data.predict.x, 0);
+      break;
+    
+    case MPC_TYPE_NOT:
+    case MPC_TYPE_MAYBE:
+      mpca_save_fn(s, (mpca_save_fn_t)p->data.not.dx, MPCA_FN_DTOR);
+      mpca_save_fn(s, (mpca_save_fn_t)p->data.not.lf, MPCA_FN_CTOR);
+      mpca_save_node(s, p->data.not.x, 0);
+      break;
+    
+    case MPC_TYPE_MANY:
+    case MPC_TYPE_MANY1:
+    case MPC_TYPE_COUNT:
+      mpca_save_int(s, p->data.repeat.n);
+      mpca_save_fn(s, (mpca_save_fn_t)p->data.repeat.f, MPCA_FN_FOLD);
+      mpca_save_fn(s, (mpca_save_fn_t)p->data.repeat.dx, MPCA_FN_DTOR);
+      mpca_save_node(s, p->data.repeat.x, 0);
+      break;
+    
+    case MPC_TYPE_OR:
+      mpca_save_int(s, p->data.or.n);
+      mpca_save_byte(s, p->data.or.jump != NULL);
+      if (p->data.or.jump) { mpca_save_bytes(s, p->data.or.jump, 256); }
+      for (k = 0; k < p->data.or.n; k++) { mpca_save_node(s, p->data.or.xs[k], 0); }
+      break;
+    
+    case MPC_TYPE_AND:
+      mpca_save_int(s, p->data.and.n);
+      mpca_save_fn(s, (mpca_save_fn_t)p->data.and.f, MPCA_FN_FOLD);
+      for (k = 0; k < p->data.and.n-1; k++) { mpca_save_fn(s, (mpca_save_fn_t)p->data.and.dxs[k], MPCA_FN_DTOR); }
+      for (k = 0; k < p->data.and.n; k++) { mpca_save_node(s, p->data.and.xs[k], 0); }
+      break;
+    
+    case MPC_TYPE_REGEX:
+      mpca_save_int(s, p->data.regex.d->flags);
+      mpca_save_int(s, p->data.regex.d->states);
+      mpca_save_bytes(s, p->data.regex.d->accept, p->data.regex.d->states);
+      mpca_save_bytes(s, p->data.regex.d->trans, p->data.regex.d->states * 256);
+      for (k = 0; k < p->data.regex.d->states; k++) {
+        if (!p->data.regex.d->expect[k]) { mpca_save_int(s, -1); continue; }
+        mpca_save_int(s, (long)mpc_dfa_expect_len(p->data.regex.d->expect[k]));
+        mpca_save_bytes(s, p->data.regex.d->expect[k], mpc_dfa_expect_len(p->data.regex.d->expect[k]));
+      }
+      mpca_save_node(s, p->data.regex.x, 0);
+      break;
+    
+    default:
+      s->error = "Cannot save a parser of unknown type!";
+      break;
+  }
+  
+}
+
+mpc_err_t *mpca_lang_save(char **data, size_t *size, ...) {
+  
+  int k;
+  mpc_parser_t *p;
+  mpc_err_t *err = NULL;
+  mpca_save_t s;
+  va_list va;
+  
+  s.size = 0;
+  s.slots = 1024;
+  s.data = malloc(s.slots);
+  s.rules_num = 0;
+  s.rules = NULL;
+  s.error = NULL;
+  
+  va_start(va, size);
+  while ((p = va_arg(va, mpc_parser_t*))) {
+    s.rules = realloc(s.rules, sizeof(mpc_parser_t*) * (s.rules_num + 1));
+    s.rules[s.rules_num++] = p;
+  }
+  va_end(va);
+  
+  mpca_save_bytes(&s, "mpca", 4);
+  mpca_save_int(&s, MPCA_SAVE_VERSION);
+  mpca_save_int(&s, s.rules_num);
+  
+  for (k = 0; k < s.rules_num; k++) { mpca_save_str(&s, s.rules[k]->name); }
+  for (k = 0; k < s.rules_num; k++) { mpca_save_node(&s, s.rules[k], 1); }
+  
+  free(s.rules);
+  
+  if (s.error) {
+    err = mpc_err_file("<mpca_lang_save>", s.error);
+    free(s.data);
+    *data = NULL;
+    *size = 0;
+  } else {
+    *data = s.data;
+    *size = s.size;
+  }
+  
+  return err;
+}
+
+/*
+** Loading checks every length and index against
+** the data so that a truncated or corrupted blob
+** gives an error rather than a broken parser.
+** After the first error all reads give zero and
+** parsers are read as undefined.
+*/
+
+typedef struct {
+  const unsigned char *data;
+  size_t size;
+  size_t pos;
+  int rules_num;
+  mpc_parser_t **rules;
+  const mpca_action_t *actions;
+  const char *error;
+} mpca_load_t;
+
+static int mpca_load_bytes(mpca_load_t *l, void *x, size_t n) {
+  if (l->error || n > l->size - l->pos) {
+    if (!l->error) { l->error = "Grammar data is truncated!"; }
+    memset(x, 0, n);
+    return 0;
+  }
+  memcpy(x, l->data + l->pos, n);
+  l->pos += n;
+  return 1;
+}
+
+static int mpca_load_byte(mpca_load_t *l) {
+  unsigned char c;
+  mpca_load_bytes(l, &c, 1);
+  return c;
+}
+
+static long mpca_load_int(mpca_load_t *l) {
+  unsigned char b[4];
+  unsigned long u;
+  mpca_load_bytes(l, b, 4);
+  u = (unsigned long)b[0] | ((unsigned long)b[1] << 8) | ((unsigned long)b[2] << 16) | ((unsigned long)b[3] << 24);
+  return u & 0x80000000UL ? -(long)((~u & 0xFFFFFFFFUL) + 1) : (long)u;
+}
+
+/* Counts must fit in the rest of the data */
+static int mpca_load_count(mpca_load_t *l, long min, size_t each) {
+  long n = mpca_load_int(l);
+  if (l->error) { return 0; }
+  if (n < min || (size_t)n > (l->size - l->pos) / each) {
+    l->error = "Grammar data is corrupted!";
+    return 0;
+  }
+  return (int)n;
+}
+
+static char *mpca_load_str(mpca_load_t *l) {
+  char *x;
+  long n = mpca_load_int(l);
+  if (l->error || n == -1) { return NULL; }
+  if (n < 0 || (size_t)n > l->size - l->pos) {
+    l->error = "Grammar data is corrupted!";
+    return NULL;
+  }
+  x = malloc(n + 1);
+  mpca_load_bytes(l, x, n);
+  x[n] = '\0';
+  return x;
+}
+
+static char *mpca_load_needed(mpca_load_t *l) {
+  char *x = mpca_load_str(l);
+  if (x == NULL && !l->error) { l->error = "Grammar data is corrupted!"; }
+  return x;
+}
+
+/* A list of messages must end with an empty one */
+static char *mpca_load_expect(mpca_load_t *l) {
+  char *x;
+  long n = mpca_load_int(l);
+  if (l->error || n == -1) { return NULL; }
+  if (n < 1 || (size_t)n > l->size - l->pos) {
+    l->error = "Grammar data is corrupted!";
+    return NULL;
+  }
+  x = malloc(n);
+  mpca_load_bytes(l, x, n);
+  if (x[n-1] != '\0' || (n > 1 && x[n-2] != '\0')) {
+    l->error = "Grammar data is corrupted!";
+    x[0] = '\0';
+  }
+  return x;
+}
+
+/* A function must be of the kind its slot calls */
+static mpca_save_fn_t mpca_load_fn(mpca_load_t *l, int kind) {
+  int k = mpca_load_byte(l);
+  if (k >= MPCA_SAVE_FNS) { l->error = "Grammar data uses an unknown function!"; return NULL; }
+  if (mpca_save_fns[k].f != NULL && mpca_save_fns[k].kind != kind) { l->error = "Grammar data uses a function of the wrong kind!"; return NULL; }
+  return mpca_save_fns[k].f;
+}
+
+/* Functions a parser always calls can't be NULL */
+static mpca_save_fn_t mpca_load_needed_fn(mpca_load_t *l, int kind) {
+  mpca_save_fn_t f = mpca_load_fn(l, kind);
+  if (f == NULL && !l->error) { l->error = "Grammar data is corrupted!"; }
+  return f;
+}
+
+static mpc_parser_t *mpca_load_rule(mpca_load_t *l) {
+  long k = mpca_load_int(l);
+  if (l->error) { return NULL; }
+  if (k < 0 || k >= l->rules_num) { l->error = "Grammar data is corrupted!"; return NULL; }
+  return l->rules[k];
+}
+
+static void *mpca_load_data(mpca_load_t *l, mpc_apply_to_t f) {
+  
+  int k;
+  char *name;
+  const mpca_action_t *a;
+  
+  if (f == (mpc_apply_to_t)mpc_ast_tag || f == (mpc_apply_to_t)mpc_ast_add_tag) {
+    k = mpca_load_byte(l);
+    if (k >= MPCA_SAVE_TAGS) { l->error = "Grammar data uses an unknown tag!"; return NULL; }
+    return (void*)mpca_save_tags[k];
+  }
+  
+  if (f == (mpc_apply_to_t)mpc_ast_add_rule || f == mpcaf_vals_rule) {
+    return mpca_load_rule(l);
+  }
+  
+  if (f == mpcaf_action) {
+    name = mpca_load_needed(l);
+    if (name == NULL) { return NULL; }
+    for (a = l->actions; a && a->name; a++) {
+      if (strcmp(a->name, name) == 0) { free(name); return (void*)a; }
+    }
+    free(name);
+    l->error = "Grammar data uses an unknown action!";
+    return NULL;
+  }
+  
+  return NULL;
+}
+
+static mpc_parser_t *mpca_load_node(mpca_load_t *l) {
+  
+  int k, type;
+  mpc_parser_t *p;
+  
+  if (l->error) { return mpc_undefined(); }
+  
+  type = mpca_load_byte(l);
+  
+  if (type == MPCA_SAVE_RULE) {
+    p = mpca_load_rule(l);
+    return p ? p : mpc_undefined();
+  }
+  
+  p = mpc_undefined();
+  p->name = mpca_load_str(l);
+  p->rule = (int)mpca_load_int(l);
+  
+  switch (type) {
+    
+    case MPC_TYPE_UNDEFINED:
+    case MPC_TYPE_PASS:
+    case MPC_TYPE_ANY:
+    case MPC_TYPE_STATE:
+    case MPC_TYPE_LIFT_VAL:
+      break;
+    
+    case MPC_TYPE_FAIL: p->data.fail.m = mpca_load_needed(l); break;
+    case MPC_TYPE_LIFT: p->data.lift.lf = (mpc_ctor_t)mpca_load_needed_fn(l, MPCA_FN_CTOR); break;
+    
+    case MPC_TYPE_EXPECT:
+      p->data.expect.m = mpca_load_needed(l);
+      p->data.expect.x = mpca_load_node(l);
+      break;
+    
+    case MPC_TYPE_ANCHOR:  p->data.anchor.f = (int(*)(char,char))mpca_load_needed_fn(l, MPCA_FN_ANCHOR); break;
+    case MPC_TYPE_SATISFY: p->data.satisfy.f = (int(*)(char))mpca_load_needed_fn(l, MPCA_FN_SATISFY); break;
+    case MPC_TYPE_SINGLE:  p->data.single.x = (char)mpca_load_byte(l); break;
+    
+    case MPC_TYPE_RANGE:
+      p->data.range.x = (char)mpca_load_byte(l);
+      p->data.range.y = (char)mpca_load_byte(l);
+      break;
+    
+    case MPC_TYPE_ONEOF:
+    case MPC_TYPE_NONEOF:
+      p->data.set.x = mpca_load_needed(l);
+      mpca_load_bytes(l, p->data.set.s, MPC_SET_SIZE);
+      break;
+    
+    case MPC_TYPE_STRING:
+      p->data.string.x = mpca_load_needed(l);
+      if (mpca_load_byte(l) && p->data.string.x) {
+        k = (int)strlen(p->data.string.x) * 4;
+        p->data.string.m = malloc(k);
+        mpca_load_bytes(l, p->data.string.m, k);
+      }
+      break;
+    
+    case MPC_TYPE_SCAN:
+      p->data.scan.n = (int)mpca_load_int(l);
+      p->data.scan.m = mpca_load_needed(l);
+      mpca_load_bytes(l, p->data.scan.s, MPC_SET_SIZE);
+      p->data.scan.c = mpc_class_new(p->data.scan.s);
+      break;
+    
+    case MPC_TYPE_APPLY:
+      p->data.apply.f = (mpc_apply_t)mpca_load_needed_fn(l, MPCA_FN_APPLY);
+      p->data.apply.x = mpca_load_node(l);
+      break;
+    
+    case MPC_TYPE_APPLY_TO:
+      p->data.apply_to.f = (mpc_apply_to_t)mpca_load_needed_fn(l, MPCA_FN_APPLY_TO);
+      p->data.apply_to.d = mpca_load_data(l, p->data.apply_to.f);
+      p->data.apply_to.x = mpca_load_node(l);
+      break;
+    
+    case MPC_TYPE_CHECK:
+      p->data.check.f = (mpc_check_t)mpca_load_needed_fn(l, MPCA_FN_CHECK);
+      p->data.check.e = mpca_load_needed(l);
+      p->data.check.x = mpca_load_node(l);
+      break;
+    
+    case MPC_TYPE_CHECK_WITH:
+      p->data.check_with.f = (mpc_check_with_t)mpca_load_needed_fn(l, MPCA_FN_CHECK_WITH);
+      p->data.check_with.d = NULL;
+      p->data.check_with.e = mpca_load_needed(l);
+      p->data.check_with.x = mpca_load_node(l);
+      break;
+    
+    case MPC_TYPE_PREDICT:
+    case MPC_TYPE_DEFERRED:
+    case MPC_TYPE_SPAN:
+      p->data.predict.x = mpca_load_node(l);
+      break;
+    
+    case MPC_TYPE_NOT:
+    case MPC_TYPE_MAYBE:
+      p->data.not.dx = (mpc_dtor_t)(type == MPC_TYPE_NOT ? mpca_load_needed_fn : mpca_load_fn)(l, MPCA_FN_DTOR);
+      p->data.not.lf = (mpc_ctor_t)mpca_load_needed_fn(l, MPCA_FN_CTOR);
+      p->data.not.x = mpca_load_node(l);
+      break;
+    
+    case MPC_TYPE_MANY:
+    case MPC_TYPE_MANY1:
+    case MPC_TYPE_COUNT:
+      p->data.repeat.n = (int)mpca_load_int(l);
+      p->data.repeat.f = (mpc_fold_t)mpca_load_needed_fn(l, MPCA_FN_FOLD);
+      p->data.repeat.dx = (mpc_dtor_t)(type == MPC_TYPE_COUNT ? mpca_load_needed_fn : mpca_load_fn)(l, MPCA_FN_DTOR);
+      p->data.repeat.x = mpca_load_node(l);
+      break;
+    
+    case MPC_TYPE_OR:
+      p->data.or.n = mpca_load_count(l, 0, 1);
+      p->data.or.jump = NULL;
+      if (mpca_load_byte(l)) {
+        p->data.or.jump = malloc(256);
+        mpca_load_bytes(l, p->data.or.jump, 256);
+      }
+      p->data.or.xs = malloc(sizeof(mpc_parser_t*) * (p->data.or.n + 1));
+      for (k = 0; k < p->data.or.n; k++) { p->data.or.xs[k] = mpca_load_node(l); }
+      break;
+    
+    case MPC_TYPE_AND:
+      p->data.and.n = mpca_load_count(l, 1, 1);
+      if (l->error) { p->data.and.n = 1; }
+      p->data.and.f = (mpc_fold_t)mpca_load_needed_fn(l, MPCA_FN_FOLD);
+      p->data.and.xs = malloc(sizeof(mpc_parser_t*) * p->data.and.n);
+      p->data.and.dxs = malloc(sizeof(mpc_dtor_t) * p->data.and.n);
+      for (k = 0; k < p->data.and.n-1; k++) { p->data.and.dxs[k] = (mpc_dtor_t)mpca_load_needed_fn(l, MPCA_FN_DTOR); }
+      for (k = 0; k < p->data.and.n; k++) { p->data.and.xs[k] = mpca_load_node(l); }
+      break;
+    
+    case MPC_TYPE_REGEX:
+      p->data.regex.d = malloc(sizeof(mpc_dfa_t));
+      p->data.regex.d->flags = (int)mpca_load_int(l);
+      p->data.regex.d->states = mpca_load_count(l, 2, 257);
+      p->data.regex.d->accept = malloc(p->data.regex.d->states + 1);
+      p->data.regex.d->trans = malloc(p->data.regex.d->states * 256 + 1);
+      mpca_load_bytes(l, p->data.regex.d->accept, p->data.regex.d->states);
+      mpca_load_bytes(l, p->data.regex.d->trans, p->data.regex.d->states * 256);
+      p->data.regex.d->expect = calloc(p->data.regex.d->states, sizeof(char*));
+      for (k = 0; k < p->data.regex.d->states; k++) {
+        p->data.regex.d->expect[k] = mpca_load_expect(l);
+      }
+      mpc_dfa_loops(p->data.regex.d);
+      p->data.regex.x = mpca_load_node(l);
+      break;
+    
+    default:
+      l->error = "Grammar data uses an unknown parser type!";
+      return p;
+  }
+  
+  p->type = (char)type;
+  return p;
+}
+
+static mpc_err_t *mpca_lang_load_st(mpca_load_t *l, va_list va) {
+  
+  int j, k, num, given_num = 0;
+  char *name;
+  mpc_parser_t *p, **defs, **given = NULL;
+  mpc_err_t *err = NULL;
+  
+  while ((p = va_arg(va, mpc_parser_t*))) {
+    given = realloc(given, sizeof(mpc_parser_t*) * (given_num + 1));
+    given[given_num++] = p;
+  }
+  
+  if (l->size < 4 || memcmp(l->data, "mpca", 4) != 0) {
+    l->error = "Grammar data is not a saved grammar!";
+  } else {
+    l->pos = 4;
+    if (mpca_load_int(l) != MPCA_SAVE_VERSION && !l->error) {
+      l->error = "Grammar data was saved by a different version!";
+    }
+  }
+  
+  num = mpca_load_count(l, 0, 1);
+  l->rules = calloc(num + 1, sizeof(mpc_parser_t*));
+  defs = calloc(num + 1, sizeof(mpc_parser_t*));
+  
+  /* Saved rules are matched to the given parsers by name */
+  for (j = 0; j < num && !l->error; j++) {
+    name = mpca_load_needed(l);
+    for (k = 0; name && k < given_num; k++) {
+      if (given[k]->name && strcmp(given[k]->name, name) == 0) { l->rules[j] = given[k]; }
+    }
+    if (name && !l->rules[j]) { l->error = "Grammar data uses a rule which was not given!"; }
+    free(name);
+  }
+  l->rules_num = l->error ? 0 : num;
+  
+  for (j = 0; j < num && !l->error; j++) {
+    defs[j] = mpca_load_node(l);
+    if (defs[j]->retained) { defs[j] = NULL; l->error = "Grammar data is corrupted!"; }
+  }
+  
+  if (!l->error && l->pos != l->size) { l->error = "Grammar data is corrupted!"; }
+  
+  /* Nothing is defined unless all of it loaded */
+  for (j = 0; j < num; j++) {
+    if (defs[j] == NULL) { continue; }
+    if (l->error) { mpc_delete(defs[j]); continue; }
+    l->rules[j]->rule = defs[j]->rule;
+    free(defs[j]->name);
+    defs[j]->name = NULL;
+    mpc_define(l->rules[j], defs[j]);
+  }
+  
+  if (l->error) { err = mpc_err_file("<mpca_lang_load>", l->error); }
+  
+  free(defs);
+  free(l->rules);
+  free(given);
+  return err;
+}
+
+mpc_err_t *mpca_lang_load(const char *data, size_t size, ...) {
+  mpca_load_t l;
+  mpc_err_t *err;
+  va_list va;
+  va_start(va, size);
+  l.data = (const unsigned char*)data;
+  l.size = size;
+  l.pos = 0;
+  l.rules_num = 0;
+  l.rules = NULL;
+  l.actions = NULL;
+  l.error = NULL;
+  err = mpca_lang_load_st(&l, va);
+  va_end(va);
+  return err;
+}
+
+mpc_err_t *mpca_lang_load_actions(const mpca_action_t *actions, const char *data, size_t size, ...) {
+  mpca_load_t l;
+  mpc_err_t *err;
+  va_list va;
+  va_start(va, size);
+  l.data = (const unsigned char*)data;
+  l.size = size;
+  l.pos = 0;
+  l.rules_num = 0;
+  l.rules = NULL;
+  l.actions = actions;
+  l.error = NULL;
+  err = mpca_lang_load_st(&l, va);
+  va_end(va);
+  return err;
+}
+
+/*
+** AST Caching
+**
+** `mpc_ast_save` writes a tree out as a compact
+** block of bytes which `mpc_ast_load` turns back
+** into the same tree far faster than its text can
+** be parsed again. Each distinct tag is written
+** once at the start and nodes refer to it by
+** index. Nodes follow in pre order, each as its
+** tag, contents, position, rule ids and the number
+** of children which follow it.
+**
+** Integers are written as varints, seven bits to
+** a byte with the lowest first and the top bit set
+** on all but the last. Positions and rows are
+** written as the difference from the node before,
+** folded so that small negative differences stay
+** small, so most take a single byte.
+*/
+
+enum {
+  MPC_AST_SAVE_VERSION = 1,
+  MPC_AST_SAVE_NODE_MIN = 8
+};
+
+typedef struct {
+  char *data;
+  size_t size;
+  size_t slots;
+} mpc_ast_buf_t;
+
+static void mpc_ast_buf_bytes(mpc_ast_buf_t *b, const void *x, size_t n) {
+  while (b->size + n > b->slots) {
+    b->slots *= 2;
+    b->data = realloc(b->data, b->slots);
+  }
+  memcpy(b->data + b->size, x, n);
+  b->size += n;
+}
+
+static void mpc_ast_buf_varint(mpc_ast_buf_t *b, unsigned long x) {
+  unsigned char c[sizeof(unsigned long) * 8 / 7 + 1];
+  int n = 0;
+  while (x >= 0x80) { c[n++] = (unsigned char)((x & 0x7F) | 0x80); x >>= 7; }
+  c[n++] = (unsigned char)x;
+  mpc_ast_buf_bytes(b, c, n);
+}
+
+static void mpc_ast_buf_signed(mpc_ast_buf_t *b, long x) {
+  mpc_ast_buf_varint(b, x < 0 ? ((unsigned long)(-(x + 1)) << 1) | 1 : (unsigned long)x << 1);
+}
+
+/*
+** Tags are numbered in the order they are first
+** seen. As in `mpc_compile` a hash table holds
+** each number plus one, so zero is empty.
+*/
+
+static int *mpc_ast_tag_slot(int *table, int slots, char **tags, const char *tag) {
+  unsigned long h = 5381;
+  const char *c;
+  int *t;
+  for (c = tag; *c; c++) { h = h * 33 + (unsigned char)*c; }
+  t = &table[h & (unsigned long)(slots-1)];
+  while (*t && strcmp(tags[*t-1], tag) != 0) {
+    t = t == &table[slots-1] ? table : t+1;
+  }
+  return t;
+}
+
+void mpc_ast_save(mpc_ast_t *a, char **data, size_t *size) {
+  
+  int j, k, *t, tags_num = 0, slots = 64;
+  int *table = calloc(slots, sizeof(int));
+  char **tags = malloc(sizeof(char*) * slots);
+  long n, pos = 0, row = 0;
+  const char *c;
+  mpc_ast_t *x;
+  mpc_ast_iter_t it;
+  mpc_ast_buf_t b, nodes;
+  
+  nodes.size = 0;
+  nodes.slots = 1024;
+  nodes.data = malloc(nodes.slots);
+  
+  mpc_ast_iter_init(&it);
+  mpc_ast_iter_start(&it, a, mpc_ast_trav_order_pre);
+  
+  while ((x = mpc_ast_iter_next(&it))) {
+    
+    t = mpc_ast_tag_slot(table, slots, tags, x->tag);
+    if (!*t) {
+      tags[tags_num] = x->tag;
+      *t = ++tags_num;
+      if (tags_num * 2 > slots) {
+        slots *= 2;
+        tags = realloc(tags, sizeof(char*) * slots);
+        free(table);
+        table = calloc(slots, sizeof(int));
+        for (j = 0; j < tags_num; j++) {
+          *mpc_ast_tag_slot(table, slots, tags, tags[j]) = j+1;
+        }
+      }
+    }
+    
+    k = *mpc_ast_tag_slot(table, slots, tags, x->tag) - 1;
+    c = mpc_ast_text(x, &n);
+    
+    mpc_ast_buf_varint(&nodes, (unsigned long)k);
+    mpc_ast_buf_varint(&nodes, (unsigned long)n);
+    mpc_ast_buf_bytes(&nodes, c, n);
+    mpc_ast_buf_signed(&nodes, x->state.pos - pos);
+    mpc_ast_buf_signed(&nodes, x->state.row - row);
+    mpc_ast_buf_varint(&nodes, (unsigned long)x->state.col);
+    mpc_ast_buf_varint(&nodes, (unsigned long)x->rule);
+    mpc_ast_buf_varint(&nodes, (unsigned long)x->primary);
+    mpc_ast_buf_varint(&nodes, (unsigned long)x->children_num);
+    pos = x->state.pos;
+    row = x->state.row;
+  }
+  
+  mpc_ast_iter_free(&it);
+  
+  b.size = 0;
+  b.slots = nodes.size + 64;
+  b.data = malloc(b.slots);
+  
+  mpc_ast_buf_bytes(&b, "mpct", 4);
+  mpc_ast_buf_varint(&b, MPC_AST_SAVE_VERSION);
+  mpc_ast_buf_varint(&b, (unsigned long)tags_num);
+  for (j = 0; j < tags_num; j++) {
+    mpc_ast_buf_varint(&b, (unsigned long)strlen(tags[j]));
+    mpc_ast_buf_bytes(&b, tags[j], strlen(tags[j]));
+  }
+  mpc_ast_buf_bytes(&b, nodes.data, nodes.size);
+  
+  free(nodes.data);
+  free(table);
+  free(tags);
+  
+  *data = b.data;
+  *size = b.size;
+}
+
+/*
+** As with grammars every count is checked against
+** the data, and after the first error all reads
+** give zero. Each node takes at least eight bytes,
+** so the children still to be read must fit in
+** what is left, which bounds what corrupted data
+** can make the loader allocate.
+**
+** With `MPC_INPUT_AST_ARENA` the tree is built in
+** one region freed by `mpc_ast_arena_delete`, with
+** each tag stored once. With `MPC_INPUT_AST_VIEWS`
+** contents point into the data, which must then
+** outlive the tree, so it can be mapped straight
+** from a file.
+*/
+
+typedef struct {
+  const unsigned char *data;
+  size_t size;
+  size_t pos;
+  int flags;
+  mpc_ast_arena_t *arena;
+  unsigned long tags_num;
+  char **tags;
+  size_t *tag_lens;
+  unsigned long pending;
+  long node_pos;
+  long node_row;
+  const char *error;
+} mpc_ast_load_t;
+
+typedef struct {
+  mpc_ast_t *node;
+  int children_num;
+} mpc_ast_load_frame_t;
+
+static unsigned long mpc_ast_load_varint(mpc_ast_load_t *l) {
+  
+  unsigned long x = 0;
+  unsigned char c;
+  int shift = 0;
+  
+  if (l->error) { return 0; }
+  
+  do {
+    if (l->pos == l->size) { l->error = "AST data is truncated!"; return 0; }
+    if (shift >= (int)sizeof(unsigned long) * 8) { l->error = "AST data is corrupted!"; return 0; }
+    c = l->data[l->pos++];
+    x |= (unsigned long)(c & 0x7F) << shift;
+    shift += 7;
+  } while (c & 0x80);
+  
+  return x;
+}
+
+static long mpc_ast_load_signed(mpc_ast_load_t *l) {
+  unsigned long x = mpc_ast_load_varint(l);
+  return x & 1 ? -(long)(x >> 1) - 1 : (long)(x >> 1);
+}
+
+static const char *mpc_ast_load_bytes(mpc_ast_load_t *l, unsigned long n) {
+  const char *x;
+  if (l->error) { return NULL; }
+  if (n > l->size - l->pos) { l->error = "AST data is truncated!"; return NULL; }
+  x = (const char*)l->data + l->pos;
+  l->pos += n;
+  return x;
+}
+
+static char *mpc_ast_load_str(mpc_ast_load_t *l, const char *c, size_t n) {
+  char *x;
+  if (l->arena) {
+    if (n == 0) { return l->arena->empty; }
+    x = mpc_ast_region_alloc(l->arena, n + 1);
+  } else {
+    x = malloc(n + 1);
+  }
+  memcpy(x, c, n);
+  x[n] = '\0';
+  return x;
+}
+
+/*
+** Reads one node into `a`, returning how many
+** children it has, or -1 on an error in which
+** case nothing has been allocated.
+*/
+
+static int mpc_ast_load_node(mpc_ast_load_t *l, mpc_ast_t *a) {
+  
+  unsigned long tag, n, col, rule, primary, children;
+  long pos, row;
+  const char *c;
+  
+  tag = mpc_ast_load_varint(l);
+  n = mpc_ast_load_varint(l);
+  c = mpc_ast_load_bytes(l, n);
+  pos = mpc_ast_load_signed(l);
+  row = mpc_ast_load_signed(l);
+  col = mpc_ast_load_varint(l);
+  rule = mpc_ast_load_varint(l);
+  primary = mpc_ast_load_varint(l);
+  children = mpc_ast_load_varint(l);
+  
+  if (l->error) { return -1; }
+  
+  if (tag >= l->tags_num || (unsigned long)(int)children != children
+  ||  (l->pending + children) > (l->size - l->pos) / MPC_AST_SAVE_NODE_MIN) {
+    l->error = "AST data is corrupted!";
+    return -1;
+  }
+  
+  l->pending += children;
+  l->node_pos += pos;
+  l->node_row += row;
+  
+  if (l->arena) {
+    a->tag = l->tags[tag];
+    a->contents = mpc_ast_load_str(l, c, n);
+    a->children = children ? mpc_ast_region_alloc(l->arena, sizeof(mpc_ast_t*) * children) : NULL;
+  } else {
+    a->tag = mpc_ast_load_str(l, l->tags[tag], l->tag_lens[tag]);
+    a->contents = l->flags & MPC_INPUT_AST_VIEWS ? NULL : mpc_ast_load_str(l, c, n);
+    a->children = children ? malloc(sizeof(mpc_ast_t*) * children) : NULL;
+  }
+  
+  a->view = a->contents ? NULL : c;
+  a->view_len = a->contents ? 0 : (long)n;
+  a->state.pos = l->node_pos;
+  a->state.row = l->node_row;
+  a->state.col = (long)col;
+  a->rule = (int)rule;
+  a->primary = (int)primary;
+  a->children_num = 0;
+  
+  return (int)children;
+}
+
+static mpc_ast_t *mpc_ast_load_new(mpc_ast_load_t *l) {
+  return l->arena
+    ? mpc_ast_region_alloc(l->arena, sizeof(mpc_ast_t))
+    : malloc(sizeof(mpc_ast_t));
+}
+
+static mpc_ast_t *mpc_ast_load_tree(mpc_ast_load_t *l) {
+  
+  int n, num = 0, slots = 32;
+  mpc_ast_t *root, *a;
+  mpc_ast_load_frame_t *f, *stack;
+  
+  root = l->arena ? &l->arena->root : malloc(sizeof(mpc_ast_t));
+  n = mpc_ast_load_node(l, root);
+  if (n < 0) {
+    if (!l->arena) { free(root); }
+    return NULL;
+  }
+  
+  stack = malloc(sizeof(mpc_ast_load_frame_t) * slots);
+  stack[num].node = root;
+  stack[num].children_num = n;
+  num++;
+  
+  while (num > 0) {
+    
+    f = &stack[num-1];
+    if (f->node->children_num == f->children_num) { num--; continue; }
+    
+    l->pending--;
+    a = mpc_ast_load_new(l);
+    n = mpc_ast_load_node(l, a);
+    if (n < 0) {
+      if (!l->arena) { free(a); }
+      break;
+    }
+    
+    f->node->children[f->node->children_num++] = a;
+    
+    if (num == slots) {
+      slots *= 2;
+      stack = realloc(stack, sizeof(mpc_ast_load_frame_t) * slots);
+    }
+    stack[num].node = a;
+    stack[num].children_num = n;
+    num++;
+  }
+  
+  free(stack);
+  
+  if (!l->error && l->pos != l->size) { l->error = "AST data is corrupted!"; }
+  
+  return root;
+}
+
+mpc_err_t *mpc_ast_load(const char *data, size_t size, int flags, mpc_ast_t **a) {
+  
+  unsigned long j, n;
+  const char *c;
+  mpc_ast_t *root = NULL;
+  mpc_ast_load_t l;
+  
+  l.data = (const unsigned char*)data;
+  l.size = size;
+  l.pos = 4;
+  l.flags = flags;
+  l.arena = NULL;
+  l.tags_num = 0;
+  l.tags = NULL;
+  l.tag_lens = NULL;
+  l.pending = 0;
+  l.node_pos = 0;
+  l.node_row = 0;
+  l.error = NULL;
+  
+  if (size < 4 || memcmp(data, "mpct", 4) != 0) {
+    l.error = "AST data is not a saved AST!";
+  } else if (mpc_ast_load_varint(&l) != MPC_AST_SAVE_VERSION && !l.error) {
+    l.error = "AST data was saved by a different version!";
+  }
+  
+  if (flags & MPC_INPUT_AST_ARENA) {
+    l.arena = malloc(sizeof(mpc_ast_arena_t));
+    l.arena->chunks = NULL;
+    l.arena->empty[0] = '\0';
+  }
+  
+  n = mpc_ast_load_varint(&l);
+  if (!l.error && n > l.size - l.pos) { l.error = "AST data is corrupted!"; }
+  if (!l.error) {
+    l.tags = malloc(sizeof(char*) * (n + 1));
+    l.tag_lens = malloc(sizeof(size_t) * (n + 1));
+  }
+  
+  for (j = 0; j < n && !l.error; j++) {
+    l.tag_lens[j] = mpc_ast_load_varint(&l);
+    c = mpc_ast_load_bytes(&l, l.tag_lens[j]);
+    if (l.error) { break; }
+    l.tags[j] = l.arena ? mpc_ast_load_str(&l, c, l.tag_lens[j]) : (char*)c;
+    l.tags_num++;
+  }
+  
+  if (!l.error) { root = mpc_ast_load_tree(&l); }
+  
+  free(l.tags);
+  free(l.tag_lens);
+  
+  if (l.error) {
+    if (l.arena) { mpc_ast_arena_delete((mpc_ast_t*)l.arena); }
+    else { mpc_ast_delete(root); }
+    *a = NULL;
+    return mpc_err_file("<mpc_ast_load>", l.error);
+  }
+  
+  *a = root;
+  return NULL;
+}
+
+static int mpc_nodecount_unretained(mpc_parser_t* p, int force) {
+
+  int i, total;
+
+  if (p->retained && !force) { return 0; }
+
+  if (p->type == MPC_TYPE_EXPECT) { return 1 + mpc_nodecount_unretained(p->data.expect.x, 0); }
+
+  if (p->type == MPC_TYPE_APPLY)    { return 1 + mpc_nodecount_unretained(p->data.apply.x, 0); }
+  if (p->type == MPC_TYPE_APPLY_TO) { return 1 + mpc_nodecount_unretained(p->data.apply_to.x, 0); }
+  if (p->type == MPC_TYPE_PREDICT)  { return 1 + mpc_nodecount_unretained(p->data.predict.x, 0); }
+  if (p->type == MPC_TYPE_DEFERRED) { return 1 + mpc_nodecount_unretained(p->data.predict.x, 0); }
+  if (p->type == MPC_TYPE_REGEX)    { return 1 + mpc_nodecount_unretained(p->data.regex.x, 0); }
+  if (p->type == MPC_TYPE_SPAN)     { return 1 + mpc_nodecount_unretained(p->data.predict.x, 0); }
+
+  if (p->type == MPC_TYPE_CHECK)    { return 1 + mpc_nodecount_unretained(p->data.check.x, 0); }
+  if (p->type == MPC_TYPE_CHECK_WITH) { return 1 + mpc_nodecount_unretained(p->data.check_with.x, 0); }
+
+  if (p->type == MPC_TYPE_NOT)   { return 1 + mpc_nodecount_unretained(p->data.not.x, 0); }
+  if (p->type == MPC_TYPE_MAYBE) { return 1 + mpc_nodecount_unretained(p->data.not.x, 0); }
+
+  if (p->type == MPC_TYPE_MANY)  { return 1 + mpc_nodecount_unretained(p->data.repeat.x, 0); }
+  if (p->type == MPC_TYPE_MANY1) { return 1 + mpc_nodecount_unretained(p->data.repeat.x, 0); }
+  if (p->type == MPC_TYPE_COUNT) { return 1 + mpc_nodecount_unretained(p->data.repeat.x, 0); }
+
+  if (p->type == MPC_TYPE_OR) { 
+    total = 1;
+    for(i = 0; i < p->data.or.n; i++) {
+      total += mpc_nodecount_unretained(p->data.or.xs[i], 0);
+    }
+    return total;
+  }
+  
+  if (p->type == MPC_TYPE_AND) {
+    total = 1;
+    for(i = 0; i < p->data.and.n; i++) {
+      total += mpc_nodecount_unretained(p->data.and.xs[i], 0);
+    }
+    return total;
+  }
+
+  return 1;
+  
+}
+
+/*
+** The optimiser is made of several passes over
+** the unretained part of a parser. Each walk runs
+** one more of them along with all those before
+** it. Nested labels are hoisted first so they do
+** not hide the character classes below them, and
+** sequences are factored before the runs of
+** characters in them are joined into strings.
+*/
+
+enum {
+  MPC_OPTIMISE_MERGE   = 1,
+  MPC_OPTIMISE_EXPECT  = 2,
+  MPC_OPTIMISE_SETS    = 4,
+  MPC_OPTIMISE_FACTOR  = 8,
+  MPC_OPTIMISE_STRINGS = 16,
+  MPC_OPTIMISE_SCANS   = 32,
+  MPC_OPTIMISE_PASSES  = 6
+};
+
+static const char *mpc_optimise_names[MPC_OPTIMISE_PASSES] = {
+  "Merges", "Expects", "Sets", "Factoring", "Strings", "Scans"
+};
+
+/*
+** An `or` of parsers which each match a single
+** character from some class can be replaced by
+** one set containing all of them. The expected
+** messages of each alternative are joined so
+** errors read the same as before.
+*/
+
+static int mpc_optimise_is_char(mpc_parser_t *p) {
+  if (p->retained || p->type != MPC_TYPE_EXPECT) { return 0; }
+  p = p->data.expect.x;
+  return !p->retained
+    && (p->type == MPC_TYPE_SINGLE || p->type == MPC_TYPE_RANGE
+    ||  p->type == MPC_TYPE_ONEOF  || p->type == MPC_TYPE_NONEOF);
+}
+
+static void mpc_optimise_set(mpc_parser_t *p) {
+  
+  int j;
+  size_t l = 0;
+  char *m, *x;
+  mpc_parser_t *t = mpc_undefined();
+  
+  t->type = MPC_TYPE_ONEOF;
+  memset(t->data.set.s, 0, MPC_SET_SIZE);
+  t->data.set.x = x = malloc(256);
+  
+  for (j = 0; j < p->data.or.n; j++) {
+    mpc_set_add_parser(t->data.set.s, p->data.or.xs[j]->data.expect.x);
+    l += strlen(p->data.or.xs[j]->data.expect.m) + strlen(", ");
+  }
+  
+  for (j = 1; j < 256; j++) {
+    if (MPC_SET_HAS(t->data.set.s, j)) { *x++ = (char)j; }
+  }
+  *x = '\0';
+  
+  m = malloc(l + strlen(" or ") + 1);
+  m[0] = '\0';
+  for (j = 0; j < p->data.or.n; j++) {
+    if (j > 0) { strcat(m, j == p->data.or.n-1 ? " or " : ", "); }
+    strcat(m, p->data.or.xs[j]->data.expect.m);
+    mpc_delete(p->data.or.xs[j]);
+  }
+  free(p->data.or.xs);
+  free(p->data.or.jump);
+  
+  p->type = MPC_TYPE_EXPECT;
+  p->data.expect.x = t;
+  p->data.expect.m = m;
+}
+
+/*
+** Replaces a parser with one of its parts in
+** place, keeping the name and retained flag of
+** the parser so that references to it stay valid.
+*/
+
+static void mpc_optimise_replace(mpc_parser_t *p, mpc_parser_t *t) {
+  char *name = p->name;
+  char retained = p->retained;
+  int rule = p->rule;
+  memcpy(p, t, sizeof(mpc_parser_t));
+  p->name = name;
+  p->retained = retained;
+  p->rule = rule;
+  free(t->name);
+  free(t);
+}
+
+/*
+** Unretained character and string parsers are
+** equal when they match the same input and give
+** the same expected message.
+*/
+
+static int mpc_optimise_equal(mpc_parser_t *p, mpc_parser_t *q) {
+  
+  if (p == q) { return 1; }
+  if (p->retained || q->retained || p->type != q->type) { return 0; }
+  
+  switch (p->type) {
+    case MPC_TYPE_ANY:    return 1;
+    case MPC_TYPE_SINGLE: return p->data.single.x == q->data.single.x;
+    case MPC_TYPE_RANGE:
+      return p->data.range.x == q->data.range.x && p->data.range.y == q->data.range.y;
+    case MPC_TYPE_ONEOF:
+    case MPC_TYPE_NONEOF:
+      return memcmp(p->data.set.s, q->data.set.s, MPC_SET_SIZE) == 0;
+    case MPC_TYPE_STRING:
+      return !p->data.string.m && !q->data.string.m
+        && strcmp(p->data.string.x, q->data.string.x) == 0;
+    case MPC_TYPE_EXPECT:
+      return strcmp(p->data.expect.m, q->data.expect.m) == 0
+        && mpc_optimise_equal(p->data.expect.x, q->data.expect.x);
+    default: return 0;
+  }
+  
+}
+
+/*
+** Neighbouring alternatives which are sequences
+** starting with the same parser are factored into
+** that parser followed by an `or` of their rests.
+** Outputs only fold the same afterwards when the
+** fold joins strings or the sequences are pairs.
+*/
+
+static int mpc_optimise_factors(mpc_parser_t *p, mpc_parser_t *q) {
+  return !p->retained && !q->retained
+    && p->type == MPC_TYPE_AND && q->type == MPC_TYPE_AND
+    && p->data.and.n >= 2 && q->data.and.n >= 2
+    && p->data.and.f == q->data.and.f
+    && (p->data.and.f == mpcf_strfold || (p->data.and.n == 2 && q->data.and.n == 2))
+    && p->data.and.dxs[0] == q->data.and.dxs[0]
+    && mpc_optimise_equal(p->data.and.xs[0], q->data.and.xs[0]);
+}
+
+static void mpc_optimise_unretained(mpc_parser_t *p, int force, int passes);
+
+static void mpc_optimise_factor(mpc_parser_t *p, int j, int k, int passes) {
+  
+  int l, n;
+  mpc_parser_t *a, *x = p->data.or.xs[j]->data.and.xs[0];
+  mpc_parser_t *t = mpc_undefined(), *o = mpc_undefined();
+  
+  t->type = MPC_TYPE_AND;
+  t->data.and.n = 2;
+  t->data.and.f = p->data.or.xs[j]->data.and.f;
+  t->data.and.xs = malloc(sizeof(mpc_parser_t*) * 2);
+  t->data.and.dxs = malloc(sizeof(mpc_dtor_t));
+  t->data.and.xs[0] = x;
+  t->data.and.xs[1] = o;
+  t->data.and.dxs[0] = p->data.or.xs[j]->data.and.dxs[0];
+  
+  o->type = MPC_TYPE_OR;
+  o->data.or.n = k - j;
+  o->data.or.xs = malloc(sizeof(mpc_parser_t*) * (k - j));
+  o->data.or.jump = NULL;
+  
+  for (l = j; l < k; l++) {
+    
+    a = p->data.or.xs[l];
+    n = a->data.and.n;
+    if (a->data.and.xs[0] != x) { mpc_delete(a->data.and.xs[0]); }
+    
+    if (n == 2) {
+      o->data.or.xs[l-j] = a->data.and.xs[1];
+      free(a->data.and.xs); free(a->data.and.dxs); free(a->name); free(a);
+    } else {
+      memmove(a->data.and.xs, a->data.and.xs + 1, (n - 1) * sizeof(mpc_parser_t*));
+      memmove(a->data.and.dxs, a->data.and.dxs + 1, (n - 2) * sizeof(mpc_dtor_t));
+      a->data.and.n--;
+      o->data.or.xs[l-j] = a;
+    }
+  }
+  
+  mpc_optimise_unretained(o, 0, passes);
+  
+  n = p->data.or.n;
+  p->data.or.xs[j] = t;
+  memmove(p->data.or.xs + j + 1, p->data.or.xs + k, (n - k) * sizeof(mpc_parser_t*));
+  p->data.or.n = n - (k - j - 1);
+  free(p->data.or.jump);
+  p->data.or.jump = NULL;
+}
+
+/*
+** Runs of single characters in a sequence joined
+** with `mpcf_strfold` become one string. A table of
+** the characters' expected messages is kept with
+** it so errors still point at the character which
+** did not match rather than the start of the run.
+*/
+
+static int mpc_optimise_is_single(mpc_parser_t *p) {
+  mpc_parser_t *x;
+  if (p->retained) { return 0; }
+  if (p->type == MPC_TYPE_STRING) { return p->data.string.m != NULL; }
+  if (p->type != MPC_TYPE_EXPECT) { return 0; }
+  x = p->data.expect.x;
+  return !x->retained && x->type == MPC_TYPE_SINGLE
+    && p->data.expect.m[0] == '\''
+    && p->data.expect.m[1] == x->data.single.x
+    && p->data.expect.m[2] == '\''
+    && p->data.expect.m[3] == '\0';
+}
+
+static void mpc_optimise_string(mpc_parser_t *p, int j, int k) {
+  
+  int l, n = 0;
+  mpc_parser_t *x, *t = mpc_undefined();
+  
+  for (l = j; l < k; l++) {
+    x = p->data.and.xs[l];
+    n += x->type == MPC_TYPE_STRING ? (int)strlen(x->data.string.x) : 1;
+  }
+  
+  t->type = MPC_TYPE_STRING;
+  t->data.string.x = malloc(n + 1);
+  t->data.string.m = malloc(n * 4);
+  
+  for (l = j, n = 0; l < k; l++) {
+    x = p->data.and.xs[l];
+    if (x->type == MPC_TYPE_STRING) {
+      strcpy(t->data.string.x + n, x->data.string.x);
+      memcpy(t->data.string.m + n * 4, x->data.string.m, strlen(x->data.string.x) * 4);
+      n += strlen(x->data.string.x);
+    } else {
+      t->data.string.x[n] = x->data.expect.x->data.single.x;
+      memcpy(t->data.string.m + n * 4, x->data.expect.m, 4);
+      n++;
+    }
+    mpc_delete(x);
+  }
+  t->data.string.x[n] = '\0';
+  
+  n = p->data.and.n;
+  p->data.and.xs[j] = t;
+  memmove(p->data.and.xs + j + 1, p->data.and.xs + k, (n - k) * sizeof(mpc_parser_t*));
+  if (k < n) {
+    memmove(p->data.and.dxs + j + 1, p->data.and.dxs + k, (n - 1 - k) * sizeof(mpc_dtor_t));
+  }
+  p->data.and.n = n - (k - j - 1);
+}
+
+/*
+** A `many` of one character class folded into a
+** string becomes a scan, which reads the whole run
+** in a single loop. A `span` of a scan adds nothing.
+*/
+
+static void mpc_optimise_scan(mpc_parser_t *p) {
+  mpc_parser_t *t = p->data.repeat.x;
+  p->data.scan.n = p->type == MPC_TYPE_MANY1;
+  p->data.scan.m = t->data.expect.m;
+  memset(p->data.scan.s, 0, MPC_SET_SIZE);
+  mpc_set_add_parser(p->data.scan.s, t->data.expect.x);
+  p->data.scan.c = mpc_class_new(p->data.scan.s);
+  p->type = MPC_TYPE_SCAN;
+  t->data.expect.m = NULL;
+  mpc_delete(t);
+}
+
+/*
+** Inside an `expect` every error is suppressed
+** and replaced by its label, so any `expect` met
+** below it before anything but an `apply` is
+** never seen and can be removed.
+*/
+
+static mpc_parser_t **mpc_optimise_inner_expect(mpc_parser_t *p) {
+  mpc_parser_t **x = &p->data.expect.x;
+  while (!(*x)->retained) {
+    if ((*x)->type == MPC_TYPE_EXPECT)   { return x; }
+    if ((*x)->type == MPC_TYPE_APPLY)    { x = &(*x)->data.apply.x; continue; }
+    if ((*x)->type == MPC_TYPE_APPLY_TO) { x = &(*x)->data.apply_to.x; continue; }
+    break;
+  }
+  return NULL;
 }
 
-static void mpc_optimise_unretained(mpc_parser_t *p, int force) {
+static void mpc_optimise_unretained(mpc_parser_t *p, int force, int passes) {
   
   int i, n, m;
-  mpc_parser_t *t;
+  mpc_parser_t *t, **x;
   
   if (p->retained && !force) { return; }
   
   /* Optimise Subexpressions */
   
-  if (p->type == MPC_TYPE_EXPECT)     { mpc_optimise_unretained(p->data.expect.x, 0); }
-  if (p->type == MPC_TYPE_APPLY)      { mpc_optimise_unretained(p->data.apply.x, 0); }
-  if (p->type == MPC_TYPE_APPLY_TO)   { mpc_optimise_unretained(p->data.apply_to.x, 0); }
-  if (p->type == MPC_TYPE_CHECK)      { mpc_optimise_unretained(p->data.check.x, 0); }
-  if (p->type == MPC_TYPE_CHECK_WITH) { mpc_optimise_unretained(p->data.check_with.x, 0); }
-  if (p->type == MPC_TYPE_PREDICT)    { mpc_optimise_unretained(p->data.predict.x, 0); }
-  if (p->type == MPC_TYPE_NOT)        { mpc_optimise_unretained(p->data.not.x, 0); }
-  if (p->type == MPC_TYPE_MAYBE)      { mpc_optimise_unretained(p->data.not.x, 0); }
-  if (p->type == MPC_TYPE_MANY)       { mpc_optimise_unretained(p->data.repeat.x, 0); }
-  if (p->type == MPC_TYPE_MANY1)      { mpc_optimise_unretained(p->data.repeat.x, 0); }
-  if (p->type == MPC_TYPE_COUNT)      { mpc_optimise_unretained(p->data.repeat.x, 0); }
+  if (p->type == MPC_TYPE_EXPECT)     { mpc_optimise_unretained(p->data.expect.x, 0, passes); }
+  if (p->type == MPC_TYPE_APPLY)      { mpc_optimise_unretained(p->data.apply.x, 0, passes); }
+  if (p->type == MPC_TYPE_APPLY_TO)   { mpc_optimise_unretained(p->data.apply_to.x, 0, passes); }
+  if (p->type == MPC_TYPE_CHECK)      { mpc_optimise_unretained(p->data.check.x, 0, passes); }
+  if (p->type == MPC_TYPE_CHECK_WITH) { mpc_optimise_unretained(p->data.check_with.x, 0, passes); }
+  if (p->type == MPC_TYPE_PREDICT)    { mpc_optimise_unretained(p->data.predict.x, 0, passes); }
+  if (p->type == MPC_TYPE_DEFERRED)   { mpc_optimise_unretained(p->data.predict.x, 0, passes); }
+  if (p->type == MPC_TYPE_REGEX)      { mpc_optimise_unretained(p->data.regex.x, 0, passes); }
+  if (p->type == MPC_TYPE_SPAN)       { mpc_optimise_unretained(p->data.predict.x, 0, passes); }
+  if (p->type == MPC_TYPE_NOT)        { mpc_optimise_unretained(p->data.not.x, 0, passes); }
+  if (p->type == MPC_TYPE_MAYBE)      { mpc_optimise_unretained(p->data.not.x, 0, passes); }
+  if (p->type == MPC_TYPE_MANY)       { mpc_optimise_unretained(p->data.repeat.x, 0, passes); }
+  if (p->type == MPC_TYPE_MANY1)      { mpc_optimise_unretained(p->data.repeat.x, 0, passes); }
+  if (p->type == MPC_TYPE_COUNT)      { mpc_optimise_unretained(p->data.repeat.x, 0, passes); }
   
   if (p->type == MPC_TYPE_OR) { 
     for(i = 0; i < p->data.or.n; i++) {
-      mpc_optimise_unretained(p->data.or.xs[i], 0);
+      mpc_optimise_unretained(p->data.or.xs[i], 0, passes);
     }
   }
   
   if (p->type == MPC_TYPE_AND) {
     for(i = 0; i < p->data.and.n; i++) {
-      mpc_optimise_unretained(p->data.and.xs[i], 0);
+      mpc_optimise_unretained(p->data.and.xs[i], 0, passes);
     }
   }  
   
@@ -3822,7 +8148,8 @@ static void mpc_optimise_unretained(mpc_parser_t *p, int force) {
   while (1) {
     
     /* Merge rhs `or` */
-    if (p->type == MPC_TYPE_OR
+    if ((passes & MPC_OPTIMISE_MERGE)
+    &&  p->type == MPC_TYPE_OR
     &&  p->data.or.xs[p->data.or.n-1]->type == MPC_TYPE_OR
     && !p->data.or.xs[p->data.or.n-1]->retained) {
       t = p->data.or.xs[p->data.or.n-1];
@@ -3830,12 +8157,13 @@ static void mpc_optimise_unretained(mpc_parser_t *p, int force) {
       p->data.or.n = n + m - 1;
       p->data.or.xs = realloc(p->data.or.xs, sizeof(mpc_parser_t*) * (n + m -1));
       memmove(p->data.or.xs + n - 1, t->data.or.xs, m * sizeof(mpc_parser_t*));
-      free(t->data.or.xs); free(t->name); free(t);
+      free(t->data.or.xs); free(t->data.or.jump); free(t->name); free(t);
       continue;
     }
 
     /* Merge lhs `or` */
-    if (p->type == MPC_TYPE_OR
+    if ((passes & MPC_OPTIMISE_MERGE)
+    &&  p->type == MPC_TYPE_OR
     &&  p->data.or.xs[0]->type == MPC_TYPE_OR
     && !p->data.or.xs[0]->retained) {
       t = p->data.or.xs[0];
@@ -3844,12 +8172,78 @@ static void mpc_optimise_unretained(mpc_parser_t *p, int force) {
       p->data.or.xs = realloc(p->data.or.xs, sizeof(mpc_parser_t*) * (n + m -1));
       memmove(p->data.or.xs + m, p->data.or.xs + 1, (n - 1) * sizeof(mpc_parser_t*));
       memmove(p->data.or.xs, t->data.or.xs, m * sizeof(mpc_parser_t*));
-      free(t->data.or.xs); free(t->name); free(t);
+      free(t->data.or.xs); free(t->data.or.jump); free(t->name); free(t);
+      continue;
+    }
+    
+    /* Merge `or` of characters into a set */
+    if ((passes & MPC_OPTIMISE_SETS) && p->type == MPC_TYPE_OR && p->data.or.n > 1) {
+      for (i = 0; i < p->data.or.n; i++) {
+        if (!mpc_optimise_is_char(p->data.or.xs[i])) { break; }
+      }
+      if (i == p->data.or.n) { mpc_optimise_set(p); continue; }
+    }
+    
+    /* Factor `or` of sequences with the same start */
+    if ((passes & MPC_OPTIMISE_FACTOR) && p->type == MPC_TYPE_OR) {
+      for (i = 0; i < p->data.or.n; i = n) {
+        for (n = i+1; n < p->data.or.n
+          && mpc_optimise_factors(p->data.or.xs[i], p->data.or.xs[n]); n++);
+        if (n - i > 1) { break; }
+      }
+      if (i < p->data.or.n) { mpc_optimise_factor(p, i, n, passes); continue; }
+    }
+    
+    /* Join runs of characters into a string */
+    if ((passes & MPC_OPTIMISE_STRINGS)
+    &&  p->type == MPC_TYPE_AND
+    &&  p->data.and.f == mpcf_strfold) {
+      for (i = 0; i < p->data.and.n; i = n+1) {
+        for (n = i; n < p->data.and.n && mpc_optimise_is_single(p->data.and.xs[n]); n++);
+        if (n - i > 1) { break; }
+      }
+      if (i < p->data.and.n) {
+        mpc_optimise_string(p, i, n);
+        if (p->data.and.n == 1) {
+          t = p->data.and.xs[0];
+          free(p->data.and.xs); free(p->data.and.dxs);
+          mpc_optimise_replace(p, t);
+        }
+        continue;
+      }
+    }
+    
+    /* Turn `many` of a character class into a scan */
+    if ((passes & MPC_OPTIMISE_SCANS)
+    &&  (p->type == MPC_TYPE_MANY || p->type == MPC_TYPE_MANY1)
+    &&  p->data.repeat.f == mpcf_strfold
+    &&  mpc_optimise_is_char(p->data.repeat.x)) {
+      mpc_optimise_scan(p);
+      continue;
+    }
+    
+    /* Remove `span` of a scan */
+    if ((passes & MPC_OPTIMISE_SCANS)
+    &&  p->type == MPC_TYPE_SPAN
+    &&  p->data.predict.x->type == MPC_TYPE_SCAN
+    && !p->data.predict.x->retained) {
+      mpc_optimise_replace(p, p->data.predict.x);
+      continue;
+    }
+    
+    /* Hoist `expect` labels */
+    if ((passes & MPC_OPTIMISE_EXPECT)
+    &&  p->type == MPC_TYPE_EXPECT
+    &&  (x = mpc_optimise_inner_expect(p))) {
+      t = *x;
+      *x = t->data.expect.x;
+      free(t->data.expect.m); free(t->name); free(t);
       continue;
     }
     
     /* Remove ast `pass` */
-    if (p->type == MPC_TYPE_AND
+    if ((passes & MPC_OPTIMISE_MERGE)
+    &&  p->type == MPC_TYPE_AND
     &&  p->data.and.n == 2
     &&  p->data.and.xs[0]->type == MPC_TYPE_PASS
     && !p->data.and.xs[0]->retained
@@ -3863,7 +8257,8 @@ static void mpc_optimise_unretained(mpc_parser_t *p, int force) {
     }
     
     /* Merge ast lhs `and` */
-    if (p->type == MPC_TYPE_AND
+    if ((passes & MPC_OPTIMISE_MERGE)
+    &&  p->type == MPC_TYPE_AND
     &&  p->data.and.f == mpcf_fold_ast
     &&  p->data.and.xs[0]->type == MPC_TYPE_AND
     && !p->data.and.xs[0]->retained
@@ -3881,7 +8276,8 @@ static void mpc_optimise_unretained(mpc_parser_t *p, int force) {
     }
     
     /* Merge ast rhs `and` */
-    if (p->type == MPC_TYPE_AND
+    if ((passes & MPC_OPTIMISE_MERGE)
+    &&  p->type == MPC_TYPE_AND
     &&  p->data.and.f == mpcf_fold_ast
     &&  p->data.and.xs[p->data.and.n-1]->type == MPC_TYPE_AND
     && !p->data.and.xs[p->data.and.n-1]->retained
@@ -3898,7 +8294,8 @@ static void mpc_optimise_unretained(mpc_parser_t *p, int force) {
     }
 
     /* Remove re `lift` */
-    if (p->type == MPC_TYPE_AND
+    if ((passes & MPC_OPTIMISE_MERGE)
+    &&  p->type == MPC_TYPE_AND
     &&  p->data.and.n == 2
     &&  p->data.and.xs[0]->type == MPC_TYPE_LIFT
     &&  p->data.and.xs[0]->data.lift.lf == mpcf_ctor_str
@@ -3913,7 +8310,8 @@ static void mpc_optimise_unretained(mpc_parser_t *p, int force) {
     }
 
     /* Merge re lhs `and` */
-    if (p->type == MPC_TYPE_AND
+    if ((passes & MPC_OPTIMISE_MERGE)
+    &&  p->type == MPC_TYPE_AND
     &&  p->data.and.f == mpcf_strfold
     &&  p->data.and.xs[0]->type == MPC_TYPE_AND
     && !p->data.and.xs[0]->retained
@@ -3931,7 +8329,8 @@ static void mpc_optimise_unretained(mpc_parser_t *p, int force) {
     }
     
     /* Merge re rhs `and` */
-    if (p->type == MPC_TYPE_AND
+    if ((passes & MPC_OPTIMISE_MERGE)
+    &&  p->type == MPC_TYPE_AND
     &&  p->data.and.f == mpcf_strfold
     &&  p->data.and.xs[p->data.and.n-1]->type == MPC_TYPE_AND
     && !p->data.and.xs[p->data.and.n-1]->retained
@@ -3953,7 +8352,620 @@ static void mpc_optimise_unretained(mpc_parser_t *p, int force) {
   
 }
 
+/*
+** The FIRST set of a parser holds every character
+** it could begin by consuming. If it might also
+** succeed consuming nothing it is nullable. Rules
+** are followed into their definitions, and where
+** nothing can be said (undefined rules, or left
+** recursion deeper than the limit) it is unknown.
+*/
+
+enum {
+  MPC_FIRST_UNKNOWN   = 0,
+  MPC_FIRST_CONSUMES  = 1,
+  MPC_FIRST_NULLABLE  = 2,
+  MPC_FIRST_DEPTH_MAX = 64
+};
+
+static int mpc_first(mpc_parser_t *p, unsigned char *s, int depth) {
+  
+  int j, f, nullable = 0;
+  
+  if (depth > MPC_FIRST_DEPTH_MAX) { return MPC_FIRST_UNKNOWN; }
+  
+  switch (p->type) {
+    
+    case MPC_TYPE_FAIL: return MPC_FIRST_CONSUMES;
+    
+    case MPC_TYPE_PASS:
+    case MPC_TYPE_LIFT:
+    case MPC_TYPE_LIFT_VAL:
+    case MPC_TYPE_STATE:
+    case MPC_TYPE_ANCHOR:
+    case MPC_TYPE_NOT:
+      return MPC_FIRST_NULLABLE;
+    
+    case MPC_TYPE_ANY:
+    case MPC_TYPE_SINGLE:
+    case MPC_TYPE_RANGE:
+    case MPC_TYPE_ONEOF:
+    case MPC_TYPE_NONEOF:
+      mpc_set_add_parser(s, p);
+      return MPC_FIRST_CONSUMES;
+    
+    case MPC_TYPE_SATISFY:
+      for (j = 0; j < 256; j++) {
+        if (p->data.satisfy.f((char)j)) { MPC_SET_ADD(s, j); }
+      }
+      return MPC_FIRST_CONSUMES;
+    
+    case MPC_TYPE_STRING:
+      if (p->data.string.x[0] == '\0') { return MPC_FIRST_NULLABLE; }
+      MPC_SET_ADD(s, p->data.string.x[0]);
+      return MPC_FIRST_CONSUMES;
+    
+    case MPC_TYPE_SCAN:
+      for (j = 0; j < MPC_SET_SIZE; j++) { s[j] |= p->data.scan.s[j]; }
+      return p->data.scan.n ? MPC_FIRST_CONSUMES : MPC_FIRST_NULLABLE;
+    
+    case MPC_TYPE_REGEX:
+      if (!p->data.regex.d) { return mpc_first(p->data.regex.x, s, depth+1); }
+      for (j = 0; j < 256; j++) {
+        if (p->data.regex.d->trans[256 + j]) { MPC_SET_ADD(s, j); }
+      }
+      return p->data.regex.d->accept[1] ? MPC_FIRST_NULLABLE : MPC_FIRST_CONSUMES;
+    
+    case MPC_TYPE_EXPECT:     return mpc_first(p->data.expect.x, s, depth+1);
+    case MPC_TYPE_APPLY:      return mpc_first(p->data.apply.x, s, depth+1);
+    case MPC_TYPE_APPLY_TO:   return mpc_first(p->data.apply_to.x, s, depth+1);
+    case MPC_TYPE_CHECK:      return mpc_first(p->data.check.x, s, depth+1);
+    case MPC_TYPE_CHECK_WITH: return mpc_first(p->data.check_with.x, s, depth+1);
+    case MPC_TYPE_PREDICT:
+    case MPC_TYPE_DEFERRED:
+    case MPC_TYPE_SPAN:
+      return mpc_first(p->data.predict.x, s, depth+1);
+    
+    case MPC_TYPE_MAYBE:
+      return mpc_first(p->data.not.x, s, depth+1) ? MPC_FIRST_NULLABLE : MPC_FIRST_UNKNOWN;
+    
+    case MPC_TYPE_MANY:
+      return mpc_first(p->data.repeat.x, s, depth+1) ? MPC_FIRST_NULLABLE : MPC_FIRST_UNKNOWN;
+    
+    case MPC_TYPE_MANY1:
+      return mpc_first(p->data.repeat.x, s, depth+1);
+    
+    case MPC_TYPE_COUNT:
+      if (p->data.repeat.n == 0) { return MPC_FIRST_NULLABLE; }
+      return mpc_first(p->data.repeat.x, s, depth+1);
+    
+    case MPC_TYPE_OR:
+      for (j = 0; j < p->data.or.n; j++) {
+        f = mpc_first(p->data.or.xs[j], s, depth+1);
+        if (f == MPC_FIRST_UNKNOWN) { return MPC_FIRST_UNKNOWN; }
+        if (f == MPC_FIRST_NULLABLE) { nullable = 1; }
+      }
+      return nullable || p->data.or.n == 0 ? MPC_FIRST_NULLABLE : MPC_FIRST_CONSUMES;
+    
+    case MPC_TYPE_AND:
+      for (j = 0; j < p->data.and.n; j++) {
+        f = mpc_first(p->data.and.xs[j], s, depth+1);
+        if (f != MPC_FIRST_NULLABLE) { return f; }
+      }
+      return MPC_FIRST_NULLABLE;
+    
+    default: return MPC_FIRST_UNKNOWN;
+  }
+  
+}
+
+/*
+** An `or` gets a jump table mapping each character
+** to the only alternative able to start with it,
+** which must also consume something on success so
+** that the errors skipped alternatives would have
+** given are always behind the furthest one. Other
+** characters, and '\0', map to zero and all the
+** alternatives are tried as before.
+*/
+
+static void mpc_optimise_dispatch(mpc_parser_t *p) {
+  
+  int j, c, k, used = 0;
+  unsigned char (*firsts)[MPC_SET_SIZE];
+  char *consumes;
+  
+  free(p->data.or.jump);
+  p->data.or.jump = NULL;
+  
+  if (p->data.or.n < 2 || p->data.or.n > 255) { return; }
+  
+  firsts = calloc(p->data.or.n, MPC_SET_SIZE);
+  consumes = malloc(p->data.or.n);
+  p->data.or.jump = calloc(256, 1);
+  
+  for (j = 0; j < p->data.or.n; j++) {
+    consumes[j] = mpc_first(p->data.or.xs[j], firsts[j], 0) == MPC_FIRST_CONSUMES;
+    if (!consumes[j]) { memset(firsts[j], 0xFF, MPC_SET_SIZE); }
+  }
+  
+  for (c = 1; c < 256; c++) {
+    for (j = 0, k = 0; j < p->data.or.n; j++) {
+      if (!MPC_SET_HAS(firsts[j], c)) { continue; }
+      if (k) { k = 0; break; }
+      k = j+1;
+    }
+    if (k && !consumes[k-1]) { k = 0; }
+    p->data.or.jump[c] = (unsigned char)k;
+    used = used || k;
+  }
+  
+  free(firsts);
+  free(consumes);
+  
+  if (!used) {
+    free(p->data.or.jump);
+    p->data.or.jump = NULL;
+  }
+  
+}
+
+static void mpc_optimise_first(mpc_parser_t *p, int force) {
+  
+  int i;
+  
+  if (p->retained && !force) { return; }
+  
+  switch (p->type) {
+    case MPC_TYPE_EXPECT:     mpc_optimise_first(p->data.expect.x, 0); break;
+    case MPC_TYPE_APPLY:      mpc_optimise_first(p->data.apply.x, 0); break;
+    case MPC_TYPE_APPLY_TO:   mpc_optimise_first(p->data.apply_to.x, 0); break;
+    case MPC_TYPE_CHECK:      mpc_optimise_first(p->data.check.x, 0); break;
+    case MPC_TYPE_CHECK_WITH: mpc_optimise_first(p->data.check_with.x, 0); break;
+    case MPC_TYPE_PREDICT:
+    case MPC_TYPE_DEFERRED:
+    case MPC_TYPE_SPAN:       mpc_optimise_first(p->data.predict.x, 0); break;
+    case MPC_TYPE_REGEX:      mpc_optimise_first(p->data.regex.x, 0); break;
+    case MPC_TYPE_NOT:
+    case MPC_TYPE_MAYBE:      mpc_optimise_first(p->data.not.x, 0); break;
+    case MPC_TYPE_MANY:
+    case MPC_TYPE_MANY1:
+    case MPC_TYPE_COUNT:      mpc_optimise_first(p->data.repeat.x, 0); break;
+    case MPC_TYPE_AND:
+      for (i = 0; i < p->data.and.n; i++) { mpc_optimise_first(p->data.and.xs[i], 0); }
+      break;
+    case MPC_TYPE_OR:
+      for (i = 0; i < p->data.or.n; i++) { mpc_optimise_first(p->data.or.xs[i], 0); }
+      mpc_optimise_dispatch(p);
+      break;
+    default: break;
+  }
+  
+}
+
+static void mpc_optimise_passes(mpc_parser_t *p, int *removed) {
+  
+  int k, m, n = removed ? mpc_nodecount_unretained(p, 1) : 0;
+  
+  for (k = 0; k < MPC_OPTIMISE_PASSES; k++) {
+    mpc_optimise_unretained(p, 1, (2 << k) - 1);
+    if (removed) {
+      m = mpc_nodecount_unretained(p, 1);
+      removed[k] = n - m;
+      n = m;
+    }
+  }
+  
+}
+
 void mpc_optimise(mpc_parser_t *p) {
-  mpc_optimise_unretained(p, 1);
+  mpc_optimise_passes(p, NULL);
+  mpc_optimise_first(p, 1);
+}
+
+/*
+** Stats are taken on a copy of the parser so the
+** change each optimisation pass would make to the
+** node count can be shown without touching it.
+*/
+
+void mpc_stats(mpc_parser_t* p) {
+  
+  int k, removed[MPC_OPTIMISE_PASSES];
+  mpc_parser_t t = *p, *c;
+  
+  t.retained = 0;
+  t.name = NULL;
+  c = mpc_copy(&t);
+  
+  printf("Stats\n");
+  printf("=====\n");
+  printf("Node Count: %i\n", mpc_nodecount_unretained(p, 1));
+  
+  mpc_optimise_passes(c, removed);
+  
+  printf("Optimised Node Count: %i\n", mpc_nodecount_unretained(c, 1));
+  for (k = 0; k < MPC_OPTIMISE_PASSES; k++) {
+    printf("  %-10s %+i\n", mpc_optimise_names[k], -removed[k]);
+  }
+  
+  mpc_delete(c);
+}
+
+/*
+** Profiles
+*/
+
+mpc_profile_t *mpc_profile_new(void) {
+  mpc_profile_t *f = malloc(sizeof(mpc_profile_t));
+  f->num = 0;
+  f->slots = 32;
+  f->table = calloc(f->slots, sizeof(int));
+  f->entries = malloc(sizeof(mpc_profile_entry_t) * f->slots / 2);
+  f->stack_num = 0;
+  f->stack_slots = 32;
+  f->stack = malloc(sizeof(int) * f->stack_slots);
+  return f;
+}
+
+void mpc_profile_delete(mpc_profile_t *f) {
+  int j;
+  for (j = 0; j < f->num; j++) { free(f->entries[j].name); }
+  free(f->table);
+  free(f->entries);
+  free(f->stack);
+  free(f);
+}
+
+void mpc_input_profile(mpc_input_t *i, mpc_profile_t *f) {
+  i->profile = f;
+}
+
+static int mpc_profile_cmp(const void *a, const void *b) {
+  const mpc_profile_entry_t *x = a, *y = b;
+  if (x->time != y->time) { return x->time > y->time ? -1 : 1; }
+  if (x->calls != y->calls) { return x->calls > y->calls ? -1 : 1; }
+  return strcmp(x->name, y->name);
+}
+
+static mpc_profile_entry_t *mpc_profile_sorted(mpc_profile_t *f) {
+  mpc_profile_entry_t *ys = malloc(sizeof(mpc_profile_entry_t) * (f->num + 1));
+  memcpy(ys, f->entries, sizeof(mpc_profile_entry_t) * f->num);
+  qsort(ys, f->num, sizeof(mpc_profile_entry_t), mpc_profile_cmp);
+  return ys;
+}
+
+static double mpc_profile_ms(clock_t t) {
+  return (double)t * 1000.0 / CLOCKS_PER_SEC;
+}
+
+/*
+** Rules are listed slowest first. Times include
+** the time spent in the rules each one calls.
+*/
+
+void mpc_profile_print_to(mpc_profile_t *f, FILE *fp) {
+  
+  int j, w = 4;
+  mpc_profile_entry_t *ys = mpc_profile_sorted(f);
+  
+  for (j = 0; j < f->num; j++) {
+    if ((int)strlen(ys[j].name) > w) { w = (int)strlen(ys[j].name); }
+  }
+  
+  fprintf(fp, "Profile\n");
+  fprintf(fp, "=======\n");
+  fprintf(fp, "%-*s %10s %10s %10s %10s %10s %10s\n", w,
+    "Rule", "Calls", "Success", "Failure", "Bytes", "Rewinds", "Time (ms)");
+  
+  for (j = 0; j < f->num; j++) {
+    fprintf(fp, "%-*s %10ld %10ld %10ld %10ld %10ld %10.3f\n", w,
+      ys[j].name, ys[j].calls, ys[j].successes, ys[j].failures,
+      ys[j].bytes, ys[j].rewinds, mpc_profile_ms(ys[j].time));
+  }
+  
+  free(ys);
+}
+
+void mpc_profile_print(mpc_profile_t *f) {
+  mpc_profile_print_to(f, stdout);
+}
+
+static void mpc_profile_json_string(const char *s, FILE *fp) {
+  fputc('"', fp);
+  for (; *s; s++) {
+    if (*s == '"' || *s == '\\') { fprintf(fp, "\\%c", *s); }
+    else if ((unsigned char)*s < 0x20) { fprintf(fp, "\\u%04x", (unsigned char)*s); }
+    else { fputc(*s, fp); }
+  }
+  fputc('"', fp);
+}
+
+void mpc_profile_print_json_to(mpc_profile_t *f, FILE *fp) {
+  
+  int j;
+  mpc_profile_entry_t *ys = mpc_profile_sorted(f);
+  
+  fprintf(fp, "[");
+  for (j = 0; j < f->num; j++) {
+    fprintf(fp, "%s\n  {\"name\": ", j ? "," : "");
+    mpc_profile_json_string(ys[j].name, fp);
+    fprintf(fp, ", \"calls\": %ld, \"successes\": %ld, \"failures\": %ld, "
+      "\"bytes\": %ld, \"rewinds\": %ld, \"time_ms\": %.3f}",
+      ys[j].calls, ys[j].successes, ys[j].failures,
+      ys[j].bytes, ys[j].rewinds, mpc_profile_ms(ys[j].time));
+  }
+  fprintf(fp, "%s]\n", f->num ? "\n" : "");
+  
+  free(ys);
+}
+
+
+/*
+** Incremental Parsing
+*/
+
+/*
+** A reparse holds a document's text along with
+** where each item parsed from it starts and ends
+** and its reach - one past the furthest character
+** looked at while parsing it, which may lie past
+** its end.
+**
+** After an edit the items which reach no further
+** than the edit are kept as they are. Parsing
+** restarts from the end of the last of these and
+** stops once it arrives at the start of an old
+** item which lies after the edit and follows the
+** same character, as from there on every old item
+** would be parsed exactly as before. Those are
+** moved into the new result with their positions
+** shifted.
+*/
+
+typedef struct {
+  mpc_state_t start;
+  mpc_state_t end;
+  long reach;
+} mpc_reparse_item_t;
+
+struct mpc_reparse_t {
+  char *filename;
+  const mpc_parser_t *p;
+  char *text;
+  long length;
+  int valid;
+  int items_num;
+  mpc_reparse_item_t *items;
+  long parsed;
+};
+
+mpc_reparse_t *mpc_reparse_new(const char *filename, const mpc_parser_t *p) {
+  mpc_reparse_t *t = malloc(sizeof(mpc_reparse_t));
+  t->filename = malloc(strlen(filename) + 1);
+  strcpy(t->filename, filename);
+  t->p = p;
+  t->text = calloc(1, 1);
+  t->length = 0;
+  t->valid = 0;
+  t->items_num = 0;
+  t->items = NULL;
+  t->parsed = 0;
+  return t;
+}
+
+void mpc_reparse_delete(mpc_reparse_t *t) {
+  free(t->filename);
+  free(t->text);
+  free(t->items);
+  free(t);
+}
+
+long mpc_reparse_parsed(mpc_reparse_t *t) {
+  return t->parsed;
+}
+
+/*
+** Only positions on the row an item starts on
+** have their column moved, as the rest follow a
+** newline inside the item itself.
+*/
+
+static mpc_state_t mpc_reparse_shift_state(mpc_state_t s, long pos, long row, long rows, long cols) {
+  if (s.row == row) { s.col += cols; }
+  s.pos += pos;
+  s.row += rows;
+  return s;
 }
 
+static void mpc_reparse_shift(mpc_ast_t *a, long pos, long row, long rows, long cols) {
+  int j;
+  a->state = mpc_reparse_shift_state(a->state, pos, row, rows, cols);
+  for (j = 0; j < a->children_num; j++) {
+    mpc_reparse_shift(a->children[j], pos, row, rows, cols);
+  }
+}
+
+static char mpc_reparse_last(const char *text, long pos) {
+  return pos ? text[pos - 1] : '\0';
+}
+
+/*
+** Parses items into `root`, which holds one child
+** for each of the old items. The first `a` of these
+** are kept and the rest either reused or replaced.
+** Old positions at or past `old_end` lie after the
+** edit and move by `delta` in the new text.
+*/
+
+static int mpc_reparse_items(mpc_reparse_t *t, mpc_ast_t *root, int a,
+  const char *old_text, long delta, long old_end, mpc_result_t *r) {
+  
+  int j, k = a, num = 0, slots, stop;
+  long q;
+  char c;
+  mpc_input_t *i;
+  mpc_state_t from, s;
+  mpc_ast_t **xs;
+  mpc_reparse_item_t *items, *old = t->items;
+  int old_num = t->items_num;
+  
+  slots = old_num + 8;
+  xs = malloc(sizeof(mpc_ast_t*) * slots);
+  items = malloc(sizeof(mpc_reparse_item_t) * slots);
+  
+  for (j = 0; j < a; j++) {
+    xs[num] = root->children[j];
+    items[num] = old[j];
+    num++;
+  }
+  
+  from = a ? old[a-1].end : mpc_state_new();
+  i = mpc_input_new_nstring(t->filename, t->text + from.pos, t->length - from.pos);
+  mpc_input_origin(i, from);
+  i->last = mpc_reparse_last(t->text, from.pos);
+  
+  while (1) {
+    
+    c = mpc_input_skip_space(i);
+    q = from.pos + i->pos;
+    
+    while (k < old_num && old[k].start.pos + delta < q) { k++; }
+    if (k < old_num && old[k].start.pos + delta == q && old[k].start.pos >= old_end
+    &&  mpc_reparse_last(t->text, q) == mpc_reparse_last(old_text, old[k].start.pos)) {
+      break;
+    }
+    
+    if (c == '\0' && mpc_input_terminated(i)) { k = old_num; break; }
+    
+    s = mpc_input_state(i);
+    i->reach = i->pos;
+    
+    if (!mpc_parse_input(i, t->p, r)) {
+      mpc_input_delete(i);
+      for (j = 0; j < num; j++) { mpc_ast_delete(xs[j]); }
+      for (j = a; j < old_num; j++) { mpc_ast_delete(root->children[j]); }
+      root->children_num = 0;
+      mpc_ast_delete(root);
+      free(xs);
+      free(items);
+      t->valid = 0;
+      t->parsed = q - from.pos;
+      return 0;
+    }
+    
+    if (num == slots) {
+      slots *= 2;
+      xs = realloc(xs, sizeof(mpc_ast_t*) * slots);
+      items = realloc(items, sizeof(mpc_reparse_item_t) * slots);
+    }
+    
+    xs[num] = r->output;
+    items[num].start = s;
+    items[num].end = mpc_input_state(i);
+    items[num].reach = from.pos + i->reach;
+    num++;
+  }
+  
+  stop = k;
+  t->parsed = q - from.pos;
+  
+  if (stop < old_num) {
+    
+    long row = old[stop].start.row;
+    long rows, cols;
+    
+    s = mpc_input_state(i);
+    rows = s.row - old[stop].start.row;
+    cols = s.col - old[stop].start.col;
+    
+    for (j = stop; j < old_num; j++) {
+      
+      if (num == slots) {
+        slots *= 2;
+        xs = realloc(xs, sizeof(mpc_ast_t*) * slots);
+        items = realloc(items, sizeof(mpc_reparse_item_t) * slots);
+      }
+      
+      mpc_reparse_shift(root->children[j], delta, row, rows, cols);
+      xs[num] = root->children[j];
+      items[num].start = mpc_reparse_shift_state(old[j].start, delta, row, rows, cols);
+      items[num].end = mpc_reparse_shift_state(old[j].end, delta, row, rows, cols);
+      items[num].reach = old[j].reach + delta;
+      num++;
+    }
+  }
+  
+  for (j = a; j < stop; j++) { mpc_ast_delete(root->children[j]); }
+  
+  mpc_input_delete(i);
+  
+  free(root->children);
+  root->children = xs;
+  root->children_num = num;
+  
+  free(t->items);
+  t->items = items;
+  t->items_num = num;
+  t->valid = 1;
+  
+  r->output = root;
+  return 1;
+}
+
+/*
+** Parses a whole document as a sequence of items,
+** each skipping leading whitespace as it does with
+** `mpc_parse_next`. On success the output is a
+** root AST with one child for each item, so the
+** parser given must produce ASTs.
+*/
+
+int mpc_reparse(mpc_reparse_t *t, const char *string, mpc_result_t *r) {
+  free(t->text);
+  t->length = (long)strlen(string);
+  t->text = malloc(t->length + 1);
+  memcpy(t->text, string, t->length + 1);
+  t->items_num = 0;
+  return mpc_reparse_items(t, mpc_ast_new(">", ""), 0, NULL, 0, 0, r);
+}
+
+/*
+** Replaces `removed` characters at `offset` with
+** `inserted` and parses the result again, reusing
+** what it can of `previous`. The previous result
+** is taken over and must not be used afterwards.
+** If it is `NULL` or the last parse failed the
+** whole document is parsed again.
+*/
+
+int mpc_reparse_edit(mpc_reparse_t *t, mpc_ast_t *previous,
+  long offset, long removed, const char *inserted, mpc_result_t *r) {
+  
+  int a = 0, x;
+  char *old = t->text;
+  long length = (long)strlen(inserted);
+  
+  if (offset < 0) { offset = 0; }
+  if (offset > t->length) { offset = t->length; }
+  if (removed < 0) { removed = 0; }
+  if (removed > t->length - offset) { removed = t->length - offset; }
+  
+  t->text = malloc(t->length - removed + length + 1);
+  memcpy(t->text, old, offset);
+  memcpy(t->text + offset, inserted, length);
+  memcpy(t->text + offset + length, old + offset + removed, t->length - offset - removed + 1);
+  t->length += length - removed;
+  
+  if (!t->valid || !previous || previous->children_num != t->items_num) {
+    if (previous) { mpc_ast_delete(previous); }
+    previous = mpc_ast_new(">", "");
+    t->items_num = 0;
+  }
+  
+  while (a < t->items_num && t->items[a].reach <= offset) { a++; }
+  
+  x = mpc_reparse_items(t, previous, a, old, length - removed, offset + removed, r);
+  free(old);
+  return x;
+}
@@ -0,0 +1,74 @@
+#include "../mpc.h"
+#include <time.h>
+
+/*
+** Parses deeply nested expressions with
+** different sizes of input arena. A size
+** of zero allocates everything with malloc.
+*/
+
+static const char *maths_lang =
+  " expression : <product> (('+' | '-') <product>)*;  "
+  " product    : <value>   (('*' | '/') <value>)*;    "
+  " value      : /[0-9]+/ | '(' <expression> ')';     "
+  " maths      : /^/ <expression> /$/;                ";
+
+enum { DEPTH = 200, COPIES = 20, RUNS = 50 };
+
+static double bench_arena(mpc_parser_t *p, const char *input, size_t size) {
+
+  int j;
+  clock_t start;
+  mpc_input_t *i;
+  mpc_result_t r;
+
+  start = clock();
+
+  for (j = 0; j < RUNS; j++) {
+    i = mpc_input_new_string("<bench>", input);
+    mpc_input_arena(i, size);
+    if (mpc_parse_input(i, p, &r)) {
+      mpc_ast_delete(r.output);
+    } else {
+      mpc_err_print(r.error);
+      mpc_err_delete(r.error);
+    }
+    mpc_input_delete(i);
+  }
+
+  return (double)(clock() - start) / CLOCKS_PER_SEC / RUNS;
+}
+
+int main(void) {
+
+  int j, k;
+  char *input, *c;
+  size_t sizes[] = { 0, 4096, 32768, 1048576 };
+
+  mpc_parser_t *Expr  = mpc_new("expression");
+  mpc_parser_t *Prod  = mpc_new("product");
+  mpc_parser_t *Value = mpc_new("value");
+  mpc_parser_t *Maths = mpc_new("maths");
+
+  mpca_lang(MPCA_LANG_DEFAULT, maths_lang, Expr, Prod, Value, Maths, NULL);
+
+  c = input = malloc(COPIES * (DEPTH * 4 + 3) + 1);
+  for (k = 0; k < COPIES; k++) {
+    if (k > 0) { *c++ = '+'; }
+    for (j = 0; j < DEPTH; j++) { *c++ = '('; }
+    *c++ = '1';
+    for (j = 0; j < DEPTH; j++) { *c++ = '*'; *c++ = '2'; *c++ = ')'; }
+  }
+  *c = '\0';
+
+  for (j = 0; j < 4; j++) {
+    printf("arena: %lu bytes input, %7lu byte arena %.2f ms\n",
+      (unsigned long)strlen(input), (unsigned long)sizes[j],
+      bench_arena(Maths, input, sizes[j]) * 1000);
+  }
+
+  mpc_cleanup(4, Expr, Prod, Value, Maths);
+  free(input);
+
+  return 0;
+}
@@ -0,0 +1,86 @@
+#include "../mpc.h"
+#include <time.h>
+
+/*
+** Compares building and deleting ASTs with
+** malloc against building them in an arena.
+*/
+
+static const char *lispy_lang =
+  " number  \"number\"  : /-?[0-9]+/ ;                       "
+  " symbol  \"symbol\"  : /[a-zA-Z0-9_+\\-*\\/\\\\=<>!&]+/ ; "
+  " string  \"string\"  : /\"(\\\\.|[^\"])*\"/ ;             "
+  " comment             : /;[^\\r\\n]*/ ;                    "
+  " sexpr               : '(' <expr>* ')' ;                  "
+  " qexpr               : '{' <expr>* '}' ;                  "
+  " expr                : <number>  | <symbol> | <string>    "
+  "                     | <comment> | <sexpr>  | <qexpr> ;   "
+  " lispy               : /^/ <expr>* /$/ ;                  ";
+
+static const char *lispy_line =
+  "(def {fib} (\\ {n} {if (< n 2) {n} {+ (fib (- n 1)) (fib (- n 2))}})) ; fib\n"
+  "(print \"fib\" (fib 20) {1 2 3 4 5 6 7 8 9 10})\n";
+
+enum { LINES = 2000, RUNS = 20 };
+
+static double bench_ast(mpc_parser_t *p, int flags, const char *input) {
+
+  int j;
+  clock_t start;
+  mpc_input_t *i;
+  mpc_result_t r;
+
+  start = clock();
+
+  for (j = 0; j < RUNS; j++) {
+    i = mpc_input_new_string("<bench>", input);
+    mpc_input_flags(i, flags);
+    if (mpc_parse_input(i, p, &r)) {
+      if (flags & MPC_INPUT_AST_ARENA) {
+        mpc_ast_arena_delete(r.output);
+      } else {
+        mpc_ast_delete(r.output);
+      }
+    } else {
+      mpc_err_print(r.error);
+      mpc_err_delete(r.error);
+    }
+    mpc_input_delete(i);
+  }
+
+  return (double)(clock() - start) / CLOCKS_PER_SEC / RUNS;
+}
+
+int main(void) {
+
+  int j;
+  double heap, arena;
+  size_t l = strlen(lispy_line);
+  char *input = malloc(l * LINES + 1);
+
+  mpc_parser_t* Number  = mpc_new("number");
+  mpc_parser_t* Symbol  = mpc_new("symbol");
+  mpc_parser_t* String  = mpc_new("string");
+  mpc_parser_t* Comment = mpc_new("comment");
+  mpc_parser_t* Sexpr   = mpc_new("sexpr");
+  mpc_parser_t* Qexpr   = mpc_new("qexpr");
+  mpc_parser_t* Expr    = mpc_new("expr");
+  mpc_parser_t* Lispy   = mpc_new("lispy");
+
+  mpca_lang(MPCA_LANG_DEFAULT, lispy_lang,
+    Number, Symbol, String, Comment, Sexpr, Qexpr, Expr, Lispy, NULL);
+
+  for (j = 0; j < LINES; j++) { memcpy(input + l * j, lispy_line, l); }
+  input[l * LINES] = '\0';
+
+  heap  = bench_ast(Lispy, MPC_INPUT_DEFAULT, input);
+  arena = bench_ast(Lispy, MPC_INPUT_AST_ARENA, input);
+
+  printf("ast: %lu bytes, malloc %.2f ms, arena %.2f ms (%.2fx)\n",
+    (unsigned long)(l * LINES), heap * 1000, arena * 1000, heap / arena);
+
+  mpc_cleanup(8, Number, Symbol, String, Comment, Sexpr, Qexpr, Expr, Lispy);
+  free(input);
+
+  return 0;
+}
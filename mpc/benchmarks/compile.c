@@ -0,0 +1,213 @@
+#include "../mpc.h"
+#include <time.h>
+
+/*
+** Compares parsing with the recursive parser
+** graph against its compiled instruction array
+** for each grammar in the examples and tests.
+** Inputs are built by repeating one item. Each
+** is also timed with a stray character at its
+** end, as failing input is parsed twice when
+** compiled.
+*/
+
+enum { PARSERS_MAX = 17, RUNS = 10 };
+
+typedef struct {
+  const char *name;
+  int flags;
+  const char *lang;
+  const char *names[PARSERS_MAX];
+  const char *prefix;
+  const char *item;
+  const char *suffix;
+  int items;
+} bench_t;
+
+static const bench_t benches[] = {
+
+  { "maths", MPCA_LANG_PREDICTIVE,
+    " expression : <product> (('+' | '-') <product>)*; "
+    " product : <value>   (('*' | '/')   <value>)*;    "
+    " value : /[0-9]+/ | '(' <expression> ')';         "
+    " maths : /^/ <expression> /$/;                    ",
+    { "expression", "product", "value", "maths" },
+    "", "(4 * 2 * 11 + 2) - 529 + 2 * 3 - 99 - (5 + 5 + 2) / 100 + ", "1", 4000 },
+
+  { "maths.grammar", MPCA_LANG_DEFAULT, NULL,
+    { "expression", "product", "value", "maths" },
+    "", "(4 * 2 * 11 + 2) - 529 + 2 * 3 - 99 - (5 + 5 + 2) / 100 + ", "1", 4000 },
+
+  { "lispy", MPCA_LANG_PREDICTIVE,
+    " number  \"number\"  : /[0-9]+/ ;                         "
+    " symbol  \"symbol\"  : /[a-zA-Z0-9_+\\-*\\/\\\\=<>!&]+/ ; "
+    " string  \"string\"  : /\"(\\\\.|[^\"])*\"/ ;             "
+    " comment             : /;[^\\r\\n]*/ ;                    "
+    " sexpr               : '(' <expr>* ')' ;                  "
+    " qexpr               : '{' <expr>* '}' ;                  "
+    " expr                : <number>  | <symbol> | <string>    "
+    "                     | <comment> | <sexpr>  | <qexpr> ;   "
+    " lispy               : /^/ <expr>* /$/ ;                  ",
+    { "number", "symbol", "string", "comment", "sexpr", "qexpr", "expr", "lispy" },
+    "", "(def {fib} (\\ {n} {if (< n 2) {n} {+ (fib (- n 1)) (fib (- n 2))}})) ; fib\n", "", 4000 },
+
+  { "doge", MPCA_LANG_DEFAULT,
+    " adjective : \"wow\" | \"many\" | \"so\" | \"such\";                 "
+    " noun      : \"lisp\" | \"language\" | \"c\" | \"book\" | \"build\"; "
+    " phrase    : <adjective> <noun>;                                     "
+    " doge      : /^/ <phrase>* /$/;                                      ",
+    { "adjective", "noun", "phrase", "doge" },
+    "", "so c wow book many language such build so lisp\n", "", 4000 },
+
+  { "smallc", MPCA_LANG_DEFAULT,
+    " ident     : /[a-zA-Z_][a-zA-Z0-9_]*/ ;                           \n"
+    " number    : /[0-9]+/ ;                                           \n"
+    " character : /'.'/ ;                                              \n"
+    " string    : /\"(\\\\.|[^\"])*\"/ ;                               \n"
+    " factor    : '(' <lexp> ')'                                       \n"
+    "           | <number>                                             \n"
+    "           | <character>                                          \n"
+    "           | <string>                                             \n"
+    "           | <ident> '(' <lexp>? (',' <lexp>)* ')'                \n"
+    "           | <ident> ;                                            \n"
+    " term      : <factor> (('*' | '/' | '%') <factor>)* ;             \n"
+    " lexp      : <term> (('+' | '-') <term>)* ;                       \n"
+    " stmt      : '{' <stmt>* '}'                                      \n"
+    "           | \"while\" '(' <exp> ')' <stmt>                       \n"
+    "           | \"if\"    '(' <exp> ')' <stmt>                       \n"
+    "           | <ident> '=' <lexp> ';'                               \n"
+    "           | \"print\" '(' <lexp>? ')' ';'                        \n"
+    "           | \"return\" <lexp>? ';'                               \n"
+    "           | <ident> '(' <ident>? (',' <ident>)* ')' ';' ;        \n"
+    " exp       : <lexp> '>' <lexp>                                    \n"
+    "           | <lexp> '<' <lexp>                                    \n"
+    "           | <lexp> \">=\" <lexp>                                 \n"
+    "           | <lexp> \"<=\" <lexp>                                 \n"
+    "           | <lexp> \"!=\" <lexp>                                 \n"
+    "           | <lexp> \"==\" <lexp> ;                               \n"
+    " typeident : (\"int\" | \"char\") <ident> ;                       \n"
+    " decls     : (<typeident> ';')* ;                                 \n"
+    " args      : <typeident>? (',' <typeident>)* ;                    \n"
+    " body      : '{' <decls> <stmt>* '}' ;                            \n"
+    " procedure : (\"int\" | \"char\") <ident> '(' <args> ')' <body> ; \n"
+    " main      : \"main\" '(' ')' <body> ;                            \n"
+    " includes  : (\"#include\" <string>)* ;                           \n"
+    " smallc    : /^/ <includes> <decls> <procedure>* <main> /$/ ;     \n",
+    { "ident", "number", "character", "string", "factor", "term", "lexp", "stmt", "exp",
+      "typeident", "decls", "args", "body", "procedure", "main", "includes", "smallc" },
+    "#include \"stdio.h\"\n",
+    "int fib(int n) {\n"
+    "  if (n == 0) { return 0; }\n"
+    "  if (n == 1) { return 1; }\n"
+    "  return fib(n - 1) + fib(n - 2);\n"
+    "}\n",
+    "main() { int n; n = fib(10); print(n); return 0; }\n", 1000 },
+
+  { "tree_traversal", MPCA_LANG_PREDICTIVE,
+    " node : '(' <node> ',' /foo/ ',' <node> ')' | <leaf>;"
+    " leaf : /bar/;"
+    " input : /^/ <node> /$/;",
+    { "node", "leaf", "input" },
+    "", "(bar,foo,", "bar", 4000 },
+
+  { "foobar", MPCA_LANG_DEFAULT,
+    " foobar : \"foo\" | \"bar\"; ",
+    { "foobar" },
+    "", "", "bar", 1 }
+
+};
+
+static char *bench_input(const bench_t *b) {
+
+  int j;
+  size_t l = strlen(b->item);
+  char *input = malloc(strlen(b->prefix) + l * b->items + strlen(b->suffix) + b->items + 1);
+  char *x = input;
+
+  strcpy(x, b->prefix); x += strlen(b->prefix);
+  for (j = 0; j < b->items; j++) { memcpy(x, b->item, l); x += l; }
+  strcpy(x, b->suffix); x += strlen(b->suffix);
+
+  /* Nested items are closed at the end */
+  if (strchr(b->item, '(') && !strchr(b->item, ')')) {
+    for (j = 0; j < b->items; j++) { *x++ = ')'; }
+  }
+  *x = '\0';
+
+  return input;
+}
+
+static char *bench_broken(const char *input) {
+  char *broken = malloc(strlen(input) + 2);
+  strcpy(broken, input);
+  strcat(broken, "\001");
+  return broken;
+}
+
+static double bench_parse(mpc_parser_t *p, mpc_program_t *c, const char *input) {
+
+  int j;
+  clock_t start = clock();
+  mpc_result_t r;
+
+  for (j = 0; j < RUNS; j++) {
+    if (c ? mpc_parse_compiled("<bench>", input, c, &r) : mpc_parse("<bench>", input, p, &r)) {
+      mpc_ast_delete(r.output);
+    } else {
+      mpc_err_delete(r.error);
+    }
+  }
+
+  return (double)(clock() - start) / CLOCKS_PER_SEC / RUNS;
+}
+
+int main(void) {
+
+  int j, k, n;
+  double graph, compiled, graph_err, compiled_err;
+  char *input, *broken;
+  mpc_err_t *err;
+  mpc_program_t *c;
+  mpc_parser_t *ps[PARSERS_MAX+1];
+  const bench_t *b;
+
+  for (j = 0; j < (int)(sizeof(benches) / sizeof(bench_t)); j++) {
+
+    b = &benches[j];
+
+    for (n = 0; n < PARSERS_MAX && b->names[n]; n++) { ps[n] = mpc_new(b->names[n]); }
+    for (k = n; k <= PARSERS_MAX; k++) { ps[k] = NULL; }
+
+    err = b->lang
+      ? mpca_lang(b->flags, b->lang,
+          ps[0], ps[1], ps[2], ps[3], ps[4], ps[5], ps[6], ps[7], ps[8],
+          ps[9], ps[10], ps[11], ps[12], ps[13], ps[14], ps[15], ps[16], NULL)
+      : mpca_lang_contents(b->flags, "tests/maths.grammar", ps[0], ps[1], ps[2], ps[3], NULL);
+
+    if (err) {
+      mpc_err_print(err);
+      mpc_err_delete(err);
+      return 1;
+    }
+
+    input = bench_input(b);
+    broken = bench_broken(input);
+    c = mpc_compile(ps[n-1]);
+
+    graph        = bench_parse(ps[n-1], NULL, input);
+    compiled     = bench_parse(ps[n-1], c, input);
+    graph_err    = bench_parse(ps[n-1], NULL, broken);
+    compiled_err = bench_parse(ps[n-1], c, broken);
+
+    printf("compile: %-14s %7lu bytes, graph %.2f ms, compiled %.2f ms (%.2fx), failing %.2fx\n",
+      b->name, (unsigned long)strlen(input), graph * 1000, compiled * 1000,
+      graph / compiled, graph_err / compiled_err);
+
+    mpc_program_delete(c);
+    free(broken);
+    free(input);
+    for (k = 0; k < n; k++) { mpc_cleanup(1, ps[k]); }
+  }
+
+  return 0;
+}
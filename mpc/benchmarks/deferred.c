@@ -0,0 +1,79 @@
+#include "../mpc.h"
+#include <time.h>
+
+/*
+** Compares parsing mostly valid input with
+** errors built eagerly against errors deferred
+** until the whole parse fails.
+*/
+
+static const char *lispy_lang =
+  " number  \"number\"  : /[0-9]+/ ;                         "
+  " symbol  \"symbol\"  : /[a-zA-Z0-9_+\\-*\\/\\\\=<>!&]+/ ; "
+  " string  \"string\"  : /\"(\\\\.|[^\"])*\"/ ;             "
+  " comment             : /;[^\\r\\n]*/ ;                    "
+  " sexpr               : '(' <expr>* ')' ;                  "
+  " qexpr               : '{' <expr>* '}' ;                  "
+  " expr                : <number>  | <symbol> | <string>    "
+  "                     | <comment> | <sexpr>  | <qexpr> ;   "
+  " lispy               : /^/ <expr>* /$/ ;                  ";
+
+static const char *lispy_line =
+  "(def {fib} (\\ {n} {if (< n 2) {n} {+ (fib (- n 1)) (fib (- n 2))}})) ; fib\n"
+  "(print \"fib\" (fib 20) {1 2 3 4 5 6 7 8 9 10})\n";
+
+enum { LINES = 2000, RUNS = 20 };
+
+static double bench_parse(int flags, const char *input) {
+
+  int j;
+  clock_t start;
+  mpc_result_t r;
+
+  mpc_parser_t* Number  = mpc_new("number");
+  mpc_parser_t* Symbol  = mpc_new("symbol");
+  mpc_parser_t* String  = mpc_new("string");
+  mpc_parser_t* Comment = mpc_new("comment");
+  mpc_parser_t* Sexpr   = mpc_new("sexpr");
+  mpc_parser_t* Qexpr   = mpc_new("qexpr");
+  mpc_parser_t* Expr    = mpc_new("expr");
+  mpc_parser_t* Lispy   = mpc_new("lispy");
+
+  mpca_lang(flags, lispy_lang,
+    Number, Symbol, String, Comment, Sexpr, Qexpr, Expr, Lispy, NULL);
+
+  start = clock();
+
+  for (j = 0; j < RUNS; j++) {
+    if (mpc_parse("<bench>", input, Lispy, &r)) {
+      mpc_ast_delete(r.output);
+    } else {
+      mpc_err_print(r.error);
+      mpc_err_delete(r.error);
+    }
+  }
+
+  mpc_cleanup(8, Number, Symbol, String, Comment, Sexpr, Qexpr, Expr, Lispy);
+
+  return (double)(clock() - start) / CLOCKS_PER_SEC / RUNS;
+}
+
+int main(void) {
+
+  int j;
+  double eager, deferred;
+  char *input = malloc(strlen(lispy_line) * LINES + 1);
+
+  input[0] = '\0';
+  for (j = 0; j < LINES; j++) { strcat(input + strlen(lispy_line) * j, lispy_line); }
+
+  eager    = bench_parse(MPCA_LANG_DEFAULT, input);
+  deferred = bench_parse(MPCA_LANG_DEFERRED_ERRORS, input);
+
+  printf("deferred: %lu bytes, eager %.2f ms, deferred %.2f ms (%.2fx)\n",
+    (unsigned long)strlen(input), eager * 1000, deferred * 1000, eager / deferred);
+
+  free(input);
+
+  return 0;
+}
@@ -0,0 +1,85 @@
+#include "../mpc.h"
+#include <time.h>
+
+/*
+** Compares parsing a lispy program trying every
+** alternative of each `or` in turn against jumping
+** straight to the one its next character selects.
+*/
+
+static const char *lispy_lang =
+  " number  : /-?[0-9]+/ ;                             "
+  " symbol  : /[a-zA-Z0-9_+\\-*\\/\\\\=<>!&]+/ ;       "
+  " string  : /\"(\\\\.|[^\"])*\"/ ;                   "
+  " comment : /;[^\\r\\n]*/ ;                          "
+  " sexpr   : '(' <expr>* ')' ;                        "
+  " qexpr   : '{' <expr>* '}' ;                        "
+  " expr    : <number>  | <symbol> | <string>          "
+  "         | <comment> | <sexpr>  | <qexpr> ;         "
+  " lispy   : /^/ <expr>* /$/ ;                        ";
+
+static const char *lispy_line =
+  "(def {fib} (\\ {n} {if (< n 2) {n} {+ (fib (- n 1)) (fib (- n 2))}})) ; fib\n"
+  "(print \"fib\" (fib 20) {1 2 3 4 5 6 7 8 9 10} (head {a b c}) (tail {a b c}))\n";
+
+enum { LINES = 2000, RUNS = 10 };
+
+static double bench_parse(mpc_parser_t *p, int flags, const char *input, long *allocs) {
+
+  int j;
+  clock_t start;
+  mpc_input_t *i;
+  mpc_result_t r;
+
+  start = clock();
+
+  for (j = 0; j < RUNS; j++) {
+    i = mpc_input_new_string("<bench>", input);
+    mpc_input_flags(i, flags);
+    if (mpc_parse_input(i, p, &r)) {
+      mpc_ast_delete(r.output);
+    } else {
+      mpc_err_print(r.error);
+      mpc_err_delete(r.error);
+    }
+    *allocs = mpc_input_allocs(i);
+    mpc_input_delete(i);
+  }
+
+  return (double)(clock() - start) / CLOCKS_PER_SEC / RUNS;
+}
+
+int main(void) {
+
+  int j;
+  long a0 = 0, a1 = 0;
+  double tried, jumped;
+  size_t l = strlen(lispy_line);
+  char *input = malloc(l * LINES + 1);
+
+  mpc_parser_t *Number  = mpc_new("number");
+  mpc_parser_t *Symbol  = mpc_new("symbol");
+  mpc_parser_t *String  = mpc_new("string");
+  mpc_parser_t *Comment = mpc_new("comment");
+  mpc_parser_t *Sexpr   = mpc_new("sexpr");
+  mpc_parser_t *Qexpr   = mpc_new("qexpr");
+  mpc_parser_t *Expr    = mpc_new("expr");
+  mpc_parser_t *Lispy   = mpc_new("lispy");
+
+  mpca_lang(MPCA_LANG_DEFAULT, lispy_lang,
+    Number, Symbol, String, Comment, Sexpr, Qexpr, Expr, Lispy, NULL);
+
+  for (j = 0; j < LINES; j++) { memcpy(input + l * j, lispy_line, l); }
+  input[l * LINES] = '\0';
+
+  tried  = bench_parse(Lispy, MPC_INPUT_NO_DISPATCH, input, &a0);
+  jumped = bench_parse(Lispy, MPC_INPUT_DEFAULT, input, &a1);
+
+  printf("dispatch: %lu bytes, backtracking %.2f ms (%ld allocs), dispatched %.2f ms (%ld allocs) (%.2fx)\n",
+    (unsigned long)strlen(input), tried * 1000, a0, jumped * 1000, a1, tried / jumped);
+
+  mpc_cleanup(8, Number, Symbol, String, Comment, Sexpr, Qexpr, Expr, Lispy);
+  free(input);
+
+  return 0;
+}
@@ -0,0 +1,71 @@
+#include "../mpc.h"
+#include <time.h>
+
+/*
+** Compares building the lispy grammar from its
+** text with `mpca_lang` against loading it from
+** data saved with `mpca_lang_save`.
+*/
+
+static const char *lispy_lang =
+  " number  : /-?[0-9]+/ ;                             "
+  " symbol  : /[a-zA-Z0-9_+\\-*\\/\\\\=<>!&]+/ ;       "
+  " string  : /\"(\\\\.|[^\"])*\"/ ;                   "
+  " comment : /;[^\\r\\n]*/ ;                          "
+  " sexpr   : '(' <expr>* ')' ;                        "
+  " qexpr   : '{' <expr>* '}' ;                        "
+  " expr    : <number>  | <symbol> | <string>          "
+  "         | <comment> | <sexpr>  | <qexpr> ;         "
+  " lispy   : /^/ <expr>* /$/ ;                        ";
+
+static const char *lispy_names[] = {
+  "number", "symbol", "string", "comment", "sexpr", "qexpr", "expr", "lispy" };
+
+enum { RUNS = 200 };
+
+static double bench_lang(const char *data, size_t size, char **saved, size_t *saved_size) {
+
+  int j, k;
+  clock_t start = clock();
+  mpc_parser_t *ps[8];
+  mpc_err_t *err;
+
+  for (j = 0; j < RUNS; j++) {
+
+    for (k = 0; k < 8; k++) { ps[k] = mpc_new(lispy_names[k]); }
+
+    err = data
+      ? mpca_lang_load(data, size, ps[0], ps[1], ps[2], ps[3], ps[4], ps[5], ps[6], ps[7], NULL)
+      : mpca_lang(MPCA_LANG_DEFAULT, lispy_lang, ps[0], ps[1], ps[2], ps[3], ps[4], ps[5], ps[6], ps[7], NULL);
+
+    if (err) {
+      mpc_err_print(err);
+      mpc_err_delete(err);
+    }
+
+    if (saved && j == 0) {
+      mpca_lang_save(saved, saved_size, ps[0], ps[1], ps[2], ps[3], ps[4], ps[5], ps[6], ps[7], NULL);
+    }
+
+    mpc_cleanup(8, ps[0], ps[1], ps[2], ps[3], ps[4], ps[5], ps[6], ps[7]);
+  }
+
+  return (double)(clock() - start) / CLOCKS_PER_SEC / RUNS;
+}
+
+int main(void) {
+
+  char *data;
+  size_t size;
+  double text, loaded;
+
+  text   = bench_lang(NULL, 0, &data, &size);
+  loaded = bench_lang(data, size, NULL, NULL);
+
+  printf("lang: %lu bytes saved, mpca_lang %.1f us, mpca_lang_load %.1f us (%.0fx)\n",
+    (unsigned long)size, text * 1e6, loaded * 1e6, text / loaded);
+
+  free(data);
+
+  return 0;
+}
@@ -0,0 +1,63 @@
+#include "../mpc.h"
+#include <time.h>
+
+/*
+** Compares the throughput of the Skippy token
+** regexes run as a DFA and as a parser tree.
+*/
+
+static const char *number_re = "-?[0-9]+([.][0-9]+)?";
+static const char *symbol_re = "[a-zA-Z0-9_+\\-*\\/\\\\=<>!&%]+";
+
+static const char *tokens_line =
+  "def fib n if <= n 1 n + fib - n 1 fib - n 2 -12.5 3.14159 42 head tail list eval join \n";
+
+enum { LINES = 20000, RUNS = 10 };
+
+static double bench_tokens(int mode, const char *input) {
+
+  int j;
+  clock_t start;
+  mpc_result_t r;
+  mpc_parser_t *p;
+
+  p = mpc_many(mpcf_null, mpc_apply(
+    mpc_tok(mpc_or(2, mpc_re_mode(number_re, mode), mpc_re_mode(symbol_re, mode))),
+    mpcf_free));
+  p = mpc_whole(p, mpcf_dtor_null);
+
+  start = clock();
+
+  for (j = 0; j < RUNS; j++) {
+    if (!mpc_parse("<bench>", input, p, &r)) {
+      mpc_err_print(r.error);
+      mpc_err_delete(r.error);
+    }
+  }
+
+  mpc_delete(p);
+
+  return (double)(clock() - start) / CLOCKS_PER_SEC / RUNS;
+}
+
+int main(void) {
+
+  int j;
+  double tree, dfa, mb;
+  size_t l = strlen(tokens_line);
+  char *input = malloc(l * LINES + 1);
+
+  for (j = 0; j < LINES; j++) { memcpy(input + l * j, tokens_line, l); }
+  input[l * LINES] = '\0';
+  mb = (double)(l * LINES) / (1024 * 1024);
+
+  tree = bench_tokens(MPC_RE_NODFA, input);
+  dfa  = bench_tokens(MPC_RE_DEFAULT, input);
+
+  printf("regex: %.2f MB, tree %.2f MB/s, dfa %.2f MB/s (%.2fx)\n",
+    mb, mb / tree, mb / dfa, tree / dfa);
+
+  free(input);
+
+  return 0;
+}
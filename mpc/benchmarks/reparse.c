@@ -0,0 +1,87 @@
+#include "../mpc.h"
+#include <time.h>
+
+/*
+** Compares parsing a whole document again after
+** each small edit against reparsing only the items
+** each edit touches with `mpc_reparse_edit`.
+*/
+
+enum { ITEMS = 5000, EDITS = 200 };
+
+static const char *lispy_item =
+  "(def {fib%d} (\\ {n} {if (< n 2) {n} {+ (fib (- n 1)) (fib (- n 2))}})) ; %d\n";
+
+static char *bench_input(void) {
+  int j;
+  size_t n = 0;
+  char *input = malloc(ITEMS * 128);
+  for (j = 0; j < ITEMS; j++) { n += sprintf(input + n, lispy_item, j, j); }
+  return input;
+}
+
+int main(void) {
+
+  int j;
+  long offset, size;
+  clock_t start;
+  double full, edit;
+  char digit[2], *input = bench_input();
+  mpc_result_t r;
+  mpc_reparse_t *t;
+  mpc_ast_t *a;
+  mpc_parser_t *Number, *Symbol, *String, *Comment, *Sexpr, *Qexpr, *Expr;
+
+  Number  = mpc_new("number");
+  Symbol  = mpc_new("symbol");
+  String  = mpc_new("string");
+  Comment = mpc_new("comment");
+  Sexpr   = mpc_new("sexpr");
+  Qexpr   = mpc_new("qexpr");
+  Expr    = mpc_new("expr");
+
+  mpca_lang(MPCA_LANG_DEFAULT,
+    " number  : /-?[0-9]+/ ;                             "
+    " symbol  : /[a-zA-Z0-9_+\\-*\\/\\\\=<>!&]+/ ;       "
+    " string  : /\"(\\\\.|[^\"])*\"/ ;                   "
+    " comment : /;[^\\r\\n]*/ ;                          "
+    " sexpr   : '(' <expr>* ')' ;                        "
+    " qexpr   : '{' <expr>* '}' ;                        "
+    " expr    : <number>  | <symbol> | <string>          "
+    "         | <comment> | <sexpr>  | <qexpr> ;         ",
+    Number, Symbol, String, Comment, Sexpr, Qexpr, Expr, NULL);
+
+  t = mpc_reparse_new("<bench>", Expr);
+  size = (long)strlen(input);
+
+  start = clock();
+  if (!mpc_reparse(t, input, &r)) { mpc_err_print(r.error); return 1; }
+  full = (double)(clock() - start) / CLOCKS_PER_SEC;
+  a = r.output;
+
+  /* Swap a digit back and forth at spread out places */
+  start = clock();
+  for (j = 0; j < EDITS; j++) {
+    offset = (long)((double)size * j / EDITS);
+    while (input[offset] < '0' || input[offset] > '9') { offset++; }
+    input[offset] = input[offset] == '1' ? '2' : '1';
+    digit[0] = input[offset];
+    digit[1] = '\0';
+    if (!mpc_reparse_edit(t, a, offset, 1, digit, &r)) {
+      mpc_err_print(r.error);
+      return 1;
+    }
+    a = r.output;
+  }
+  edit = (double)(clock() - start) / CLOCKS_PER_SEC / EDITS;
+
+  printf("reparse: %d items, full %.2f ms, edit %.3f ms (%.0fx)\n",
+    ITEMS, full * 1e3, edit * 1e3, full / edit);
+
+  mpc_ast_delete(a);
+  mpc_reparse_delete(t);
+  free(input);
+  mpc_cleanup(7, Number, Symbol, String, Comment, Sexpr, Qexpr, Expr);
+
+  return 0;
+}
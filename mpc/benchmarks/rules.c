@@ -0,0 +1,121 @@
+#include "../mpc.h"
+#include <time.h>
+
+/*
+** Compares walking a lispy AST classifying each
+** node by matching its tag against switching on
+** its primary rule id.
+*/
+
+static const char *lispy_lang =
+  " number  : /-?[0-9]+/ ;                             "
+  " symbol  : /[a-zA-Z0-9_+\\-*\\/\\\\=<>!&]+/ ;       "
+  " sexpr   : '(' <expr>* ')' ;                        "
+  " qexpr   : '{' <expr>* '}' ;                        "
+  " expr    : <number> | <symbol> | <sexpr> | <qexpr> ;"
+  " lispy   : /^/ <expr>* /$/ ;                        ";
+
+enum { RULE_NUMBER = 1, RULE_SYMBOL, RULE_SEXPR, RULE_QEXPR, RULE_EXPR, RULE_LISPY };
+
+static const char *lispy_line =
+  "(def {fib} (\\ {n} {if (< n 2) {n} {+ (fib (- n 1)) (fib (- n 2))}}))\n"
+  "(list (fib 20) {1 2 3 4 5 6 7 8 9 10} (head {a b c}) (tail {a b c}))\n";
+
+enum { LINES = 2000, RUNS = 200 };
+
+static long read_tags(mpc_ast_t *t) {
+
+  int j;
+  long n = 0;
+
+  if (strstr(t->tag, "number")) { return 1; }
+  if (strstr(t->tag, "symbol")) { return 2; }
+
+  if (strcmp(t->tag, ">") == 0) { n = 3; }
+  if (strstr(t->tag, "sexpr"))  { n = 3; }
+  if (strstr(t->tag, "qexpr"))  { n = 4; }
+
+  for (j = 0; j < t->children_num; j++) {
+    if (strcmp(t->children[j]->contents, "(") == 0) { continue; }
+    if (strcmp(t->children[j]->contents, ")") == 0) { continue; }
+    if (strcmp(t->children[j]->contents, "{") == 0) { continue; }
+    if (strcmp(t->children[j]->contents, "}") == 0) { continue; }
+    if (strcmp(t->children[j]->tag,  "regex") == 0) { continue; }
+    n += read_tags(t->children[j]);
+  }
+
+  return n;
+}
+
+static long read_rules(mpc_ast_t *t) {
+
+  int j;
+  long n;
+
+  switch (t->primary) {
+    case RULE_NUMBER: return 1;
+    case RULE_SYMBOL: return 2;
+    case RULE_QEXPR:  n = 4; break;
+    default:          n = 3; break;
+  }
+
+  for (j = 0; j < t->children_num; j++) {
+    if (t->children[j]->primary == 0 && t->children[j]->children_num == 0) { continue; }
+    n += read_rules(t->children[j]);
+  }
+
+  return n;
+}
+
+static double bench_read(long (*f)(mpc_ast_t*), mpc_ast_t *a, long *total) {
+
+  int j;
+  clock_t start = clock();
+
+  *total = 0;
+  for (j = 0; j < RUNS; j++) { *total += f(a); }
+
+  return (double)(clock() - start) / CLOCKS_PER_SEC / RUNS;
+}
+
+int main(void) {
+
+  int j;
+  long n0, n1;
+  double tags, rules;
+  mpc_result_t r;
+  size_t l = strlen(lispy_line);
+  char *input = malloc(l * LINES + 1);
+
+  mpc_parser_t *Number = mpc_new("number");
+  mpc_parser_t *Symbol = mpc_new("symbol");
+  mpc_parser_t *Sexpr  = mpc_new("sexpr");
+  mpc_parser_t *Qexpr  = mpc_new("qexpr");
+  mpc_parser_t *Expr   = mpc_new("expr");
+  mpc_parser_t *Lispy  = mpc_new("lispy");
+
+  mpca_lang(MPCA_LANG_DEFAULT, lispy_lang,
+    Number, Symbol, Sexpr, Qexpr, Expr, Lispy, NULL);
+
+  for (j = 0; j < LINES; j++) { memcpy(input + l * j, lispy_line, l); }
+  input[l * LINES] = '\0';
+
+  if (!mpc_parse("<bench>", input, Lispy, &r)) {
+    mpc_err_print(r.error);
+    mpc_err_delete(r.error);
+    return 1;
+  }
+
+  tags  = bench_read(read_tags, r.output, &n0);
+  rules = bench_read(read_rules, r.output, &n1);
+
+  printf("rules: %lu bytes, tags %.2f ms, rule ids %.2f ms (%.2fx)%s\n",
+    (unsigned long)strlen(input), tags * 1000, rules * 1000, tags / rules,
+    n0 == n1 ? "" : " MISMATCH");
+
+  mpc_ast_delete(r.output);
+  mpc_cleanup(6, Number, Symbol, Sexpr, Qexpr, Expr, Lispy);
+  free(input);
+
+  return 0;
+}
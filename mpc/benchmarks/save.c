@@ -0,0 +1,105 @@
+#include "../mpc.h"
+#include <time.h>
+
+/*
+** Compares parsing a document against loading
+** the AST saved from it with `mpc_ast_load`,
+** copying its contents, pointing into the data
+** and building it in an arena.
+*/
+
+enum { ITEMS = 5000, RUNS = 10 };
+
+static const char *lispy_item =
+  "(def {fib%d} (\\ {n} {if (< n 2) {n} {+ (fib (- n 1)) (fib (- n 2))}})) ; %d\n";
+
+static char *bench_input(void) {
+  int j;
+  size_t n = 0;
+  char *input = malloc(ITEMS * 128);
+  for (j = 0; j < ITEMS; j++) { n += sprintf(input + n, lispy_item, j, j); }
+  return input;
+}
+
+static void bench_delete(mpc_ast_t *a, int flags) {
+  if (flags & MPC_INPUT_AST_ARENA) { mpc_ast_arena_delete(a); } else { mpc_ast_delete(a); }
+}
+
+static double bench_parse(mpc_parser_t *p, const char *input, int flags) {
+  int j;
+  clock_t start = clock();
+  mpc_input_t *i;
+  mpc_result_t r;
+  for (j = 0; j < RUNS; j++) {
+    i = mpc_input_new_string("<bench>", input);
+    mpc_input_flags(i, flags);
+    if (mpc_parse_input(i, p, &r)) { bench_delete(r.output, flags); }
+    else { mpc_err_print(r.error); mpc_err_delete(r.error); }
+    mpc_input_delete(i);
+  }
+  return (double)(clock() - start) / CLOCKS_PER_SEC / RUNS;
+}
+
+static double bench_load(const char *data, size_t size, int flags) {
+  int j;
+  clock_t start = clock();
+  mpc_ast_t *a;
+  mpc_err_t *err;
+  for (j = 0; j < RUNS; j++) {
+    err = mpc_ast_load(data, size, flags, &a);
+    if (err) { mpc_err_print(err); mpc_err_delete(err); }
+    else { bench_delete(a, flags); }
+  }
+  return (double)(clock() - start) / CLOCKS_PER_SEC / RUNS;
+}
+
+int main(void) {
+
+  char *data, *input = bench_input();
+  size_t size;
+  double parse, arena, copy, views, loaded;
+  mpc_result_t r;
+  mpc_parser_t *Number, *Symbol, *String, *Comment, *Sexpr, *Qexpr, *Expr, *Lispy;
+
+  Number  = mpc_new("number");
+  Symbol  = mpc_new("symbol");
+  String  = mpc_new("string");
+  Comment = mpc_new("comment");
+  Sexpr   = mpc_new("sexpr");
+  Qexpr   = mpc_new("qexpr");
+  Expr    = mpc_new("expr");
+  Lispy   = mpc_new("lispy");
+
+  mpca_lang(MPCA_LANG_DEFAULT,
+    " number  : /-?[0-9]+/ ;                             "
+    " symbol  : /[a-zA-Z0-9_+\\-*\\/\\\\=<>!&]+/ ;       "
+    " string  : /\"(\\\\.|[^\"])*\"/ ;                   "
+    " comment : /;[^\\r\\n]*/ ;                          "
+    " sexpr   : '(' <expr>* ')' ;                        "
+    " qexpr   : '{' <expr>* '}' ;                        "
+    " expr    : <number>  | <symbol> | <string>          "
+    "         | <comment> | <sexpr>  | <qexpr> ;         "
+    " lispy   : /^/ <expr>* /$/ ;                        ",
+    Number, Symbol, String, Comment, Sexpr, Qexpr, Expr, Lispy, NULL);
+
+  if (!mpc_parse("<bench>", input, Lispy, &r)) { mpc_err_print(r.error); return 1; }
+  mpc_ast_save(r.output, &data, &size);
+  mpc_ast_delete(r.output);
+
+  parse  = bench_parse(Lispy, input, MPC_INPUT_DEFAULT);
+  arena  = bench_parse(Lispy, input, MPC_INPUT_AST_ARENA);
+  copy   = bench_load(data, size, MPC_INPUT_DEFAULT);
+  views  = bench_load(data, size, MPC_INPUT_AST_VIEWS);
+  loaded = bench_load(data, size, MPC_INPUT_AST_ARENA);
+
+  printf("save: %lu bytes of text saved as %lu\n", (unsigned long)strlen(input), (unsigned long)size);
+  printf("save: parse %.1f ms, parse in arena %.1f ms\n", parse * 1e3, arena * 1e3);
+  printf("save: load %.1f ms (%.1fx), views %.1f ms (%.1fx), arena %.1f ms (%.1fx)\n",
+    copy * 1e3, parse / copy, views * 1e3, parse / views, loaded * 1e3, arena / loaded);
+
+  free(data);
+  free(input);
+  mpc_cleanup(8, Number, Symbol, String, Comment, Sexpr, Qexpr, Expr, Lispy);
+
+  return 0;
+}
@@ -0,0 +1,119 @@
+#include "../mpc.h"
+#include <time.h>
+
+/*
+** Compares scanning long runs of a character
+** class one byte at a time against many bytes at
+** a time, for scans made by `mpc_optimise` and
+** for regexes run as a DFA. Each input is a single
+** run of its class between a prefix and an end.
+*/
+
+enum { BYTES = 1 << 20, RUNS = 20 };
+
+typedef struct {
+  const char *name;
+  mpc_parser_t *(*parser)(void);
+  const char *prefix;
+  const char *members;
+  const char *end;
+} bench_t;
+
+static mpc_parser_t *bench_spaces(void) {
+  mpc_parser_t *p = mpc_many(mpcf_strfold, mpc_whitespace());
+  mpc_optimise(p);
+  return p;
+}
+
+static mpc_parser_t *bench_digits(void) {
+  mpc_parser_t *p = mpc_many1(mpcf_strfold, mpc_digit());
+  mpc_optimise(p);
+  return p;
+}
+
+static mpc_parser_t *bench_line(void) {
+  mpc_parser_t *p = mpc_many(mpcf_strfold, mpc_noneof("\n"));
+  mpc_optimise(p);
+  return p;
+}
+
+static mpc_parser_t *bench_symbol(void) { return mpc_re("[a-zA-Z0-9_+\\-*\\/\\\\=<>!&%]+"); }
+static mpc_parser_t *bench_comment(void) { return mpc_re(";[^\\r\\n]*"); }
+
+static const bench_t benches[] = {
+  { "spaces",  bench_spaces,  "",   "  \t ",              "x"  },
+  { "digits",  bench_digits,  "",   "0123456789",         "x"  },
+  { "line",    bench_line,    "",   "any text, here.",    "\n" },
+  { "symbol",  bench_symbol,  "",   "fib_list->sym+2",    " "  },
+  { "comment", bench_comment, ";",  " a comment (here) ", "\n" }
+};
+
+static char *bench_input(const bench_t *b) {
+
+  long j;
+  size_t l = strlen(b->prefix), n = strlen(b->members);
+  char *input = malloc(l + BYTES + strlen(b->end) + 1);
+
+  strcpy(input, b->prefix);
+  for (j = 0; j < BYTES; j++) { input[l + j] = b->members[j % n]; }
+  strcpy(input + l + BYTES, b->end);
+
+  return input;
+}
+
+static double bench_scan(mpc_parser_t *p, int flags, const char *input) {
+
+  int j;
+  clock_t start;
+  double time;
+  mpc_input_t *is[RUNS];
+  mpc_result_t rs[RUNS];
+  int oks[RUNS];
+
+  /* String inputs copy their text so are made before timing */
+  for (j = 0; j < RUNS; j++) {
+    is[j] = mpc_input_new_string("<bench>", input);
+    mpc_input_flags(is[j], flags);
+  }
+
+  start = clock();
+  for (j = 0; j < RUNS; j++) { oks[j] = mpc_parse_input(is[j], p, &rs[j]); }
+  time = (double)(clock() - start) / CLOCKS_PER_SEC / RUNS;
+
+  for (j = 0; j < RUNS; j++) {
+    if (oks[j]) {
+      free(rs[j].output);
+    } else {
+      mpc_err_print(rs[j].error);
+      mpc_err_delete(rs[j].error);
+    }
+    mpc_input_delete(is[j]);
+  }
+
+  return time;
+}
+
+int main(void) {
+
+  int j;
+  double bytes, vector;
+  char *input;
+  mpc_parser_t *p;
+
+  for (j = 0; j < (int)(sizeof(benches) / sizeof(bench_t)); j++) {
+
+    p = benches[j].parser();
+    input = bench_input(&benches[j]);
+
+    bytes  = bench_scan(p, MPC_INPUT_NO_VECTOR, input);
+    vector = bench_scan(p, MPC_INPUT_DEFAULT, input);
+
+    printf("scan: %-8s bytes %7.0f MB/s, vector %7.0f MB/s (%.1fx)\n",
+      benches[j].name, BYTES / bytes / 1e6, BYTES / vector / 1e6, bytes / vector);
+
+    free(input);
+    mpc_delete(p);
+  }
+
+  return 0;
+}
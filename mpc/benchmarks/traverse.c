@@ -0,0 +1,68 @@
+#include "../mpc.h"
+#include <time.h>
+
+/*
+** Compares walking a tree of about a million
+** nodes with `mpc_ast_traverse_next`, which
+** allocates for every node, against an iterator
+** which keeps its path on a reusable stack.
+*/
+
+enum { BRANCHES = 10, DEPTH = 6, RUNS = 5 };
+
+static mpc_ast_t *bench_tree(int depth) {
+  int j;
+  mpc_ast_t *a = mpc_ast_new("node", depth ? "" : "leaf");
+  if (depth) {
+    for (j = 0; j < BRANCHES; j++) { mpc_ast_add_child(a, bench_tree(depth - 1)); }
+  }
+  return a;
+}
+
+static double bench_traverse(mpc_ast_t *a, mpc_ast_trav_order_t order, long *nodes) {
+  int j;
+  clock_t start = clock();
+  mpc_ast_trav_t *trav;
+  for (j = 0; j < RUNS; j++) {
+    *nodes = 0;
+    trav = mpc_ast_traverse_start(a, order);
+    while (mpc_ast_traverse_next(&trav)) { (*nodes)++; }
+    mpc_ast_traverse_free(&trav);
+  }
+  return (double)(clock() - start) / CLOCKS_PER_SEC / RUNS;
+}
+
+static double bench_iter(mpc_ast_t *a, mpc_ast_trav_order_t order, long *nodes) {
+  int j;
+  clock_t start = clock();
+  mpc_ast_iter_t it;
+  mpc_ast_iter_init(&it);
+  for (j = 0; j < RUNS; j++) {
+    *nodes = 0;
+    mpc_ast_iter_start(&it, a, order);
+    while (mpc_ast_iter_next(&it)) { (*nodes)++; }
+  }
+  mpc_ast_iter_free(&it);
+  return (double)(clock() - start) / CLOCKS_PER_SEC / RUNS;
+}
+
+int main(void) {
+
+  int j;
+  long n0, n1;
+  double trav, iter;
+  mpc_ast_t *a = bench_tree(DEPTH);
+  const mpc_ast_trav_order_t orders[] = { mpc_ast_trav_order_pre, mpc_ast_trav_order_post };
+  const char *names[] = { "pre", "post" };
+
+  for (j = 0; j < 2; j++) {
+    trav = bench_traverse(a, orders[j], &n0);
+    iter = bench_iter(a, orders[j], &n1);
+    printf("traverse: %-4s %ld nodes, traverse %.1f ms, iter %.1f ms (%.1fx)%s\n",
+      names[j], n0, trav * 1e3, iter * 1e3, trav / iter, n0 == n1 ? "" : " MISMATCH");
+  }
+
+  mpc_ast_delete(a);
+
+  return 0;
+}
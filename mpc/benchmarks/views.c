@@ -0,0 +1,83 @@
+#include "../mpc.h"
+#include <time.h>
+
+/*
+** Compares parsing a large data literal with
+** contents copied into every node against
+** contents viewed in the input string.
+*/
+
+static const char *data_lang =
+  " number : /-?[0-9]+([.][0-9]+)?/ ;                 "
+  " symbol : /[a-zA-Z_]+/ ;                           "
+  " qexpr  : '{' <expr>* '}' ;                        "
+  " expr   : <number> | <symbol> | <qexpr> ;          "
+  " data   : /^/ <expr>* /$/ ;                        ";
+
+static const char *data_line =
+  "{point 12.5 -3 {rgb 255 128 0} {tags alpha beta gamma} 1 2 3 4 5 6 7 8}\n";
+
+enum { LINES = 4000, RUNS = 10 };
+
+static long count_copies(mpc_ast_t *a) {
+  int j;
+  long n = a->contents != NULL;
+  for (j = 0; j < a->children_num; j++) { n += count_copies(a->children[j]); }
+  return n;
+}
+
+static double bench_parse(mpc_parser_t *p, int flags, const char *input, long *copies) {
+
+  int j;
+  clock_t start;
+  mpc_input_t *i;
+  mpc_result_t r;
+
+  start = clock();
+
+  for (j = 0; j < RUNS; j++) {
+    i = mpc_input_new_string("<bench>", input);
+    mpc_input_flags(i, flags);
+    if (mpc_parse_input(i, p, &r)) {
+      *copies = count_copies(r.output);
+      mpc_ast_delete(r.output);
+    } else {
+      mpc_err_print(r.error);
+      mpc_err_delete(r.error);
+    }
+    mpc_input_delete(i);
+  }
+
+  return (double)(clock() - start) / CLOCKS_PER_SEC / RUNS;
+}
+
+int main(void) {
+
+  int j;
+  long c0 = 0, c1 = 0;
+  double copied, viewed;
+  size_t l = strlen(data_line);
+  char *input = malloc(l * LINES + 1);
+
+  mpc_parser_t *Number = mpc_new("number");
+  mpc_parser_t *Symbol = mpc_new("symbol");
+  mpc_parser_t *Qexpr  = mpc_new("qexpr");
+  mpc_parser_t *Expr   = mpc_new("expr");
+  mpc_parser_t *Data   = mpc_new("data");
+
+  mpca_lang(MPCA_LANG_DEFAULT, data_lang, Number, Symbol, Qexpr, Expr, Data, NULL);
+
+  for (j = 0; j < LINES; j++) { memcpy(input + l * j, data_line, l); }
+  input[l * LINES] = '\0';
+
+  copied = bench_parse(Data, MPC_INPUT_DEFAULT, input, &c0);
+  viewed = bench_parse(Data, MPC_INPUT_AST_VIEWS, input, &c1);
+
+  printf("views: %lu bytes, copied %.2f ms (%ld copies), viewed %.2f ms (%ld copies) (%.2fx)\n",
+    (unsigned long)strlen(input), copied * 1000, c0, viewed * 1000, c1, copied / viewed);
+
+  mpc_cleanup(5, Number, Symbol, Qexpr, Expr, Data);
+  free(input);
+
+  return 0;
+}
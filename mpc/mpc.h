@@ -21,6 +21,7 @@ extern "C" {
 #include <math.h>
 #include <errno.h>
 #include <ctype.h>
+#include <time.h>
 
 /*
 ** State Type
@@ -64,11 +65,69 @@ typedef union {
 struct mpc_parser_t;
 typedef struct mpc_parser_t mpc_parser_t;
 
-int mpc_parse(const char *filename, const char *string, mpc_parser_t *p, mpc_result_t *r);
-int mpc_nparse(const char *filename, const char *string, size_t length, mpc_parser_t *p, mpc_result_t *r);
-int mpc_parse_file(const char *filename, FILE *file, mpc_parser_t *p, mpc_result_t *r);
-int mpc_parse_pipe(const char *filename, FILE *pipe, mpc_parser_t *p, mpc_result_t *r);
-int mpc_parse_contents(const char *filename, mpc_parser_t *p, mpc_result_t *r);
+int mpc_parse(const char *filename, const char *string, const mpc_parser_t *p, mpc_result_t *r);
+int mpc_nparse(const char *filename, const char *string, size_t length, const mpc_parser_t *p, mpc_result_t *r);
+int mpc_parse_file(const char *filename, FILE *file, const mpc_parser_t *p, mpc_result_t *r);
+int mpc_parse_pipe(const char *filename, FILE *pipe, const mpc_parser_t *p, mpc_result_t *r);
+int mpc_parse_contents(const char *filename, const mpc_parser_t *p, mpc_result_t *r);
+
+/*
+** Streaming
+*/
+
+struct mpc_input_t;
+typedef struct mpc_input_t mpc_input_t;
+
+mpc_input_t *mpc_input_new_string(const char *filename, const char *string);
+mpc_input_t *mpc_input_new_nstring(const char *filename, const char *string, size_t length);
+mpc_input_t *mpc_input_new_file(const char *filename, FILE *file);
+mpc_input_t *mpc_input_new_pipe(const char *filename, FILE *pipe);
+void mpc_input_delete(mpc_input_t *i);
+
+int mpc_parse_input(mpc_input_t *i, const mpc_parser_t *p, mpc_result_t *r);
+int mpc_parse_next(mpc_input_t *i, const mpc_parser_t *p, mpc_result_t *r);
+
+enum {
+  MPC_INPUT_DEFAULT     = 0,
+  MPC_INPUT_AST_ARENA   = 1,
+  MPC_INPUT_AST_VIEWS   = 2,
+  MPC_INPUT_NO_DISPATCH = 4,
+  MPC_INPUT_NO_VECTOR   = 8
+};
+
+void mpc_input_flags(mpc_input_t *i, int flags);
+long mpc_input_allocs(mpc_input_t *i);
+void mpc_input_arena(mpc_input_t *i, size_t size);
+void mpc_input_origin(mpc_input_t *i, mpc_state_t s);
+void mpc_input_limits(mpc_input_t *i, long depth, long length, long steps);
+
+/*
+** Compiled Parsers
+*/
+
+struct mpc_program_t;
+typedef struct mpc_program_t mpc_program_t;
+
+mpc_program_t *mpc_compile(mpc_parser_t *p);
+void mpc_program_delete(mpc_program_t *c);
+
+int mpc_parse_compiled(const char *filename, const char *string, const mpc_program_t *c, mpc_result_t *r);
+int mpc_parse_input_compiled(mpc_input_t *i, const mpc_program_t *c, mpc_result_t *r);
+
+/*
+** Profiling
+*/
+
+struct mpc_profile_t;
+typedef struct mpc_profile_t mpc_profile_t;
+
+mpc_profile_t *mpc_profile_new(void);
+void mpc_profile_delete(mpc_profile_t *f);
+void mpc_input_profile(mpc_input_t *i, mpc_profile_t *f);
+
+void mpc_profile_print(mpc_profile_t *f);
+void mpc_profile_print_to(mpc_profile_t *f, FILE *fp);
+void mpc_profile_print_json_to(mpc_profile_t *f, FILE *fp);
 
 /*
 ** Function Types
@@ -146,6 +205,8 @@ mpc_parser_t *mpc_or(int n, ...);
 mpc_parser_t *mpc_and(int n, mpc_fold_t f, ...);
 
 mpc_parser_t *mpc_predictive(mpc_parser_t *a);
+mpc_parser_t *mpc_deferred(mpc_parser_t *a);
+mpc_parser_t *mpc_span(mpc_parser_t *a);
 
 /*
 ** Common Parsers
@@ -262,7 +323,13 @@ mpc_val_t *mpcf_maths(int n, mpc_val_t** xs);
 ** Regular Expression Parsers
 */
 
+enum {
+  MPC_RE_DEFAULT = 0,
+  MPC_RE_NODFA   = 1
+};
+
 mpc_parser_t *mpc_re(const char *re);
+mpc_parser_t *mpc_re_mode(const char *re, int mode);
   
 /*
 ** AST
@@ -274,6 +341,10 @@ typedef struct mpc_ast_t {
   mpc_state_t state;
   int children_num;
   struct mpc_ast_t** children;
+  int rule;
+  int primary;
+  const char *view;
+  long view_len;
 } mpc_ast_t;
 
 mpc_ast_t *mpc_ast_new(const char *tag, const char *contents);
@@ -281,11 +352,14 @@ mpc_ast_t *mpc_ast_build(int n, const char *tag, ...);
 mpc_ast_t *mpc_ast_add_root(mpc_ast_t *a);
 mpc_ast_t *mpc_ast_add_child(mpc_ast_t *r, mpc_ast_t *a);
 mpc_ast_t *mpc_ast_add_tag(mpc_ast_t *a, const char *t);
+mpc_ast_t *mpc_ast_add_rule(mpc_ast_t *a, mpc_parser_t *p);
 mpc_ast_t *mpc_ast_add_root_tag(mpc_ast_t *a, const char *t);
 mpc_ast_t *mpc_ast_tag(mpc_ast_t *a, const char *t);
 mpc_ast_t *mpc_ast_state(mpc_ast_t *a, mpc_state_t s);
+const char *mpc_ast_contents(mpc_ast_t *a);
 
 void mpc_ast_delete(mpc_ast_t *a);
+void mpc_ast_arena_delete(mpc_ast_t *a);
 void mpc_ast_print(mpc_ast_t *a);
 void mpc_ast_print_to(mpc_ast_t *a, FILE *fp);
 
@@ -313,6 +387,34 @@ mpc_ast_t *mpc_ast_traverse_next(mpc_ast_trav_t **trav);
 
 void mpc_ast_traverse_free(mpc_ast_trav_t **trav);
 
+/*
+** Unlike the traversal above, which allocates for
+** every node it visits, an iterator keeps its path
+** through the tree on one stack that only grows,
+** and can be started again on another tree.
+*/
+
+typedef struct {
+  mpc_ast_t *node;
+  int child;
+} mpc_ast_iter_frame_t;
+
+typedef struct {
+  mpc_ast_trav_order_t order;
+  int num;
+  int slots;
+  mpc_ast_iter_frame_t *stack;
+} mpc_ast_iter_t;
+
+void mpc_ast_iter_init(mpc_ast_iter_t *it);
+void mpc_ast_iter_start(mpc_ast_iter_t *it, mpc_ast_t *ast, mpc_ast_trav_order_t order);
+mpc_ast_t *mpc_ast_iter_next(mpc_ast_iter_t *it);
+int mpc_ast_iter_depth(mpc_ast_iter_t *it);
+void mpc_ast_iter_free(mpc_ast_iter_t *it);
+
+void mpc_ast_save(mpc_ast_t *a, char **data, size_t *size);
+mpc_err_t *mpc_ast_load(const char *data, size_t size, int flags, mpc_ast_t **a);
+
 /*
 ** Warning: This function currently doesn't test for equality of the `state` member!
 */
@@ -341,7 +443,8 @@ mpc_parser_t *mpca_and(int n, ...);
 enum {
   MPCA_LANG_DEFAULT              = 0,
   MPCA_LANG_PREDICTIVE           = 1,
-  MPCA_LANG_WHITESPACE_SENSITIVE = 2
+  MPCA_LANG_WHITESPACE_SENSITIVE = 2,
+  MPCA_LANG_DEFERRED_ERRORS      = 4
 };
 
 mpc_parser_t *mpca_grammar(int flags, const char *grammar, ...);
@@ -351,6 +454,34 @@ mpc_err_t *mpca_lang_file(int flags, FILE *f, ...);
 mpc_err_t *mpca_lang_pipe(int flags, FILE *f, ...);
 mpc_err_t *mpca_lang_contents(int flags, const char *filename, ...);
 
+typedef struct {
+  const char *name;
+  mpc_fold_t fold;
+  mpc_apply_t apply;
+  mpc_dtor_t dtor;
+} mpca_action_t;
+
+mpc_err_t *mpca_lang_actions(int flags, const mpca_action_t *actions, const char *language, ...);
+
+mpc_err_t *mpca_lang_save(char **data, size_t *size, ...);
+mpc_err_t *mpca_lang_load(const char *data, size_t size, ...);
+mpc_err_t *mpca_lang_load_actions(const mpca_action_t *actions, const char *data, size_t size, ...);
+
+/*
+** Incremental Parsing
+*/
+
+struct mpc_reparse_t;
+typedef struct mpc_reparse_t mpc_reparse_t;
+
+mpc_reparse_t *mpc_reparse_new(const char *filename, const mpc_parser_t *p);
+void mpc_reparse_delete(mpc_reparse_t *t);
+
+int mpc_reparse(mpc_reparse_t *t, const char *string, mpc_result_t *r);
+int mpc_reparse_edit(mpc_reparse_t *t, mpc_ast_t *previous,
+  long offset, long removed, const char *inserted, mpc_result_t *r);
+long mpc_reparse_parsed(mpc_reparse_t *t);
+
 /*
 ** Misc
 */
@@ -81,9 +81,50 @@ void test_check_withf(void) {
   mpc_delete(p);
 }
 
+void test_charset(void) {
+  int           j, success;
+  char         *e0, *e1;
+  mpc_result_t  r0, r1;
+  const char   *inputs[] = { "a", "5", "y", "\xe9", "-", "b", "" };
+  mpc_parser_t *p0 = mpc_or(4, mpc_char('a'), mpc_range('0', '9'), mpc_oneof("xyz"), mpc_oneof("\xe9"));
+  mpc_parser_t *p1 = mpc_copy(p0);
+  mpc_parser_t *q  = mpc_noneof("ab\xe9");
+
+  mpc_optimise(p1);
+
+  for (j = 0; j < 7; j++) {
+    success = mpc_parse("test", inputs[j], p0, &r0);
+    PT_ASSERT(success == mpc_parse("test", inputs[j], p1, &r1));
+    if (success) {
+      PT_ASSERT_STR_EQ(r0.output, inputs[j]);
+      PT_ASSERT_STR_EQ(r1.output, inputs[j]);
+      free(r0.output); free(r1.output);
+    } else {
+      e0 = mpc_err_string(r0.error);
+      e1 = mpc_err_string(r1.error);
+      PT_ASSERT_STR_EQ(e0, e1);
+      free(e0); free(e1);
+      mpc_err_delete(r0.error); mpc_err_delete(r1.error);
+    }
+  }
+
+  success = mpc_parse("test", "c", q, &r0);
+  PT_ASSERT(success);
+  if (success) free(r0.output); else mpc_err_delete(r0.error);
+
+  success = mpc_parse("test", "\xe9", q, &r0);
+  PT_ASSERT(!success);
+  if (success) free(r0.output); else mpc_err_delete(r0.error);
+
+  mpc_delete(p0);
+  mpc_delete(p1);
+  mpc_delete(q);
+}
+
 void suite_combinators(void) {
   pt_add_test(test_check,       "Test Check",        "Suite Combinators");
   pt_add_test(test_check_with,  "Test Check with",   "Suite Combinators");
   pt_add_test(test_checkf,      "Test Check F",      "Suite Combinators");
   pt_add_test(test_check_withf, "Test Check with F", "Suite Combinators");
+  pt_add_test(test_charset,     "Test Charset",      "Suite Combinators");
 }
@@ -89,7 +89,9 @@ void test_repeat(void) {
   
   int success;
   mpc_result_t r;
+  mpc_program_t *c;
   mpc_parser_t *p = mpc_count(3, mpcf_strfold, mpc_digit(), free);
+  mpc_parser_t *q = mpc_or(2, mpc_count(3, mpcf_strfold, mpc_char('a'), free), mpc_string("aab"));
   
   success = mpc_parse("test", "046", p, &r);
   PT_ASSERT(success);
@@ -110,7 +112,18 @@ void test_repeat(void) {
   PT_ASSERT(!success);
   mpc_err_delete(r.error);
   
+  /* Too few repetitions give back what they read */
+  c = mpc_compile(q);
+  success = mpc_parse("test", "aab", q, &r);
+  PT_ASSERT(success);
+  if (success) { PT_ASSERT_STR_EQ(r.output, "aab"); free(r.output); } else { mpc_err_delete(r.error); }
+  success = mpc_parse_compiled("test", "aab", c, &r);
+  PT_ASSERT(success);
+  if (success) { PT_ASSERT_STR_EQ(r.output, "aab"); free(r.output); } else { mpc_err_delete(r.error); }
+  mpc_program_delete(c);
+  
   mpc_delete(p);
+  mpc_delete(q);
   
 }
 
@@ -152,10 +165,451 @@ void test_copy(void) {
   
 }
 
+void test_stream(void) {
+  
+  int n;
+  FILE *f;
+  mpc_input_t *i;
+  mpc_result_t r;
+  mpc_parser_t *p = mpc_tok(mpc_digits());
+  const char *expected[] = { "12", "345", "6" };
+  
+  i = mpc_input_new_string("test", "  12 345\n\t6  ");
+  for (n = 0; mpc_parse_next(i, p, &r); n++) {
+    PT_ASSERT(n < 3);
+    PT_ASSERT_STR_EQ(r.output, expected[n]);
+    free(r.output);
+  }
+  PT_ASSERT(n == 3);
+  PT_ASSERT(r.error == NULL);
+  mpc_input_delete(i);
+  
+  f = tmpfile();
+  fputs("12 345\n6 x", f);
+  rewind(f);
+  
+  i = mpc_input_new_pipe("test", f);
+  for (n = 0; mpc_parse_next(i, p, &r); n++) {
+    PT_ASSERT(n < 3);
+    PT_ASSERT_STR_EQ(r.output, expected[n]);
+    free(r.output);
+  }
+  PT_ASSERT(n == 3);
+  PT_ASSERT(r.error != NULL);
+  PT_ASSERT(r.error->state.row == 1);
+  PT_ASSERT(r.error->state.col == 2);
+  mpc_err_delete(r.error);
+  mpc_input_delete(i);
+  
+  rewind(f);
+  
+  i = mpc_input_new_file("test", f);
+  for (n = 0; mpc_parse_next(i, p, &r); n++) {
+    PT_ASSERT(n < 3);
+    PT_ASSERT_STR_EQ(r.output, expected[n]);
+    free(r.output);
+  }
+  PT_ASSERT(n == 3);
+  PT_ASSERT(r.error != NULL);
+  mpc_err_delete(r.error);
+  mpc_input_delete(i);
+  
+  fclose(f);
+  mpc_delete(p);
+  
+}
+
+void test_state(void) {
+  
+  int k;
+  FILE *f;
+  mpc_input_t *i;
+  mpc_result_t r;
+  mpc_ast_t *a;
+  mpc_state_t origin;
+  mpc_parser_t *w, *p;
+  const char *input = "ab\n cd\n\n  ef 1";
+  long rows[] = { 0, 1, 3 };
+  long cols[] = { 0, 1, 2 };
+  
+  w = mpca_state(mpca_tag(mpc_apply(mpc_tok(mpc_ident()), mpcf_str_ast), "word"));
+  p = mpc_total(mpc_many(mpcf_fold_ast, w), (mpc_dtor_t)mpc_ast_delete);
+  
+  PT_ASSERT(mpc_parse("test", "ab\n cd\n\n  ef", p, &r));
+  a = r.output;
+  PT_ASSERT(a->children_num == 3);
+  for (k = 0; k < 3; k++) {
+    PT_ASSERT(a->children[k]->state.row == rows[k]);
+    PT_ASSERT(a->children[k]->state.col == cols[k]);
+  }
+  mpc_ast_delete(a);
+  
+  PT_ASSERT(!mpc_parse("test", input, p, &r));
+  PT_ASSERT(r.error->state.pos == 13);
+  PT_ASSERT(r.error->state.row == 3);
+  PT_ASSERT(r.error->state.col == 5);
+  mpc_err_delete(r.error);
+  
+  f = tmpfile();
+  fputs(input, f);
+  rewind(f);
+  
+  i = mpc_input_new_pipe("test", f);
+  PT_ASSERT(!mpc_parse_input(i, p, &r));
+  PT_ASSERT(r.error->state.row == 3);
+  PT_ASSERT(r.error->state.col == 5);
+  mpc_err_delete(r.error);
+  mpc_input_delete(i);
+  
+  fclose(f);
+  
+  /* Part of the input parsed alone reports the same positions */
+  for (k = 1; k < 4; k++) {
+    origin.pos = k;
+    origin.row = k < 3 ? 0 : 1;
+    origin.col = k < 3 ? k : 0;
+    i = mpc_input_new_string("test", input + k);
+    mpc_input_origin(i, origin);
+    PT_ASSERT(!mpc_parse_input(i, p, &r));
+    PT_ASSERT(r.error->state.pos == 13);
+    PT_ASSERT(r.error->state.row == 3);
+    PT_ASSERT(r.error->state.col == 5);
+    mpc_err_delete(r.error);
+    mpc_input_delete(i);
+  }
+  
+  origin.pos = 3; origin.row = 1; origin.col = 0;
+  i = mpc_input_new_nstring("test", input + 3, 9);
+  mpc_input_origin(i, origin);
+  PT_ASSERT(mpc_parse_input(i, p, &r));
+  a = r.output;
+  PT_ASSERT(a->children_num == 2);
+  for (k = 0; k < 2; k++) {
+    PT_ASSERT(a->children[k]->state.row == rows[k+1]);
+    PT_ASSERT(a->children[k]->state.col == cols[k+1]);
+  }
+  mpc_ast_delete(a);
+  mpc_input_delete(i);
+  
+  mpc_delete(p);
+  
+}
+
+void test_span(void) {
+  
+  int n, k;
+  long allocs, base;
+  FILE *f;
+  mpc_input_t *i;
+  mpc_result_t r;
+  mpc_parser_t *ps[3], *q, *pass = mpc_pass();
+  const char *input = "a_symbol_long_enough_not_to_fit_in_one_block_of_the_memory_pool_1234 b 42";
+  const char *expected[] = { "a_symbol_long_enough_not_to_fit_in_one_block_of_the_memory_pool_1234", "b", "42" };
+  
+  /* Each token ends in an error where it stops, so defer the errors it builds */
+  ps[0] = mpc_deferred(mpc_re("[a-z_0-9]+"));
+  ps[1] = mpc_deferred(mpc_re_mode("[a-z_0-9]+", MPC_RE_NODFA));
+  ps[2] = mpc_deferred(mpc_re("[a-z_0-9]+[a-z]*"));
+  
+  /* Allocations made by any parse, even one which builds nothing */
+  i = mpc_input_new_string("test", input);
+  mpc_parse_input(i, pass, &r);
+  base = mpc_input_allocs(i);
+  mpc_input_delete(i);
+  
+  for (k = 0; k < 3; k++) {
+    i = mpc_input_new_string("test", input);
+    for (n = 0; allocs = mpc_input_allocs(i), mpc_parse_next(i, ps[k], &r); n++) {
+      PT_ASSERT(n < 3);
+      PT_ASSERT_STR_EQ(r.output, expected[n]);
+      PT_ASSERT(mpc_input_allocs(i) == allocs + base + 1);
+      free(r.output);
+    }
+    PT_ASSERT(n == 3);
+    mpc_input_delete(i);
+  }
+  
+  f = tmpfile();
+  fputs(input, f);
+  rewind(f);
+  
+  i = mpc_input_new_file("test", f);
+  for (n = 0; allocs = mpc_input_allocs(i), mpc_parse_next(i, ps[1], &r); n++) {
+    PT_ASSERT(n < 3);
+    PT_ASSERT_STR_EQ(r.output, expected[n]);
+    PT_ASSERT(mpc_input_allocs(i) == allocs + base + 1);
+    free(r.output);
+  }
+  PT_ASSERT(n == 3);
+  mpc_input_delete(i);
+  
+  q = mpc_span(mpc_and(3, mpcf_strfold,
+    mpc_string("ab"), mpc_many(mpcf_strfold, mpc_digit()), mpc_maybe(mpc_apply(mpc_char('!'), mpcf_free)),
+    free, free));
+  
+  rewind(f);
+  fputs("ab123!ab4", f);
+  rewind(f);
+  
+  i = mpc_input_new_pipe("test", f);
+  PT_ASSERT(mpc_parse_input(i, q, &r));
+  PT_ASSERT_STR_EQ(r.output, "ab123!");
+  free(r.output);
+  PT_ASSERT(mpc_parse_input(i, q, &r));
+  PT_ASSERT_STR_EQ(r.output, "ab4");
+  free(r.output);
+  PT_ASSERT(!mpc_parse_input(i, q, &r));
+  mpc_err_delete(r.error);
+  mpc_input_delete(i);
+  
+  fclose(f);
+  mpc_delete(q);
+  mpc_delete(pass);
+  for (k = 0; k < 3; k++) { mpc_delete(ps[k]); }
+  
+}
+
+void test_arena(void) {
+  
+  int k;
+  char *err, *expected = NULL;
+  mpc_input_t *i;
+  mpc_result_t r;
+  size_t sizes[] = { 0, 64, 256, 1 << 20 };
+  mpc_parser_t *p = mpc_whole(
+    mpc_many(mpcf_strfold, mpc_tok(mpc_or(2, mpc_ident(), mpc_digits()))), free);
+  
+  for (k = 0; k < 4; k++) {
+    
+    i = mpc_input_new_string("test", "ab 12 cd   345 efghijklmnopqrstuvwxyz 6789 g");
+    mpc_input_arena(i, sizes[k]);
+    PT_ASSERT(mpc_parse_input(i, p, &r));
+    PT_ASSERT_STR_EQ(r.output, "ab12cd345efghijklmnopqrstuvwxyz6789g");
+    free(r.output);
+    mpc_input_delete(i);
+    
+    i = mpc_input_new_string("test", "ab 12 cd ! 345");
+    mpc_input_arena(i, sizes[k]);
+    PT_ASSERT(!mpc_parse_input(i, p, &r));
+    err = mpc_err_string(r.error);
+    if (expected == NULL) { expected = err; }
+    else { PT_ASSERT_STR_EQ(err, expected); free(err); }
+    mpc_err_delete(r.error);
+    mpc_input_delete(i);
+  }
+  
+  free(expected);
+  mpc_delete(p);
+  
+}
+
+static int check_not_q(mpc_val_t **x) { return strcmp(*x, "q") != 0; }
+
+void test_compile(void) {
+  
+  int j, k, x0, x1;
+  char *e0, *e1;
+  mpc_result_t r0, r1;
+  mpc_program_t *c;
+  mpc_parser_t *ps[5];
+  const char *inputs[] = {
+    "ab12!", "ab", "ab1!x", "xyw!", "xyz", "xyq", "abd", "abc", "abcd", "q", "", "  42 x" };
+  
+  ps[0] = mpc_whole(mpc_span(mpc_and(3, mpcf_strfold,
+    mpc_string("ab"), mpc_many(mpcf_strfold, mpc_digit()), mpc_maybe(mpc_apply(mpc_char('!'), mpcf_free)),
+    free, free)), free);
+  ps[1] = mpc_and(3, mpcf_strfold,
+    mpc_count(2, mpcf_strfold, mpc_oneof("xy"), free),
+    mpc_not_lift(mpc_char('z'), free, mpcf_ctor_str),
+    mpc_many1(mpcf_strfold, mpc_check(mpc_any(), check_not_q, "Not q")),
+    free, free);
+  ps[2] = mpc_predictive(mpc_or(3, mpc_string("abc"), mpc_string("abd"), mpc_re("[a-z]+")));
+  ps[3] = mpc_deferred(mpc_strip(mpc_or(2, mpc_ident(), mpc_digits())));
+  ps[4] = mpc_or(2, mpc_expect(mpc_count(3, mpcf_strfold, mpc_alpha(), free), "three letters"), mpc_tok(mpc_digits()));
+  
+  for (j = 0; j < 5; j++) {
+    
+    c = mpc_compile(ps[j]);
+    
+    for (k = 0; k < 12; k++) {
+      
+      x0 = mpc_parse("test", inputs[k], ps[j], &r0);
+      x1 = mpc_parse_compiled("test", inputs[k], c, &r1);
+      PT_ASSERT(x0 == x1);
+      
+      if (x0 && x1) {
+        PT_ASSERT_STR_EQ(r0.output, r1.output);
+        free(r0.output);
+        free(r1.output);
+      } else if (!x0 && !x1) {
+        e0 = mpc_err_string(r0.error);
+        e1 = mpc_err_string(r1.error);
+        PT_ASSERT_STR_EQ(e0, e1);
+        free(e0); free(e1);
+        mpc_err_delete(r0.error);
+        mpc_err_delete(r1.error);
+      }
+    }
+    
+    mpc_program_delete(c);
+    mpc_delete(ps[j]);
+  }
+  
+}
+
+void test_optimise(void) {
+  
+  int j, k, x0, x1;
+  char *e0, *e1;
+  FILE *f;
+  mpc_result_t r0, r1;
+  mpc_parser_t *ps[5], *q;
+  const char *inputs[] = {
+    "abc", "abx", "ab", "ax", "a", "  123x", "123", " x", "abcabx9", "", "4 5\n", "acb" };
+  
+  ps[0] = mpc_or(3,
+    mpc_and(3, mpcf_strfold, mpc_char('a'), mpc_char('b'), mpc_char('c'), free, free),
+    mpc_and(2, mpcf_strfold, mpc_char('a'), mpc_char('x'), free),
+    mpc_and(3, mpcf_strfold, mpc_char('a'), mpc_many1(mpcf_strfold, mpc_oneof("bc")), mpc_char('x'), free, free));
+  ps[1] = mpc_and(3, mpcf_strfold,
+    mpc_whitespaces(), mpc_many1(mpcf_strfold, mpc_digit()), mpc_many(mpcf_strfold, mpc_noneof("\n")), free, free);
+  ps[2] = mpc_many(mpcf_strfold, mpc_or(2,
+    mpc_and(3, mpcf_strfold, mpc_char('a'), mpc_char('b'), mpc_char('c'), free, free),
+    mpc_and(3, mpcf_strfold, mpc_char('a'), mpc_char('b'), mpc_char('x'), free, free)));
+  ps[3] = mpc_expect(mpc_apply(mpc_expect(mpc_many1(mpcf_strfold, mpc_alpha()), "letters"), mpcf_strtriml), "word");
+  ps[4] = mpc_re("a(bc|bx)*|[0-9]+x?|\\s+");
+  
+  for (j = 0; j < 5; j++) {
+    
+    q = mpc_copy(ps[j]);
+    mpc_optimise(q);
+    
+    for (k = 0; k < 12; k++) {
+      
+      x0 = mpc_parse("test", inputs[k], ps[j], &r0);
+      x1 = mpc_parse("test", inputs[k], q, &r1);
+      PT_ASSERT(x0 == x1);
+      
+      if (x0 && x1) {
+        PT_ASSERT_STR_EQ(r0.output, r1.output);
+        free(r0.output);
+        free(r1.output);
+      } else if (!x0 && !x1) {
+        e0 = mpc_err_string(r0.error);
+        e1 = mpc_err_string(r1.error);
+        PT_ASSERT_STR_EQ(e0, e1);
+        free(e0); free(e1);
+        mpc_err_delete(r0.error);
+        mpc_err_delete(r1.error);
+      }
+    }
+    
+    mpc_delete(q);
+    mpc_delete(ps[j]);
+  }
+  
+  /* Scans read files and pipes a character at a time */
+  q = mpc_and(3, mpcf_strfold,
+    mpc_whitespaces(), mpc_many1(mpcf_strfold, mpc_digit()), mpc_many(mpcf_strfold, mpc_alpha()), free, free);
+  mpc_optimise(q);
+  
+  f = tmpfile();
+  fputs("  1234ab", f);
+  
+  rewind(f);
+  PT_ASSERT(mpc_parse_file("test", f, q, &r0));
+  PT_ASSERT_STR_EQ(r0.output, "  1234ab");
+  free(r0.output);
+  
+  rewind(f);
+  PT_ASSERT(mpc_parse_pipe("test", f, q, &r0));
+  PT_ASSERT_STR_EQ(r0.output, "  1234ab");
+  free(r0.output);
+  
+  fclose(f);
+  mpc_delete(q);
+  
+}
+
+void test_scan(void) {
+  
+  int j, k, l, x0, x1;
+  char input[128], *e0, *e1;
+  mpc_input_t *i0, *i1;
+  mpc_result_t r0, r1;
+  mpc_parser_t *ps[6];
+  
+  /* Each run of members is between a prefix and terminator */
+  const char *members[] = { " \t\n\r\v\f", "0123456789", "az_+-*/\\=<>!&%09AZ",
+    "ab \xc3\xa9(", "ab\xc3\xa9 \t\x7f", "ab \xc3\xa9{" };
+  const char *prefixes[] = { "", "", "", "\"", "", ";" };
+  const char *closes[] = { "", "", "", "\"", "", "" };
+  const char *ends[] = { "x", "a", " ", "\"", "\n", "\n" };
+  
+  ps[0] = mpc_many1(mpcf_strfold, mpc_whitespace());
+  ps[1] = mpc_many(mpcf_strfold, mpc_digit());
+  ps[2] = mpc_re("[a-zA-Z0-9_+\\-*\\/\\\\=<>!&%]+");
+  ps[3] = mpc_re("\"(\\\\.|[^\"])*\"");
+  ps[4] = mpc_many1(mpcf_strfold, mpc_noneof("\n"));
+  ps[5] = mpc_re(";[^\\r\\n]*");
+  mpc_optimise(ps[0]);
+  mpc_optimise(ps[1]);
+  mpc_optimise(ps[4]);
+  
+  for (j = 0; j < 6; j++) {
+    for (l = 0; l < 70; l++) {
+      
+      strcpy(input, prefixes[j]);
+      for (k = 0; k < l; k++) {
+        input[strlen(prefixes[j]) + k] = members[j][(k + l) % strlen(members[j])];
+      }
+      input[strlen(prefixes[j]) + l] = '\0';
+      strcat(input, ends[j]);
+      strcat(input, "tail");
+      
+      i0 = mpc_input_new_string("test", input);
+      i1 = mpc_input_new_string("test", input);
+      mpc_input_flags(i1, MPC_INPUT_NO_VECTOR);
+      
+      x0 = mpc_parse_input(i0, ps[j], &r0);
+      x1 = mpc_parse_input(i1, ps[j], &r1);
+      PT_ASSERT(x0 == x1);
+      
+      if (x0 && x1) {
+        PT_ASSERT(strlen(r0.output) == strlen(prefixes[j]) + l + strlen(closes[j]));
+        PT_ASSERT(strncmp(r0.output, input, strlen(r0.output)) == 0);
+        PT_ASSERT_STR_EQ(r0.output, r1.output);
+        free(r0.output);
+        free(r1.output);
+      } else if (!x0 && !x1) {
+        PT_ASSERT(l == 0);
+        e0 = mpc_err_string(r0.error);
+        e1 = mpc_err_string(r1.error);
+        PT_ASSERT_STR_EQ(e0, e1);
+        free(e0); free(e1);
+        mpc_err_delete(r0.error);
+        mpc_err_delete(r1.error);
+      }
+      
+      mpc_input_delete(i0);
+      mpc_input_delete(i1);
+    }
+    mpc_delete(ps[j]);
+  }
+  
+}
+
 void suite_core(void) {
   pt_add_test(test_ident,  "Test Ident",  "Suite Core");
   pt_add_test(test_maths,  "Test Maths",  "Suite Core");
   pt_add_test(test_strip,  "Test Strip",  "Suite Core");
   pt_add_test(test_repeat, "Test Repeat", "Suite Core");
   pt_add_test(test_copy,   "Test Copy",   "Suite Core");
+  pt_add_test(test_stream, "Test Stream", "Suite Core");
+  pt_add_test(test_state,  "Test State",  "Suite Core");
+  pt_add_test(test_span,   "Test Span",   "Suite Core");
+  pt_add_test(test_arena,  "Test Arena",  "Suite Core");
+  pt_add_test(test_compile, "Test Compile", "Suite Core");
+  pt_add_test(test_optimise, "Test Optimise", "Suite Core");
+  pt_add_test(test_scan,   "Test Scan",   "Suite Core");
 }
@@ -278,6 +278,1336 @@ void test_missingrule(void) {
 
 }
 
+void test_deferred(void) {
+  
+  int j, k;
+  mpc_result_t r0, r1;
+  mpc_parser_t *Expr0, *Prod0, *Value0, *Maths0;
+  mpc_parser_t *Expr1, *Prod1, *Value1, *Maths1;
+  const char *inputs[] = { "(4 * 2 * 11 + 2) + 5", "(4 * 2 * 11 + 2 + 5", "2 * 3 $", "", "1 +\n (2 - )" };
+  
+  Expr0  = mpc_new("expression"); Expr1  = mpc_new("expression");
+  Prod0  = mpc_new("product");    Prod1  = mpc_new("product");
+  Value0 = mpc_new("value");      Value1 = mpc_new("value");
+  Maths0 = mpc_new("maths");      Maths1 = mpc_new("maths");
+  
+  #define MATHS_LANG \
+    " expression : <product> (('+' | '-') <product>)*; " \
+    " product    : <value>   (('*' | '/')   <value>)*; " \
+    " value      : /[0-9]+/ | '(' <expression> ')';    " \
+    " maths      : /^/ <expression> /$/;               "
+  
+  PT_ASSERT(mpca_lang(MPCA_LANG_DEFAULT, MATHS_LANG, Expr0, Prod0, Value0, Maths0, NULL) == NULL);
+  PT_ASSERT(mpca_lang(MPCA_LANG_DEFERRED_ERRORS, MATHS_LANG, Expr1, Prod1, Value1, Maths1, NULL) == NULL);
+  
+  #undef MATHS_LANG
+  
+  for (j = 0; j < 5; j++) {
+    
+    PT_ASSERT(mpc_parse("test", inputs[j], Maths0, &r0) == mpc_parse("test", inputs[j], Maths1, &r1));
+    
+    if (j == 0) {
+      PT_ASSERT(mpc_ast_eq(r0.output, r1.output));
+      mpc_ast_delete(r0.output);
+      mpc_ast_delete(r1.output);
+      continue;
+    }
+    
+    PT_ASSERT(r0.error->state.pos == r1.error->state.pos);
+    PT_ASSERT(r0.error->state.row == r1.error->state.row);
+    PT_ASSERT(r0.error->state.col == r1.error->state.col);
+    PT_ASSERT(r0.error->recieved == r1.error->recieved);
+    PT_ASSERT(r0.error->expected_num == r1.error->expected_num);
+    for (k = 0; k < r1.error->expected_num; k++) {
+      PT_ASSERT(strstr(r0.error->expected[k], r1.error->expected[k]) != NULL);
+    }
+    
+    mpc_err_delete(r0.error);
+    mpc_err_delete(r1.error);
+  }
+  
+  mpc_cleanup(8, Expr0, Prod0, Value0, Maths0, Expr1, Prod1, Value1, Maths1);
+  
+}
+
+static int ast_eq_state(mpc_ast_t *a, mpc_ast_t *b) {
+  int j;
+  if (!mpc_ast_eq(a, b)) { return 0; }
+  if (a->state.pos != b->state.pos || a->state.row != b->state.row || a->state.col != b->state.col) { return 0; }
+  if (a->rule != b->rule || a->primary != b->primary) { return 0; }
+  for (j = 0; j < a->children_num; j++) {
+    if (!ast_eq_state(a->children[j], b->children[j])) { return 0; }
+  }
+  return 1;
+}
+
+void test_ast_arena(void) {
+  
+  int j, n;
+  char *e0, *e1;
+  mpc_input_t *i0, *i1;
+  mpc_result_t r0, r1;
+  mpc_parser_t *Number, *Symbol, *String, *Comment, *Sexpr, *Qexpr, *Expr, *Lispy;
+  mpc_parser_t *Digits = mpc_digits();
+  const char *inputs[] = {
+    "(def {fib} (\\ {n} {if (< n 2) {n} {+ (fib (- n 1)) (fib (- n 2))}})) ; fib\n(print \"fib\" (fib 20))",
+    "", "x", "(+ 1 (* 2 3)", "{1 2 3} (head {a \"b\"}) ; done" };
+  
+  Number  = mpc_new("number");
+  Symbol  = mpc_new("symbol");
+  String  = mpc_new("string");
+  Comment = mpc_new("comment");
+  Sexpr   = mpc_new("sexpr");
+  Qexpr   = mpc_new("qexpr");
+  Expr    = mpc_new("expr");
+  Lispy   = mpc_new("lispy");
+  
+  PT_ASSERT(mpca_lang(MPCA_LANG_DEFAULT,
+    " number  : /-?[0-9]+/ ;                             "
+    " symbol  : /[a-zA-Z0-9_+\\-*\\/\\\\=<>!&]+/ ;       "
+    " string  : /\"(\\\\.|[^\"])*\"/ ;                   "
+    " comment : /;[^\\r\\n]*/ ;                          "
+    " sexpr   : '(' <expr>* ')' ;                        "
+    " qexpr   : '{' <expr>* '}' ;                        "
+    " expr    : <number>  | <symbol> | <string>          "
+    "         | <comment> | <sexpr>  | <qexpr> ;         "
+    " lispy   : /^/ <expr>* /$/ ;                        ",
+    Number, Symbol, String, Comment, Sexpr, Qexpr, Expr, Lispy, NULL) == NULL);
+  
+  for (j = 0; j < 5; j++) {
+    
+    i0 = mpc_input_new_string("test", inputs[j]);
+    i1 = mpc_input_new_string("test", inputs[j]);
+    mpc_input_flags(i1, MPC_INPUT_AST_ARENA);
+    
+    PT_ASSERT(mpc_parse_input(i0, Lispy, &r0) == mpc_parse_input(i1, Lispy, &r1));
+    
+    if (j != 3) {
+      PT_ASSERT(ast_eq_state(r0.output, r1.output));
+      mpc_ast_delete(r0.output);
+      mpc_ast_arena_delete(r1.output);
+    } else {
+      e0 = mpc_err_string(r0.error);
+      e1 = mpc_err_string(r1.error);
+      PT_ASSERT_STR_EQ(e0, e1);
+      free(e0); free(e1);
+      mpc_err_delete(r0.error);
+      mpc_err_delete(r1.error);
+    }
+    
+    mpc_input_delete(i0);
+    mpc_input_delete(i1);
+  }
+  
+  i0 = mpc_input_new_string("test", inputs[4]);
+  i1 = mpc_input_new_string("test", inputs[4]);
+  mpc_input_flags(i1, MPC_INPUT_AST_ARENA);
+  
+  for (n = 0; mpc_parse_next(i0, Expr, &r0); n++) {
+    PT_ASSERT(mpc_parse_next(i1, Expr, &r1));
+    PT_ASSERT(ast_eq_state(r0.output, r1.output));
+    mpc_ast_delete(r0.output);
+    mpc_ast_arena_delete(r1.output);
+  }
+  PT_ASSERT(n == 3);
+  PT_ASSERT(!mpc_parse_next(i1, Expr, &r1));
+  
+  mpc_input_delete(i0);
+  mpc_input_delete(i1);
+  
+  /* Parsers which build no AST are left as they are */
+  i0 = mpc_input_new_string("test", "123");
+  mpc_input_flags(i0, MPC_INPUT_AST_ARENA);
+  PT_ASSERT(mpc_parse_input(i0, Digits, &r0));
+  PT_ASSERT_STR_EQ(r0.output, "123");
+  free(r0.output);
+  mpc_input_delete(i0);
+  mpc_delete(Digits);
+  
+  mpc_cleanup(8, Number, Symbol, String, Comment, Sexpr, Qexpr, Expr, Lispy);
+  
+}
+
+static mpc_ast_t *reparse_expected(const char *text, mpc_parser_t *p, char **error) {
+  
+  mpc_result_t r;
+  mpc_ast_t *root = mpc_ast_new(">", "");
+  mpc_input_t *i = mpc_input_new_string("test", text);
+  
+  *error = NULL;
+  while (mpc_parse_next(i, p, &r)) { mpc_ast_add_child(root, r.output); }
+  mpc_input_delete(i);
+  
+  if (r.error) {
+    *error = mpc_err_string(r.error);
+    mpc_err_delete(r.error);
+    mpc_ast_delete(root);
+    return NULL;
+  }
+  
+  return root;
+}
+
+void test_reparse(void) {
+  
+  int j;
+  char text[512], *e0, *e1;
+  mpc_ast_t *a0, *a1 = NULL;
+  mpc_result_t r;
+  mpc_reparse_t *t;
+  mpc_parser_t *Number, *Symbol, *String, *Comment, *Sexpr, *Qexpr, *Expr;
+  
+  const char *start =
+    "(def {fib} (\\ {n} {if (< n 2) {n} {+ (fib (- n 1)) (fib (- n 2))}}))\n"
+    "; fib\n(print \"fib\" (fib 20))\n{1 2 3} (head {a \"b\"}) ; done\nx y";
+  
+  const struct { long offset, removed; const char *inserted; } edits[] = {
+    {   6,  3, "fob" },       /* inside the first item */
+    {  68,  0, "\n\n" },      /* rows shift for those after */
+    {  76,  0, "ber" },       /* longer comment */
+    {  80,  1, "" },          /* unbalanced - fails */
+    {  80,  0, " " },         /* full reparse after failure */
+    {  80,  1, "" },          /* fails again */
+    {  80,  0, "(" },         /* restored */
+    { 134,  1, "" },          /* joins two symbols */
+    { 134,  0, " " },         /* splits them again */
+    {   0,  0, "(first) " },  /* before everything */
+    { 999,  0, " (last)" },   /* after everything */
+    {  76, 35, " 7 " },       /* across several items */
+    {  80,  0, "\"" },        /* open string swallows the rest */
+    {  80,  1, "" },
+    {   0, 999, "" },         /* empty document */
+    {   0,  0, "a b c" }
+  };
+  
+  Number  = mpc_new("number");
+  Symbol  = mpc_new("symbol");
+  String  = mpc_new("string");
+  Comment = mpc_new("comment");
+  Sexpr   = mpc_new("sexpr");
+  Qexpr   = mpc_new("qexpr");
+  Expr    = mpc_new("expr");
+  
+  PT_ASSERT(mpca_lang(MPCA_LANG_DEFAULT,
+    " number  : /-?[0-9]+/ ;                             "
+    " symbol  : /[a-zA-Z0-9_+\\-*\\/\\\\=<>!&]+/ ;       "
+    " string  : /\"(\\\\.|[^\"])*\"/ ;                   "
+    " comment : /;[^\\r\\n]*/ ;                          "
+    " sexpr   : '(' <expr>* ')' ;                        "
+    " qexpr   : '{' <expr>* '}' ;                        "
+    " expr    : <number>  | <symbol> | <string>          "
+    "         | <comment> | <sexpr>  | <qexpr> ;         ",
+    Number, Symbol, String, Comment, Sexpr, Qexpr, Expr, NULL) == NULL);
+  
+  t = mpc_reparse_new("test", Expr);
+  strcpy(text, start);
+  
+  PT_ASSERT(mpc_reparse(t, text, &r));
+  a0 = reparse_expected(text, Expr, &e0);
+  a1 = r.output;
+  PT_ASSERT(a0 && ast_eq_state(a1, a0));
+  PT_ASSERT(a1->children_num == 8);
+  mpc_ast_delete(a0);
+  
+  for (j = 0; j < (int)(sizeof(edits) / sizeof(edits[0])); j++) {
+    
+    long n = (long)strlen(text);
+    long offset = edits[j].offset < n ? edits[j].offset : n;
+    long removed = edits[j].removed < n - offset ? edits[j].removed : n - offset;
+    
+    memmove(text + offset + strlen(edits[j].inserted), text + offset + removed, n - offset - removed + 1);
+    memcpy(text + offset, edits[j].inserted, strlen(edits[j].inserted));
+    
+    a0 = reparse_expected(text, Expr, &e0);
+    
+    if (mpc_reparse_edit(t, a1, edits[j].offset, edits[j].removed, edits[j].inserted, &r)) {
+      PT_ASSERT(a0 && ast_eq_state(r.output, a0));
+      a1 = r.output;
+    } else {
+      e1 = mpc_err_string(r.error);
+      PT_ASSERT(e0 && strcmp(e0, e1) == 0);
+      free(e1);
+      mpc_err_delete(r.error);
+      a1 = NULL;
+    }
+    
+    /* Local edits only parse around the edit */
+    if (j == 0 || j == 2 || j == 7 || j == 8) {
+      PT_ASSERT(mpc_reparse_parsed(t) < 80);
+    }
+    
+    if (a0) { mpc_ast_delete(a0); }
+    free(e0);
+  }
+  
+  PT_ASSERT(a1 && a1->children_num == 3);
+  mpc_ast_delete(a1);
+  mpc_reparse_delete(t);
+  
+  mpc_cleanup(7, Number, Symbol, String, Comment, Sexpr, Qexpr, Expr);
+  
+}
+
+static mpc_parser_t *limits_parser;
+static mpc_program_t *limits_program;
+
+static int limits_parse(const char *text, int compiled, long depth, long steps, mpc_ast_t **a, char **error) {
+  
+  int x;
+  mpc_result_t r;
+  mpc_input_t *i = mpc_input_new_string("test", text);
+  
+  mpc_input_limits(i, depth, 0, steps);
+  x = compiled
+    ? mpc_parse_input_compiled(i, limits_program, &r)
+    : mpc_parse_input(i, limits_parser, &r);
+  mpc_input_delete(i);
+  
+  *a = NULL;
+  *error = NULL;
+  if (x) {
+    *a = r.output;
+  } else {
+    *error = mpc_err_string(r.error);
+    mpc_err_delete(r.error);
+  }
+  
+  return x;
+}
+
+void test_limits(void) {
+  
+  int j, k, c;
+  unsigned long seed = 7;
+  char text[256], *deep, *e0, *e1;
+  mpc_ast_t *a0, *a1;
+  mpc_input_t *i;
+  mpc_result_t r;
+  mpc_parser_t *Number, *Symbol, *Sexpr, *Qexpr, *Expr, *Lispy;
+  const char *chars = "(){} 1a";
+  
+  Number = mpc_new("number");
+  Symbol = mpc_new("symbol");
+  Sexpr  = mpc_new("sexpr");
+  Qexpr  = mpc_new("qexpr");
+  Expr   = mpc_new("expr");
+  Lispy  = mpc_new("lispy");
+  
+  PT_ASSERT(mpca_lang(MPCA_LANG_DEFAULT,
+    " number : /-?[0-9]+/ ;                               "
+    " symbol : /[a-zA-Z0-9_+\\-*\\/\\\\=<>!&]+/ ;         "
+    " sexpr  : '(' <expr>* ')' ;                          "
+    " qexpr  : '{' <expr>* '}' ;                          "
+    " expr   : <number> | <symbol> | <sexpr> | <qexpr> ;  "
+    " lispy  : /^/ <expr>* /$/ ;                          ",
+    Number, Symbol, Sexpr, Qexpr, Expr, Lispy, NULL) == NULL);
+  
+  limits_parser = Lispy;
+  limits_program = mpc_compile(Lispy);
+  
+  /* Nesting far deeper than the stack could take */
+  deep = malloc(200001);
+  for (j = 0; j < 100000; j++) { deep[j] = '('; deep[200000-j-1] = ')'; }
+  deep[200000] = '\0';
+  
+  for (c = 0; c < 2; c++) {
+    PT_ASSERT(!limits_parse(deep, c, 1000, 0, &a0, &e0));
+    PT_ASSERT(strstr(e0, "nests deeper than the limit") != NULL);
+    free(e0);
+    deep[100000] = '\0';
+    PT_ASSERT(!limits_parse(deep, c, 1000, 0, &a0, &e0));
+    PT_ASSERT(strstr(e0, "nests deeper than the limit") != NULL);
+    free(e0);
+    deep[100000] = ')';
+  }
+  
+  free(deep);
+  
+  /* Ordinary input is unaffected */
+  strcpy(text, "(+ 1 (* 2 3)) {a {b} c} x");
+  PT_ASSERT(limits_parse(text, 0, 0, 0, &a0, &e0));
+  for (c = 0; c < 2; c++) {
+    PT_ASSERT(limits_parse(text, c, 100, 10000, &a1, &e1));
+    PT_ASSERT(mpc_ast_eq(a0, a1));
+    mpc_ast_delete(a1);
+    PT_ASSERT(!limits_parse(text, c, 0, 20, &a1, &e1));
+    PT_ASSERT(strstr(e1, "more steps than the limit") != NULL);
+    free(e1);
+  }
+  mpc_ast_delete(a0);
+  
+  for (c = 0; c < 3; c++) {
+    i = mpc_input_new_string("test", "(a b c) (d e f) (g h i)");
+    mpc_input_flags(i, c == 0 ? MPC_INPUT_DEFAULT : c == 1 ? MPC_INPUT_AST_ARENA : MPC_INPUT_AST_VIEWS);
+    mpc_input_limits(i, 0, 12, 0);
+    PT_ASSERT(!(c % 2 ? mpc_parse_input_compiled(i, limits_program, &r) : mpc_parse_input(i, Lispy, &r)));
+    e0 = mpc_err_string(r.error);
+    PT_ASSERT(strstr(e0, "longer than the limit") != NULL);
+    free(e0);
+    mpc_err_delete(r.error);
+    mpc_input_delete(i);
+  }
+  
+  /* Random bracketed input parses as without limits or hits one */
+  for (j = 0; j < 500; j++) {
+    
+    int n = j % 255;
+    for (k = 0; k < n; k++) {
+      seed = seed * 1103515245UL + 12345UL;
+      text[k] = k < n / 2 && (seed >> 16) % 3 ? "({"[(seed >> 8) % 2] : chars[(seed >> 16) % 7];
+    }
+    text[n] = '\0';
+    
+    limits_parse(text, 0, 0, 0, &a0, &e0);
+    
+    for (c = 0; c < 2; c++) {
+      if (limits_parse(text, c, 40 + j % 40, 0, &a1, &e1)) {
+        PT_ASSERT(a0 && mpc_ast_eq(a0, a1));
+        mpc_ast_delete(a1);
+      } else {
+        PT_ASSERT((e0 && strcmp(e0, e1) == 0) || strstr(e1, "than the limit") != NULL);
+        free(e1);
+      }
+    }
+    
+    if (a0) { mpc_ast_delete(a0); }
+    free(e0);
+  }
+  
+  mpc_program_delete(limits_program);
+  mpc_cleanup(6, Number, Symbol, Sexpr, Qexpr, Expr, Lispy);
+  
+}
+
+static int ast_copies(mpc_ast_t *a) {
+  int j, n = a->contents != NULL;
+  for (j = 0; j < a->children_num; j++) { n += ast_copies(a->children[j]); }
+  return n;
+}
+
+void test_ast_views(void) {
+  
+  int j;
+  mpc_ast_t *a;
+  mpc_input_t *i0, *i1;
+  mpc_result_t r0, r1;
+  mpc_parser_t *Number, *Symbol, *String, *Qexpr, *Expr, *Data;
+  const char *inputs[] = {
+    "{1 2 3} {\"a\" b {-4 c}}", "", "{x \"y z\" {} 12345678}" };
+  
+  Number = mpc_new("number");
+  Symbol = mpc_new("symbol");
+  String = mpc_new("string");
+  Qexpr  = mpc_new("qexpr");
+  Expr   = mpc_new("expr");
+  Data   = mpc_new("data");
+  
+  PT_ASSERT(mpca_lang(MPCA_LANG_DEFAULT,
+    " number : /-?[0-9]+/ ;                          "
+    " symbol : /[a-zA-Z]+/ ;                         "
+    " string : /\"(\\\\.|[^\"])*\"/ ;                    "
+    " qexpr  : '{' <expr>* '}' ;                     "
+    " expr   : <number> | <symbol> | <string> | <qexpr> ; "
+    " data   : /^/ <expr>* /$/ ;                     ",
+    Number, Symbol, String, Qexpr, Expr, Data, NULL) == NULL);
+  
+  for (j = 0; j < 3; j++) {
+    
+    i0 = mpc_input_new_string("test", inputs[j]);
+    i1 = mpc_input_new_string("test", inputs[j]);
+    mpc_input_flags(i1, MPC_INPUT_AST_VIEWS);
+    
+    PT_ASSERT(mpc_parse_input(i0, Data, &r0));
+    PT_ASSERT(mpc_parse_input(i1, Data, &r1));
+    PT_ASSERT(ast_copies(r1.output) == 0);
+    PT_ASSERT(ast_eq_state(r0.output, r1.output));
+    
+    mpc_ast_delete(r0.output);
+    mpc_ast_delete(r1.output);
+    mpc_input_delete(i0);
+    mpc_input_delete(i1);
+  }
+  
+  i1 = mpc_input_new_string("test", inputs[0]);
+  mpc_input_flags(i1, MPC_INPUT_AST_VIEWS);
+  PT_ASSERT(mpc_parse_input(i1, Data, &r1));
+  
+  a = mpc_ast_get_child_lb(r1.output, "expr|qexpr|>", 2);
+  PT_ASSERT(a != NULL && a->children_num == 5);
+  PT_ASSERT_STR_EQ(a->children[1]->tag, "expr|string|regex");
+  PT_ASSERT(a->children[1]->view_len == 3);
+  PT_ASSERT(a->children[1]->contents == NULL);
+  PT_ASSERT_STR_EQ(mpc_ast_contents(a->children[1]), "\"a\"");
+  PT_ASSERT(a->children[1]->contents != NULL);
+  PT_ASSERT(mpc_ast_contents(a->children[1]) == a->children[1]->contents);
+  PT_ASSERT_STR_EQ(mpc_ast_contents(a), "");
+  PT_ASSERT(ast_copies(r1.output) == 1);
+  
+  mpc_ast_delete(r1.output);
+  mpc_input_delete(i1);
+  
+  mpc_cleanup(6, Number, Symbol, String, Qexpr, Expr, Data);
+  
+}
+
+static int ast_depth(mpc_ast_t *root, mpc_ast_t *a) {
+  int j, d;
+  if (root == a) { return 0; }
+  for (j = 0; j < root->children_num; j++) {
+    d = ast_depth(root->children[j], a);
+    if (d >= 0) { return d + 1; }
+  }
+  return -1;
+}
+
+void test_ast_iter(void) {
+  
+  int j, k, n, slots;
+  mpc_ast_t *a, *b, *deep;
+  mpc_ast_trav_t *trav;
+  mpc_ast_iter_t it;
+  mpc_result_t r;
+  mpc_parser_t *Number, *Symbol, *Sexpr, *Qexpr, *Expr, *Lispy;
+  const mpc_ast_trav_order_t orders[] = { mpc_ast_trav_order_pre, mpc_ast_trav_order_post };
+  
+  Number = mpc_new("number");
+  Symbol = mpc_new("symbol");
+  Sexpr  = mpc_new("sexpr");
+  Qexpr  = mpc_new("qexpr");
+  Expr   = mpc_new("expr");
+  Lispy  = mpc_new("lispy");
+  
+  PT_ASSERT(mpca_lang(MPCA_LANG_DEFAULT,
+    " number : /-?[0-9]+/ ;                          "
+    " symbol : /[a-zA-Z0-9_+\\-*\\/\\\\=<>!&]+/ ;    "
+    " sexpr  : '(' <expr>* ')' ;                     "
+    " qexpr  : '{' <expr>* '}' ;                     "
+    " expr   : <number> | <symbol> | <sexpr> | <qexpr> ; "
+    " lispy  : /^/ <expr>* /$/ ;                     ",
+    Number, Symbol, Sexpr, Qexpr, Expr, Lispy, NULL) == NULL);
+  
+  PT_ASSERT(mpc_parse("test", "(def {fib} (\\ {n} {if (< n 2) {n} {+ (fib (- n 1)) (fib (- n 2))}})) (fib 20)", Lispy, &r));
+  
+  mpc_ast_iter_init(&it);
+  
+  /* Visits the same nodes in the same order as a traversal */
+  for (j = 0; j < 2; j++) {
+    for (k = 0; k < 2; k++) {
+      trav = mpc_ast_traverse_start(r.output, orders[j]);
+      mpc_ast_iter_start(&it, r.output, orders[j]);
+      for (n = 0; (a = mpc_ast_iter_next(&it)); n++) {
+        b = mpc_ast_traverse_next(&trav);
+        PT_ASSERT(a == b);
+        PT_ASSERT(mpc_ast_iter_depth(&it) == ast_depth(r.output, a));
+      }
+      PT_ASSERT(mpc_ast_traverse_next(&trav) == NULL);
+      PT_ASSERT(n > 50);
+      mpc_ast_traverse_free(&trav);
+    }
+  }
+  
+  /* Starting again on the same tree does not grow the stack */
+  slots = it.slots;
+  mpc_ast_iter_start(&it, r.output, mpc_ast_trav_order_pre);
+  while (mpc_ast_iter_next(&it)) {}
+  PT_ASSERT(it.slots == slots);
+  
+  mpc_ast_iter_start(&it, NULL, mpc_ast_trav_order_pre);
+  PT_ASSERT(mpc_ast_iter_next(&it) == NULL);
+  
+  mpc_ast_delete(r.output);
+  
+  /* Deep trees only grow the stack, not the C stack */
+  deep = mpc_ast_new("deep", "");
+  for (a = deep, j = 0; j < 10000; j++) {
+    b = mpc_ast_new("deep", "");
+    mpc_ast_add_child(a, b);
+    a = b;
+  }
+  
+  mpc_ast_iter_start(&it, deep, mpc_ast_trav_order_post);
+  PT_ASSERT(mpc_ast_iter_next(&it) == a);
+  PT_ASSERT(mpc_ast_iter_depth(&it) == 10000);
+  for (n = 1; mpc_ast_iter_next(&it); n++) {}
+  PT_ASSERT(n == 10001);
+  PT_ASSERT(mpc_ast_iter_depth(&it) == 0);
+  
+  mpc_ast_iter_free(&it);
+  mpc_ast_delete(deep);
+  
+  mpc_cleanup(6, Number, Symbol, Sexpr, Qexpr, Expr, Lispy);
+  
+}
+
+static void ast_save_delete(mpc_ast_t *a, int flags) {
+  if (flags & MPC_INPUT_AST_ARENA) { mpc_ast_arena_delete(a); } else { mpc_ast_delete(a); }
+}
+
+void test_ast_save(void) {
+  
+  int j, k;
+  size_t size, n;
+  char *data, *e;
+  mpc_ast_t *a, *b, *deep;
+  mpc_err_t *err;
+  mpc_result_t r;
+  mpc_parser_t *Number, *Symbol, *String, *Comment, *Sexpr, *Qexpr, *Expr, *Lispy;
+  const int flags[] = { MPC_INPUT_DEFAULT, MPC_INPUT_AST_VIEWS, MPC_INPUT_AST_ARENA };
+  
+  Number  = mpc_new("number");
+  Symbol  = mpc_new("symbol");
+  String  = mpc_new("string");
+  Comment = mpc_new("comment");
+  Sexpr   = mpc_new("sexpr");
+  Qexpr   = mpc_new("qexpr");
+  Expr    = mpc_new("expr");
+  Lispy   = mpc_new("lispy");
+  
+  PT_ASSERT(mpca_lang(MPCA_LANG_DEFAULT,
+    " number  : /-?[0-9]+/ ;                             "
+    " symbol  : /[a-zA-Z0-9_+\\-*\\/\\\\=<>!&]+/ ;       "
+    " string  : /\"(\\\\.|[^\"])*\"/ ;                   "
+    " comment : /;[^\\r\\n]*/ ;                          "
+    " sexpr   : '(' <expr>* ')' ;                        "
+    " qexpr   : '{' <expr>* '}' ;                        "
+    " expr    : <number>  | <symbol> | <string>          "
+    "         | <comment> | <sexpr>  | <qexpr> ;         "
+    " lispy   : /^/ <expr>* /$/ ;                        ",
+    Number, Symbol, String, Comment, Sexpr, Qexpr, Expr, Lispy, NULL) == NULL);
+  
+  PT_ASSERT(mpc_parse("test",
+    "(def {fib} (\\ {n} {if (< n 2) {n} {+ (fib (- n 1)) (fib (- n 2))}})) ; fib\n"
+    "(print \"fib\" (fib 20))\n{1 -2 3} (head {a \"b\"}) ; done", Lispy, &r));
+  a = r.output;
+  
+  mpc_ast_save(a, &data, &size);
+  PT_ASSERT(size > 0 && memcmp(data, "mpct", 4) == 0);
+  
+  for (j = 0; j < 3; j++) {
+    PT_ASSERT(mpc_ast_load(data, size, flags[j], &b) == NULL);
+    PT_ASSERT(ast_eq_state(a, b));
+    ast_save_delete(b, flags[j]);
+  }
+  
+  /* Views point into the data rather than copying */
+  PT_ASSERT(mpc_ast_load(data, size, MPC_INPUT_AST_VIEWS, &b) == NULL);
+  PT_ASSERT(b->children[1]->contents == NULL);
+  PT_ASSERT(b->children[1]->view > data && b->children[1]->view < data + size);
+  PT_ASSERT_STR_EQ(mpc_ast_contents(b->children[1]->children[1]), "def");
+  mpc_ast_delete(b);
+  
+  /* Every truncation or corrupted byte fails cleanly */
+  for (j = 0; j < 3; j++) {
+    for (n = 0; n < size; n++) {
+      err = mpc_ast_load(data, n, flags[j], &b);
+      PT_ASSERT(err != NULL && b == NULL);
+      mpc_err_delete(err);
+    }
+    for (n = 0; n < size; n++) {
+      for (k = 0; k < 2; k++) {
+        data[n] = (char)(data[n] ^ (k ? 0x80 : 0x01));
+        err = mpc_ast_load(data, size, flags[j], &b);
+        if (err) { mpc_err_delete(err); } else { ast_save_delete(b, flags[j]); }
+        data[n] = (char)(data[n] ^ (k ? 0x80 : 0x01));
+      }
+    }
+  }
+  
+  data[0] = 'x';
+  err = mpc_ast_load(data, size, MPC_INPUT_DEFAULT, &b);
+  e = mpc_err_string(err);
+  PT_ASSERT(strstr(e, "not a saved AST") != NULL);
+  free(e);
+  mpc_err_delete(err);
+  
+  free(data);
+  mpc_ast_delete(a);
+  
+  /* Deep trees are saved and loaded without recursion */
+  deep = mpc_ast_new("deep", "");
+  for (a = deep, j = 0; j < 10000; j++) {
+    b = mpc_ast_new("deep", j % 2 ? "x" : "");
+    mpc_ast_add_child(a, b);
+    a = b;
+  }
+  
+  mpc_ast_save(deep, &data, &size);
+  PT_ASSERT(mpc_ast_load(data, size, MPC_INPUT_AST_ARENA, &b) == NULL);
+  PT_ASSERT(mpc_ast_eq(deep, b));
+  mpc_ast_arena_delete(b);
+  free(data);
+  mpc_ast_delete(deep);
+  
+  mpc_cleanup(8, Number, Symbol, String, Comment, Sexpr, Qexpr, Expr, Lispy);
+  
+}
+
+static mpc_val_t *fold_group(int n, mpc_val_t **xs) {
+  if (n == 1) { return xs[0]; }
+  free(xs[0]); free(xs[2]);
+  return xs[1];
+}
+
+static mpc_val_t *fold_maths(int n, mpc_val_t **xs) {
+  int j, *x = xs[0];
+  for (j = 1; j < n; j += 2) {
+    switch (((char*)xs[j])[0]) {
+      case '+': *x += *(int*)xs[j+1]; break;
+      case '-': *x -= *(int*)xs[j+1]; break;
+      case '*': *x *= *(int*)xs[j+1]; break;
+      case '/': *x /= *(int*)xs[j+1]; break;
+      default: break;
+    }
+    free(xs[j]); free(xs[j+1]);
+  }
+  return x;
+}
+
+static mpc_val_t *fold_words(int n, mpc_val_t **xs) {
+  int j, *x = malloc(sizeof(int));
+  *x = 0;
+  for (j = 0; j < n; j++) {
+    *x += (int)strlen(((mpc_ast_t*)xs[j])->contents);
+    mpc_ast_delete(xs[j]);
+  }
+  return x;
+}
+
+void test_actions(void) {
+  
+  int j;
+  mpc_result_t r;
+  mpc_err_t *e;
+  mpc_parser_t *Expr, *Prod, *Value, *Number, *Maths, *Word, *Words, *Choice;
+  
+  const mpca_action_t actions[] = {
+    { "group", fold_group, NULL, free },
+    { "maths", fold_maths, NULL, free },
+    { "words", fold_words, NULL, free },
+    { "int",   NULL, mpcf_int, free },
+    { NULL, NULL, NULL, NULL }
+  };
+  
+  const char *inputs[] = { "1+2*3", "(4 * 2) + 5 - 1", " 10 / (2 + 3) " };
+  const int results[] = { 7, 12, 2 };
+  
+  Expr   = mpc_new("expression");
+  Prod   = mpc_new("product");
+  Value  = mpc_new("value");
+  Number = mpc_new("number");
+  Maths  = mpc_new("maths");
+  Word   = mpc_new("word");
+  Words  = mpc_new("words");
+  Choice = mpc_new("choice");
+  
+  PT_ASSERT(mpca_lang_actions(MPCA_LANG_DEFAULT, actions,
+    " expression @maths : <product> (('+' | '-') <product>)* ; "
+    " product @maths    : <value>   (('*' | '/')   <value>)* ; "
+    " value @group      : <number> | '(' <expression> ')' ;    "
+    " number @int       : /[0-9]+/ ;                           "
+    " maths @group      : /^/ <expression> /$/ ;               "
+    " word              : /[a-z]+/ ;                           "
+    " words @words      : <word>* ;                            "
+    " choice @group     : <number> 'x' | <number> ;            ",
+    Expr, Prod, Value, Number, Maths, Word, Words, Choice, NULL) == NULL);
+  
+  for (j = 0; j < 3; j++) {
+    PT_ASSERT(mpc_parse("test", inputs[j], Maths, &r));
+    PT_ASSERT(*(int*)r.output == results[j]);
+    free(r.output);
+  }
+  
+  PT_ASSERT(!mpc_parse("test", "(4 * 2", Maths, &r));
+  mpc_err_delete(r.error);
+  
+  PT_ASSERT(mpc_parse("test", "ab cde f", Words, &r));
+  PT_ASSERT(*(int*)r.output == 6);
+  free(r.output);
+  
+  PT_ASSERT(mpc_parse("test", "5y", Choice, &r));
+  PT_ASSERT(*(int*)r.output == 5);
+  free(r.output);
+  
+  mpc_cleanup(8, Expr, Prod, Value, Number, Maths, Word, Words, Choice);
+  
+  Number = mpc_new("number");
+  e = mpca_lang_actions(MPCA_LANG_DEFAULT, actions, " number @nothing : /[0-9]+/ ; ", Number, NULL);
+  PT_ASSERT(e == NULL);
+  PT_ASSERT(!mpc_parse("test", "12", Number, &r));
+  mpc_err_delete(r.error);
+  mpc_cleanup(1, Number);
+  
+  /* Without actions the same language builds an AST */
+  Number = mpc_new("number");
+  e = mpca_lang_actions(MPCA_LANG_DEFAULT, NULL, " number @nothing : /[0-9]+/ ; ", Number, NULL);
+  PT_ASSERT(e == NULL);
+  PT_ASSERT(mpc_parse("test", "12", Number, &r));
+  PT_ASSERT_STR_EQ(((mpc_ast_t*)r.output)->contents, "12");
+  mpc_ast_delete(r.output);
+  mpc_cleanup(1, Number);
+  
+}
+
+enum { RULE_NUMBER = 1, RULE_SYMBOL, RULE_SEXPR, RULE_EXPR, RULE_LISPY };
+
+void test_rule_ids(void) {
+  
+  mpc_result_t r;
+  mpc_ast_t *a, *s;
+  mpc_parser_t *Number, *Symbol, *Sexpr, *Expr, *Lispy;
+  
+  Number = mpc_new("number");
+  Symbol = mpc_new("symbol");
+  Sexpr  = mpc_new("sexpr");
+  Expr   = mpc_new("expr");
+  Lispy  = mpc_new("lispy");
+  
+  PT_ASSERT(mpca_lang(MPCA_LANG_DEFAULT,
+    " lispy  : /^/ <expr>* /$/ ;                     "
+    " expr   : <number> | <symbol> | <sexpr> ;       "
+    " sexpr  : '(' <expr>* ')' ;                     "
+    " number : /-?[0-9]+/ ;                          "
+    " symbol : /[a-zA-Z+\\-*\\/]+/ ;                 ",
+    Number, Symbol, Sexpr, Expr, Lispy, NULL) == NULL);
+  
+  PT_ASSERT(mpc_parse("test", "(+ 1 x) 2", Lispy, &r));
+  a = r.output;
+  
+  PT_ASSERT(a->rule == 0 && a->primary == 0);
+  PT_ASSERT(a->children_num == 4);
+  PT_ASSERT(a->children[0]->rule == 0 && a->children[0]->primary == 0);
+  PT_ASSERT(a->children[3]->rule == 0 && a->children[3]->primary == 0);
+  
+  s = a->children[1];
+  PT_ASSERT_STR_EQ(s->tag, "expr|sexpr|>");
+  PT_ASSERT(s->rule == RULE_EXPR && s->primary == RULE_SEXPR);
+  PT_ASSERT(s->children_num == 5);
+  PT_ASSERT(s->children[0]->rule == 0 && s->children[4]->rule == 0);
+  PT_ASSERT(s->children[1]->rule == RULE_EXPR && s->children[1]->primary == RULE_SYMBOL);
+  PT_ASSERT(s->children[2]->rule == RULE_EXPR && s->children[2]->primary == RULE_NUMBER);
+  PT_ASSERT(s->children[3]->rule == RULE_EXPR && s->children[3]->primary == RULE_SYMBOL);
+  
+  PT_ASSERT_STR_EQ(a->children[2]->tag, "expr|number|regex");
+  PT_ASSERT(a->children[2]->rule == RULE_EXPR && a->children[2]->primary == RULE_NUMBER);
+  
+  mpc_ast_delete(r.output);
+  
+  PT_ASSERT(mpc_parse("test", "(x)", Expr, &r));
+  a = r.output;
+  PT_ASSERT(a->rule == 0 && a->children_num == 1);
+  PT_ASSERT(a->children[0]->rule == RULE_SEXPR && a->children[0]->primary == RULE_SEXPR);
+  mpc_ast_delete(r.output);
+  
+  mpc_cleanup(5, Number, Symbol, Sexpr, Expr, Lispy);
+
+}
+
+void test_dispatch(void) {
+
+  int j;
+  char *e0, *e1;
+  mpc_input_t *i0, *i1;
+  mpc_result_t r0, r1;
+  mpc_parser_t *Number, *Symbol, *String, *Sexpr, *Qexpr, *Call, *Expr, *Lispy;
+  const char *inputs[] = {
+    "(def {fib} (\\ {n} {if (< n 2) {n} {+ (fib (- n 1)) (fib (- n 2))}})) (print \"fib\" f(20))",
+    "", "-", "-12 x -y", "f(1 g(2) h)", "(+ 1 (* 2 3)", "{1 2 3} ]", "f(1 2", "\"abc" };
+
+  Number = mpc_new("number");
+  Symbol = mpc_new("symbol");
+  String = mpc_new("string");
+  Sexpr  = mpc_new("sexpr");
+  Qexpr  = mpc_new("qexpr");
+  Call   = mpc_new("call");
+  Expr   = mpc_new("expr");
+  Lispy  = mpc_new("lispy");
+
+  PT_ASSERT(mpca_lang(MPCA_LANG_DEFAULT,
+    " lispy  : /^/ <expr>* /$/ ;                         "
+    " expr   : <number> | <call> | <symbol> | <string>   "
+    "        | <sexpr>  | <qexpr> ;                      "
+    " call   : <symbol> '(' <expr>* ')' ;                "
+    " sexpr  : '(' <expr>* ')' ;                         "
+    " qexpr  : '{' <expr>* '}' ;                         "
+    " string : /\"(\\\\.|[^\"])*\"/ ;                    "
+    " number : /-?[0-9]+/ ;                              "
+    " symbol : /[a-zA-Z_+\\-*\\/\\\\=<>!&]+/ ;           ",
+    Number, Symbol, String, Sexpr, Qexpr, Call, Expr, Lispy, NULL) == NULL);
+
+  for (j = 0; j < 9; j++) {
+
+    i0 = mpc_input_new_string("test", inputs[j]);
+    i1 = mpc_input_new_string("test", inputs[j]);
+    mpc_input_flags(i0, MPC_INPUT_NO_DISPATCH);
+
+    PT_ASSERT(mpc_parse_input(i0, Lispy, &r0) == mpc_parse_input(i1, Lispy, &r1));
+    PT_ASSERT(mpc_input_allocs(i1) <= mpc_input_allocs(i0));
+    if (j == 0) { PT_ASSERT(mpc_input_allocs(i1) < mpc_input_allocs(i0)); }
+
+    if (j < 5) {
+      PT_ASSERT(ast_eq_state(r0.output, r1.output));
+      mpc_ast_delete(r0.output);
+      mpc_ast_delete(r1.output);
+    } else {
+      e0 = mpc_err_string(r0.error);
+      e1 = mpc_err_string(r1.error);
+      PT_ASSERT_STR_EQ(e0, e1);
+      free(e0); free(e1);
+      mpc_err_delete(r0.error);
+      mpc_err_delete(r1.error);
+    }
+
+    mpc_input_delete(i0);
+    mpc_input_delete(i1);
+  }
+
+  mpc_cleanup(8, Number, Symbol, String, Sexpr, Qexpr, Call, Expr, Lispy);
+
+}
+
+void test_dispatch_predictive(void) {
+
+  int j, k, x0, x1;
+  char *e0, *e1;
+  mpc_input_t *i0, *i1;
+  mpc_result_t r0, r1;
+  mpc_program_t *c;
+  mpc_parser_t *Expr, *Prod, *Value, *Maths;
+  const char *inputs[] = {
+    "(1 1", "(2 3", "(4 2)", "((1)", "+1", "", "1 2", "(((1)+)",
+    "(1+2)*3", "((4))/2-(3*(5))", "(1*)", "10/(2-", "1+" };
+
+  /* The last three parse only because nothing rewinds the input */
+
+  Expr  = mpc_new("expression");
+  Prod  = mpc_new("product");
+  Value = mpc_new("value");
+  Maths = mpc_new("maths");
+
+  /* Without backtracking alternatives may fail part way through */
+  PT_ASSERT(mpca_lang(MPCA_LANG_PREDICTIVE,
+    " expression : <product> (('+' | '-') <product>)*; "
+    " product : <value>   (('*' | '/')   <value>)*;    "
+    " value : /[0-9]+/ | '(' <expression> ')';         "
+    " maths : /^/ <expression> /$/;                    ",
+    Expr, Prod, Value, Maths, NULL) == NULL);
+
+  c = mpc_compile(Maths);
+
+  for (j = 0; j < 13; j++) {
+    for (k = 0; k < 2; k++) {
+
+      i0 = mpc_input_new_string("test", inputs[j]);
+      i1 = mpc_input_new_string("test", inputs[j]);
+      mpc_input_flags(i0, MPC_INPUT_NO_DISPATCH);
+
+      x0 = mpc_parse_input(i0, Maths, &r0);
+      x1 = k ? mpc_parse_input_compiled(i1, c, &r1) : mpc_parse_input(i1, Maths, &r1);
+      PT_ASSERT(x0 == x1);
+      PT_ASSERT(x0 == (j >= 8));
+
+      if (x0 && x1) {
+        PT_ASSERT(ast_eq_state(r0.output, r1.output));
+        mpc_ast_delete(r0.output);
+        mpc_ast_delete(r1.output);
+      } else if (!x0 && !x1) {
+        e0 = mpc_err_string(r0.error);
+        e1 = mpc_err_string(r1.error);
+        PT_ASSERT_STR_EQ(e0, e1);
+        free(e0); free(e1);
+        mpc_err_delete(r0.error);
+        mpc_err_delete(r1.error);
+      }
+
+      mpc_input_delete(i0);
+      mpc_input_delete(i1);
+    }
+  }
+
+  mpc_program_delete(c);
+  mpc_cleanup(4, Expr, Prod, Value, Maths);
+
+}
+
+void test_compiled(void) {
+
+  int j, k, x0, x1;
+  char *e0, *e1;
+  FILE *f0 = NULL, *f1 = NULL;
+  mpc_input_t *i0, *i1;
+  mpc_result_t r0, r1;
+  mpc_program_t *c;
+  mpc_parser_t *ps[2][8];
+  const char *inputs[] = {
+    "(def {fib} (\\ {n} {if (< n 2) {n} {+ (fib (- n 1)) (fib (- n 2))}})) ; fib\n(print \"fib\" (fib 20))",
+    "", "x", "(+ 1 (* 2 3)", "{1 2 3} (head {a \"b\"}) ; done", "(x))", "\"abc" };
+  const int flags[] = {
+    MPC_INPUT_DEFAULT, MPC_INPUT_AST_ARENA, MPC_INPUT_AST_VIEWS, MPC_INPUT_NO_DISPATCH, MPC_INPUT_DEFAULT };
+
+  for (j = 0; j < 2; j++) {
+
+    ps[j][0] = mpc_new("number");
+    ps[j][1] = mpc_new("symbol");
+    ps[j][2] = mpc_new("string");
+    ps[j][3] = mpc_new("comment");
+    ps[j][4] = mpc_new("sexpr");
+    ps[j][5] = mpc_new("qexpr");
+    ps[j][6] = mpc_new("expr");
+    ps[j][7] = mpc_new("lispy");
+
+    PT_ASSERT(mpca_lang(j ? MPCA_LANG_DEFERRED_ERRORS : MPCA_LANG_DEFAULT,
+      " number  : /-?[0-9]+/ ;                             "
+      " symbol  : /[a-zA-Z0-9_+\\-*\\/\\\\=<>!&]+/ ;       "
+      " string  : /\"(\\\\.|[^\"])*\"/ ;                   "
+      " comment : /;[^\\r\\n]*/ ;                          "
+      " sexpr   : '(' <expr>* ')' ;                        "
+      " qexpr   : '{' <expr>* '}' ;                        "
+      " expr    : <number>  | <symbol> | <string>          "
+      "         | <comment> | <sexpr>  | <qexpr> ;         "
+      " lispy   : /^/ <expr>* /$/ ;                        ",
+      ps[j][0], ps[j][1], ps[j][2], ps[j][3], ps[j][4], ps[j][5], ps[j][6], ps[j][7], NULL) == NULL);
+
+    c = mpc_compile(ps[j][7]);
+
+    /* The last inputs are files, which failed parses rewind by seeking */
+    for (k = 0; k < 7 * 5; k++) {
+
+      if (k / 7 == 4) {
+        f0 = tmpfile();
+        f1 = tmpfile();
+        fputs(inputs[k % 7], f0);
+        fputs(inputs[k % 7], f1);
+        rewind(f0);
+        rewind(f1);
+        i0 = mpc_input_new_file("test", f0);
+        i1 = mpc_input_new_file("test", f1);
+      } else {
+        i0 = mpc_input_new_string("test", inputs[k % 7]);
+        i1 = mpc_input_new_string("test", inputs[k % 7]);
+      }
+      mpc_input_flags(i0, flags[k / 7]);
+      mpc_input_flags(i1, flags[k / 7]);
+
+      x0 = mpc_parse_input(i0, ps[j][7], &r0);
+      x1 = mpc_parse_input_compiled(i1, c, &r1);
+      PT_ASSERT(x0 == x1);
+
+      if (x0 && x1) {
+        PT_ASSERT(ast_eq_state(r0.output, r1.output));
+        if (flags[k / 7] == MPC_INPUT_AST_ARENA) {
+          mpc_ast_arena_delete(r0.output);
+          mpc_ast_arena_delete(r1.output);
+        } else {
+          mpc_ast_delete(r0.output);
+          mpc_ast_delete(r1.output);
+        }
+      } else if (!x0 && !x1) {
+        e0 = mpc_err_string(r0.error);
+        e1 = mpc_err_string(r1.error);
+        PT_ASSERT_STR_EQ(e0, e1);
+        free(e0); free(e1);
+        mpc_err_delete(r0.error);
+        mpc_err_delete(r1.error);
+      }
+
+      mpc_input_delete(i0);
+      mpc_input_delete(i1);
+      if (k / 7 == 4) {
+        fclose(f0);
+        fclose(f1);
+      }
+    }
+
+    mpc_program_delete(c);
+  }
+
+  for (j = 0; j < 2; j++) {
+    mpc_cleanup(8, ps[j][0], ps[j][1], ps[j][2], ps[j][3], ps[j][4], ps[j][5], ps[j][6], ps[j][7]);
+  }
+
+}
+
+static mpc_val_t *apply_upper(mpc_val_t *x) {
+  char *s = x;
+  for (; *s; s++) { *s = (char)toupper((unsigned char)*s); }
+  return x;
+}
+
+void test_lang_save(void) {
+
+  int j, k, x0, x1;
+  char *data, *again, *e0, *e1;
+  size_t size, again_size, n;
+  mpc_err_t *err;
+  mpc_result_t r0, r1;
+  mpc_parser_t *ps[2][8], *Upper;
+  const char *inputs[] = {
+    "(def {fib} (\\ {n} {if (< n 2) {n} {+ (fib (- n 1)) (fib (- n 2))}})) ; fib\n(print \"fib\" (fib 20))",
+    "", "x", "(+ 1 (* 2 3)", "{1 2 3} (head {a \"b\"}) ; done", "(x))", "\"abc" };
+  const int flags[] = {
+    MPCA_LANG_DEFAULT, MPCA_LANG_PREDICTIVE,
+    MPCA_LANG_DEFERRED_ERRORS, MPCA_LANG_WHITESPACE_SENSITIVE };
+
+  for (j = 0; j < 4; j++) {
+
+    for (k = 0; k < 2; k++) {
+      ps[k][0] = mpc_new("number");
+      ps[k][1] = mpc_new("symbol");
+      ps[k][2] = mpc_new("string");
+      ps[k][3] = mpc_new("comment");
+      ps[k][4] = mpc_new("sexpr");
+      ps[k][5] = mpc_new("qexpr");
+      ps[k][6] = mpc_new("expr");
+      ps[k][7] = mpc_new("lispy");
+    }
+
+    PT_ASSERT(mpca_lang(flags[j],
+      " number  : /-?[0-9]+/ ;                             "
+      " symbol  : /[a-zA-Z0-9_+\\-*\\/\\\\=<>!&]+/ ;       "
+      " string  : /\"(\\\\.|[^\"])*\"/ ;                   "
+      " comment : /;[^\\r\\n]*/ ;                          "
+      " sexpr   : '(' <expr>* ')' ;                        "
+      " qexpr   : '{' <expr>* '}' ;                        "
+      " expr    : <number>  | <symbol> | <string>          "
+      "         | <comment> | <sexpr>  | <qexpr> ;         "
+      " lispy   : /^/ <expr>* /$/ ;                        ",
+      ps[0][0], ps[0][1], ps[0][2], ps[0][3], ps[0][4], ps[0][5], ps[0][6], ps[0][7], NULL) == NULL);
+
+    PT_ASSERT(mpca_lang_save(&data, &size,
+      ps[0][0], ps[0][1], ps[0][2], ps[0][3], ps[0][4], ps[0][5], ps[0][6], ps[0][7], NULL) == NULL);
+
+    /* Rules are matched by name so order does not matter */
+    PT_ASSERT(mpca_lang_load(data, size,
+      ps[1][7], ps[1][6], ps[1][5], ps[1][4], ps[1][3], ps[1][2], ps[1][1], ps[1][0], NULL) == NULL);
+
+    /* Saving again gives the same data */
+    PT_ASSERT(mpca_lang_save(&again, &again_size,
+      ps[1][0], ps[1][1], ps[1][2], ps[1][3], ps[1][4], ps[1][5], ps[1][6], ps[1][7], NULL) == NULL);
+    PT_ASSERT(again_size == size && memcmp(again, data, size) == 0);
+    free(again);
+
+    for (k = 0; k < 7; k++) {
+      x0 = mpc_parse("test", inputs[k], ps[0][7], &r0);
+      x1 = mpc_parse("test", inputs[k], ps[1][7], &r1);
+      PT_ASSERT(x0 == x1);
+      if (x0 && x1) {
+        PT_ASSERT(ast_eq_state(r0.output, r1.output));
+        mpc_ast_delete(r0.output);
+        mpc_ast_delete(r1.output);
+      } else if (!x0 && !x1) {
+        e0 = mpc_err_string(r0.error);
+        e1 = mpc_err_string(r1.error);
+        PT_ASSERT_STR_EQ(e0, e1);
+        free(e0); free(e1);
+        mpc_err_delete(r0.error);
+        mpc_err_delete(r1.error);
+      }
+    }
+
+    /* Truncated data is rejected and nothing is defined */
+    if (j == 0) {
+      mpc_cleanup(8, ps[1][0], ps[1][1], ps[1][2], ps[1][3], ps[1][4], ps[1][5], ps[1][6], ps[1][7]);
+      for (n = 0; n < size; n++) {
+        ps[1][0] = mpc_new("number");
+        ps[1][1] = mpc_new("symbol");
+        ps[1][2] = mpc_new("string");
+        ps[1][3] = mpc_new("comment");
+        ps[1][4] = mpc_new("sexpr");
+        ps[1][5] = mpc_new("qexpr");
+        ps[1][6] = mpc_new("expr");
+        ps[1][7] = mpc_new("lispy");
+        err = mpca_lang_load(data, n,
+          ps[1][0], ps[1][1], ps[1][2], ps[1][3], ps[1][4], ps[1][5], ps[1][6], ps[1][7], NULL);
+        PT_ASSERT(err != NULL);
+        mpc_err_delete(err);
+        PT_ASSERT(!mpc_parse("test", "x", ps[1][7], &r1));
+        mpc_err_delete(r1.error);
+        mpc_cleanup(8, ps[1][0], ps[1][1], ps[1][2], ps[1][3], ps[1][4], ps[1][5], ps[1][6], ps[1][7]);
+      }
+    } else {
+      mpc_cleanup(8, ps[1][0], ps[1][1], ps[1][2], ps[1][3], ps[1][4], ps[1][5], ps[1][6], ps[1][7]);
+    }
+
+    /* Every rule used must be given */
+    err = mpca_lang_load(data, size, ps[0][7], NULL);
+    PT_ASSERT(err != NULL);
+    mpc_err_delete(err);
+
+    free(data);
+    mpc_cleanup(8, ps[0][0], ps[0][1], ps[0][2], ps[0][3], ps[0][4], ps[0][5], ps[0][6], ps[0][7]);
+  }
+
+  /* Functions the library doesn't know can't be saved */
+  Upper = mpc_new("upper");
+  mpc_define(Upper, mpc_apply(mpc_ident(), apply_upper));
+  err = mpca_lang_save(&data, &size, Upper, NULL);
+  PT_ASSERT(err != NULL && data == NULL);
+  mpc_err_delete(err);
+  mpc_cleanup(1, Upper);
+
+  /* A function is only loaded where its kind is called. The byte at
+  ** which saves using two functions differ gives the function, which
+  ** is replaced by mpcf_null, a fold, and by NULL. */
+  Upper = mpc_new("upper");
+  mpc_define(Upper, mpc_apply(mpc_any(), mpcf_float));
+  PT_ASSERT(mpca_lang_save(&again, &again_size, Upper, NULL) == NULL);
+  mpc_undefine(Upper);
+  mpc_define(Upper, mpc_apply(mpc_any(), mpcf_int));
+  PT_ASSERT(mpca_lang_save(&data, &size, Upper, NULL) == NULL);
+  PT_ASSERT(again_size == size);
+  for (n = 0; n < size && data[n] == again[n]; n++);
+  PT_ASSERT(n < size);
+
+  for (k = 0; k < 2 && n < size; k++) {
+    data[n] = (char)(k ? 0 : 1);
+    err = mpca_lang_load(data, size, Upper, NULL);
+    PT_ASSERT(err != NULL);
+    e0 = mpc_err_string(err);
+    PT_ASSERT(strstr(e0, k ? "corrupted" : "wrong kind") != NULL);
+    free(e0);
+    mpc_err_delete(err);
+  }
+
+  free(data);
+  free(again);
+  mpc_cleanup(1, Upper);
+
+}
+
+void test_lang_save_actions(void) {
+
+  int j, k;
+  char *data;
+  size_t size;
+  mpc_err_t *err;
+  mpc_result_t r;
+  mpc_parser_t *ps[2][5];
+
+  const mpca_action_t actions[] = {
+    { "group", fold_group, NULL, free },
+    { "maths", fold_maths, NULL, free },
+    { "int",   NULL, mpcf_int, free },
+    { NULL, NULL, NULL, NULL }
+  };
+
+  const char *inputs[] = { "1+2*3", "(4 * 2) + 5 - 1", " 10 / (2 + 3) " };
+  const int results[] = { 7, 12, 2 };
+
+  for (k = 0; k < 2; k++) {
+    ps[k][0] = mpc_new("expression");
+    ps[k][1] = mpc_new("product");
+    ps[k][2] = mpc_new("value");
+    ps[k][3] = mpc_new("number");
+    ps[k][4] = mpc_new("maths");
+  }
+
+  PT_ASSERT(mpca_lang_actions(MPCA_LANG_DEFAULT, actions,
+    " expression @maths : <product> (('+' | '-') <product>)* ; "
+    " product @maths    : <value>   (('*' | '/')   <value>)* ; "
+    " value @group      : <number> | '(' <expression> ')' ;    "
+    " number @int       : /[0-9]+/ ;                           "
+    " maths @group      : /^/ <expression> /$/ ;               ",
+    ps[0][0], ps[0][1], ps[0][2], ps[0][3], ps[0][4], NULL) == NULL);
+
+  PT_ASSERT(mpca_lang_save(&data, &size, ps[0][0], ps[0][1], ps[0][2], ps[0][3], ps[0][4], NULL) == NULL);
+
+  /* Actions are found by name so must be given again */
+  err = mpca_lang_load(data, size, ps[1][0], ps[1][1], ps[1][2], ps[1][3], ps[1][4], NULL);
+  PT_ASSERT(err != NULL);
+  mpc_err_delete(err);
+
+  PT_ASSERT(mpca_lang_load_actions(actions, data, size,
+    ps[1][0], ps[1][1], ps[1][2], ps[1][3], ps[1][4], NULL) == NULL);
+
+  for (j = 0; j < 3; j++) {
+    PT_ASSERT(mpc_parse("test", inputs[j], ps[1][4], &r));
+    PT_ASSERT(*(int*)r.output == results[j]);
+    free(r.output);
+  }
+
+  PT_ASSERT(!mpc_parse("test", "(4 * 2", ps[1][4], &r));
+  mpc_err_delete(r.error);
+
+  free(data);
+  for (k = 0; k < 2; k++) {
+    mpc_cleanup(5, ps[k][0], ps[k][1], ps[k][2], ps[k][3], ps[k][4]);
+  }
+
+}
+
+void test_profile(void) {
+
+  int j;
+  char out[4096];
+  size_t n;
+  FILE *fp;
+  mpc_input_t *i;
+  mpc_result_t r;
+  mpc_profile_t *f;
+  mpc_program_t *c;
+  mpc_parser_t *Expr  = mpc_new("expression");
+  mpc_parser_t *Prod  = mpc_new("product");
+  mpc_parser_t *Value = mpc_new("value");
+  mpc_parser_t *Maths = mpc_new("maths");
+  const char *rules[] = {
+    "{\"name\": \"maths\", \"calls\": 1, \"successes\": 1, \"failures\": 0, \"bytes\": 7, \"rewinds\": 0",
+    "{\"name\": \"expression\", \"calls\": 2, \"successes\": 2, \"failures\": 0, \"bytes\": 10, \"rewinds\": 10",
+    "{\"name\": \"product\", \"calls\": 3, \"successes\": 3, \"failures\": 0, \"bytes\": 9, \"rewinds\": 15",
+    "{\"name\": \"value\", \"calls\": 4, \"successes\": 4, \"failures\": 0, \"bytes\": 8, \"rewinds\": 0" };
+
+  PT_ASSERT(mpca_lang(MPCA_LANG_DEFAULT,
+    " expression : <product> (('+' | '-') <product>)*; "
+    " product : <value>   (('*' | '/')   <value>)*;    "
+    " value : /[0-9]+/ | '(' <expression> ')';         "
+    " maths : /^/ <expression> /$/;                    ",
+    Expr, Prod, Value, Maths, NULL) == NULL);
+
+  c = mpc_compile(Maths);
+
+  for (j = 0; j < 2; j++) {
+
+    f = mpc_profile_new();
+    i = mpc_input_new_string("test", "(1+2)*3");
+    mpc_input_profile(i, f);
+    PT_ASSERT(j ? mpc_parse_input_compiled(i, c, &r) : mpc_parse_input(i, Maths, &r));
+    mpc_ast_delete(r.output);
+    mpc_input_delete(i);
+
+    fp = tmpfile();
+    mpc_profile_print_json_to(f, fp);
+    rewind(fp);
+    n = fread(out, 1, sizeof(out) - 1, fp);
+    out[n] = '\0';
+    fclose(fp);
+
+    PT_ASSERT(out[0] == '[');
+    PT_ASSERT(strstr(out, rules[0]) != NULL);
+    PT_ASSERT(strstr(out, rules[1]) != NULL);
+    PT_ASSERT(strstr(out, rules[2]) != NULL);
+    PT_ASSERT(strstr(out, rules[3]) != NULL);
+
+    fp = tmpfile();
+    mpc_profile_print_to(f, fp);
+    rewind(fp);
+    n = fread(out, 1, sizeof(out) - 1, fp);
+    out[n] = '\0';
+    fclose(fp);
+
+    PT_ASSERT(strstr(out, "Rewinds") != NULL);
+    PT_ASSERT(strstr(out, "expression") != NULL);
+
+    mpc_profile_delete(f);
+  }
+
+  /* Unprofiled inputs are unaffected */
+  PT_ASSERT(mpc_parse("test", "(1+2)*3", Maths, &r));
+  mpc_ast_delete(r.output);
+
+  mpc_program_delete(c);
+  mpc_cleanup(4, Expr, Prod, Value, Maths);
+
+}
+
 void suite_grammar(void) {
   pt_add_test(test_grammar, "Test Grammar", "Suite Grammar");
   pt_add_test(test_language, "Test Language", "Suite Grammar");
@@ -286,4 +1616,19 @@ void suite_grammar(void) {
   pt_add_test(test_partial, "Test Partial", "Suite Grammar");
   pt_add_test(test_qscript, "Test QScript", "Suite Grammar");
   pt_add_test(test_missingrule, "Test Missing Rule", "Suite Grammar");
+  pt_add_test(test_deferred, "Test Deferred", "Suite Grammar");
+  pt_add_test(test_ast_arena, "Test AST Arena", "Suite Grammar");
+  pt_add_test(test_rule_ids, "Test Rule Ids", "Suite Grammar");
+  pt_add_test(test_ast_views, "Test AST Views", "Suite Grammar");
+  pt_add_test(test_ast_iter, "Test AST Iter", "Suite Grammar");
+  pt_add_test(test_ast_save, "Test AST Save", "Suite Grammar");
+  pt_add_test(test_actions, "Test Actions", "Suite Grammar");
+  pt_add_test(test_dispatch, "Test Dispatch", "Suite Grammar");
+  pt_add_test(test_dispatch_predictive, "Test Dispatch Predictive", "Suite Grammar");
+  pt_add_test(test_compiled, "Test Compiled", "Suite Grammar");
+  pt_add_test(test_profile, "Test Profile", "Suite Grammar");
+  pt_add_test(test_lang_save, "Test Lang Save", "Suite Grammar");
+  pt_add_test(test_lang_save_actions, "Test Lang Save Actions", "Suite Grammar");
+  pt_add_test(test_reparse, "Test Reparse", "Suite Grammar");
+  pt_add_test(test_limits, "Test Limits", "Suite Grammar");
 }
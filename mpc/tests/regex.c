@@ -120,10 +120,241 @@ void test_regex_lisp_comment(void) {
   
 }
 
+static unsigned long regex_seed = 1;
+
+static int regex_rand(int n) {
+  regex_seed = regex_seed * 1103515245 + 12345;
+  return (int)((regex_seed >> 16) % n);
+}
+
+static void regex_gen_alt(char *re, int depth, int *nullable);
+
+static void regex_gen_atom(char *re, int depth, int *nullable) {
+  const char *classes[] = { "[ab]", "[^a]", "[a-c]", ".", "\\d", "\\s" };
+  char c[2] = { 0, 0 };
+  int k = regex_rand(6);
+  *nullable = 0;
+  if (k == 3) { strcat(re, classes[regex_rand(6)]); return; }
+  if (k == 4 && depth > 0) {
+    strcat(re, "(");
+    regex_gen_alt(re, depth - 1, nullable);
+    strcat(re, ")");
+    return;
+  }
+  c[0] = "abc"[regex_rand(3)];
+  strcat(re, c);
+}
+
+static void regex_gen_seq(char *re, int depth, int *nullable) {
+  int j, n = 1 + regex_rand(3), k, x;
+  *nullable = 1;
+  for (j = 0; j < n; j++) {
+    regex_gen_atom(re, depth, &x);
+    k = regex_rand(7);
+    if (k == 0 && !x) { strcat(re, "*"); x = 1; }
+    if (k == 1 && !x) { strcat(re, "+"); }
+    if (k == 2) { strcat(re, "?"); x = 1; }
+    if (k == 3) { strcat(re, "{2}"); }
+    *nullable = *nullable && x;
+  }
+}
+
+static void regex_gen_alt(char *re, int depth, int *nullable) {
+  int x;
+  regex_gen_seq(re, depth, nullable);
+  if (regex_rand(3) == 0) {
+    strcat(re, "|");
+    regex_gen_seq(re, depth, &x);
+    *nullable = *nullable || x;
+  }
+}
+
+void test_regex_dfa(void) {
+  
+  int j, k, l, x, r0, r1;
+  char re[512], input[8];
+  char *e0, *e1;
+  FILE *f;
+  mpc_result_t o0, o1;
+  mpc_parser_t *p0, *p1;
+  
+  for (j = 0; j < 500; j++) {
+    
+    re[0] = '\0';
+    if (regex_rand(4) == 0) { strcat(re, "^"); }
+    regex_gen_alt(re, 2, &x);
+    if (regex_rand(4) == 0) { strcat(re, "$"); }
+    
+    p0 = mpc_re_mode(re, MPC_RE_NODFA);
+    p1 = mpc_re(re);
+    
+    for (k = 0; k < 20; k++) {
+      
+      l = regex_rand(7);
+      input[l] = '\0';
+      while (l--) { input[l] = "abcd "[regex_rand(5)]; }
+      
+      r0 = mpc_parse("test", input, p0, &o0);
+      r1 = mpc_parse("test", input, p1, &o1);
+      
+      PT_ASSERT(r0 == r1);
+      if (r0 && r1) { PT_ASSERT_STR_EQ(o0.output, o1.output); }
+      if (!r0 && !r1) {
+        e0 = mpc_err_string(o0.error);
+        e1 = mpc_err_string(o1.error);
+        PT_ASSERT_STR_EQ(e0, e1);
+        free(e0); free(e1);
+      }
+      if (r1) { free(o1.output); } else { mpc_err_delete(o1.error); }
+      
+      if (k < 4) {
+        f = tmpfile();
+        fputs(input, f);
+        rewind(f);
+        r1 = mpc_parse_file("test", f, p1, &o1);
+        PT_ASSERT(r0 == r1);
+        if (r0 && r1) { PT_ASSERT_STR_EQ(o0.output, o1.output); }
+        if (r1) { free(o1.output); } else { mpc_err_delete(o1.error); }
+        fclose(f);
+      }
+      
+      if (r0) { free(o0.output); } else { mpc_err_delete(o0.error); }
+    }
+    
+    mpc_delete(p0);
+    mpc_delete(p1);
+  }
+  
+  p1 = mpc_re("-?[0-9]+([.][0-9]+)?");
+  
+  f = tmpfile();
+  fputs("-12.5x 12.x", f);
+  rewind(f);
+  PT_ASSERT(mpc_parse_pipe("test", f, p1, &o1));
+  PT_ASSERT_STR_EQ(o1.output, "-12.5");
+  free(o1.output);
+  fclose(f);
+  
+  f = tmpfile();
+  fputs("12.x", f);
+  rewind(f);
+  PT_ASSERT(mpc_parse_pipe("test", f, p1, &o1));
+  PT_ASSERT_STR_EQ(o1.output, "12");
+  free(o1.output);
+  fclose(f);
+  
+  mpc_delete(p1);
+  
+}
+
+void test_regex_dfa_errors(void) {
+  
+  int j, k, l, x, r0, r1;
+  char re[512], input[8];
+  char *e0, *e1;
+  FILE *f;
+  mpc_result_t o0, o1;
+  mpc_parser_t *p0, *p1;
+  
+  /* A match gives the errors where it stops, as the tree does */
+  p0 = mpc_and(2, mpcf_strfold, mpc_re("[a-z_][a-z0-9_]*"), mpc_or(2, mpc_char('='), mpc_char('(')), free);
+  PT_ASSERT(!mpc_parse("test", "xy<", p0, &o0));
+  e0 = mpc_err_string(o0.error);
+  PT_ASSERT_STR_EQ(e0, "test:1:3: error: expected one of 'abcdefghijklmnopqrstuvwxyz0123456789_', '=' or '(' at '<'\n");
+  free(e0);
+  mpc_err_delete(o0.error);
+  mpc_delete(p0);
+  
+  for (j = 0; j < 500; j++) {
+    
+    re[0] = '\0';
+    regex_gen_alt(re, 2, &x);
+    
+    p0 = mpc_and(2, mpcf_strfold, mpc_re_mode(re, MPC_RE_NODFA), mpc_char('!'), free);
+    p1 = mpc_and(2, mpcf_strfold, mpc_re(re), mpc_char('!'), free);
+    
+    for (k = 0; k < 20; k++) {
+      
+      l = regex_rand(7);
+      input[l] = '\0';
+      while (l--) { input[l] = "abcd !"[regex_rand(6)]; }
+      
+      r0 = mpc_parse("test", input, p0, &o0);
+      e0 = r0 ? NULL : mpc_err_string(o0.error);
+      if (r0) { free(o0.output); } else { mpc_err_delete(o0.error); }
+      
+      f = tmpfile();
+      fputs(input, f);
+      rewind(f);
+      r1 = k & 1 ? mpc_parse_file("test", f, p1, &o1) : mpc_parse("test", input, p1, &o1);
+      fclose(f);
+      
+      PT_ASSERT(r0 == r1);
+      if (!r0 && !r1) {
+        e1 = mpc_err_string(o1.error);
+        PT_ASSERT_STR_EQ(e0, e1);
+        free(e1);
+      }
+      if (r1) { free(o1.output); } else { mpc_err_delete(o1.error); }
+      free(e0);
+    }
+    
+    mpc_delete(p0);
+    mpc_delete(p1);
+  }
+  
+}
+
+void test_regex_dfa_pipe(void) {
+  
+  int j, r0, r1;
+  char *e0, *e1;
+  FILE *f;
+  mpc_result_t o0, o1;
+  mpc_parser_t *p;
+  
+  /* A pipe at its end must still be read back from its buffer */
+  const char *inputs[] = { "-", "a -", "{ -", "(-", "(+ 1 2) (- 5 -", "-12 x-" };
+  
+  p = mpc_and(2, mpcf_fst,
+    mpc_many(mpcf_strfold, mpc_or(4,
+      mpc_re("-?[0-9]+"), mpc_re("[a-z+\\-]+"),
+      mpc_oneof(" (){}"), mpc_char('\''))),
+    mpc_eoi(), free);
+  
+  for (j = 0; j < (int)(sizeof(inputs) / sizeof(inputs[0])); j++) {
+    
+    r0 = mpc_parse("test", inputs[j], p, &o0);
+    
+    f = tmpfile();
+    fputs(inputs[j], f);
+    rewind(f);
+    r1 = mpc_parse_pipe("test", f, p, &o1);
+    fclose(f);
+    
+    PT_ASSERT(r0 == r1);
+    if (r0 && r1) { PT_ASSERT_STR_EQ(o0.output, o1.output); }
+    if (!r0 && !r1) {
+      e0 = mpc_err_string(o0.error);
+      e1 = mpc_err_string(o1.error);
+      PT_ASSERT_STR_EQ(e0, e1);
+      free(e0); free(e1);
+    }
+    if (r0) { free(o0.output); } else { mpc_err_delete(o0.error); }
+    if (r1) { free(o1.output); } else { mpc_err_delete(o1.error); }
+  }
+  
+  mpc_delete(p);
+  
+}
+
 void suite_regex(void) {
   pt_add_test(test_regex_basic, "Test Regex Basic", "Suite Regex");
   pt_add_test(test_regex_range, "Test Regex Range", "Suite Regex");
   pt_add_test(test_regex_string, "Test Regex String", "Suite Regex");
   pt_add_test(test_regex_lisp_comment, "Test Regex Lisp Comment", "Suite Regex");
   pt_add_test(test_regex_boundary, "Test Regex Boundary", "Suite Regex");
+  pt_add_test(test_regex_dfa, "Test Regex DFA", "Suite Regex");
+  pt_add_test(test_regex_dfa_errors, "Test Regex DFA Errors", "Suite Regex");
+  pt_add_test(test_regex_dfa_pipe, "Test Regex DFA Pipe", "Suite Regex");
 }
@@ -4,6 +4,7 @@ void suite_core(void);
 void suite_regex(void);
 void suite_grammar(void);
 void suite_combinators(void);
+void suite_threads(void);
 
 int main(int argc, char** argv) {
   (void) argc; (void) argv;
@@ -11,6 +12,7 @@ int main(int argc, char** argv) {
   pt_add_suite(suite_regex);
   pt_add_suite(suite_grammar);
   pt_add_suite(suite_combinators);
+  pt_add_suite(suite_threads);
   return pt_run();
 }
 
@@ -0,0 +1,146 @@
+#include "ptest.h"
+#include "../mpc.h"
+
+#include <pthread.h>
+
+/*
+** Parsers are only read while parsing, so one
+** grammar can be shared by many threads as long
+** as each has its own input. Run `make tsan` to
+** check this under ThreadSanitizer.
+*/
+
+enum { THREADS = 8, ROUNDS = 25, INPUTS = 6 };
+
+static const char *thread_inputs[INPUTS] = {
+  "(def {fib} (\\ {n} {if (< n 2) {n} {+ (fib (- n 1)) (fib (- n 2))}})) ; fib\n(print \"fib\" (fib 20))",
+  "{1 2 3} (head {a \"b\"}) ; done",
+  "(+ 1 %)",
+  "(x))",
+  "\"abc",
+  "" };
+
+typedef struct {
+  int id;
+  mpc_parser_t *parser;
+  mpc_program_t *program;
+  mpc_ast_t *asts[INPUTS];
+  char *errors[INPUTS];
+  int failures;
+} thread_job_t;
+
+static void *thread_run(void *x) {
+
+  int j, k, ok;
+  char *e;
+  thread_job_t *job = x;
+  mpc_input_t *i;
+  mpc_result_t r;
+  const int flags[] = { MPC_INPUT_DEFAULT, MPC_INPUT_AST_ARENA, MPC_INPUT_AST_VIEWS, MPC_INPUT_NO_DISPATCH };
+  int f = flags[job->id % 4];
+
+  for (j = 0; j < ROUNDS; j++) {
+    for (k = 0; k < INPUTS; k++) {
+
+      i = mpc_input_new_string("test", thread_inputs[k]);
+      mpc_input_flags(i, f);
+
+      ok = (j + job->id) % 2
+        ? mpc_parse_input_compiled(i, job->program, &r)
+        : mpc_parse_input(i, job->parser, &r);
+
+      if (ok) {
+        if (!job->asts[k] || !mpc_ast_eq(r.output, job->asts[k])) { job->failures++; }
+        if (f == MPC_INPUT_AST_ARENA) { mpc_ast_arena_delete(r.output); } else { mpc_ast_delete(r.output); }
+      } else {
+        e = mpc_err_string(r.error);
+        if (!job->errors[k] || strcmp(e, job->errors[k]) != 0) { job->failures++; }
+        free(e);
+        mpc_err_delete(r.error);
+      }
+
+      mpc_input_delete(i);
+    }
+  }
+
+  return NULL;
+}
+
+void test_threads(void) {
+
+  int j, k;
+  mpc_result_t r;
+  mpc_program_t *c;
+  mpc_parser_t *ps[8];
+  pthread_t threads[THREADS];
+  thread_job_t jobs[THREADS];
+  mpc_ast_t *asts[INPUTS];
+  char *errors[INPUTS];
+
+  ps[0] = mpc_new("number");
+  ps[1] = mpc_new("symbol");
+  ps[2] = mpc_new("string");
+  ps[3] = mpc_new("comment");
+  ps[4] = mpc_new("sexpr");
+  ps[5] = mpc_new("qexpr");
+  ps[6] = mpc_new("expr");
+  ps[7] = mpc_new("lispy");
+
+  PT_ASSERT(mpca_lang(MPCA_LANG_DEFAULT,
+    " number  : /-?[0-9]+/ ;                             "
+    " symbol  : /[a-zA-Z0-9_+\\-*\\/\\\\=<>!&]+/ ;       "
+    " string  : /\"(\\\\.|[^\"])*\"/ ;                   "
+    " comment : /;[^\\r\\n]*/ ;                          "
+    " sexpr   : '(' <expr>* ')' ;                        "
+    " qexpr   : '{' <expr>* '}' ;                        "
+    " expr    : <number>  | <symbol> | <string>          "
+    "         | <comment> | <sexpr>  | <qexpr> ;         "
+    " lispy   : /^/ <expr>* /$/ ;                        ",
+    ps[0], ps[1], ps[2], ps[3], ps[4], ps[5], ps[6], ps[7], NULL) == NULL);
+
+  c = mpc_compile(ps[7]);
+
+  /* Results from a single thread to compare against */
+  for (k = 0; k < INPUTS; k++) {
+    asts[k] = NULL;
+    errors[k] = NULL;
+    if (mpc_parse("test", thread_inputs[k], ps[7], &r)) {
+      asts[k] = r.output;
+    } else {
+      errors[k] = mpc_err_string(r.error);
+      mpc_err_delete(r.error);
+    }
+  }
+
+  PT_ASSERT(errors[2] && strstr(errors[2], "at '%'"));
+
+  for (j = 0; j < THREADS; j++) {
+    jobs[j].id = j;
+    jobs[j].parser = ps[7];
+    jobs[j].program = c;
+    jobs[j].failures = 0;
+    for (k = 0; k < INPUTS; k++) {
+      jobs[j].asts[k] = asts[k];
+      jobs[j].errors[k] = errors[k];
+    }
+    PT_ASSERT(pthread_create(&threads[j], NULL, thread_run, &jobs[j]) == 0);
+  }
+
+  for (j = 0; j < THREADS; j++) {
+    PT_ASSERT(pthread_join(threads[j], NULL) == 0);
+    PT_ASSERT(jobs[j].failures == 0);
+  }
+
+  for (k = 0; k < INPUTS; k++) {
+    if (asts[k]) { mpc_ast_delete(asts[k]); }
+    free(errors[k]);
+  }
+
+  mpc_program_delete(c);
+  mpc_cleanup(8, ps[0], ps[1], ps[2], ps[3], ps[4], ps[5], ps[6], ps[7]);
+
+}
+
+void suite_threads(void) {
+  pt_add_test(test_threads, "Test Threads", "Suite Threads");
+}
@@ -0,0 +1,106 @@
+/* A test that a cache which is truncated or has bytes left over is
+ignored, so that the source is parsed again and every form of it is
+evaluated exactly once. Build and run it beside variables.c with
+
+  cc -std=c99 test_cache.c mpc.c -ledit -lm -lpthread && ./a.out */
+#define SKIPPY_NO_MAIN
+#include "variables.c"
+
+#define TEST_FORMS 3
+
+/* A function that loads the source with the cache, its printing sent
+to /dev/null, and returns how much it added to n */
+int test_load(lenv* e, char* filename, mpc_parser_t* expr) {
+  lval* k = lval_sym("n");
+  lval* before = lenv_get(e, k);
+
+  fflush(stdout);
+  int out = dup(1);
+  int null = open("/dev/null", O_WRONLY);
+  dup2(null, 1);
+  close(null);
+
+  FILE* f = fopen(filename, "rb");
+  lval_load_cached(e, filename, f, expr, 0);
+  fclose(f);
+
+  fflush(stdout);
+  dup2(out, 1);
+  close(out);
+
+  lval* after = lenv_get(e, k);
+  int added = (int)(after->num - before->num);
+  lval_del(before);
+  lval_del(after);
+  lval_del(k);
+  return added;
+}
+
+/* A function to replace the cache with the given bytes */
+void test_write(char* cache, char* data, long size) {
+  FILE* f = fopen(cache, "wb");
+  fwrite(data, 1, size, f);
+  fclose(f);
+}
+
+int main(void) {
+  mpc_parser_t* Number = mpc_new("number");
+  mpc_parser_t* Symbol = mpc_new("symbol");
+  mpc_parser_t* Sexpr = mpc_new("sexpr");
+  mpc_parser_t* Qexpr = mpc_new("qexpr");
+  mpc_parser_t* Expr = mpc_new("expr");
+  mpc_parser_t* Skippy = mpc_new("skippy");
+  lread_define(0, Number, Symbol, Sexpr, Qexpr, Expr, Skippy);
+
+  lenv* e = lenv_new();
+  lenv_add_builtins(e);
+  lval* k = lval_sym("n");
+  lval* zero = lval_num(0);
+  lenv_put(e, k, zero);
+  lval_del(k);
+  lval_del(zero);
+
+  char filename[64];
+  sprintf(filename, "test_cache_%ld.lspy", (long)getpid());
+  char* cache = lcache_name(filename);
+
+  FILE* f = fopen(filename, "w");
+  for (int i = 0; i < TEST_FORMS; i++) { fputs("(def {n} (+ n 1))\n", f); }
+  fclose(f);
+
+  /* The first load writes the cache and the second reads it */
+  long failed = 0;
+  failed += test_load(e, filename, Expr) != TEST_FORMS;
+  failed += test_load(e, filename, Expr) != TEST_FORMS;
+
+  f = fopen(cache, "rb");
+  static char data[4096];
+  long size = fread(data, 1, sizeof(data) - 1, f);
+  fclose(f);
+
+  /* Cut short at every length */
+  for (long l = 0; l < size; l++) {
+    test_write(cache, data, l);
+    if (test_load(e, filename, Expr) != TEST_FORMS) {
+      printf("Wrong count: cache cut to %li of %li bytes\n", l, size);
+      failed++;
+    }
+  }
+
+  /* And with a byte left over */
+  data[size] = '\0';
+  test_write(cache, data, size + 1);
+  if (test_load(e, filename, Expr) != TEST_FORMS) {
+    printf("Wrong count: cache with a byte left over\n");
+    failed++;
+  }
+
+  remove(cache);
+  remove(filename);
+  free(cache);
+  lenv_del(e);
+  mpc_cleanup(6, Number, Symbol, Sexpr, Qexpr, Expr, Skippy);
+
+  printf("%li failures\n", failed);
+  return failed != 0;
+}
@@ -0,0 +1,89 @@
+/* A test that reading number literals gives exactly what strtod gives,
+bit for bit, both on the fast path and where it falls back to strtod.
+Build and run it beside variables.c with
+
+  cc -std=c99 test_number.c mpc.c -ledit -lm -lpthread && ./a.out */
+#define SKIPPY_NO_MAIN
+#include "variables.c"
+
+#define TEST_RANDOM 5000000
+
+/* Literals at the edges of the fast path */
+static const char* test_fixed[] = {
+  "0", "-0", "0.0", "-0.0", "1", "-1", "0.1", "0.3", "4.9", "-12.25",
+  "9007199254740991", "9007199254740992", "9007199254740993",
+  "9999999999999999999", "18446744073709551615", "18446744073709551616",
+  "123456789012345678.5", "1.7976931348623157", "0.0000000000000000000001",
+  "0.00000000000000000000001", "1.0000000000000000000001"
+};
+
+/* A function to read a literal as strtod does */
+lval* test_strtod(char* s) {
+  errno = 0;
+  double x = strtod(s, NULL);
+  return errno != ERANGE ?
+    lval_num(x) : lval_err("invalid number");
+}
+
+/* A function that compares both readings of a literal, printing it if
+they differ. Returns 1 if they are the same */
+int test_same(char* s) {
+  lval* a = lval_read_num_str(s);
+  lval* b = test_strtod(s);
+  int same = a->type == b->type &&
+    (a->type != LVAL_NUM || memcmp(&a->num, &b->num, sizeof(double)) == 0);
+  if (!same) { printf("Mismatch: %s\n", s); }
+  lval_del(a);
+  lval_del(b);
+  return same;
+}
+
+/* A small generator so every run tests the same literals */
+static unsigned long long test_seed = 1;
+
+unsigned test_rand(void) {
+  test_seed = test_seed * 6364136223846793005ULL + 1442695040888963407ULL;
+  return test_seed >> 33;
+}
+
+/* A function that writes a random literal, mostly short but sometimes
+with more digits than the fast path takes */
+void test_literal(char* b) {
+  int n = 0;
+  if (test_rand() % 2) { b[n++] = '-'; }
+  int k = 1 + test_rand() % (test_rand() % 8 ? 10 : 40);
+  while (k--) { b[n++] = '0' + test_rand() % 10; }
+  if (test_rand() % 2) {
+    b[n++] = '.';
+    k = 1 + test_rand() % (test_rand() % 8 ? 8 : 30);
+    while (k--) { b[n++] = '0' + test_rand() % 10; }
+  }
+  b[n] = '\0';
+}
+
+int main(void) {
+  static char buf[512];
+  long failed = 0;
+
+  for (size_t i = 0; i < sizeof(test_fixed) / sizeof(test_fixed[0]); i++) {
+    strcpy(buf, test_fixed[i]);
+    failed += !test_same(buf);
+  }
+
+  /* Too small and too large to represent */
+  strcpy(buf, "0.");
+  memset(buf + 2, '0', 400);
+  strcpy(buf + 402, "1");
+  failed += !test_same(buf);
+  memset(buf, '9', 400);
+  buf[400] = '\0';
+  failed += !test_same(buf);
+
+  for (long i = 0; i < TEST_RANDOM; i++) {
+    test_literal(buf);
+    failed += !test_same(buf);
+  }
+
+  printf("%li mismatches\n", failed);
+  return failed != 0;
+}
@@ -1,3 +1,7 @@
+/* POSIX functions (threads, sysconf, mmap) are not part of C99, so ask
+for them before any header is included */
+#define _POSIX_C_SOURCE 200809L
+
 /* Library inclusions */
 #include "mpc.h"
 #include <stdio.h>
@@ -28,6 +32,11 @@ void add_history(char* unused) {}
 #else
 #include <editline/readline.h>
 #include <editline/history.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #endif
 
 /* Forward declarations of lval and lenv */
@@ -43,6 +52,10 @@ enum { LVAL_ERR, LVAL_NUM, LVAL_SYM,
 /* Declare a new function pointer type called lbuiltin */
 typedef lval*(*lbuiltin)(lenv*, lval*);
 
+/* Grammar rule ids, numbered in the order the parsers are passed to mpca_lang */
+enum { RULE_NUMBER = 1, RULE_SYMBOL, RULE_SEXPR, RULE_QEXPR,
+       RULE_EXPR, RULE_SKIPPY };
+
 /* Decalre new Lval struct */
 struct lval {
   int type;
@@ -643,41 +656,609 @@ lval* lval_eval(lenv* e, lval* v) {
 }
 
 /* READING */
-/* A function to read a number from an S-expression */
-lval* lval_read_num(mpc_ast_t* t) {
+/* Powers of ten up to the largest which a double holds exactly */
+static const double lread_pow10[] = {
+  1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+  1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+/* A function to read a number from its text. The grammar only allows
+a sign, digits and a fraction, so the digits are gathered into one
+integer. If that integer is exact as a double and the fraction has no
+more places than the table above, one division by an exact power of
+ten gives the correctly rounded result. Anything longer is left to
+strtod, which also reports numbers too large or small to represent */
+lval* lval_read_num_str(char* s) {
+  char* c = s + (*s == '-');
+  unsigned long long m = 0;
+  int digits = 0, places = 0;
+
+  for (; *c >= '0' && *c <= '9'; c++, digits++) { m = m * 10 + (*c - '0'); }
+  if (*c == '.') {
+    for (c++; *c >= '0' && *c <= '9'; c++, digits++, places++) { m = m * 10 + (*c - '0'); }
+  }
+
+  if (*c == '\0' && digits > 0 && digits <= 19 && m <= (1ULL << 53) && places <= 22) {
+    double x = places ? (double)m / lread_pow10[places] : (double)m;
+    return lval_num(*s == '-' ? -x : x);
+  }
+
   errno = 0;
-  double x = strtod(t->contents, NULL);
+  double x = strtod(s, NULL);
   return errno != ERANGE ?
     lval_num(x) : lval_err("invalid number");
 }
 
+/* A function to read a number from an S-expression */
+lval* lval_read_num(mpc_ast_t* t) {
+  return lval_read_num_str(t->contents);
+}
+
 /* A function to read an Lval */
 lval* lval_read(mpc_ast_t* t) {
 
-  /* If Symbol or Number return conversion to that type */
-  if (strstr(t->tag, "number")) { return lval_read_num(t); }
-  if (strstr(t->tag, "symbol")) { return lval_sym(t->contents); }
-
-  /* If root (>) or sexpr then create empty list */
-  lval* x = NULL;
-  if (strcmp(t->tag, ">") == 0) { x = lval_sexpr(); }
-  if (strstr(t->tag, "sexpr"))  { x = lval_sexpr(); }
-  if (strstr(t->tag, "qexpr"))  { x = lval_qexpr(); }
+  /* Switch on the innermost grammar rule that built the node */
+  lval* x;
+  switch (t->primary) {
+    case RULE_NUMBER: return lval_read_num(t);
+    case RULE_SYMBOL: return lval_sym(t->contents);
+    case RULE_QEXPR:  x = lval_qexpr(); break;
+    /* Root (>) and sexpr create an empty list */
+    default:          x = lval_sexpr(); break;
+  }
 
-  /* Fill this list with any valid expression contained within */
+  /* Fill this list with any valid expression contained within.
+  Brackets and the start and end regexes belong to no rule. */
   for (int i = 0; i < t->children_num; i++) {
-    if (strcmp(t->children[i]->contents, "(") == 0) { continue; }
-    if (strcmp(t->children[i]->contents, ")") == 0) { continue; }
-    if (strcmp(t->children[i]->contents, "{") == 0) { continue; }
-    if (strcmp(t->children[i]->contents, "}") == 0) { continue; }
-    if (strcmp(t->children[i]->tag,  "regex") == 0) { continue; }
+    if (t->children[i]->primary == 0 && t->children[i]->children_num == 0) { continue; }
     x = lval_add(x, lval_read(t->children[i]));
   }
 
   return x;
 }
 
+/* DIRECT READING */
+/* Grammar actions which build lvals while the input is parsed, so
+the direct reader never creates an mpc_ast_t tree to walk afterwards */
+mpc_val_t* lval_fold_num(mpc_val_t* x) {
+  lval* v = lval_read_num_str(x);
+  free(x);
+  return v;
+}
+
+mpc_val_t* lval_fold_sym(mpc_val_t* x) {
+  lval* v = lval_sym(x);
+  free(x);
+  return v;
+}
+
+/* Lists are given their brackets (or the start and end of input)
+first and last, which are not part of the value */
+lval* lval_fold_list(lval* x, int n, mpc_val_t** xs) {
+  free(xs[0]);
+  free(xs[n-1]);
+  for (int i = 1; i < n-1; i++) { x = lval_add(x, xs[i]); }
+  return x;
+}
+
+mpc_val_t* lval_fold_sexpr(int n, mpc_val_t** xs) {
+  return lval_fold_list(lval_sexpr(), n, xs);
+}
+
+mpc_val_t* lval_fold_qexpr(int n, mpc_val_t** xs) {
+  return lval_fold_list(lval_qexpr(), n, xs);
+}
+
+/* A function that turns a parse result into an lval. With the
+direct reader it already is one, otherwise the AST is read and freed */
+lval* lval_read_output(mpc_val_t* output, int direct) {
+  if (direct) { return output; }
+  lval* x = lval_read(output);
+  mpc_ast_arena_delete(output);
+  return x;
+}
+
+/* Actions named by the Language with @ */
+static const mpca_action_t lread_actions[] = {
+  { "num",   NULL,            lval_fold_num, (mpc_dtor_t)lval_del },
+  { "sym",   NULL,            lval_fold_sym, (mpc_dtor_t)lval_del },
+  { "sexpr", lval_fold_sexpr, NULL,          (mpc_dtor_t)lval_del },
+  { "qexpr", lval_fold_qexpr, NULL,          (mpc_dtor_t)lval_del },
+  { "expr",  mpcf_fst,        NULL,          (mpc_dtor_t)lval_del },
+  { NULL, NULL, NULL, NULL }
+};
+
+/* The Language. Without the actions above it builds an AST */
+static const char* lread_lang =
+  "                                                                \
+    number @num    : /-?[0-9]+([.][0-9]+)?/ ;                      \
+    symbol @sym    : /[a-zA-Z0-9_+\\-*\\/\\\\=<>!&%]+/ ;             \
+    sexpr @sexpr   : '(' <expr>* ')' ;                             \
+    qexpr @qexpr   : '{' <expr>* '}' ;                             \
+    expr @expr     : <number> | <symbol> | <sexpr>  | <qexpr> ;    \
+    skippy @sexpr  : /^/ <expr>* /$/ ;                             \
+  ";
+
+/* A function that defines the parsers from the Language, building
+lvals directly or an AST for lval_read */
+void lread_define(int direct, mpc_parser_t* Number, mpc_parser_t* Symbol,
+  mpc_parser_t* Sexpr, mpc_parser_t* Qexpr, mpc_parser_t* Expr, mpc_parser_t* Skippy) {
+  mpca_lang_actions(MPCA_LANG_DEFAULT, direct ? lread_actions : NULL, lread_lang,
+    Number, Symbol, Sexpr, Qexpr, Expr, Skippy);
+}
+
+/* Any input may nest without bound, which would overflow the stack
+while parsing, so every input Skippy reads may only be parsed this deep */
+#define LREAD_DEPTH 20000
+
+/* PARALLEL LOADING */
+/* Large files are read whole and split into one chunk per core at
+top-level form boundaries. Skippy's numbers and symbols never contain
+brackets, so any whitespace outside all brackets ends a form. Each
+chunk is parsed and read on its own thread with its own input, whose
+origin is set so that errors give positions in the whole file. The
+forms are then evaluated in order, each chunk once it is parsed. */
+#ifndef _WIN32
+
+/* Files smaller than this are streamed one form at a time */
+#define LOAD_PARALLEL_MIN (1 << 16)
+#define LOAD_THREADS_MAX 64
+
+typedef struct {
+  char* filename;
+  char* text;
+  long length;
+  mpc_state_t origin;
+  mpc_parser_t* expr;
+  int direct;
+  int count;
+  lval** forms;
+  mpc_err_t* error;
+  int started;
+  pthread_t thread;
+} lchunk;
+
+void* lchunk_parse(void* arg) {
+  lchunk* c = arg;
+  mpc_input_t* in = mpc_input_new_nstring(c->filename, c->text, c->length);
+  mpc_input_origin(in, c->origin);
+  if (!c->direct) { mpc_input_flags(in, MPC_INPUT_AST_ARENA); }
+  mpc_input_limits(in, LREAD_DEPTH, 0, 0);
+
+  /* Read every form up to the end of the chunk or the first error */
+  mpc_result_t r;
+  while (mpc_parse_next(in, c->expr, &r)) {
+    c->forms = realloc(c->forms, sizeof(lval*) * (c->count + 1));
+    c->forms[c->count++] = lval_read_output(r.output, c->direct);
+  }
+  c->error = r.error;
+
+  mpc_input_delete(in);
+  return NULL;
+}
+
+/* Splits text into at most n chunks of about equal size, ending each
+at the first form boundary past its share, and returns how many */
+int lchunk_split(lchunk* cs, int n, char* text, long length) {
+  int count = 0, depth = 0;
+  long start = 0, row = 0, line = 0;
+
+  cs[0].text = text;
+  cs[0].origin = (mpc_state_t){ 0, 0, 0 };
+
+  for (long k = 0; k < length && count < n-1; k++) {
+    char c = text[k];
+    if (c == '(' || c == '{') { depth++; }
+    if ((c == ')' || c == '}') && depth > 0) { depth--; }
+    if (c == '\n') { row++; line = k+1; }
+
+    if (depth == 0 && isspace((unsigned char)c) && k+1 >= (count+1) * length / n) {
+      cs[count++].length = k+1 - start;
+      start = k+1;
+      cs[count].text = text + start;
+      cs[count].origin = (mpc_state_t){ start, row, start - line };
+    }
+  }
+
+  cs[count].length = length - start;
+  return count+1;
+}
+
+/* Returns 0 if the file is better streamed, leaving it unread */
+int lval_load_parallel(lenv* e, char* filename, FILE* f, mpc_parser_t* expr, int direct) {
+  long threads = sysconf(_SC_NPROCESSORS_ONLN);
+  if (threads > LOAD_THREADS_MAX) { threads = LOAD_THREADS_MAX; }
+
+  if (fseek(f, 0, SEEK_END) != 0) { return 0; }
+  long length = ftell(f);
+  rewind(f);
+  if (threads < 2 || length < LOAD_PARALLEL_MIN) { return 0; }
+
+  char* text = malloc(length + 1);
+  length = fread(text, 1, length, f);
+  text[length] = '\0';
+
+  lchunk cs[LOAD_THREADS_MAX];
+  int n = lchunk_split(cs, threads, text, length);
+
+  for (int j = 0; j < n; j++) {
+    cs[j].filename = filename;
+    cs[j].expr = expr;
+    cs[j].direct = direct;
+    cs[j].count = 0;
+    cs[j].forms = NULL;
+    cs[j].error = NULL;
+    cs[j].started = pthread_create(&cs[j].thread, NULL, lchunk_parse, &cs[j]) == 0;
+    if (!cs[j].started) { lchunk_parse(&cs[j]); }
+  }
+
+  /* Evaluate in order, stopping at the first form that failed to parse */
+  int failed = 0;
+  for (int j = 0; j < n; j++) {
+    if (cs[j].started) { pthread_join(cs[j].thread, NULL); }
+
+    for (int k = 0; k < cs[j].count; k++) {
+      if (failed) { lval_del(cs[j].forms[k]); continue; }
+      lval* x = lval_eval(e, cs[j].forms[k]);
+      lval_println(x);
+      lval_del(x);
+    }
+
+    if (cs[j].error) {
+      if (!failed) { mpc_err_print(cs[j].error); }
+      mpc_err_delete(cs[j].error);
+      failed = 1;
+    }
+    free(cs[j].forms);
+  }
+
+  free(text);
+  return 1;
+}
+
+#else
+
+int lval_load_parallel(lenv* e, char* filename, FILE* f, mpc_parser_t* expr, int direct) {
+  return 0;
+}
+
+#endif
+
+/* CACHING */
+/* With --cache the forms read from a file are kept in a binary file
+beside it, named after it with a "c" added. While that file still
+matches the size and modification time of the source, it is mapped into
+memory and the forms are rebuilt from it directly, without parsing.
+
+Each value is written as its type followed by its number, its text as
+a varint length and characters, or its cells as a varint count and
+each cell in turn. Varints hold seven bits to a byte, lowest first,
+with the top bit set on all but the last. Numbers are written as their
+raw bytes, so a cache is only meant for the machine that wrote it,
+except for whole numbers which are written as varints, with their sign
+in the lowest bit, under a type of their own. */
+#ifndef _WIN32
+
+#define LCACHE_VERSION 1
+#define LCACHE_INT 0x40
+#define LCACHE_INT_MAX 9007199254740992.0
+
+typedef struct {
+  char* data;
+  size_t size;
+  size_t slots;
+} lbuf;
+
+void lbuf_bytes(lbuf* b, const void* x, size_t n) {
+  while (b->size + n > b->slots) {
+    b->slots = b->slots ? b->slots * 2 : 4096;
+    b->data = realloc(b->data, b->slots);
+  }
+  memcpy(b->data + b->size, x, n);
+  b->size += n;
+}
+
+void lbuf_varint(lbuf* b, unsigned long long x) {
+  unsigned char c[sizeof(unsigned long long) * 8 / 7 + 1];
+  int n = 0;
+  while (x >= 0x80) { c[n++] = (x & 0x7F) | 0x80; x >>= 7; }
+  c[n++] = x;
+  lbuf_bytes(b, c, n);
+}
+
+/* Whole numbers small enough to be held exactly, apart from negative zero */
+int lval_is_int(double x) {
+  return x > -LCACHE_INT_MAX && x < LCACHE_INT_MAX && x == (double)(long long)x
+    && !(x == 0 && 1 / x < 0);
+}
+
+/* Returns 0 for values which cannot be cached, such as functions */
+int lval_encode(lbuf* b, lval* v) {
+  unsigned char type = v->type == LVAL_NUM && lval_is_int(v->num) ? LCACHE_INT : v->type;
+  lbuf_bytes(b, &type, 1);
+
+  if (type == LCACHE_INT) {
+    long long x = v->num;
+    lbuf_varint(b, x < 0 ? ((unsigned long long)-(x + 1) << 1) | 1 : (unsigned long long)x << 1);
+    return 1;
+  }
+
+  switch (v->type) {
+    case LVAL_NUM: lbuf_bytes(b, &v->num, sizeof(double)); return 1;
+    case LVAL_ERR: lbuf_varint(b, strlen(v->err)); lbuf_bytes(b, v->err, strlen(v->err)); return 1;
+    case LVAL_SYM: lbuf_varint(b, strlen(v->sym)); lbuf_bytes(b, v->sym, strlen(v->sym)); return 1;
+    case LVAL_SEXPR:
+    case LVAL_QEXPR:
+      lbuf_varint(b, v->count);
+      for (int i = 0; i < v->count; i++) {
+        if (!lval_encode(b, v->cell[i])) { return 0; }
+      }
+      return 1;
+  }
+  return 0;
+}
+
+/* Reading stops at the first error, after which every read gives 0 */
+typedef struct {
+  const unsigned char* data;
+  size_t size;
+  size_t pos;
+  int error;
+} lreader;
+
+unsigned long long lreader_varint(lreader* r) {
+  unsigned long long x = 0;
+  for (int shift = 0; !r->error; shift += 7) {
+    if (r->pos == r->size || shift >= (int)sizeof(unsigned long long) * 8) { r->error = 1; break; }
+    unsigned char c = r->data[r->pos++];
+    x |= (unsigned long long)(c & 0x7F) << shift;
+    if (!(c & 0x80)) { return x; }
+  }
+  return 0;
+}
+
+/* Counts and lengths must fit in what is left of the data */
+unsigned long lreader_count(lreader* r) {
+  unsigned long long n = lreader_varint(r);
+  if (n > r->size - r->pos) { r->error = 1; }
+  return r->error ? 0 : n;
+}
+
+/* Returns NULL if the data is truncated or corrupted */
+lval* lval_decode(lreader* r) {
+  if (r->error || r->pos == r->size) { r->error = 1; return NULL; }
+  int type = r->data[r->pos++];
+
+  switch (type) {
+    case LCACHE_INT: {
+      unsigned long long x = lreader_varint(r);
+      if (r->error) { return NULL; }
+      return lval_num(x & 1 ? -(double)(x >> 1) - 1 : (double)(x >> 1));
+    }
+
+    case LVAL_NUM: {
+      double x;
+      if (r->size - r->pos < sizeof(double)) { r->error = 1; return NULL; }
+      memcpy(&x, r->data + r->pos, sizeof(double));
+      r->pos += sizeof(double);
+      return lval_num(x);
+    }
+
+    case LVAL_ERR:
+    case LVAL_SYM: {
+      unsigned long n = lreader_count(r);
+      if (r->error) { return NULL; }
+      char* s = malloc(n + 1);
+      memcpy(s, r->data + r->pos, n);
+      s[n] = '\0';
+      r->pos += n;
+      lval* v = type == LVAL_SYM ? lval_sym(s) : lval_err("%s", s);
+      free(s);
+      return v;
+    }
+
+    case LVAL_SEXPR:
+    case LVAL_QEXPR: {
+      unsigned long n = lreader_count(r);
+      if (r->error) { return NULL; }
+      lval* v = type == LVAL_SEXPR ? lval_sexpr() : lval_qexpr();
+      v->cell = n ? malloc(sizeof(lval*) * n) : NULL;
+      while ((unsigned long)v->count < n) {
+        lval* x = lval_decode(r);
+        if (x == NULL) { lval_del(v); return NULL; }
+        v->cell[v->count++] = x;
+      }
+      return v;
+    }
+  }
+
+  r->error = 1;
+  return NULL;
+}
+
+char* lcache_name(char* filename) {
+  char* name = malloc(strlen(filename) + 2);
+  sprintf(name, "%sc", filename);
+  return name;
+}
+
+/* Returns the cached forms of a source file, or NULL if there are none
+which match it. The cache is mapped rather than read into memory. */
+lval** lcache_read(char* filename, struct stat* source, int* count) {
+  char* name = lcache_name(filename);
+  int fd = open(name, O_RDONLY);
+  free(name);
+  if (fd < 0) { return NULL; }
+
+  struct stat st;
+  if (fstat(fd, &st) != 0 || st.st_size < 4) { close(fd); return NULL; }
+  void* map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED) { return NULL; }
+
+  lreader r = { map, st.st_size, 4, 0 };
+  lval** forms = NULL;
+  *count = 0;
+
+  if (memcmp(map, "skpc", 4) == 0
+      && lreader_varint(&r) == LCACHE_VERSION
+      && lreader_varint(&r) == (unsigned long long)source->st_size
+      && lreader_varint(&r) == (unsigned long long)source->st_mtime
+      && !r.error) {
+    unsigned long n = lreader_count(&r);
+    forms = malloc(sizeof(lval*) * (n + 1));
+    while (!r.error && (unsigned long)*count < n) {
+      lval* x = lval_decode(&r);
+      if (x) { forms[(*count)++] = x; }
+    }
+
+    /* Anything wrong with the cache and the source is parsed instead */
+    if (r.error || r.pos != r.size) {
+      for (int k = 0; k < *count; k++) { lval_del(forms[k]); }
+      free(forms);
+      forms = NULL;
+      *count = 0;
+    }
+  }
+
+  munmap(map, st.st_size);
+  return forms;
+}
+
+/* Failing to write a cache is not an error, the source is just parsed
+again next time. It is written beside the source and renamed into
+place so that a reader never sees half of it. */
+void lcache_write(char* filename, struct stat* source, lval** forms, int count) {
+  lbuf b = { NULL, 0, 0 };
+  lbuf_bytes(&b, "skpc", 4);
+  lbuf_varint(&b, LCACHE_VERSION);
+  lbuf_varint(&b, source->st_size);
+  lbuf_varint(&b, source->st_mtime);
+  lbuf_varint(&b, count);
+
+  int ok = 1;
+  for (int k = 0; k < count && ok; k++) { ok = lval_encode(&b, forms[k]); }
+
+  char* name = lcache_name(filename);
+  char* temp = malloc(strlen(name) + 32);
+  sprintf(temp, "%s.%ld", name, (long)getpid());
+
+  FILE* f = ok ? fopen(temp, "wb") : NULL;
+  if (f) {
+    ok = fwrite(b.data, 1, b.size, f) == b.size;
+    ok = fclose(f) == 0 && ok;
+    if (!ok || rename(temp, name) != 0) { remove(temp); }
+  }
+
+  free(temp);
+  free(name);
+  free(b.data);
+}
+
+/* Evaluates a file from its cache, or parses all of it, caches it if
+every form parsed and evaluates it. Returns 0 if it cannot be cached. */
+int lval_load_cached(lenv* e, char* filename, FILE* f, mpc_parser_t* expr, int direct) {
+  struct stat source;
+  if (stat(filename, &source) != 0 || !S_ISREG(source.st_mode)) { return 0; }
+
+  int count = 0;
+  lval** forms = lcache_read(filename, &source, &count);
+  mpc_result_t r = { NULL };
+
+  if (forms == NULL) {
+    mpc_input_t* in = mpc_input_new_file(filename, f);
+    if (!direct) { mpc_input_flags(in, MPC_INPUT_AST_ARENA); }
+    mpc_input_limits(in, LREAD_DEPTH, 0, 0);
+
+    while (mpc_parse_next(in, expr, &r)) {
+      forms = realloc(forms, sizeof(lval*) * (count + 1));
+      forms[count++] = lval_read_output(r.output, direct);
+    }
+    mpc_input_delete(in);
+
+    if (!r.error) { lcache_write(filename, &source, forms, count); }
+  }
+
+  for (int k = 0; k < count; k++) {
+    lval* x = lval_eval(e, forms[k]);
+    lval_println(x);
+    lval_del(x);
+  }
+
+  if (r.error) {
+    mpc_err_print(r.error);
+    mpc_err_delete(r.error);
+  }
+
+  free(forms);
+  return 1;
+}
+
+#else
+
+int lval_load_cached(lenv* e, char* filename, FILE* f, mpc_parser_t* expr, int direct) {
+  return 0;
+}
+
+#endif
+
+/* LOADING */
+/* A function that evaluates a file one top-level form at a time.
+Each form is read from the stream, evaluated and freed before the
+next one is parsed, so memory use is bounded by the largest form
+rather than the size of the file. A filename of "-" reads stdin. */
+
+void lval_load(lenv* e, char* filename, mpc_parser_t* expr, int direct, int cache) {
+  int is_stdin = strcmp(filename, "-") == 0;
+  FILE* f = is_stdin ? stdin : fopen(filename, "rb");
+
+  if (f == NULL) {
+    printf("Error: Could not open file '%s'\n", filename);
+    return;
+  }
+
+  /* Cached files are not parsed at all when unchanged */
+  if (!is_stdin && cache && lval_load_cached(e, filename, f, expr, direct)) {
+    fclose(f);
+    return;
+  }
+
+  /* Large files are parsed on several threads */
+  if (!is_stdin && lval_load_parallel(e, filename, f, expr, direct)) {
+    fclose(f);
+    return;
+  }
+
+  /* Pipes cannot be seeked so stdin is read as one */
+  mpc_input_t* in = is_stdin
+    ? mpc_input_new_pipe("<stdin>", f)
+    : mpc_input_new_file(filename, f);
+
+  /* Build each form's AST in one block which is freed in one go */
+  if (!direct) { mpc_input_flags(in, MPC_INPUT_AST_ARENA); }
+  mpc_input_limits(in, LREAD_DEPTH, 0, 0);
+
+  /* Parse, evaluate and print each form as it arrives */
+  mpc_result_t r;
+  while (mpc_parse_next(in, expr, &r)) {
+    lval* x = lval_eval(e, lval_read_output(r.output, direct));
+    lval_println(x);
+    lval_del(x);
+  }
+
+  /* A form failed to parse, report it and stop reading */
+  if (r.error) {
+    mpc_err_print(r.error);
+    mpc_err_delete(r.error);
+  }
+
+  mpc_input_delete(in);
+  if (!is_stdin) { fclose(f); }
+}
+
 /* MAIN */
+/* Benchmarks and tests include this file with SKIPPY_NO_MAIN defined */
+#ifndef SKIPPY_NO_MAIN
 int main(int argc, char** argv) {
   /* Create Some Parsers */
   mpc_parser_t* Number   = mpc_new("number");
@@ -687,17 +1268,17 @@ int main(int argc, char** argv) {
   mpc_parser_t* Expr     = mpc_new("expr");
   mpc_parser_t* Skippy = mpc_new("skippy");
 
-  /* Define them with the following Language */
-  mpca_lang(MPCA_LANG_DEFAULT,
-    "                                                       \
-      number   : /-?[0-9]+([.][0-9]+)?/ ;                   \
-      symbol : /[a-zA-Z0-9_+\\-*\\/\\\\=<>!&%]+/ ;          \
-      sexpr : '(' <expr>* ')' ;                             \
-      qexpr : '{' <expr>* '}' ;                             \
-      expr     : <number> | <symbol> | <sexpr>  | <qexpr> ; \
-      skippy: /^/ <expr>* /$/ ;                             \
-    ",
-    Number, Symbol, Sexpr, Qexpr, Expr, Skippy);
+  /* With --direct the parsers build lvals rather than an AST, and
+  with --cache the forms read from files are cached beside them */
+  int direct = 0, cache = 0, first = 1;
+  for (; first < argc; first++) {
+    if (strcmp(argv[first], "--direct") == 0) { direct = 1; }
+    else if (strcmp(argv[first], "--cache") == 0) { cache = 1; }
+    else { break; }
+  }
+
+  /* Define them with the Language */
+  lread_define(direct, Number, Symbol, Sexpr, Qexpr, Expr, Skippy);
 
   puts("Skippy Version 0.0.0.0.7");
   puts("Author: Bas Straathof");
@@ -709,24 +1290,39 @@ int main(int argc, char** argv) {
   /* Call the lenv_add_builtins() function */
   lenv_add_builtins(e);
 
+  /* If files are supplied evaluate them form by form and exit */
+  if (argc > first) {
+    for (int i = first; i < argc; i++) {
+      lval_load(e, argv[i], Expr, direct, cache);
+    }
+
+    lenv_del(e);
+    mpc_cleanup(6, Number, Symbol, Sexpr, Qexpr, Expr, Skippy);
+    return 0;
+  }
+
   while (1) {
     /* Now in either case readline will be correctly defined */
     char* input = readline("skippy> ");
     add_history(input);
 
-    /* Attempt to parse the user Input */
+    /* Attempt to parse the user Input, building any AST in an arena */
+    mpc_input_t* in = mpc_input_new_string("<stdin>", input);
+    if (!direct) { mpc_input_flags(in, MPC_INPUT_AST_ARENA); }
+    mpc_input_limits(in, LREAD_DEPTH, 0, 0);
+
     mpc_result_t r;
-    if (mpc_parse("<stdin>", input, Skippy, &r)) {
-      lval* x = lval_eval(e, lval_read(r.output));
+    if (mpc_parse_input(in, Skippy, &r)) {
+      lval* x = lval_eval(e, lval_read_output(r.output, direct));
       lval_println(x);
       lval_del(x);
-      mpc_ast_delete(r.output);
     } else {
       /* Otherwise Print the Error */
       mpc_err_print(r.error);
       mpc_err_delete(r.error);
     }
 
+    mpc_input_delete(in);
     free(input);
   }
 
@@ -738,3 +1334,4 @@ int main(int argc, char** argv) {
 
   return 0;
 }
+#endif